@@ -5,9 +5,30 @@
 #include "sdl2_util.h"
 
 #include <bgfx/bgfx.h>
+#include <hedge.hpp>
 
 namespace bgfx_util {
 
 result_t init(bgfx::RendererType::Enum renderer_type, sdl2::window_ptr_t& window);
 
+/**
+   Dynamic buffers mirroring a hedge::gpu_export_t. Only the dirty ranges of
+   each export are uploaded, unless the export was rebuilt or changed its
+   index format, which recreates both buffers. Works the same under the Noop
+   renderer.
+ */
+struct mesh_buffers_t {
+  bgfx::DynamicVertexBufferHandle vertices = BGFX_INVALID_HANDLE;
+  bgfx::DynamicIndexBufferHandle indices = BGFX_INVALID_HANDLE;
+  hedge::gpu_index_format_t format = hedge::gpu_index_format_t::uint16;
+};
+
+/**
+   Float3 position followed by a float3 normal, matching hedge::gpu_vertex_t.
+ */
+const bgfx::VertexDecl& gpu_vertex_decl();
+
+void update(mesh_buffers_t& buffers, const hedge::gpu_export_t& exporter);
+void destroy(mesh_buffers_t& buffers);
+
 } // namespace gfx
@@ -77,4 +77,61 @@ result_t init(bgfx::RendererType::Enum renderer_type, sdl2::window_ptr_t& window
   return result;
 }
 
+const bgfx::VertexDecl& gpu_vertex_decl()
+{
+  static const bgfx::VertexDecl decl = []() {
+    bgfx::VertexDecl result;
+    result.begin()
+      .add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
+      .add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float)
+      .end();
+    return result;
+  }();
+  return decl;
+}
+
+void update(mesh_buffers_t& buffers, const hedge::gpu_export_t& exporter)
+{
+  const auto& vertices = exporter.vertices();
+  const auto* indices = static_cast<const uint8_t*>(exporter.index_data());
+  const size_t index_size = exporter.index_size();
+
+  if (exporter.rebuilt() || exporter.index_format() != buffers.format
+      || !bgfx::isValid(buffers.vertices) || !bgfx::isValid(buffers.indices)) {
+    destroy(buffers);
+    const uint16_t index_flags = exporter.index_format() == hedge::gpu_index_format_t::uint32
+      ? BGFX_BUFFER_INDEX32 : BGFX_BUFFER_NONE;
+    buffers.format = exporter.index_format();
+    buffers.vertices = bgfx::createDynamicVertexBuffer(
+      bgfx::copy(vertices.data(), uint32_t(vertices.size() * sizeof(hedge::gpu_vertex_t)))
+      , gpu_vertex_decl()
+      , BGFX_BUFFER_ALLOW_RESIZE);
+    buffers.indices = bgfx::createDynamicIndexBuffer(
+      bgfx::copy(indices, uint32_t(exporter.index_count() * index_size))
+      , BGFX_BUFFER_ALLOW_RESIZE | index_flags);
+    return;
+  }
+
+  for (const auto& range : exporter.dirty_vertex_ranges()) {
+    bgfx::updateDynamicVertexBuffer(buffers.vertices, uint32_t(range.begin)
+      , bgfx::copy(&vertices[range.begin], uint32_t((range.end - range.begin) * sizeof(hedge::gpu_vertex_t))));
+  }
+  for (const auto& range : exporter.dirty_index_ranges()) {
+    bgfx::updateDynamicIndexBuffer(buffers.indices, uint32_t(range.begin)
+      , bgfx::copy(indices + range.begin * index_size, uint32_t((range.end - range.begin) * index_size)));
+  }
+}
+
+void destroy(mesh_buffers_t& buffers)
+{
+  if (bgfx::isValid(buffers.vertices)) {
+    bgfx::destroy(buffers.vertices);
+  }
+  if (bgfx::isValid(buffers.indices)) {
+    bgfx::destroy(buffers.indices);
+  }
+  buffers.vertices = BGFX_INVALID_HANDLE;
+  buffers.indices = BGFX_INVALID_HANDLE;
+}
+
 } // namespace bgfx_util
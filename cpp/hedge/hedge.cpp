@@ -1,199 +1,98 @@
 
 #include "hedge.hpp"
+#include "hedge_kernel.hpp"
+#include "hedge_parallel.hpp"
 
+#include <algorithm>
 #include <array>
-#include <vector>
-#include <queue>
+#include <cfloat>
 
 #include <easylogging++.h>
 
 
 namespace hedge {
 
-/**
-   Rather than create a bunch of preprocessor macros to prevent copypasta I decided
-   to create a simple templated wrapper over std::vector which implements the
-   requirements for element storage.
- */
-template<typename TElement, typename TElementIndex>
-class element_vector_t {
-public:
-  using collection_t = std::vector<TElement>;
-  using free_cells_t =
-    std::priority_queue<
-      TElementIndex,
-      std::vector<TElementIndex>,
-      std::greater<TElementIndex>
-    >;
-
-  element_vector_t() {
-    collection.emplace_back( TElement {} );
-  }
-
-  void reserve(size_t elements) {
-    collection.reserve(elements);
-  }
-
-  size_t count() const {
-    return collection.size() - free_cells.size();
-  }
-
-  TElement* get(TElementIndex index) const {
-    TElement* element = get(index.offset);
-    if (element != nullptr) {
-      if (element->generation != index.generation) {
-        LOG(WARNING) << "Generation mismatch for element: " << index.offset << ", " << index.generation;
-        LOG(DEBUG) << "Offset: " << index.offset
-                   << ", Generation " << index.generation << " != " << element->generation;
-        element = nullptr;
-      }
-    }
-    return element;
-  }
-
-  TElement* get(offset_t offset) const {
-    TElement* element = nullptr;
-    if (offset < collection.size()) {
-      element = (TElement*)collection.data() + offset;
-    }
-    else {
-      LOG(ERROR) << "Offset requested exceeded element current storage size: "
-                 << offset << " > " << collection.size();
-    }
-    return element;
-  }
-
-  TElementIndex emplace(TElement&& element) {
-    TElementIndex index;
-    if (free_cells.size()) {
-      index = free_cells.top();
-      free_cells.pop();
-      element.generation = index.generation;
-      auto* element_at_index = get(index.offset);
-      (*element_at_index) = element;
-    }
-    else {
-      index.offset = collection.size();
-      index.generation = element.generation;
-      collection.emplace_back(std::move(element));
-    }
-    return index;
+template<template<validation_t> class TKernel, typename... TArgs>
+kernel_t::ptr_t make_kernel(validation_t validation, TArgs&&... args) {
+  kernel_t* kernel = nullptr;
+  switch (validation) {
+  case validation_t::checked_logging:
+    kernel = new TKernel<validation_t::checked_logging>(std::forward<TArgs>(args)...);
+    break;
+  case validation_t::checked_silent:
+    kernel = new TKernel<validation_t::checked_silent>(std::forward<TArgs>(args)...);
+    break;
+  case validation_t::unchecked:
+    kernel = new TKernel<validation_t::unchecked>(std::forward<TArgs>(args)...);
+    break;
   }
+  return kernel_t::ptr_t(kernel, [](kernel_t* k) { delete k; });
+}
 
-  void remove(TElementIndex index) {
-    auto* element_at_index = get(index);
-    if (element_at_index != nullptr) {
-      element_at_index->generation++;
-      element_at_index->status = element_status_t::INACTIVE;
-      index.generation++;
-      free_cells.push(index);
-    }
-  }
+kernel_t::ptr_t make_basic_kernel(validation_t validation, allocation_t allocation) {
+  return make_kernel<basic_kernel_t>(validation, allocation);
+}
 
-  void swap(TElementIndex aindex, TElementIndex bindex) {
-    auto* element_a = get(aindex);
-    auto* element_b = get(bindex);
-    if (element_a && element_b) {
-      element_a->generation++;
-      element_b->generation++;
+kernel_t::ptr_t make_soa_kernel(validation_t validation) {
+  return make_kernel<soa_kernel_t>(validation);
+}
 
-      TElement temp = *element_a;
-      *element_a = *element_b;
-      *element_b = temp;
-    }
-  }
+void report_invalid_offset(offset_t offset, size_t size) {
+  LOG(ERROR) << "Offset requested exceeded element current storage size: "
+             << offset << " > " << size;
+}
 
-private:
-  collection_t collection;
-  free_cells_t free_cells;
-};
+void report_generation_mismatch(offset_t offset, generation_t expected, uint32_t actual) {
+  LOG(WARNING) << "Generation mismatch for element: " << offset << ", " << expected;
+  LOG(DEBUG) << "Offset: " << offset
+             << ", Generation " << expected << " != " << actual;
+}
 
-///////////////////////////////////////////////////////////////////////////////////////
+void report_empty_function_set() {
+  LOG(DEBUG) << "Returning empty function set";
+}
 
-class basic_kernel_t : public kernel_t {
-  element_vector_t<vertex_t, vertex_index_t> vertices;
-  element_vector_t<face_t, face_index_t>     faces;
-  element_vector_t<edge_t, edge_index_t>     edges;
-  element_vector_t<point_t, point_index_t>   points;
+void report_storage_exhausted() {
+  LOG(ERROR) << "Element storage exceeded the maximum index offset: " << index_offset_max;
+}
 
-public:
-  edge_t* get(edge_index_t index) override {
-    return edges.get(index);
-  }
-  face_t* get(face_index_t index) override {
-    return faces.get(index);
-  }
-  vertex_t* get(vertex_index_t index) override {
-    return vertices.get(index);
-  }
-  point_t* get(point_index_t index) override {
-    return points.get(index);
-  }
+void report_claim_exhausted(size_t capacity) {
+  LOG(ERROR) << "Concurrent emplacement used up the room set aside for it: " << capacity;
+}
 
-  edge_index_t emplace(edge_t&& edge) override {
-    return edges.emplace(std::move(edge));
-  }
-  face_index_t emplace(face_t&& face) override {
-    return faces.emplace(std::move(face));
-  }
-  vertex_index_t emplace(vertex_t&& vertex) override {
-    return vertices.emplace(std::move(vertex));
-  }
-  point_index_t emplace(point_t&& point) override {
-    return points.emplace(std::move(point));
-  }
+void report_property_exists(const std::string& name) {
+  LOG(ERROR) << "A property by that name already exists: " << name;
+}
 
-  void remove(edge_index_t index) override {
-    return edges.remove(index);
-  }
-  void remove(face_index_t index) override {
-    return faces.remove(index);
-  }
-  void remove(vertex_index_t index) override {
-    return vertices.remove(index);
-  }
-  void remove(point_index_t index) override {
-    return points.remove(index);
-  }
+void report_property_type_mismatch(const std::string& name) {
+  LOG(ERROR) << "Property requested with the wrong value type: " << name;
+}
 
-  size_t point_count() const override {
-    return points.count();
-  }
+///////////////////////////////////////////////////////////////////////////////
 
-  size_t vertex_count() const override {
-    return vertices.count();
-  }
+namespace {
 
-  size_t face_count() const override {
-    return faces.count();
-  }
+// Edits go through the open transaction of the mesh, if there is one, so
+// that they can be taken back.
 
-  size_t edge_count() const override {
-    return edges.count();
+template<typename TElement>
+auto emplace_element(mesh_t& mesh, TElement&& element) -> decltype(mesh.kernel->emplace(std::move(element))) {
+  auto* transaction = mesh.transaction();
+  if (transaction != nullptr) {
+    return transaction->emplace(std::move(element));
   }
+  return mesh.kernel->emplace(std::move(element));
+}
 
-  void resolve(edge_index_t* index, edge_t** edge) const override {
-    *edge = edges.get(index->offset);
-    index->generation = (*edge)->generation;
-  }
-  void resolve(face_index_t* index, face_t** face) const override {
-    *face = faces.get(index->offset);
-    index->generation = (*face)->generation;
-  }
-  void resolve(point_index_t* index, point_t** point) const override {
-    *point = points.get(index->offset);
-    index->generation = (*point)->generation;
-  }
-  void resolve(vertex_index_t* index, vertex_t** vert) const override {
-    *vert = vertices.get(index->offset);
-    index->generation = (*vert)->generation;
+template<typename TIndex>
+void touch_element(const mesh_t& mesh, TIndex index) {
+  auto* transaction = mesh.transaction();
+  if (transaction != nullptr) {
+    transaction->touch(index);
   }
-};
-
-// basic_kernel_t
-///////////////////////////////////////////////////////////////////////////////
+}
 
-///////////////////////////////////////////////////////////////////////////////
+} // namespace
 
 mesh_modifier_t::mesh_modifier_t(mesh_t& mesh)
   : _mesh(mesh)
@@ -202,20 +101,21 @@ mesh_modifier_t::mesh_modifier_t(mesh_t& mesh)
 vertex_index_t mesh_modifier_t::make_vertex(point_index_t pindex) {
   vertex_t vert;
   vert.point_index = pindex;
-  return _mesh.kernel->emplace(std::move(vert));
+  return emplace_element(_mesh, std::move(vert));
 }
 
 void mesh_modifier_t::update_vertex(vertex_index_t vindex, edge_index_t eindex) {
-  auto* vert = _mesh.kernel->get(vindex);
-  if (vert) {
-    vert->edge_index = eindex;
+  auto vertices = _mesh.kernel->vertex_table();
+  if (vertices.validate(vindex)) {
+    touch_element(_mesh, vindex);
+    vertices.edge_index.writable(vindex.offset) = eindex;
   }
 }
 
 edge_index_t mesh_modifier_t::make_edge(vertex_index_t vindex) {
   edge_t edge;
   edge.vertex_index = vindex;
-  auto eindex = _mesh.kernel->emplace(std::move(edge));
+  auto eindex = emplace_element(_mesh, std::move(edge));
   update_vertex(vindex, eindex);
   return eindex;
 }
@@ -224,8 +124,9 @@ edge_index_t mesh_modifier_t::make_edge(vertex_index_t vindex, edge_index_t prev
   edge_t edge;
   edge.vertex_index = vindex;
   edge.prev_index = prev_index;
-  auto eindex = _mesh.kernel->emplace(std::move(edge));
+  auto eindex = emplace_element(_mesh, std::move(edge));
   set_next_edge(prev_index, eindex);
+  update_vertex(vindex, eindex);
   return eindex;
 }
 
@@ -235,13 +136,19 @@ void mesh_modifier_t::connect_edges(edge_index_t prev_eindex, edge_index_t next_
 }
 
 void mesh_modifier_t::set_next_edge(edge_index_t prev_index, edge_index_t next_index) {
-  auto* prev = _mesh.kernel->get(prev_index);
-  prev->next_index = next_index;
+  auto edges = _mesh.kernel->edge_table();
+  if (edges.validate(prev_index)) {
+    touch_element(_mesh, prev_index);
+    edges.next_index.writable(prev_index.offset) = next_index;
+  }
 }
 
 void mesh_modifier_t::set_prev_edge(edge_index_t prev_index, edge_index_t next_index) {
-  auto* next = _mesh.kernel->get(next_index);
-  next->prev_index = prev_index;
+  auto edges = _mesh.kernel->edge_table();
+  if (edges.validate(next_index)) {
+    touch_element(_mesh, next_index);
+    edges.prev_index.writable(next_index.offset) = prev_index;
+  }
 }
 
 // mesh_modifier_t
@@ -284,11 +191,15 @@ edge_index_t edge_loop_builder_t::close()  {
 ///////////////////////////////////////////////////////////////////////////////
 
 mesh_t::mesh_t()
-  : kernel(new basic_kernel_t, [](kernel_t* k) { delete k; })
+  : tag(0)
+  , kernel(make_basic_kernel())
+  , open_transaction(nullptr)
 {}
 
 mesh_t::mesh_t(kernel_t::ptr_t&& _kernel)
-  : kernel(std::move(kernel))
+  : tag(0)
+  , kernel(std::move(_kernel))
+  , open_transaction(nullptr)
 {}
 
 size_t mesh_t::point_count() const {
@@ -326,8 +237,7 @@ point_t* mesh_t::point(point_index_t pindex) const {
   return kernel->get(pindex);
 }
 point_t* mesh_t::point(vertex_index_t vindex) const {
-  auto* vert = kernel->get(vindex);
-  return point(vert->point_index);
+  return vertex(vindex).point();
 }
 
 std::pair<point_t*, point_t*> mesh_t::points(edge_index_t eindex) const {
@@ -336,8 +246,24 @@ std::pair<point_t*, point_t*> mesh_t::points(edge_index_t eindex) const {
   return std::make_pair(p0, p1);
 }
 
+element_range_t<edge_index_t> mesh_t::edges() const {
+  return element_range_t<edge_index_t>(kernel->edge_table());
+}
+
+element_range_t<face_index_t> mesh_t::faces() const {
+  return element_range_t<face_index_t>(kernel->face_table());
+}
+
+element_range_t<vertex_index_t> mesh_t::vertices() const {
+  return element_range_t<vertex_index_t>(kernel->vertex_table());
+}
+
+element_range_t<point_index_t> mesh_t::points() const {
+  return element_range_t<point_index_t>(kernel->point_table());
+}
+
 point_index_t mesh_t::add_point(float x, float y, float z) {
-  return kernel->emplace(point_t(x, y, z));
+  return emplace_element(*this, point_t(x, y, z));
 }
 
 edge_index_t mesh_t::add_edge(point_index_t pindex0, point_index_t pindex1) {
@@ -345,26 +271,27 @@ edge_index_t mesh_t::add_edge(point_index_t pindex0, point_index_t pindex1) {
   v0.point_index = pindex0;
   v1.point_index = pindex1;
 
-  auto vindex0 = kernel->emplace(std::move(v0));
-  auto vindex1 = kernel->emplace(std::move(v1));
+  auto vindex0 = emplace_element(*this, std::move(v0));
+  auto vindex1 = emplace_element(*this, std::move(v1));
 
   edge_t e0, e1;
   e0.vertex_index = vindex0;
   e1.vertex_index = vindex1;
 
-  auto eindex0 = kernel->emplace(std::move(e0));
-  auto eindex1 = kernel->emplace(std::move(e1));
+  auto eindex0 = emplace_element(*this, std::move(e0));
+  auto eindex1 = emplace_element(*this, std::move(e1));
 
-  kernel->get(vindex0)->edge_index = eindex0;
-  kernel->get(vindex1)->edge_index = eindex1;
+  auto vertices = kernel->vertex_table();
+  vertices.edge_index.writable(vindex0.offset) = eindex0;
+  vertices.edge_index.writable(vindex1.offset) = eindex1;
 
   return eindex0;
 }
 
 face_index_t mesh_t::add_triangle(point_t p0, point_t p1, point_t p2) {
-  auto pindex0 = kernel->emplace(std::move(p0));
-  auto pindex1 = kernel->emplace(std::move(p1));
-  auto pindex2 = kernel->emplace(std::move(p2));
+  auto pindex0 = emplace_element(*this, std::move(p0));
+  auto pindex1 = emplace_element(*this, std::move(p1));
+  auto pindex2 = emplace_element(*this, std::move(p2));
   return add_triangle(pindex0, pindex1, pindex2);
 }
 
@@ -377,12 +304,25 @@ face_index_t mesh_t::add_triangle(point_index_t pindex0, point_index_t pindex1,
 }
 
 face_index_t mesh_t::add_triangle(edge_index_t eindex, point_index_t pindex) {
-  auto adjacent_index = edge(eindex).adjacent().index();
-  edge_loop_builder_t loop(*this, adjacent_index);
-  loop.add_point(edge(eindex).vertex().element()->point_index);
-  loop.add_point(pindex);
-  auto root_eindex = loop.close();
-  return add_face(root_eindex);
+  auto boundary = edge(eindex);
+  if (!boundary || !boundary.is_boundary()) {
+    LOG(WARNING) << "Triangles can only be added onto boundary edges: " << eindex.offset;
+    return face_index_t();
+  }
+
+  // The new face runs the opposite way along the edge so its root edge is the
+  // adjacent half-edge of eindex.
+  auto findex = add_triangle(
+    boundary.next().vertex().point_index(),
+    boundary.vertex().point_index(),
+    pindex);
+
+  auto root_eindex = face(findex).edge().index();
+  touch_element(*this, eindex);
+  auto edges = kernel->edge_table();
+  edges.adjacent_index.writable(eindex.offset) = root_eindex;
+  edges.adjacent_index.writable(root_eindex.offset) = eindex;
+  return findex;
 }
 
 face_index_t mesh_t::add_face(edge_index_t root_eindex) {
@@ -390,122 +330,477 @@ face_index_t mesh_t::add_face(edge_index_t root_eindex) {
 
   face_t face;
   face.edge_index = root_eindex;
-  auto findex = kernel->emplace(std::move(face));
+  auto findex = emplace_element(*this, std::move(face));
 
-  auto* elem = kernel->get(root_eindex);
-  while( elem && elem->tag != tag ) {
-    elem->tag = tag;
-    elem->face_index = findex;
-    elem = kernel->get(elem->next_index);
+  auto edges = kernel->edge_table();
+  auto eindex = root_eindex;
+  while( eindex && edges.validate(eindex) && edges.element[eindex.offset].tag != tag ) {
+    touch_element(*this, eindex);
+    edges.element.writable(eindex.offset).tag = tag;
+    edges.face_index.writable(eindex.offset) = findex;
+    eindex = edges.next_index[eindex.offset];
   }
   return findex;
 }
 
-// mesh_t
-///////////////////////////////////////////////////////////////////////////////
-
-///////////////////////////////////////////////////////////////////////////////
+bool mesh_t::build_from_indexed(const std::vector<position_t>& positions,
+                                const std::vector<uint32_t>& indices,
+                                const std::vector<uint32_t>& face_sizes) {
+  const bool triangles = face_sizes.empty();
+  if (triangles && indices.size() % 3 != 0) {
+    LOG(ERROR) << "Triangle index buffer size is not a multiple of 3: " << indices.size();
+    return false;
+  }
 
-element_t::element_t()
-  : status(element_status_t::ACTIVE)
-  , tag(0)
-  , generation(0)
-{}
+  size_t corner_count = triangles ? indices.size() : 0;
+  for (auto size : face_sizes) {
+    if (size < 3) {
+      LOG(ERROR) << "Faces require at least 3 corners, got: " << size;
+      return false;
+    }
+    corner_count += size;
+  }
+  if (corner_count != indices.size()) {
+    LOG(ERROR) << "Face sizes account for " << corner_count
+               << " corners but the index buffer holds " << indices.size();
+    return false;
+  }
 
-point_t::point_t(float x, float y, float z)
-  : element_t()
-  , position(x, y, z)
-{}
+  std::vector<uint8_t> referenced(positions.size(), 0);
+  size_t vertex_count = 0;
+  for (auto index : indices) {
+    if (index >= positions.size()) {
+      LOG(ERROR) << "Index exceeded the position buffer size: "
+                 << index << " >= " << positions.size();
+      return false;
+    }
+    if (!referenced[index]) {
+      referenced[index] = 1;
+      vertex_count++;
+    }
+  }
 
-point_t::point_t()
-  : element_t()
-  , position(0.f)
-{}
+  const size_t face_count = triangles ? indices.size() / 3 : face_sizes.size();
+  auto face_size = [&](size_t face) -> size_t {
+    return triangles ? 3 : face_sizes[face];
+  };
 
-///////////////////////////////////////////////////////////////////////////////
+  kernel->reserve(positions.size(), vertex_count, face_count, corner_count);
 
-#define FN_GETTER(A, B)                           \
-  auto *elem = element();                         \
-  if (elem != nullptr)                            \
-  {                                               \
-    return A;                                     \
-  }                                               \
-  else                                            \
-  {                                               \
-    LOG(DEBUG) << "Returning empty function set"; \
-    return B;                                     \
+  std::vector<point_index_t> pindices;
+  pindices.reserve(positions.size());
+  for (auto& position : positions) {
+    pindices.push_back(emplace_element(*this, point_t(position.x, position.y, position.z)));
   }
 
-#define MAKE_VERT_FN(INDEX) \
-  FN_GETTER(vertex_fn_t(_kernel, INDEX), vertex_fn_t(_kernel, vertex_index_t()))
-
-#define MAKE_FACE_FN(INDEX) \
-  FN_GETTER(face_fn_t(_kernel, INDEX), face_fn_t(_kernel, face_index_t()))
+  std::vector<vertex_index_t> vindices(positions.size());
+  for (size_t index = 0; index < positions.size(); ++index) {
+    if (referenced[index]) {
+      vertex_t vert;
+      vert.point_index = pindices[index];
+      vindices[index] = emplace_element(*this, std::move(vert));
+    }
+  }
 
-#define MAKE_EDGE_FN(INDEX) \
-  FN_GETTER(edge_fn_t(_kernel, INDEX), edge_fn_t(_kernel, edge_index_t()))
+  std::vector<edge_index_t> eindices;
+  eindices.reserve(corner_count);
+  for (auto index : indices) {
+    edge_t edge;
+    edge.vertex_index = vindices[index];
+    eindices.push_back(emplace_element(*this, std::move(edge)));
+  }
+
+  std::vector<face_index_t> findices;
+  findices.reserve(face_count);
+  for (size_t face = 0, first = 0; face < face_count; first += face_size(face), ++face) {
+    face_t f;
+    f.edge_index = eindices[first];
+    findices.push_back(emplace_element(*this, std::move(f)));
+  }
+
+  // Nothing else gets emplaced so the tables stay valid for the linking passes.
+  auto edges = kernel->edge_table();
+  auto vertices = kernel->vertex_table();
+  for (size_t face = 0, first = 0; face < face_count; first += face_size(face), ++face) {
+    const size_t size = face_size(face);
+    for (size_t corner = 0; corner < size; ++corner) {
+      auto eindex = eindices[first + corner];
+      edges.next_index.writable(eindex.offset) = eindices[first + (corner + 1) % size];
+      edges.prev_index.writable(eindex.offset) = eindices[first + (corner + size - 1) % size];
+      edges.face_index.writable(eindex.offset) = findices[face];
+
+      auto vindex = vindices[indices[first + corner]];
+      if (!vertices.edge_index[vindex.offset]) {
+        vertices.edge_index.writable(vindex.offset) = eindex;
+      }
+    }
+  }
 
-///////////////////////////////////////////////////////////////////////////////
+  auto report = link_adjacent_edges(*this);
+  if (report.non_manifold_edges.size() || report.degenerate_edges.size()) {
+    LOG(WARNING) << "Left " << report.non_manifold_edges.size() << " non-manifold and "
+                 << report.degenerate_edges.size() << " degenerate edges unlinked";
+  }
+  return true;
+}
 
-vertex_fn_t edge_fn_t::vertex() const {
-  MAKE_VERT_FN(elem->vertex_index)
+transaction_t* mesh_t::transaction() const {
+  return open_transaction;
 }
 
-face_fn_t edge_fn_t::face() const {
-  MAKE_FACE_FN(elem->face_index)
+size_t mesh_t::cell_count(edge_index_t) const {
+  return kernel->edge_table().size;
 }
 
-edge_fn_t edge_fn_t::next() const {
-  MAKE_EDGE_FN(elem->next_index)
+size_t mesh_t::cell_count(face_index_t) const {
+  return kernel->face_table().size;
 }
 
-edge_fn_t edge_fn_t::prev() const {
-  MAKE_EDGE_FN(elem->prev_index)
+size_t mesh_t::cell_count(vertex_index_t) const {
+  return kernel->vertex_table().size;
 }
 
-edge_fn_t edge_fn_t::adjacent() const {
-  MAKE_EDGE_FN(elem->adjacent_index)
+size_t mesh_t::cell_count(point_index_t) const {
+  return kernel->point_table().size;
 }
 
-bool edge_fn_t::is_boundary() const {
-  auto* edge = element();
-  if (edge != nullptr) {
-    auto adjacent_face = adjacent().face();
-    if (adjacent_face) {
-      return false;
+// mesh_t
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+
+link_report_t link_adjacent_edges(mesh_t& mesh, size_t thread_count) {
+  link_report_t report;
+
+  auto edges = mesh.kernel->edge_table();
+  auto vertices = mesh.kernel->vertex_table();
+  auto points = mesh.kernel->point_table();
+  if (points.size > UINT32_MAX) {
+    LOG(ERROR) << "Too many points to build 64-bit edge keys from: " << points.size;
+    return report;
+  }
+
+  struct record_t {
+    uint64_t key;
+    offset_t edge;
+    uint32_t from;
+  };
+
+  auto point_of = [&](edge_index_t eindex) -> offset_t {
+    if (!edges.contains(eindex) || edges.element[eindex.offset].status != element_status_t::ACTIVE) {
+      return 0;
+    }
+    auto vindex = edges.vertex_index[eindex.offset];
+    if (!vindex || !vertices.contains(vindex)) {
+      return 0;
+    }
+    return vertices.point_index[vindex.offset].offset;
+  };
+
+  auto hash = [](uint64_t key) -> uint64_t {
+    return key * 0x9E3779B97F4A7C15ull;
+  };
+
+  thread_count = resolve_thread_count(thread_count);
+  auto transaction = mesh.transaction();
+  size_t partition_bits = 0;
+  while ((size_t(1) << partition_bits) < thread_count * 4) {
+    ++partition_bits;
+  }
+  const size_t partition_count = size_t(1) << partition_bits;
+  auto partition_of = [&](uint64_t key) -> size_t {
+    return partition_bits ? size_t(hash(key) >> (64 - partition_bits)) : 0;
+  };
+
+  // Gather the keys of every chunk of edges along with a histogram of the
+  // partitions they fall into.
+  std::vector<std::vector<record_t>> local(thread_count);
+  std::vector<std::vector<size_t>> histograms(thread_count, std::vector<size_t>(partition_count, 0));
+  std::vector<std::vector<edge_index_t>> degenerate(thread_count);
+
+  parallel_for(edges.size, thread_count, [&](size_t begin, size_t end, size_t chunk) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      auto& element = edges.element[offset];
+      if (element.status != element_status_t::ACTIVE) {
+        continue;
+      }
+      edge_index_t eindex(offset, element.generation);
+      auto from = point_of(eindex);
+      auto to = point_of(edges.next_index[offset]);
+      if (!from || !to) {
+        continue;
+      }
+      if (from == to) {
+        degenerate[chunk].push_back(eindex);
+        continue;
+      }
+      uint64_t lo = std::min(from, to), hi = std::max(from, to);
+      record_t record { (lo << 32) | hi, offset_t(offset), uint32_t(from) };
+      histograms[chunk][partition_of(record.key)]++;
+      local[chunk].push_back(record);
+    }
+  });
+
+  std::vector<size_t> partition_begin(partition_count + 1, 0);
+  std::vector<std::vector<size_t>> cursors(thread_count, std::vector<size_t>(partition_count, 0));
+  {
+    size_t total = 0;
+    for (size_t partition = 0; partition < partition_count; ++partition) {
+      partition_begin[partition] = total;
+      for (size_t chunk = 0; chunk < thread_count; ++chunk) {
+        cursors[chunk][partition] = total;
+        total += histograms[chunk][partition];
+      }
     }
+    partition_begin[partition_count] = total;
   }
-  return true;
+
+  std::vector<record_t> records(partition_begin[partition_count]);
+  parallel_for(thread_count, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+      auto& cursor = cursors[chunk];
+      for (auto& record : local[chunk]) {
+        records[cursor[partition_of(record.key)]++] = record;
+      }
+      local[chunk] = std::vector<record_t>();
+    }
+  });
+
+  // Each partition holds every edge for its keys, so they can all be paired
+  // without touching one another. The pairs land next to the edges and only
+  // the links that change get written afterwards.
+  std::vector<edge_index_t> linked(edges.size);
+  std::vector<link_report_t> partials(thread_count);
+  parallel_for(partition_count, thread_count, [&](size_t begin, size_t end, size_t chunk) {
+    auto& partial = partials[chunk];
+    for (size_t partition = begin; partition < end; ++partition) {
+      auto first = records.begin() + partition_begin[partition];
+      auto last = records.begin() + partition_begin[partition + 1];
+      std::sort(first, last, [](const record_t& a, const record_t& b) {
+        return a.key < b.key || (a.key == b.key && a.edge < b.edge);
+      });
+
+      for (auto run = first; run != last;) {
+        auto run_end = run + 1;
+        while (run_end != last && run_end->key == run->key) {
+          ++run_end;
+        }
+        auto run_size = run_end - run;
+        if (run_size == 1) {
+          partial.boundary_edges++;
+        }
+        else if (run_size == 2 && run->from != (run + 1)->from) {
+          edge_index_t e0(run->edge, edges.element[run->edge].generation);
+          edge_index_t e1((run + 1)->edge, edges.element[(run + 1)->edge].generation);
+          linked[e0.offset] = e1;
+          linked[e1.offset] = e0;
+          partial.linked_pairs++;
+        }
+        else {
+          for (auto it = run; it != run_end; ++it) {
+            partial.non_manifold_edges.emplace_back(it->edge, edges.element[it->edge].generation);
+          }
+        }
+        run = run_end;
+      }
+    }
+  });
+
+  auto relink = [&](offset_t offset) {
+    auto& element = edges.element[offset];
+    if (element.status != element_status_t::ACTIVE || edges.adjacent_index[offset] == linked[offset]) {
+      return;
+    }
+    if (transaction != nullptr) {
+      transaction->touch(edge_index_t(offset, element.generation));
+    }
+    edges.adjacent_index.writable(offset) = linked[offset];
+  };
+  if (transaction != nullptr) {
+    for (offset_t offset = 1; offset < edges.size; ++offset) {
+      relink(offset);
+    }
+  }
+  else {
+    // Writing from several threads, so every page gets copied up front.
+    edges.make_writable();
+    parallel_for(edges.size, thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+        relink(offset_t(offset));
+      }
+    });
+  }
+
+  for (size_t chunk = 0; chunk < thread_count; ++chunk) {
+    auto& partial = partials[chunk];
+    report.linked_pairs += partial.linked_pairs;
+    report.boundary_edges += partial.boundary_edges;
+    report.non_manifold_edges.insert(report.non_manifold_edges.end(),
+                                     partial.non_manifold_edges.begin(),
+                                     partial.non_manifold_edges.end());
+    report.degenerate_edges.insert(report.degenerate_edges.end(),
+                                   degenerate[chunk].begin(), degenerate[chunk].end());
+  }
+  std::sort(report.non_manifold_edges.begin(), report.non_manifold_edges.end());
+  return report;
 }
 
-// edge_fn_t
+// link_adjacent_edges
 ///////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////
 
-edge_fn_t vertex_fn_t::edge() const {
-  MAKE_EDGE_FN(elem->edge_index)
+namespace {
+
+/**
+   Spreads the low 21 bits of v out to every third bit.
+ */
+uint64_t spread_bits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+std::vector<offset_t> morton_face_order(const edge_table_t& edges, const face_table_t& faces,
+                                        const vertex_table_t& vertices, const point_table_t& points) {
+  std::vector<std::pair<uint64_t, offset_t>> keys;
+  std::vector<position_t> centroids;
+  position_t lower(FLT_MAX, FLT_MAX, FLT_MAX);
+  position_t upper(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for (offset_t offset = 1; offset < faces.size; ++offset) {
+    if (faces.element[offset].status != element_status_t::ACTIVE) {
+      continue;
+    }
+    position_t centroid(0.f, 0.f, 0.f);
+    size_t corners = 0;
+    for (auto vindex : face_vertex_range_t(edges, faces.edge_index[offset])) {
+      if (vertices.contains(vindex) && points.contains(vertices.point_index[vindex.offset])) {
+        centroid += points.position[vertices.point_index[vindex.offset].offset];
+        ++corners;
+      }
+    }
+    if (corners > 0) {
+      centroid /= float(corners);
+    }
+    lower = position_t::Min(lower, centroid);
+    upper = position_t::Max(upper, centroid);
+    keys.emplace_back(0, offset);
+    centroids.push_back(centroid);
+  }
+
+  const position_t extent = upper - lower;
+  const float scale = float(0x1fffff);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    uint64_t code = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t = extent[axis] > 0.f ? (centroids[i][axis] - lower[axis]) / extent[axis] : 0.f;
+      code |= spread_bits(uint64_t(t * scale)) << axis;
+    }
+    keys[i].first = code;
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<offset_t> order;
+  order.reserve(keys.size());
+  for (auto& key : keys) {
+    order.push_back(key.second);
+  }
+  return order;
 }
 
-point_t* vertex_fn_t::point() const {
-  auto* vert = element();
-  return _kernel->get(vert->point_index);
+/**
+   Visits the faces one connected patch at a time, every patch starting from
+   its first face in the current layout.
+ */
+std::vector<offset_t> breadth_first_face_order(const edge_table_t& edges, const face_table_t& faces) {
+  std::vector<offset_t> order;
+  std::vector<uint8_t> visited(faces.size, 0);
+  for (offset_t seed = 1; seed < faces.size; ++seed) {
+    if (visited[seed] || faces.element[seed].status != element_status_t::ACTIVE) {
+      continue;
+    }
+    visited[seed] = 1;
+    size_t head = order.size();
+    order.push_back(seed);
+    while (head < order.size()) {
+      auto offset = order[head++];
+      for (auto eindex : face_edge_range_t(edges, faces.edge_index[offset])) {
+        auto adjacent = edges.adjacent_index[eindex.offset];
+        if (!edges.contains(adjacent)) {
+          continue;
+        }
+        auto findex = edges.face_index[adjacent.offset];
+        if (faces.contains(findex) && !visited[findex.offset]) {
+          visited[findex.offset] = 1;
+          order.push_back(findex.offset);
+        }
+      }
+    }
+  }
+  return order;
 }
 
-// vertex_fn_t
-///////////////////////////////////////////////////////////////////////////////
+} // namespace
 
-///////////////////////////////////////////////////////////////////////////////
+remap_table_t reorder_for_locality(mesh_t& mesh, locality_order_t locality) {
+  auto edges = mesh.kernel->edge_table();
+  auto faces = mesh.kernel->face_table();
+  auto vertices = mesh.kernel->vertex_table();
+  auto points = mesh.kernel->point_table();
 
-edge_fn_t face_fn_t::edge() const {
-  MAKE_EDGE_FN(elem->edge_index)
-}
+  element_order_t order;
+  order.faces = locality == locality_order_t::morton
+    ? morton_face_order(edges, faces, vertices, points)
+    : breadth_first_face_order(edges, faces);
+
+  // Everything else follows the faces, repeats are skipped by the kernel.
+  order.edges.reserve(edges.size);
+  for (auto offset : order.faces) {
+    for (auto eindex : face_edge_range_t(edges, faces.edge_index[offset])) {
+      order.edges.push_back(eindex.offset);
+    }
+  }
+  order.vertices.reserve(vertices.size);
+  for (auto offset : order.edges) {
+    auto vindex = edges.vertex_index[offset];
+    if (vertices.contains(vindex)) {
+      order.vertices.push_back(vindex.offset);
+    }
+  }
+  order.points.reserve(points.size);
+  for (auto offset : order.vertices) {
+    auto pindex = vertices.point_index[offset];
+    if (points.contains(pindex)) {
+      order.points.push_back(pindex.offset);
+    }
+  }
 
-float face_fn_t::area() const {
-  return 0.f;
+  return mesh.kernel->reorder(order);
 }
 
-// face_fn_t
+// reorder_for_locality
+///////////////////////////////////////////////////////////////////////////////
+
 ///////////////////////////////////////////////////////////////////////////////
 
+element_t::element_t()
+  : status(element_status_t::ACTIVE)
+  , tag(0)
+  , generation(0)
+{}
+
+point_t::point_t(float x, float y, float z)
+  : element_t()
+  , position(x, y, z)
+{}
+
+point_t::point_t()
+  : element_t()
+  , position(0.f)
+{}
+
 } // namespace hedge
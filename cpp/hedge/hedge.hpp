@@ -1,23 +1,78 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 #include <mathfu/glsl_mappings.h>
 
 namespace hedge {
 
-struct edge_t; struct edge_index_t; class edge_fn_t;
-struct face_t; struct face_index_t; class face_fn_t;
-struct vertex_t; struct vertex_index_t; class vertex_fn_t;
+struct edge_t; struct edge_index_t;
+struct face_t; struct face_index_t;
+struct vertex_t; struct vertex_index_t;
 struct point_t; struct point_index_t;
 
+struct edge_table_t; struct face_table_t;
+struct vertex_table_t; struct point_table_t;
+
 class kernel_t;
 class mesh_t;
+class transaction_t;
+
+template<typename TKernel> class basic_edge_fn_t;
+template<typename TKernel> class basic_face_fn_t;
+template<typename TKernel> class basic_vertex_fn_t;
+
+using edge_fn_t = basic_edge_fn_t<kernel_t>;
+using face_fn_t = basic_face_fn_t<kernel_t>;
+using vertex_fn_t = basic_vertex_fn_t<kernel_t>;
 
 using position_t = mathfu::vec3;
 using color_t = mathfu::vec4;
+
+/**
+   Defining HEDGE_COMPACT_INDEX packs each index into a single 32-bit handle:
+   the low HEDGE_INDEX_GENERATION_BITS bits of the element generation and the
+   offset in the remaining bits. With the default of 4 generation bits that's
+   room for 2^28 elements of each type. Stale indices are still detected but
+   only until the generation wraps around.
+ */
+#if defined(HEDGE_COMPACT_INDEX)
+#if !defined(HEDGE_INDEX_GENERATION_BITS)
+#define HEDGE_INDEX_GENERATION_BITS 4
+#endif
+static_assert(HEDGE_INDEX_GENERATION_BITS > 0 && HEDGE_INDEX_GENERATION_BITS < 16,
+              "HEDGE_INDEX_GENERATION_BITS must be within [1, 15]");
+using offset_t = uint32_t;
+using generation_t = uint32_t;
+constexpr generation_t index_generation_mask = (1u << HEDGE_INDEX_GENERATION_BITS) - 1;
+constexpr offset_t index_offset_max = (1u << (32 - HEDGE_INDEX_GENERATION_BITS)) - 1;
+#else
 using offset_t = size_t;
 using generation_t = size_t;
+constexpr offset_t index_offset_max = SIZE_MAX;
+#endif
+
+/**
+   Compact indices only carry the low bits of an element's generation so the
+   comparison between the two has to go through here.
+ */
+inline bool is_same_generation(uint32_t element_generation, generation_t index_generation) {
+#if defined(HEDGE_COMPACT_INDEX)
+  return (element_generation & index_generation_mask) == index_generation;
+#else
+  return element_generation == index_generation;
+#endif
+}
 
 /**
    Using a strong index type instead of a bare pointer or generic integer index
@@ -29,8 +84,13 @@ enum class index_type_t : unsigned char {
 };
 template<index_type_t TIndexType = index_type_t::unsupported>
 struct index_t {
+#if defined(HEDGE_COMPACT_INDEX)
+  offset_t offset : 32 - HEDGE_INDEX_GENERATION_BITS;
+  generation_t generation : HEDGE_INDEX_GENERATION_BITS;
+#else
   offset_t offset;
   generation_t generation;
+#endif
 
   explicit index_t() noexcept
     : offset(0)
@@ -78,13 +138,380 @@ struct face_index_t : public index_t<index_type_t::face> { using index_t::index_
 struct vertex_index_t : public index_t<index_type_t::vertex> { using index_t::index_t; };
 struct point_index_t : public index_t<index_type_t::point> { using index_t::index_t; };
 
+////////////////////////////////////////////////////////////////////////////////
+// Index validation
+
+/**
+   Reporting is kept out of line so that the inlined lookups in the headers stay
+   small and don't need to pull in the logging library.
+ */
+void report_invalid_offset(offset_t offset, size_t size);
+void report_generation_mismatch(offset_t offset, generation_t expected, uint32_t actual);
+void report_empty_function_set();
+void report_storage_exhausted();
+void report_claim_exhausted(size_t capacity);
+
+/**
+   How the element storage and function sets treat indices they can't resolve.
+   Both checked modes reject the index and count the failure, the logging mode
+   also reports it through the log. Unchecked trusts every index it's handed and
+   skips the range and generation checks entirely.
+ */
+enum class validation_t : uint8_t {
+  checked_logging, checked_silent, unchecked
+};
+
+struct validation_counters_t {
+  std::atomic<size_t> invalid_offsets;
+  std::atomic<size_t> generation_mismatches;
+  std::atomic<size_t> empty_function_sets;
+
+  validation_counters_t()
+    : invalid_offsets(0)
+    , generation_mismatches(0)
+    , empty_function_sets(0)
+  {}
+};
+
+/**
+   Carries the validation mode along with the counters of the kernel it came
+   from. When the kernel is known at compile time the mode folds away.
+ */
+struct validator_t {
+  validation_t validation;
+  validation_counters_t* counters;
+
+  explicit validator_t(validation_t v = validation_t::checked_logging,
+                       validation_counters_t* c = nullptr)
+    : validation(v), counters(c)
+  {}
+
+  bool is_checked() const {
+    return validation != validation_t::unchecked;
+  }
+
+  void invalid_offset(offset_t offset, size_t size) const {
+    if (counters != nullptr) {
+      counters->invalid_offsets.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (validation == validation_t::checked_logging) {
+      report_invalid_offset(offset, size);
+    }
+  }
+
+  void generation_mismatch(offset_t offset, generation_t expected, uint32_t actual) const {
+    if (counters != nullptr) {
+      counters->generation_mismatches.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (validation == validation_t::checked_logging) {
+      report_generation_mismatch(offset, expected, actual);
+    }
+  }
+
+  void empty_function_set() const {
+    if (counters != nullptr) {
+      counters->empty_function_sets.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (validation == validation_t::checked_logging) {
+      report_empty_function_set();
+    }
+  }
+};
+
+/**
+   Where a kernel gets the memory for its element arrays.
+
+   Heap storage grows like a std::vector, moving every element each time it
+   runs out. Paged storage reserves address space for a very large array up
+   front and lets the system back it with pages as they are first touched, so
+   elements never move when the array grows and pointers to them stay valid
+   until the element is removed or the kernel is compacted or reordered. Huge
+   pages is paged storage that asks for 2MB pages, which cuts down on TLB
+   misses over large meshes; pages from the system's huge page pool only
+   back what was asked for through reserve(), the rest is left to the
+   kernel's transparent huge pages. Monotonic storage carves every array out of one
+   arena owned by the kernel and frees it all at once when the kernel goes,
+   which suits short lived scratch meshes; arrays that can't grow in place
+   move within the arena and leave their old space unused.
+ */
+enum class allocation_t : uint8_t {
+  heap, paged, huge_pages, monotonic
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+   Where compacting a kernel moved its elements. Each vector maps an old cell
+   offset onto the element's new index, with the empty index for cells that
+   were free. Indices held outside of the kernel can be brought up to date by
+   passing them through; stale ones come back empty.
+ */
+struct remap_table_t {
+  std::vector<edge_index_t> edges;
+  std::vector<face_index_t> faces;
+  std::vector<vertex_index_t> vertices;
+  std::vector<point_index_t> points;
+
+  edge_index_t operator()(edge_index_t index) const { return lookup(edges, index); }
+  face_index_t operator()(face_index_t index) const { return lookup(faces, index); }
+  vertex_index_t operator()(vertex_index_t index) const { return lookup(vertices, index); }
+  point_index_t operator()(point_index_t index) const { return lookup(points, index); }
+
+private:
+  template<typename TIndex>
+  static TIndex lookup(const std::vector<TIndex>& remap, TIndex index) {
+    if (index.offset < remap.size() && remap[index.offset].generation == index.generation) {
+      return remap[index.offset];
+    }
+    return TIndex();
+  }
+};
+
+/**
+   A new layout for a kernel's storage given as the old cell offsets of each
+   element type in the order they should end up in. Active elements missing
+   from a list follow the listed ones in their old order, free cells and
+   repeated offsets are skipped.
+ */
+struct element_order_t {
+  std::vector<offset_t> edges;
+  std::vector<offset_t> faces;
+  std::vector<offset_t> vertices;
+  std::vector<offset_t> points;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Properties
+
+void report_property_exists(const std::string& name);
+void report_property_type_mismatch(const std::string& name);
+
+/**
+   Handle to a property column, the values of one named property for every
+   cell of an element type. Values are stored densely by cell offset next to
+   the kernel's own storage, so a lookup is a single index into an array with
+   no name or hash involved; the name is only looked up when the handle is
+   taken. Handles stay valid until the property is removed or its kernel
+   goes, across emplace, compact and reorder, but the generation of the index
+   isn't checked so stale indices have to be caught through the kernel.
+ */
+template<typename TIndex, typename T>
+class property_t {
+  static_assert(!std::is_same<T, bool>::value,
+                "std::vector<bool> doesn't hand out references, use uint8_t for flags");
+  std::vector<T>* _values;
+
+public:
+  property_t() : _values(nullptr) {}
+  explicit property_t(std::vector<T>* values) : _values(values) {}
+
+  T& operator[](TIndex index) const {
+    return (*_values)[index.offset];
+  }
+
+  /**
+     The value of the cell at index, or nullptr when the offset is past the
+     cells the property knows about.
+   */
+  T* get(TIndex index) const {
+    return index.offset < _values->size() ? _values->data() + index.offset : nullptr;
+  }
+
+  /**
+     The values indexed by cell offset. Like the tables they're only valid
+     until the next emplace, compact or reorder on the kernel.
+   */
+  T* data() const {
+    return _values->data();
+  }
+
+  size_t size() const {
+    return _values->size();
+  }
+
+  explicit operator bool() const noexcept {
+    return _values != nullptr;
+  }
+};
+
+/**
+   The property columns of one element type. The kernel keeps every column as
+   long as its own storage: emplace() sets the new cell back to the initial
+   value of each column and compact() and reorder() move the values along with
+   the elements. remove(), retract() and restore() leave the values alone so
+   the ones of a removed cell come back with it when a transaction is undone;
+   property values themselves aren't journaled.
+ */
+template<typename TIndex>
+class property_columns_t {
+  struct column_base_t {
+    std::string name;
+    const std::type_info* type;
+
+    column_base_t(const std::string& n, const std::type_info& t) : name(n), type(&t) {}
+    virtual ~column_base_t() = default;
+
+    virtual void created(size_t begin, size_t end) = 0;
+    virtual void remap(const std::vector<TIndex>& remap, size_t size) = 0;
+  };
+
+  template<typename T>
+  struct column_t final : column_base_t {
+    std::vector<T> values;
+    T initial;
+
+    column_t(const std::string& name, size_t size, const T& i)
+      : column_base_t(name, typeid(T)), values(size, i), initial(i)
+    {}
+
+    void created(size_t begin, size_t end) override {
+      std::fill(values.begin() + std::min(begin, values.size()),
+                values.begin() + std::min(end, values.size()), initial);
+      if (values.size() < end) {
+        values.resize(end, initial);
+      }
+    }
+
+    void remap(const std::vector<TIndex>& remap, size_t size) override {
+      std::vector<T> moved(size, initial);
+      const size_t count = std::min(remap.size(), values.size());
+      for (offset_t offset = 1; offset < count; ++offset) {
+        if (remap[offset]) {
+          moved[remap[offset].offset] = std::move(values[offset]);
+        }
+      }
+      values.swap(moved);
+    }
+  };
+
+  std::vector<std::unique_ptr<column_base_t>> _columns;
+
+  column_base_t* lookup(const std::string& name) const {
+    for (auto& column : _columns) {
+      if (column->name == name) {
+        return column.get();
+      }
+    }
+    return nullptr;
+  }
+
+public:
+  /**
+     Adds a column of size cells all holding initial. Fails with an empty
+     handle when the name is already taken.
+   */
+  template<typename T>
+  property_t<TIndex, T> add(const std::string& name, size_t size, const T& initial = T()) {
+    if (lookup(name) != nullptr) {
+      report_property_exists(name);
+      return property_t<TIndex, T>();
+    }
+    auto* column = new column_t<T>(name, size, initial);
+    _columns.emplace_back(column);
+    return property_t<TIndex, T>(&column->values);
+  }
+
+  /**
+     The column called name, or an empty handle when there's none or it
+     holds values of another type.
+   */
+  template<typename T>
+  property_t<TIndex, T> find(const std::string& name) const {
+    auto* column = lookup(name);
+    if (column == nullptr) {
+      return property_t<TIndex, T>();
+    }
+    if (*column->type != typeid(T)) {
+      report_property_type_mismatch(name);
+      return property_t<TIndex, T>();
+    }
+    return property_t<TIndex, T>(&static_cast<column_t<T>*>(column)->values);
+  }
+
+  bool remove(const std::string& name) {
+    for (auto it = _columns.begin(); it != _columns.end(); ++it) {
+      if ((*it)->name == name) {
+        _columns.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t size() const {
+    return _columns.size();
+  }
+
+  void created(TIndex index) {
+    if (index) {
+      created(index.offset, index.offset + 1);
+    }
+  }
+
+  /**
+     Sets the cells in [begin, end) back to the initial values, growing the
+     columns to end if they're shorter.
+   */
+  void created(size_t begin, size_t end) {
+    for (auto& column : _columns) {
+      column->created(begin, end);
+    }
+  }
+
+  void remap(const std::vector<TIndex>& remap) {
+    if (_columns.empty() || remap.empty()) {
+      return;
+    }
+    size_t size = 1;
+    for (auto& index : remap) {
+      if (index) {
+        size = std::max<size_t>(size, index.offset + 1);
+      }
+    }
+    for (auto& column : _columns) {
+      column->remap(remap, size);
+    }
+  }
+};
+
+/**
+   The property columns of every element type of a kernel.
+ */
+struct property_set_t {
+  property_columns_t<edge_index_t> edges;
+  property_columns_t<face_index_t> faces;
+  property_columns_t<vertex_index_t> vertices;
+  property_columns_t<point_index_t> points;
+
+  property_columns_t<edge_index_t>& columns(edge_index_t) { return edges; }
+  property_columns_t<face_index_t>& columns(face_index_t) { return faces; }
+  property_columns_t<vertex_index_t>& columns(vertex_index_t) { return vertices; }
+  property_columns_t<point_index_t>& columns(point_index_t) { return points; }
+
+  void remap(const remap_table_t& remap) {
+    edges.remap(remap.edges);
+    faces.remap(remap.faces);
+    vertices.remap(remap.vertices);
+    points.remap(remap.points);
+  }
+};
+
 /**
    The mesh kernel implements/provides the fundamental storage and access operations.
+
+   Elements can be accessed either as whole structures through get() or field by
+   field through the element tables. Kernels that don't store whole elements (like
+   the structure-of-arrays kernel) return nullptr from get() for those element
+   types, so code that should work against any kernel ought to use the tables.
  */
 class kernel_t {
+  property_set_t _properties;
+
 public:
   using ptr_t = std::unique_ptr<kernel_t, void(*)(kernel_t*)>;
 
+  virtual ~kernel_t() = default;
+
   virtual edge_t* get(edge_index_t index) = 0;
   virtual face_t* get(face_index_t index) = 0;
   virtual vertex_t* get(vertex_index_t index) = 0;
@@ -100,17 +527,142 @@ public:
   virtual void remove(vertex_index_t index) = 0;
   virtual void remove(point_index_t index) = 0;
 
+  /**
+     Exact inverses of emplace() and remove() for replaying a journal, see
+     transaction_t. They only work backwards through the history: retract()
+     puts the cell of the latest emplace still standing back on the free
+     list, leaving indices to it stale, restore() takes the cell at the head
+     of the free list, that of the latest remove or retract, off again with
+     the generation of the given index. Both leave the fields of the cell
+     alone and return false when the cell isn't the one the history says it
+     has to be.
+   */
+  virtual bool retract(edge_index_t index) = 0;
+  virtual bool retract(face_index_t index) = 0;
+  virtual bool retract(vertex_index_t index) = 0;
+  virtual bool retract(point_index_t index) = 0;
+
+  virtual bool restore(edge_index_t index) = 0;
+  virtual bool restore(face_index_t index) = 0;
+  virtual bool restore(vertex_index_t index) = 0;
+  virtual bool restore(point_index_t index) = 0;
+
   virtual size_t point_count() const = 0;
   virtual size_t vertex_count() const = 0;
   virtual size_t face_count() const = 0;
   virtual size_t edge_count() const = 0;
 
+  /**
+     Makes room for at least this many more elements of each type.
+   */
+  virtual void reserve(size_t points, size_t vertices, size_t faces, size_t edges) = 0;
+
+  /**
+     Squeezes the free cells out of every element type, rewriting all of the
+     indices stored in the elements to match. Any index held elsewhere has to
+     go through the returned table.
+   */
+  virtual remap_table_t compact() = 0;
+
+  /**
+     Lays the elements out in the given order, which compacts them as well,
+     and rewrites the stored indices the same way compact() does.
+   */
+  virtual remap_table_t reorder(const element_order_t& order) = 0;
+
   virtual void resolve(edge_index_t* index, edge_t** edge) const = 0;
   virtual void resolve(face_index_t* index, face_t** face) const = 0;
   virtual void resolve(point_index_t* index, point_t** point) const = 0;
   virtual void resolve(vertex_index_t* index, vertex_t** vertex) const = 0;
+
+  /**
+     Tables are only valid until the next emplace on the kernel since growing the
+     underlying storage may move it.
+   */
+  virtual edge_table_t edge_table() = 0;
+  virtual face_table_t face_table() = 0;
+  virtual vertex_table_t vertex_table() = 0;
+  virtual point_table_t point_table() = 0;
+
+  virtual validation_t validation() const = 0;
+  virtual const validation_counters_t& validation_counters() const = 0;
+
+  /**
+     A read-only kernel that keeps seeing the elements as they are now while
+     this one goes on changing. It can be handed to and released on any
+     thread, but has to be taken on the thread that edits this kernel, in
+     between edits. Element pointers and tables taken from this kernel
+     before the snapshot must not be written through after it. Kernels that
+     don't keep versions return an empty pointer.
+   */
+  virtual ptr_t snapshot() = 0;
+
+  /**
+     The property columns attached to the cells of this kernel, see
+     property_columns_t. Snapshots and mapped or saved copies of the kernel
+     don't carry them along.
+   */
+  property_set_t& properties() {
+    return _properties;
+  }
+
+protected:
+  // Kernels pass the cells they create and the tables of the cells they move
+  // through here to keep the property columns lined up with the elements.
+  template<typename TIndex>
+  TIndex created(TIndex index) {
+    _properties.columns(index).created(index);
+    return index;
+  }
+
+  remap_table_t remapped(remap_table_t&& remap) {
+    _properties.remap(remap);
+    return std::move(remap);
+  }
 };
 
+/**
+   Array-of-structures kernel, every element is stored as a whole in a single array.
+ */
+kernel_t::ptr_t make_basic_kernel(validation_t validation = validation_t::checked_logging,
+                                  allocation_t allocation = allocation_t::heap);
+
+/**
+   Structure-of-arrays kernel, every field of edges, faces and vertices is stored
+   in its own dense array so traversals only touch the fields they need. Points
+   keep their layout since a point is only its position.
+ */
+kernel_t::ptr_t make_soa_kernel(validation_t validation = validation_t::checked_logging);
+
+/**
+   Read-only kernel over a file written by save_binary(). The element arrays
+   are mapped straight from the file and only paged in as they're touched, so
+   opening doesn't depend on the size of the mesh. The header is always
+   checked, the checksum over the element data only when asked for since it
+   has to read the whole file. Returns an empty pointer when the file can't
+   be used.
+
+   Elements can't be added or removed. Fields can still be written through
+   get() or the tables but the mapping is private, so changes never reach the
+   file.
+ */
+kernel_t::ptr_t make_mapped_kernel(const std::string& path, bool verify_checksum = false,
+                                   validation_t validation = validation_t::checked_logging);
+
+/**
+   Kernel for one writer and any number of readers. Elements live in pages of
+   1024 cells that are shared with the snapshots taken through snapshot(),
+   which only copies the page tables. The first write to a shared page after
+   a snapshot copies the page, and the original is freed once every snapshot
+   that can see it is gone, on whichever thread lets go of the last one.
+
+   Tables read the shared pages in place and only copy the page of a cell
+   written through column_t::writable(). get() and resolve() hand out
+   element pointers that could be written through, so they copy the page of
+   their element.
+ */
+kernel_t::ptr_t make_versioned_kernel(validation_t validation = validation_t::checked_logging);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Our principle element structures.
 
@@ -151,122 +703,817 @@ struct point_t : public element_t {
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-// "Function sets" proxy the mesh and elements and provide an easy access api
+// Element tables give kernel independent access to the individual fields.
 
 /**
-   We have this simple templated base class which allows functions that request
-   an alement to return an "empty" proxy. An alternative to this would be to
-   use std::optional but it seems like this would be sufficient for now.
+   Told about every page a paged column is about to write to, so that a
+   kernel sharing its pages can copy the page first.
  */
-template<typename TIndex, typename TElement>
-class element_fn_t {
+class page_writer_t {
+public:
+  virtual void write_page(size_t page) = 0;
+  virtual void write_pages() = 0;
+
 protected:
-  kernel_t* _kernel;
-  TIndex _index;
+  ~page_writer_t() = default;
+};
+
+/**
+   A strided view over a single field of an element collection. A kernel that
+   stores whole elements hands out columns that step over the entire element
+   while a column oriented kernel hands out densely packed ones. Kernels that
+   keep their elements in fixed size pages hand out paged columns, which find
+   the page of a cell through a table of page pointers first.
+
+   Reads go through operator[] and writes through writable(), which lets a
+   kernel that shares pages with its snapshots copy just the page of the cell
+   being written.
+ */
+template<typename TField>
+class column_t {
+  char* _base;
+  char* const* _pages;
+  page_writer_t* _writer;
+  size_t _stride;
+  size_t _field;
+  unsigned _page_shift;
+
+  TField* cell(offset_t offset) const {
+    if (_pages == nullptr) {
+      return reinterpret_cast<TField*>(_base + offset * _stride);
+    }
+    const size_t cell = offset & ((size_t(1) << _page_shift) - 1);
+    return reinterpret_cast<TField*>(_pages[offset >> _page_shift] + _field + cell * _stride);
+  }
 public:
-  explicit element_fn_t(kernel_t* kernel, TIndex index)
-    : _kernel(kernel), _index(index)
+  column_t() noexcept
+    : _base(nullptr), _pages(nullptr), _writer(nullptr), _stride(sizeof(TField)), _field(0), _page_shift(0)
   {}
 
-  explicit operator bool() const noexcept {
-    return _kernel != nullptr && (bool)_index && element() != nullptr;
+  explicit column_t(TField* base, size_t stride = sizeof(TField)) noexcept
+    : _base(reinterpret_cast<char*>(base)), _pages(nullptr), _writer(nullptr), _stride(stride), _field(0)
+    , _page_shift(0)
+  {}
+
+  /**
+     Column over pages of 2^page_shift cells each, field being the offset of
+     the field within a cell. The writer, if any, hears about every page
+     before it's written to.
+   */
+  column_t(char* const* pages, unsigned page_shift, size_t field, size_t stride,
+           page_writer_t* writer = nullptr) noexcept
+    : _base(nullptr), _pages(pages), _writer(writer), _stride(stride), _field(field), _page_shift(page_shift)
+  {}
+
+  const TField& operator[](offset_t offset) const {
+    return *cell(offset);
   }
 
-  TElement* element() const {
-    if (_kernel != nullptr) {
-      return _kernel->get(_index);
+  TField& writable(offset_t offset) const {
+    if (_writer != nullptr) {
+      _writer->write_page(offset >> _page_shift);
     }
-    else {
-      return nullptr;
+    return *cell(offset);
+  }
+
+  /**
+     Readies every page for writing at once. Threads writing side by side
+     have to go through this first since they'd race to copy the pages.
+   */
+  void make_writable() const {
+    if (_writer != nullptr) {
+      _writer->write_pages();
     }
   }
 
-  TIndex index() {
-    return _index;
+  size_t stride() const {
+    return _stride;
+  }
+
+  explicit operator bool() const noexcept {
+    return _base != nullptr || _pages != nullptr;
   }
 };
 
-class edge_fn_t : public element_fn_t<edge_index_t, edge_t> {
-public:
-  using element_fn_t::element_fn_t;
+template<typename TField, typename TElement>
+column_t<TField> make_column(TElement* data, TField TElement::*field) {
+  return column_t<TField>(&(data->*field), sizeof(TElement));
+}
 
-  vertex_fn_t vertex() const;
-  face_fn_t face() const;
-  edge_fn_t next() const;
-  edge_fn_t prev() const;
-  edge_fn_t adjacent() const;
+struct element_table_t {
+  size_t size;
+  column_t<element_t> element;
+  validator_t validator;
 
-  bool is_boundary() const;
-};
+  element_table_t() : size(0) {}
 
-class face_fn_t : public element_fn_t<face_index_t, face_t> {
-public:
-  using element_fn_t::element_fn_t;
+  /**
+     See column_t::make_writable(), the columns of a table share their pages.
+   */
+  void make_writable() const {
+    element.make_writable();
+  }
+
+  template<typename TIndex>
+  bool contains(TIndex index) const {
+    return index.offset < size && is_same_generation(element[index.offset].generation, index.generation);
+  }
 
-  edge_fn_t edge() const;
-  float area() const;
+  /**
+     Same as contains() but follows the kernel's validation mode, reporting why
+     an index was rejected or skipping the checks when unchecked.
+   */
+  template<typename TIndex>
+  bool validate(TIndex index) const {
+    if (!validator.is_checked()) {
+      return true;
+    }
+    if (index.offset >= size) {
+      validator.invalid_offset(index.offset, size);
+      return false;
+    }
+    auto generation = element[index.offset].generation;
+    if (!is_same_generation(generation, index.generation)) {
+      validator.generation_mismatch(index.offset, index.generation, generation);
+      return false;
+    }
+    return true;
+  }
 };
 
-class vertex_fn_t : public element_fn_t<vertex_index_t, vertex_t> {
-public:
-  using element_fn_t::element_fn_t;
+struct edge_table_t : public element_table_t {
+  column_t<vertex_index_t> vertex_index;
+  column_t<face_index_t> face_index;
+  column_t<edge_index_t> next_index;
+  column_t<edge_index_t> prev_index;
+  column_t<edge_index_t> adjacent_index;
+};
 
-  edge_fn_t edge() const;
-  point_t* point() const;
+struct face_table_t : public element_table_t {
+  column_t<edge_index_t> edge_index;
 };
 
-////////////////////////////////////////////////////////////////////////////////
+struct vertex_table_t : public element_table_t {
+  column_t<point_index_t> point_index;
+  column_t<edge_index_t> edge_index;
+};
+
+struct point_table_t : public element_table_t {
+  column_t<position_t> position;
+};
 
 /**
- * Provide whatever functions needed to perform basic mesh operations at
- * a higher level.
+   Maps an index type onto the element and table types it refers to so that
+   generic code can reach the right table for any index.
  */
-class mesh_modifier_t {
-protected:
-  mesh_t& _mesh;
-  mesh_modifier_t(mesh_t& mesh);
+template<typename TIndex> struct element_traits_t;
 
-  vertex_index_t make_vertex(point_index_t pindex);
-  void update_vertex(vertex_index_t vindex, edge_index_t eindex);
+template<> struct element_traits_t<edge_index_t> {
+  using element_type = edge_t;
+  using table_type = edge_table_t;
+  template<typename TKernel>
+  static table_type table(TKernel& kernel) { return kernel.edge_table(); }
+};
 
-  edge_index_t make_edge(vertex_index_t vindex);
-  edge_index_t make_edge(vertex_index_t vindex, edge_index_t prev_eindex);
-  void set_next_edge(edge_index_t prev_eindex, edge_index_t next_eindex);
-  void set_prev_edge(edge_index_t prev_eindex, edge_index_t next_eindex);
-  void connect_edges(edge_index_t prev_eindex, edge_index_t next_eindex);
+template<> struct element_traits_t<face_index_t> {
+  using element_type = face_t;
+  using table_type = face_table_t;
+  template<typename TKernel>
+  static table_type table(TKernel& kernel) { return kernel.face_table(); }
 };
 
-/**
- * A simple interface for constructing edge loops originating at the
- * specified point.
- */
-class edge_loop_builder_t : public mesh_modifier_t {
-  edge_index_t _root_eindex;
-  edge_index_t _last_eindex;
-public:
-  edge_loop_builder_t(mesh_t& mesh, point_index_t root_pindex);
-  edge_loop_builder_t(mesh_t& mesh, edge_index_t root_eindex);
-  bool add_point(point_index_t next_pindex);
-  edge_index_t close();
+template<> struct element_traits_t<vertex_index_t> {
+  using element_type = vertex_t;
+  using table_type = vertex_table_t;
+  template<typename TKernel>
+  static table_type table(TKernel& kernel) { return kernel.vertex_table(); }
+};
+
+template<> struct element_traits_t<point_index_t> {
+  using element_type = point_t;
+  using table_type = point_table_t;
+  template<typename TKernel>
+  static table_type table(TKernel& kernel) { return kernel.point_table(); }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Circulators walk the cycles of edges around faces, vertices and edges.
+
 /**
-   Mesh can do a great deal of work on it's own as long as the kernel implements
-   a couple of principle functions related to data storage.
+   The walks define how a circulator steps from one edge of its cycle to the
+   next, the projections what it yields for each edge.
+
+   Around a face the cycle simply follows the next edges. Around a vertex it
+   visits the outgoing edges, stepping from an edge to the adjacent edge of the
+   one before it. Around an edge it alternates between the edge and its
+   adjacent edge.
  */
-class mesh_t {
-  uint16_t tag;
-public:
-  mesh_t();
-  mesh_t(kernel_t::ptr_t&&);
+struct face_loop_walk_t {
+  static edge_index_t step(const edge_table_t& edges, edge_index_t eindex) {
+    return edges.next_index[eindex.offset];
+  }
+};
 
-  size_t point_count() const;
-  size_t vertex_count() const;
-  size_t edge_count() const;
-  size_t face_count() const;
+struct vertex_ring_walk_t {
+  static edge_index_t step(const edge_table_t& edges, edge_index_t eindex) {
+    auto prev = edges.prev_index[eindex.offset];
+    return edges.contains(prev) ? edges.adjacent_index[prev.offset] : edge_index_t();
+  }
 
-  edge_fn_t edge(edge_index_t index) const;
-  face_fn_t face(face_index_t index) const;
+  /**
+     Steps the opposite way round, needed to find where a ring around a
+     boundary vertex starts.
+   */
+  static edge_index_t step_back(const edge_table_t& edges, edge_index_t eindex) {
+    auto adjacent = edges.adjacent_index[eindex.offset];
+    return edges.contains(adjacent) ? edges.next_index[adjacent.offset] : edge_index_t();
+  }
+};
+
+struct edge_pair_walk_t {
+  static edge_index_t step(const edge_table_t& edges, edge_index_t eindex) {
+    return edges.adjacent_index[eindex.offset];
+  }
+};
+
+struct edge_projection_t {
+  using value_type = edge_index_t;
+  static value_type project(const edge_table_t&, edge_index_t eindex) {
+    return eindex;
+  }
+};
+
+struct vertex_projection_t {
+  using value_type = vertex_index_t;
+  static value_type project(const edge_table_t& edges, edge_index_t eindex) {
+    return edges.vertex_index[eindex.offset];
+  }
+};
+
+struct face_projection_t {
+  using value_type = face_index_t;
+  static value_type project(const edge_table_t& edges, edge_index_t eindex) {
+    return edges.face_index[eindex.offset];
+  }
+};
+
+/**
+   Forward iterator over one cycle of edges. It ends when the walk returns to
+   the edge it started from or runs into a missing edge, which is how rings
+   around boundary vertices end. The number of steps is capped at the size of
+   the edge table so a malformed cycle can't loop forever.
+ */
+template<typename TWalk, typename TProjection>
+class circulator_t {
+  using value_t = typename TProjection::value_type;
+
+  const edge_table_t* _edges;
+  edge_index_t _start;
+  edge_index_t _current;
+  value_t _value;
+  size_t _steps;
+
+  void update() {
+    _value = _current ? TProjection::project(*_edges, _current) : value_t();
+  }
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = value_t;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const value_t*;
+  using reference = const value_t&;
+
+  circulator_t() noexcept
+    : _edges(nullptr), _start(), _current(), _value(), _steps(0)
+  {}
+
+  circulator_t(const edge_table_t* edges, edge_index_t start)
+    : _edges(edges), _start(start), _current(start), _value(), _steps(0)
+  {
+    update();
+  }
+
+  reference operator*() const {
+    return _value;
+  }
+  pointer operator->() const {
+    return &_value;
+  }
+
+  circulator_t& operator++() {
+    auto next = TWalk::step(*_edges, _current);
+    if (!next || next == _start || !_edges->contains(next) || ++_steps >= _edges->size) {
+      next.reset();
+    }
+    _current = next;
+    update();
+    return *this;
+  }
+  circulator_t operator++(int) {
+    auto it = *this;
+    ++(*this);
+    return it;
+  }
+
+  /**
+     The edge the circulator is currently on.
+   */
+  edge_index_t edge() const {
+    return _current;
+  }
+
+  friend bool operator==(const circulator_t& lhs, const circulator_t& rhs) {
+    return lhs._current == rhs._current;
+  }
+  friend bool operator!=(const circulator_t& lhs, const circulator_t& rhs) {
+    return !(lhs == rhs);
+  }
+};
+
+/**
+   A cycle of edges starting at a given edge. The range keeps its own copy of
+   the edge table so it has to outlive the circulators taken from it.
+ */
+template<typename TWalk, typename TProjection>
+class circulator_range_t {
+  edge_table_t _edges;
+  edge_index_t _start;
+public:
+  using iterator = circulator_t<TWalk, TProjection>;
+  using const_iterator = iterator;
+
+  circulator_range_t()
+    : _edges(), _start()
+  {}
+
+  circulator_range_t(const edge_table_t& edges, edge_index_t start)
+    : _edges(edges), _start(edges.contains(start) ? start : edge_index_t())
+  {}
+
+  iterator begin() const {
+    return iterator(&_edges, _start);
+  }
+  iterator end() const {
+    return iterator(&_edges, edge_index_t());
+  }
+  bool empty() const {
+    return !_start;
+  }
+};
+
+/**
+   Rings around boundary vertices have to start at the outgoing edge without
+   an adjacent edge, otherwise the walk would stop halfway round.
+ */
+inline edge_index_t find_ring_start(const edge_table_t& edges, edge_index_t start) {
+  if (!start || !edges.contains(start)) {
+    return edge_index_t();
+  }
+  auto eindex = start;
+  for (size_t steps = 0; steps < edges.size; ++steps) {
+    auto prev = vertex_ring_walk_t::step_back(edges, eindex);
+    if (!prev || prev == start) {
+      break;
+    }
+    eindex = prev;
+  }
+  return eindex;
+}
+
+using face_edge_range_t = circulator_range_t<face_loop_walk_t, edge_projection_t>;
+using face_vertex_range_t = circulator_range_t<face_loop_walk_t, vertex_projection_t>;
+using vertex_edge_range_t = circulator_range_t<vertex_ring_walk_t, edge_projection_t>;
+using vertex_face_range_t = circulator_range_t<vertex_ring_walk_t, face_projection_t>;
+using edge_face_range_t = circulator_range_t<edge_pair_walk_t, face_projection_t>;
+
+////////////////////////////////////////////////////////////////////////////////
+// Face geometry
+
+/**
+   The position an edge starts from, or the origin when any index on the way
+   there is stale.
+ */
+inline position_t corner_position(const edge_table_t& edges, const vertex_table_t& vertices,
+                                  const point_table_t& points, edge_index_t eindex) {
+  if (edges.contains(eindex)) {
+    auto vindex = edges.vertex_index[eindex.offset];
+    if (vertices.contains(vindex)) {
+      auto pindex = vertices.point_index[vindex.offset];
+      if (points.contains(pindex)) {
+        return points.position[pindex.offset];
+      }
+    }
+  }
+  return position_t(0.f, 0.f, 0.f);
+}
+
+/**
+   The normal of a face scaled by its area. Polygons are fanned around their
+   first corner, which is exact as long as they are planar.
+ */
+inline position_t face_vector_area(const edge_table_t& edges, const vertex_table_t& vertices,
+                                   const point_table_t& points, edge_index_t first) {
+  position_t sum(0.f, 0.f, 0.f);
+  if (!edges.contains(first)) {
+    return sum;
+  }
+  auto origin = corner_position(edges, vertices, points, first);
+  auto eindex = edges.next_index[first.offset];
+  for (size_t steps = 0; steps < edges.size && eindex != first && edges.contains(eindex); ++steps) {
+    auto next = edges.next_index[eindex.offset];
+    if (!next || next == first || !edges.contains(next)) {
+      break;
+    }
+    auto b = corner_position(edges, vertices, points, eindex) - origin;
+    auto c = corner_position(edges, vertices, points, next) - origin;
+    sum += position_t::CrossProduct(b, c);
+    eindex = next;
+  }
+  return sum * 0.5f;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// "Function sets" proxy the mesh and elements and provide an easy access api
+
+/**
+   We have this simple templated base class which allows functions that request
+   an alement to return an "empty" proxy. An alternative to this would be to
+   use std::optional but it seems like this would be sufficient for now.
+
+   The function sets are templated on the kernel so that traversals against a
+   concrete (final) kernel resolve the tables without any virtual dispatch and
+   inline down to indexing into the element storage. The edge_fn_t, face_fn_t
+   and vertex_fn_t aliases work against any kernel through kernel_t.
+ */
+template<typename TKernel, typename TIndex, typename TElement>
+class element_fn_t {
+protected:
+  using table_t = typename element_traits_t<TIndex>::table_type;
+
+  TKernel* _kernel;
+  TIndex _index;
+
+  table_t table() const {
+    return element_traits_t<TIndex>::table(*_kernel);
+  }
+
+  template<typename TField>
+  TField field(column_t<TField> table_t::*column) const {
+    if (_kernel != nullptr) {
+      auto elem = table();
+      if (elem.validate(_index)) {
+        return (elem.*column)[_index.offset];
+      }
+      elem.validator.empty_function_set();
+    }
+    return TField();
+  }
+public:
+  explicit element_fn_t(TKernel* kernel, TIndex index)
+    : _kernel(kernel), _index(index)
+  {}
+
+  explicit operator bool() const noexcept {
+    return _kernel != nullptr && (bool)_index && table().contains(_index);
+  }
+
+  /**
+     Direct access to the element structure, this is nullptr for kernels which
+     don't store whole elements.
+   */
+  TElement* element() const {
+    if (_kernel != nullptr) {
+      return _kernel->get(_index);
+    }
+    else {
+      return nullptr;
+    }
+  }
+
+  TIndex index() {
+    return _index;
+  }
+};
+
+template<typename TKernel>
+class basic_edge_fn_t : public element_fn_t<TKernel, edge_index_t, edge_t> {
+public:
+  using element_fn_t<TKernel, edge_index_t, edge_t>::element_fn_t;
+
+  basic_vertex_fn_t<TKernel> vertex() const {
+    return basic_vertex_fn_t<TKernel>(this->_kernel, this->field(&edge_table_t::vertex_index));
+  }
+  basic_face_fn_t<TKernel> face() const {
+    return basic_face_fn_t<TKernel>(this->_kernel, this->field(&edge_table_t::face_index));
+  }
+  basic_edge_fn_t next() const {
+    return basic_edge_fn_t(this->_kernel, this->field(&edge_table_t::next_index));
+  }
+  basic_edge_fn_t prev() const {
+    return basic_edge_fn_t(this->_kernel, this->field(&edge_table_t::prev_index));
+  }
+  basic_edge_fn_t adjacent() const {
+    return basic_edge_fn_t(this->_kernel, this->field(&edge_table_t::adjacent_index));
+  }
+
+  bool is_boundary() const {
+    if (*this) {
+      auto adjacent_face = adjacent().face();
+      if (adjacent_face) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+     The face of this edge followed by the face on the other side, if any.
+   */
+  edge_face_range_t faces() const {
+    if (this->_kernel == nullptr) {
+      return edge_face_range_t();
+    }
+    return edge_face_range_t(this->table(), this->_index);
+  }
+};
+
+template<typename TKernel>
+class basic_face_fn_t : public element_fn_t<TKernel, face_index_t, face_t> {
+public:
+  using element_fn_t<TKernel, face_index_t, face_t>::element_fn_t;
+
+  basic_edge_fn_t<TKernel> edge() const {
+    return basic_edge_fn_t<TKernel>(this->_kernel, this->field(&face_table_t::edge_index));
+  }
+
+  face_edge_range_t edges() const {
+    if (this->_kernel == nullptr) {
+      return face_edge_range_t();
+    }
+    return face_edge_range_t(this->_kernel->edge_table(), edge().index());
+  }
+
+  face_vertex_range_t vertices() const {
+    if (this->_kernel == nullptr) {
+      return face_vertex_range_t();
+    }
+    return face_vertex_range_t(this->_kernel->edge_table(), edge().index());
+  }
+
+  float area() const {
+    return vector_area().Length();
+  }
+
+  /**
+     The unit normal of the face, zero for degenerate faces.
+   */
+  position_t normal() const {
+    auto vector = vector_area();
+    auto length = vector.Length();
+    return length > 0.f ? vector / length : vector;
+  }
+
+private:
+  position_t vector_area() const {
+    if (this->_kernel == nullptr) {
+      return position_t(0.f, 0.f, 0.f);
+    }
+    return face_vector_area(this->_kernel->edge_table(), this->_kernel->vertex_table(),
+                            this->_kernel->point_table(), edge().index());
+  }
+};
+
+template<typename TKernel>
+class basic_vertex_fn_t : public element_fn_t<TKernel, vertex_index_t, vertex_t> {
+public:
+  using element_fn_t<TKernel, vertex_index_t, vertex_t>::element_fn_t;
+
+  basic_edge_fn_t<TKernel> edge() const {
+    return basic_edge_fn_t<TKernel>(this->_kernel, this->field(&vertex_table_t::edge_index));
+  }
+
+  /**
+     The outgoing edges around the vertex. On the boundary the ring starts at
+     the outgoing edge that has no adjacent edge and ends at the last one.
+   */
+  vertex_edge_range_t outgoing_edges() const {
+    if (this->_kernel == nullptr) {
+      return vertex_edge_range_t();
+    }
+    auto edges = this->_kernel->edge_table();
+    return vertex_edge_range_t(edges, find_ring_start(edges, edge().index()));
+  }
+
+  vertex_face_range_t faces() const {
+    if (this->_kernel == nullptr) {
+      return vertex_face_range_t();
+    }
+    auto edges = this->_kernel->edge_table();
+    return vertex_face_range_t(edges, find_ring_start(edges, edge().index()));
+  }
+
+  point_index_t point_index() const {
+    return this->field(&vertex_table_t::point_index);
+  }
+
+  point_t* point() const {
+    auto pindex = point_index();
+    return pindex ? this->_kernel->get(pindex) : nullptr;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Element ranges
+
+/**
+   Iterates the active cells of an element table and yields their indices.
+   Skipping over the inactive cells left behind by remove() can't be done in
+   constant time so this is a bidirectional iterator. For data parallel passes
+   split the range by storage cells instead, see element_range_t::slice().
+   Like the tables it's only valid until the next emplace on the kernel.
+ */
+template<typename TIndex>
+class element_iterator_t {
+  column_t<element_t> _element;
+  offset_t _begin;
+  offset_t _end;
+  TIndex _current;
+
+  bool is_active(offset_t offset) const {
+    return _element[offset].status == element_status_t::ACTIVE;
+  }
+
+  void seek(offset_t offset) {
+    while (offset < _end && !is_active(offset)) {
+      ++offset;
+    }
+    _current = TIndex(offset, offset < _end ? _element[offset].generation : 0);
+  }
+public:
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = TIndex;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const TIndex*;
+  // Indices are handed out by value, a reference into the iterator would
+  // dangle once std::reverse_iterator dereferences its temporary copy.
+  using reference = TIndex;
+
+  element_iterator_t() noexcept
+    : _begin(0), _end(0), _current()
+  {}
+
+  element_iterator_t(column_t<element_t> element, offset_t begin, offset_t end, offset_t offset)
+    : _element(element), _begin(begin), _end(end), _current()
+  {
+    seek(offset);
+  }
+
+  reference operator*() const {
+    return _current;
+  }
+  pointer operator->() const {
+    return &_current;
+  }
+
+  element_iterator_t& operator++() {
+    seek(_current.offset + 1);
+    return *this;
+  }
+  element_iterator_t operator++(int) {
+    auto it = *this;
+    ++(*this);
+    return it;
+  }
+  /**
+     Steps back to the previous active cell. There's none before begin(), so
+     decrementing begin() leaves it where it is rather than landing on a cell
+     that isn't active.
+   */
+  element_iterator_t& operator--() {
+    for (offset_t offset = _current.offset; offset > _begin;) {
+      --offset;
+      if (is_active(offset)) {
+        _current = TIndex(offset, _element[offset].generation);
+        break;
+      }
+    }
+    return *this;
+  }
+  element_iterator_t operator--(int) {
+    auto it = *this;
+    --(*this);
+    return it;
+  }
+
+  friend bool operator==(const element_iterator_t& lhs, const element_iterator_t& rhs) {
+    return lhs._current.offset == rhs._current.offset;
+  }
+  friend bool operator!=(const element_iterator_t& lhs, const element_iterator_t& rhs) {
+    return !(lhs == rhs);
+  }
+};
+
+/**
+   The active elements of one type within a span of storage cells, by default
+   every cell but the reserved first one. Splitting a range into slices is
+   constant time which is what the parallel helpers use to divide the work.
+ */
+template<typename TIndex>
+class element_range_t {
+  column_t<element_t> _element;
+  offset_t _first;
+  offset_t _last;
+public:
+  using iterator = element_iterator_t<TIndex>;
+  using const_iterator = iterator;
+
+  explicit element_range_t(const element_table_t& table)
+    : _element(table.element), _first(1), _last(std::max<offset_t>(1, table.size))
+  {}
+
+  element_range_t(column_t<element_t> element, offset_t first, offset_t last)
+    : _element(element), _first(first), _last(last)
+  {}
+
+  iterator begin() const {
+    return iterator(_element, _first, _last, _first);
+  }
+  iterator end() const {
+    return iterator(_element, _first, _last, _last);
+  }
+  bool empty() const {
+    return begin() == end();
+  }
+
+  /**
+     Number of storage cells spanned, an upper bound on the number of elements.
+   */
+  size_t cells() const {
+    return _last - _first;
+  }
+
+  /**
+     The sub-range over cells [first, last) relative to the start of this range.
+   */
+  element_range_t slice(size_t first, size_t last) const {
+    return element_range_t(_element,
+                           _first + std::min(first, cells()),
+                           _first + std::min(last, cells()));
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Provide whatever functions needed to perform basic mesh operations at
+ * a higher level. Edits are recorded by the mesh's open transaction, if any.
+ */
+class mesh_modifier_t {
+protected:
+  mesh_t& _mesh;
+  mesh_modifier_t(mesh_t& mesh);
+
+  vertex_index_t make_vertex(point_index_t pindex);
+  void update_vertex(vertex_index_t vindex, edge_index_t eindex);
+
+  edge_index_t make_edge(vertex_index_t vindex);
+  edge_index_t make_edge(vertex_index_t vindex, edge_index_t prev_eindex);
+  void set_next_edge(edge_index_t prev_eindex, edge_index_t next_eindex);
+  void set_prev_edge(edge_index_t prev_eindex, edge_index_t next_eindex);
+  void connect_edges(edge_index_t prev_eindex, edge_index_t next_eindex);
+};
+
+/**
+ * A simple interface for constructing edge loops originating at the
+ * specified point.
+ */
+class edge_loop_builder_t : public mesh_modifier_t {
+  edge_index_t _root_eindex;
+  edge_index_t _last_eindex;
+public:
+  edge_loop_builder_t(mesh_t& mesh, point_index_t root_pindex);
+  edge_loop_builder_t(mesh_t& mesh, edge_index_t root_eindex);
+  bool add_point(point_index_t next_pindex);
+  edge_index_t close();
+};
+
+/**
+   Mesh can do a great deal of work on it's own as long as the kernel implements
+   a couple of principle functions related to data storage.
+ */
+class mesh_t {
+  uint16_t tag;
+public:
+  mesh_t();
+  mesh_t(kernel_t::ptr_t&&);
+
+  size_t point_count() const;
+  size_t vertex_count() const;
+  size_t edge_count() const;
+  size_t face_count() const;
+
+  edge_fn_t edge(edge_index_t index) const;
+  face_fn_t face(face_index_t index) const;
   vertex_fn_t vertex(vertex_index_t index) const;
 
   point_t* point(offset_t offset) const;
@@ -275,6 +1522,11 @@ public:
 
   std::pair<point_t*, point_t*> points(edge_index_t eindex) const;
 
+  element_range_t<edge_index_t> edges() const;
+  element_range_t<face_index_t> faces() const;
+  element_range_t<vertex_index_t> vertices() const;
+  element_range_t<point_index_t> points() const;
+
   point_index_t add_point(float x, float y, float z);
   edge_index_t add_edge(point_index_t p0, point_index_t p1);
 
@@ -284,7 +1536,694 @@ public:
 
   face_index_t add_face(edge_index_t root_eindex);
 
+  /**
+     Builds faces from an indexed polygon buffer in a handful of linear passes.
+     Each face consumes face_sizes[i] consecutive entries of indices, which refer
+     to positions. An empty face_sizes means every face is a triangle. Every
+     referenced position gets a single vertex, and edges shared by two faces
+     have their adjacent indices linked. Returns false without modifying the
+     mesh if the buffers are inconsistent.
+   */
+  bool build_from_indexed(const std::vector<position_t>& positions,
+                          const std::vector<uint32_t>& indices,
+                          const std::vector<uint32_t>& face_sizes = {});
+
+  /**
+     The transaction recording the edits to this mesh, if one is open.
+   */
+  transaction_t* transaction() const;
+
+  /**
+     Attaches a column of values called name to the elements the index type
+     refers to, every cell starting out as initial. UVs, colors, normals and
+     the like live here rather than in the elements so traversals don't drag
+     them through the cache. Fails with an empty handle when an element type
+     already has a property by that name.
+   */
+  template<typename TIndex, typename T>
+  property_t<TIndex, T> add_property(const std::string& name, const T& initial = T()) {
+    return kernel->properties().columns(TIndex()).add(name, cell_count(TIndex()), initial);
+  }
+
+  /**
+     The property called name, or an empty handle when there's no such
+     property with values of type T.
+   */
+  template<typename TIndex, typename T>
+  property_t<TIndex, T> property(const std::string& name) const {
+    return kernel->properties().columns(TIndex()).template find<T>(name);
+  }
+
+  template<typename TIndex>
+  bool remove_property(const std::string& name) {
+    return kernel->properties().columns(TIndex()).remove(name);
+  }
+
   kernel_t::ptr_t kernel;
+
+private:
+  friend class transaction_t;
+  transaction_t* open_transaction;
+
+  size_t cell_count(edge_index_t) const;
+  size_t cell_count(face_index_t) const;
+  size_t cell_count(vertex_index_t) const;
+  size_t cell_count(point_index_t) const;
+};
+
+/**
+   The edits recorded by a transaction, enough to take them back or make them
+   again. For every element type it keeps the order cells were created and
+   removed in, which undo() walks backwards through the kernel's retract()
+   and restore() and redo() walks forwards through restore() and remove(),
+   and one image of each touched cell from before its first edit and after
+   its last.
+
+   A delta only applies to the mesh as it left it (undo) or found it (redo),
+   so deltas have to be undone newest first and redone oldest first with no
+   unrecorded edits in between. Replays check the element counts and the
+   touched cells first and refuse with an error when the mesh has moved on;
+   a redo that still finds a cell out of place takes back what it replayed.
+   Compacting or reordering the kernel renumbers the cells and so leaves
+   every delta taken before it unusable.
+ */
+class mesh_delta_t {
+  template<typename TIndex>
+  struct journal_t {
+    using element_type = typename element_traits_t<TIndex>::element_type;
+    struct change_t {
+      offset_t offset;
+      uint32_t generation;
+      bool created;
+    };
+    struct image_t {
+      offset_t offset;
+      element_type before;
+      element_type after;
+    };
+    std::vector<change_t> changes;
+    std::vector<image_t> images;
+    size_t count_before;
+    size_t count_after;
+
+    journal_t() : count_before(0), count_after(0) {}
+  };
+
+  journal_t<edge_index_t> _edges;
+  journal_t<face_index_t> _faces;
+  journal_t<vertex_index_t> _vertices;
+  journal_t<point_index_t> _points;
+
+  journal_t<edge_index_t>& journal(edge_index_t) { return _edges; }
+  journal_t<face_index_t>& journal(face_index_t) { return _faces; }
+  journal_t<vertex_index_t>& journal(vertex_index_t) { return _vertices; }
+  journal_t<point_index_t>& journal(point_index_t) { return _points; }
+
+  bool matches(kernel_t& kernel, bool after) const;
+  friend class transaction_t;
+public:
+  bool undo(mesh_t& mesh) const;
+  bool redo(mesh_t& mesh) const;
+
+  bool empty() const;
+
+  /**
+     Memory held by the recorded changes and images.
+   */
+  size_t bytes() const;
+};
+
+/**
+   Records the edits made to a mesh until it's committed or rolled back.
+   While it's open the editing functions of the mesh and mesh_modifier_t
+   record through it. Anything else has to emplace and remove through the
+   transaction and touch() an element before writing to its fields, which
+   saves the cell the first time. A transaction that goes without being
+   committed rolls back. Only one transaction can be open on a mesh, a
+   second one reports the error and records nothing.
+ */
+class transaction_t {
+  mesh_t& _mesh;
+  bool _open;
+  mesh_delta_t _delta;
+  std::unordered_map<offset_t, size_t> _edge_slots;
+  std::unordered_map<offset_t, size_t> _face_slots;
+  std::unordered_map<offset_t, size_t> _vertex_slots;
+  std::unordered_map<offset_t, size_t> _point_slots;
+
+  std::unordered_map<offset_t, size_t>& slots(edge_index_t) { return _edge_slots; }
+  std::unordered_map<offset_t, size_t>& slots(face_index_t) { return _face_slots; }
+  std::unordered_map<offset_t, size_t>& slots(vertex_index_t) { return _vertex_slots; }
+  std::unordered_map<offset_t, size_t>& slots(point_index_t) { return _point_slots; }
+
+  template<typename TIndex> void save(TIndex index, bool created);
+  template<typename TIndex, typename TElement> TIndex record_emplace(TElement&& element);
+  template<typename TIndex> void record_remove(TIndex index);
+public:
+  explicit transaction_t(mesh_t& mesh);
+  ~transaction_t();
+
+  transaction_t(const transaction_t&) = delete;
+  transaction_t& operator=(const transaction_t&) = delete;
+
+  edge_index_t emplace(edge_t&& edge);
+  face_index_t emplace(face_t&& face);
+  vertex_index_t emplace(vertex_t&& vertex);
+  point_index_t emplace(point_t&& point);
+
+  void remove(edge_index_t index);
+  void remove(face_index_t index);
+  void remove(vertex_index_t index);
+  void remove(point_index_t index);
+
+  void touch(edge_index_t index);
+  void touch(face_index_t index);
+  void touch(vertex_index_t index);
+  void touch(point_index_t index);
+
+  bool is_open() const;
+
+  /**
+     Ends the transaction keeping its edits, which the delta can undo.
+   */
+  mesh_delta_t commit();
+
+  /**
+     Ends the transaction taking its edits back.
+   */
+  void rollback();
+};
+
+/**
+   Outcome of linking adjacent half-edges. Edges that share their point pair
+   with more than one other edge, or whose only match runs in the same
+   direction, are non-manifold. Degenerate edges start and end on the same
+   point. Neither kind is linked.
+ */
+struct link_report_t {
+  size_t linked_pairs;
+  size_t boundary_edges;
+  std::vector<edge_index_t> non_manifold_edges;
+  std::vector<edge_index_t> degenerate_edges;
+
+  link_report_t() : linked_pairs(0), boundary_edges(0) {}
+};
+
+/**
+   Recomputes the adjacent index of every active edge in the mesh by matching
+   opposite half-edges on their (from point, to point) keys. The keys are
+   partitioned by hash across thread_count threads (zero meaning one per core)
+   and every partition is sorted and paired independently. Only the edges
+   whose link changes are written, and touched first in the open transaction
+   if there is one.
+ */
+link_report_t link_adjacent_edges(mesh_t& mesh, size_t thread_count = 0);
+
+struct weld_options_t {
+  /**
+     Points at most this far apart are merged, and so are points chained
+     together by such pairs. Zero only merges points at exactly the same
+     position.
+   */
+  float tolerance;
+  /**
+     Threads used to bucket, match and rewrite, zero meaning one per core.
+   */
+  size_t thread_count;
+
+  weld_options_t() : tolerance(0.f), thread_count(0) {}
+};
+
+struct weld_report_t {
+  size_t merged_points;
+  size_t merged_vertices;
+
+  weld_report_t() : merged_points(0), merged_vertices(0) {}
+};
+
+/**
+   Merges coincident points, such as the corners of a triangle soup. The
+   points are bucketed into a uniform grid with cells as wide as the
+   tolerance, the cells partitioned by hash across the threads and every
+   partition matched on its own. Each group of merged points keeps the one
+   with the lowest offset, position included, and the others are removed.
+   The vertices of a group fold into its lowest vertex the same way, which
+   the edges are pointed at, so every welded point ends up with a single
+   vertex like a mesh built from indices.
+
+   Follow up with link_adjacent_edges() to connect the faces that now share
+   points. Inside an open transaction the rewrites and removals are recorded
+   and done serially.
+ */
+weld_report_t weld_points(mesh_t& mesh, const weld_options_t& options = weld_options_t());
+
+/**
+   How reorder_for_locality() lays out a mesh. Morton sorts the faces along a
+   Z-order curve over their centroids, breadth first follows the adjacency
+   from face to face. Either way the edges then follow the face loops, the
+   vertices the edges and the points the vertices.
+ */
+enum class locality_order_t : uint8_t {
+  morton, breadth_first
+};
+
+/**
+   Renumbers the elements of the mesh so that neighbours sit close together in
+   memory, patching every stored index. Indices held outside of the mesh have
+   to go through the returned table.
+ */
+remap_table_t reorder_for_locality(mesh_t& mesh, locality_order_t order = locality_order_t::morton);
+
+struct simplify_options_t {
+  /**
+     Stop once the mesh is down to this many faces.
+   */
+  size_t target_faces;
+  /**
+     Stop before the first collapse whose error, the summed squared distance
+     of the new position to the planes merged into it, goes over this.
+   */
+  double max_error;
+  /**
+     Weight of the planes that hold boundary edges in place relative to the
+     planes of the faces.
+   */
+  double boundary_weight;
+  /**
+     Partitions simplified side by side before a serial pass finishes the
+     job, zero meaning one per core. One keeps the whole run serial. On a
+     versioned kernel with snapshots alive, partitions copy every shared page
+     of the edges, vertices and points up front where a serial run copies
+     only the pages it writes.
+   */
+  size_t thread_count;
+
+  simplify_options_t() : target_faces(0), max_error(DBL_MAX), boundary_weight(1000.0), thread_count(1) {}
+};
+
+struct simplify_report_t {
+  size_t collapses;
+  size_t faces_before;
+  size_t faces_after;
+  double max_error;
+
+  simplify_report_t() : collapses(0), faces_before(0), faces_after(0), max_error(0.0) {}
+};
+
+/**
+   Collapses edges in order of their quadric error until the target face count
+   or the error bound is reached. Every vertex carries the quadric of the
+   planes around it, the cheapest edge goes first and the surviving vertex
+   moves to the position minimizing the merged quadric. The queue is never
+   updated in place: entries hold the edge with its generation and the stamps
+   of both vertices, and are dropped when popped stale. Collapses that break
+   the link condition, fold a face over or would close up a hole are skipped.
+   Only triangles are collapsed and the mesh needs its adjacent edges linked.
+
+   With more than one thread the points are cut into slabs along the longest
+   axis of the mesh and every slab is simplified on its own, touching only
+   faces whose vertices all lie inside of it. Removals are held back until
+   the slabs are done, then the remaining faces go through the serial pass.
+   Runs inside an open transaction record their edits and stay serial.
+ */
+simplify_report_t simplify(mesh_t& mesh, const simplify_options_t& options = simplify_options_t());
+
+/**
+   One level of subdivision written into result, which has to be empty and
+   brings the kernel to use. The sizes of the result follow from the counts
+   of the mesh, so its storage is reserved and its cells emplaced up front,
+   after which thread_count threads (zero meaning one per core) fill them in.
+   Where everything goes is worked out from the offsets of the elements it
+   comes from, every edge or face of the mesh owning a fixed block of the
+   result, so the output is the same for any thread count. Elements are
+   numbered even vertices first, then edge points (then face points), and
+   come out linked.
+
+   Loop subdivision splits every triangle into four and only takes triangle
+   meshes. Catmull-Clark takes any polygons and gives a quad for every corner.
+   Boundaries are kept as cubic curves. Returns false and logs the reason when
+   the mesh or the result can't be used.
+ */
+bool subdivide_loop(mesh_t& mesh, mesh_t& result, size_t thread_count = 0);
+bool subdivide_catmull_clark(mesh_t& mesh, mesh_t& result, size_t thread_count = 0);
+
+/**
+   Quickhull straight into a closed triangle mesh with a vertex and a point
+   for every corner of the hull. Every point outside the hull sits in the
+   conflict list of the first face it's in front of, found by testing four
+   points at a time against each plane. The furthest point of a face is
+   added next: the faces it can see are removed and a cone from their
+   horizon to the point takes their place, reusing the cells the removed
+   faces, edges and inner vertices freed up. Points within a small tolerance
+   of the hull, scaled to the extent of the input, count as inside.
+
+   build_convex_hull() needs an empty mesh and four points off a plane.
+   extend_convex_hull() adds points to a hull built before (or any closed,
+   convex triangle mesh, whether its corners share vertices or not). Points
+   and vertices go only once no face left uses them. Both return false and
+   log the reason when they can't be used. Edits go through the open
+   transaction if there is one.
+ */
+bool build_convex_hull(mesh_t& hull, const std::vector<position_t>& points);
+bool extend_convex_hull(mesh_t& hull, const std::vector<position_t>& points);
+
+/**
+   Writes the element storage of any kernel in the layout of the basic kernel,
+   free cells included, so the file can be mapped back by make_mapped_kernel().
+ */
+bool save_binary(mesh_t& mesh, const std::string& path);
+
+struct import_options_t {
+  /**
+     STL stores every triangle with its own corners, welding merges corners
+     at exactly the same position so the triangles end up connected.
+   */
+  bool weld_stl;
+  /**
+     Threads used to parse text formats, zero meaning one per core.
+   */
+  size_t thread_count;
+
+  import_options_t() : weld_stl(false), thread_count(0) {}
+};
+
+/**
+   Importers for OBJ, PLY (ascii and binary) and STL (ascii and binary). These
+   don't stream: the whole file is read into memory and parsed into per chunk
+   buffers, in parallel for the text formats, which are then merged into one
+   set of indexed buffers for mesh_t::build_from_indexed(). That reserves the
+   kernel storage once and links adjacent edges at the end. Peak memory is the
+   file plus two copies of its positions and indices, before the kernel's own
+   storage. Only positions and faces are read. Returns false and leaves the
+   mesh alone when the file can't be read or parsed.
+ */
+bool import_obj(mesh_t& mesh, const std::string& path, const import_options_t& options = import_options_t());
+bool import_ply(mesh_t& mesh, const std::string& path, const import_options_t& options = import_options_t());
+bool import_stl(mesh_t& mesh, const std::string& path, const import_options_t& options = import_options_t());
+
+/**
+   Picks the importer from the file extension.
+ */
+bool import_mesh(mesh_t& mesh, const std::string& path, const import_options_t& options = import_options_t());
+
+/**
+   Batch geometry for a whole mesh, meant to be rerun on every deformed frame.
+   Results go into caller provided arrays indexed by cell offset, so they need
+   room for every cell of the face or vertex storage (the size of its table)
+   and removed cells come back as zero. Faces are processed four at a time
+   with vectorial's SIMD types, which fall back to scalar code on targets
+   without SSE or NEON.
+ */
+void compute_face_areas(mesh_t& mesh, float* areas, size_t thread_count = 0);
+void compute_face_normals(mesh_t& mesh, position_t* normals, size_t thread_count = 0);
+
+/**
+   Area weighted vertex normals: every face adds its vector area to the
+   vertices of its loop before they are normalized.
+ */
+void compute_vertex_normals(mesh_t& mesh, position_t* normals, size_t thread_count = 0);
+
+/**
+   One vertex of an exported buffer: position and normal interleaved, which
+   is the layout of a vertex declaration with a float3 position and a float3
+   normal.
+ */
+struct gpu_vertex_t {
+  float position[3];
+  float normal[3];
+};
+
+/**
+   A half open range of vertices or indices, [begin, end).
+ */
+struct gpu_range_t {
+  size_t begin;
+  size_t end;
+};
+
+enum class gpu_index_format_t : uint8_t {
+  uint16, uint32
+};
+
+struct gpu_export_options_t {
+  /**
+     Use 16-bit indices while the vertex storage fits them, switching to
+     32-bit (with a full rebuild) once it grows past that.
+   */
+  bool allow_16bit_indices;
+  /**
+     Dirty vertices closer together than this many vertices are merged into
+     one range, trading a few rewritten vertices for fewer uploads.
+   */
+  size_t merge_gap;
+  /**
+     Threads used by full rebuilds, zero meaning one per core.
+   */
+  size_t thread_count;
+
+  gpu_export_options_t() : allow_16bit_indices(true), merge_gap(16), thread_count(0) {}
+};
+
+/**
+   Keeps renderable copies of a mesh: one vertex per vertex cell with its
+   area weighted normal, and the faces fanned into triangles in an index
+   buffer. Every face cell owns a fixed run of triangles in the index buffer,
+   so an edited face is rewritten in place; faces that outgrow their run move
+   to the end and leave degenerate triangles behind until the next rebuild.
+   Nothing here depends on a renderer.
+
+   update() compares the status and generation of every face and vertex cell
+   to the last export to find added and removed elements, which is a cheap
+   scan next to rewriting the buffers. Edits that keep the cells, moving a
+   point or relinking a face, have to be reported through mark_vertex() and
+   mark_face(). After each update the dirty ranges say which parts of the
+   buffers changed, ready to hand to the update of a dynamic buffer.
+ */
+class gpu_export_t {
+  struct cell_state_t {
+    element_status_t status;
+    uint32_t generation;
+  };
+  struct face_slot_t {
+    uint32_t first;
+    uint32_t capacity;
+    uint32_t count;
+  };
+
+  gpu_export_options_t _options;
+  gpu_index_format_t _format;
+  bool _rebuilt;
+  bool _invalid;
+  size_t _live_triangles;
+  std::vector<gpu_vertex_t> _vertices;
+  std::vector<uint16_t> _indices16;
+  std::vector<uint32_t> _indices32;
+  std::vector<face_slot_t> _slots;
+  std::vector<cell_state_t> _face_states;
+  std::vector<cell_state_t> _vertex_states;
+  std::vector<face_index_t> _marked_faces;
+  std::vector<vertex_index_t> _marked_vertices;
+  std::vector<gpu_range_t> _dirty_vertices;
+  std::vector<gpu_range_t> _dirty_indices;
+
+  void rebuild(mesh_t& mesh);
+  void write_face(const edge_table_t& edges, edge_index_t first, const face_slot_t& slot);
+  void write_index(size_t at, offset_t value);
+  void record_states(const face_table_t& faces, const vertex_table_t& vertices);
+public:
+  explicit gpu_export_t(const gpu_export_options_t& options = gpu_export_options_t());
+
+  /**
+     Brings the buffers up to date with the mesh. The first update, and any
+     update after invalidate(), an index format switch or when more than
+     half of the index buffer has gone to waste, rewrites everything.
+   */
+  void update(mesh_t& mesh);
+
+  /**
+     The face was changed in place, its triangles and the normals of its
+     corners get rewritten.
+   */
+  void mark_face(face_index_t findex);
+
+  /**
+     The point of the vertex moved, so it and the corners of every face
+     around it get rewritten.
+   */
+  void mark_vertex(vertex_index_t vindex);
+
+  void invalidate();
+
+  /**
+     Whether the last update rewrote the buffers from scratch, in which case
+     the dirty ranges cover all of them.
+   */
+  bool rebuilt() const;
+
+  const std::vector<gpu_vertex_t>& vertices() const;
+  gpu_index_format_t index_format() const;
+  size_t index_size() const;
+  size_t index_count() const;
+  const void* index_data() const;
+
+  /**
+     Sorted, non-overlapping ranges changed by the last update, in vertices
+     and indices.
+   */
+  const std::vector<gpu_range_t>& dirty_vertex_ranges() const;
+  const std::vector<gpu_range_t>& dirty_index_ranges() const;
+};
+
+struct ray_t {
+  position_t origin;
+  position_t direction;
+  float max_distance;
+
+  ray_t() : origin(0.f, 0.f, 0.f), direction(0.f, 0.f, 1.f), max_distance(FLT_MAX) {}
+  ray_t(const position_t& o, const position_t& d, float max = FLT_MAX) : origin(o), direction(d), max_distance(max) {}
+};
+
+/**
+   The nearest face along a ray, with the distance in lengths of the ray
+   direction. The face is empty when nothing was hit.
+ */
+struct ray_hit_t {
+  face_index_t face;
+  float distance;
+  position_t position;
+
+  ray_hit_t() : distance(FLT_MAX), position(0.f, 0.f, 0.f) {}
+};
+
+/**
+   The point on the mesh closest to a query point. The face is empty when
+   nothing was within the search distance.
+ */
+struct closest_point_t {
+  face_index_t face;
+  float distance;
+  position_t position;
+
+  closest_point_t() : distance(FLT_MAX), position(0.f, 0.f, 0.f) {}
+};
+
+struct bvh_options_t {
+  /**
+     Nodes with this many triangles or fewer aren't split any further.
+   */
+  size_t leaf_size;
+  /**
+     Buckets the centroids are sorted into along each axis when looking for
+     the split with the lowest surface area cost.
+   */
+  size_t bin_count;
+  /**
+     Threads used to build, refit and answer batches, zero meaning one per
+     core.
+   */
+  size_t thread_count;
+
+  bvh_options_t() : leaf_size(4), bin_count(16), thread_count(0) {}
+};
+
+/**
+   Bounding volume hierarchy over the faces of a mesh, polygons fanned into
+   triangles. Splits are chosen by binned surface area heuristic and the
+   subtrees below the top levels are built on their own threads. The
+   triangles are copied into leaf order so that queries don't go back to
+   the mesh, and every one keeps the handle of its face and the points of
+   its corners.
+
+   As long as the faces and their loops stay the same, refit() picks up
+   points that moved by reloading the corners and growing the boxes again
+   from the leaves up, the tree shape and face handles stay. Anything else
+   needs another build(). Queries can run from any number of threads while
+   nothing is building or refitting.
+ */
+class face_bvh_t {
+  struct node_t {
+    float lo[3];
+    uint32_t first;
+    float hi[3];
+    uint32_t count;
+  };
+  struct triangle_t {
+    float a[3];
+    float b[3];
+    float c[3];
+  };
+
+  bvh_options_t _options;
+  std::vector<node_t> _nodes;
+  std::vector<triangle_t> _triangles;
+  std::vector<face_index_t> _faces;
+  std::vector<point_index_t> _corners;
+
+  bool load_triangles(const point_table_t& points, size_t begin, size_t end);
+  void fit_nodes();
+public:
+  explicit face_bvh_t(const bvh_options_t& options = bvh_options_t());
+
+  void build(mesh_t& mesh);
+  /**
+     False when a corner point is gone from the mesh, its triangles keep
+     their old corners until the next build().
+   */
+  bool refit(mesh_t& mesh);
+
+  ray_hit_t intersect(const ray_t& ray) const;
+  closest_point_t closest_point(const position_t& point, float max_distance = FLT_MAX) const;
+
+  /**
+     Batches split across the threads of the options.
+   */
+  void intersect(const ray_t* rays, ray_hit_t* hits, size_t count) const;
+  void closest_points(const position_t* points, closest_point_t* results, size_t count,
+                      float max_distance = FLT_MAX) const;
+
+  size_t node_count() const;
+  size_t triangle_count() const;
+};
+
+/**
+   A mesh over a concrete kernel type. All of the construction api comes from
+   mesh_t but the function sets it hands out are bound to TKernel, so when the
+   kernel is final the traversal functions compile down to direct indexing.
+   The kernel must not be replaced through mesh_t::kernel.
+ */
+template<typename TKernel>
+class basic_mesh_t : public mesh_t {
+  TKernel* _kernel;
+public:
+  using edge_fn_t = basic_edge_fn_t<TKernel>;
+  using face_fn_t = basic_face_fn_t<TKernel>;
+  using vertex_fn_t = basic_vertex_fn_t<TKernel>;
+
+  /**
+     The arguments go to the kernel's constructor, e.g. an allocation_t for
+     basic_kernel_t.
+   */
+  template<typename... TArgs>
+  explicit basic_mesh_t(TArgs&&... args)
+    : mesh_t(kernel_t::ptr_t(new TKernel(std::forward<TArgs>(args)...), [](kernel_t* k) { delete k; }))
+    , _kernel(static_cast<TKernel*>(kernel.get()))
+  {}
+
+  TKernel& typed_kernel() const {
+    return *_kernel;
+  }
+
+  edge_fn_t edge(edge_index_t index) const {
+    return edge_fn_t(_kernel, index);
+  }
+
+  face_fn_t face(face_index_t index) const {
+    return face_fn_t(_kernel, index);
+  }
+
+  vertex_fn_t vertex(vertex_index_t index) const {
+    return vertex_fn_t(_kernel, index);
+  }
 };
 
 } // namespace hedge
@@ -0,0 +1,561 @@
+
+#include <easylogging++.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hedge.hpp"
+#include "hedge_kernel.hpp"
+
+INITIALIZE_EASYLOGGINGPP;
+
+////////////////////////////////////////////////////////////////////////////////
+// Every allocation goes through these so memory use can be reported per element.
+
+namespace {
+
+// The library allocates from its worker threads as well.
+std::atomic<size_t> live_bytes(0);
+const size_t allocation_header = 16;
+
+void* counted_alloc(size_t size) {
+  auto block = static_cast<char*>(std::malloc(size + allocation_header));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  *reinterpret_cast<size_t*>(block) = size;
+  live_bytes.fetch_add(size, std::memory_order_relaxed);
+  return block + allocation_header;
+}
+
+void counted_free(void* ptr) {
+  if (ptr != nullptr) {
+    auto block = static_cast<char*>(ptr) - allocation_header;
+    live_bytes.fetch_sub(*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+  }
+}
+
+#ifdef __cpp_aligned_new
+// Over-aligned blocks keep the size in the header right before them like the
+// others and the start of the malloc() block in the second half of it.
+void* counted_alloc(size_t size, std::align_val_t alignment) {
+  const size_t align = std::max(size_t(alignment), allocation_header);
+  auto block = static_cast<char*>(std::malloc(size + align + allocation_header));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  const uintptr_t start = reinterpret_cast<uintptr_t>(block) + allocation_header;
+  auto ptr = reinterpret_cast<char*>((start + align - 1) & ~(align - 1));
+  *reinterpret_cast<size_t*>(ptr - allocation_header) = size;
+  *reinterpret_cast<char**>(ptr - sizeof(char*)) = block;
+  live_bytes.fetch_add(size, std::memory_order_relaxed);
+  return ptr;
+}
+
+void counted_free(void* ptr, std::align_val_t) {
+  if (ptr != nullptr) {
+    auto header = static_cast<char*>(ptr);
+    live_bytes.fetch_sub(*reinterpret_cast<size_t*>(header - allocation_header), std::memory_order_relaxed);
+    std::free(*reinterpret_cast<char**>(header - sizeof(char*)));
+  }
+}
+#endif
+
+} // namespace
+
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return counted_alloc(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return counted_alloc(size, alignment); }
+void operator delete(void* ptr, std::align_val_t alignment) noexcept { counted_free(ptr, alignment); }
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept { counted_free(ptr, alignment); }
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept { counted_free(ptr, alignment); }
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept { counted_free(ptr, alignment); }
+#endif
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+// Synthetic meshes, all of them generated from fixed seeds so runs compare.
+// Random numbers come straight from mt19937, whose output the standard pins
+// down, the distributions of each standard library differ.
+
+struct indexed_mesh_t {
+  std::string name;
+  std::vector<hedge::position_t> positions;
+  std::vector<uint32_t> indices;
+
+  size_t face_count() const {
+    return indices.size() / 3;
+  }
+};
+
+indexed_mesh_t make_grid(size_t target_faces) {
+  indexed_mesh_t mesh;
+  mesh.name = "grid";
+  const uint32_t side = std::max<uint32_t>(1, uint32_t(std::ceil(std::sqrt(target_faces / 2.0))));
+  mesh.positions.reserve((side + 1) * (side + 1));
+  for (uint32_t y = 0; y <= side; ++y) {
+    for (uint32_t x = 0; x <= side; ++x) {
+      mesh.positions.emplace_back(float(x), float(y), 0.f);
+    }
+  }
+  mesh.indices.reserve(side * side * 6);
+  for (uint32_t y = 0; y < side; ++y) {
+    for (uint32_t x = 0; x < side; ++x) {
+      uint32_t i = y * (side + 1) + x;
+      mesh.indices.insert(mesh.indices.end(), { i, i + 1, i + side + 2, i, i + side + 2, i + side + 1 });
+    }
+  }
+  return mesh;
+}
+
+/**
+   Subdivides an icosahedron until it has the face count closest to the target,
+   every level multiplies the faces by four.
+ */
+indexed_mesh_t make_icosphere(size_t target_faces) {
+  indexed_mesh_t mesh;
+  mesh.name = "icosphere";
+  const float t = (1.f + std::sqrt(5.f)) / 2.f;
+  mesh.positions = {
+    { -1.f, t, 0.f }, { 1.f, t, 0.f }, { -1.f, -t, 0.f }, { 1.f, -t, 0.f },
+    { 0.f, -1.f, t }, { 0.f, 1.f, t }, { 0.f, -1.f, -t }, { 0.f, 1.f, -t },
+    { t, 0.f, -1.f }, { t, 0.f, 1.f }, { -t, 0.f, -1.f }, { -t, 0.f, 1.f }
+  };
+  mesh.indices = {
+    0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+    1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+    3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+    4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+  };
+  for (auto& position : mesh.positions) {
+    position.Normalize();
+  }
+
+  while (std::abs(std::log(double(mesh.face_count() * 4) / target_faces)) <
+         std::abs(std::log(double(mesh.face_count()) / target_faces))) {
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> midpoints;
+    auto midpoint = [&mesh, &midpoints](uint32_t a, uint32_t b) {
+      auto key = std::make_pair(std::min(a, b), std::max(a, b));
+      auto it = midpoints.find(key);
+      if (it != midpoints.end()) {
+        return it->second;
+      }
+      auto index = uint32_t(mesh.positions.size());
+      hedge::position_t position = (mesh.positions[a] + mesh.positions[b]) * 0.5f;
+      mesh.positions.push_back(position.Normalized());
+      midpoints.emplace(key, index);
+      return index;
+    };
+
+    std::vector<uint32_t> indices;
+    indices.reserve(mesh.indices.size() * 4);
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+      uint32_t a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+      uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+      indices.insert(indices.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+    }
+    mesh.indices.swap(indices);
+  }
+  return mesh;
+}
+
+/**
+   Unconnected triangles with random corners, the worst case for locality.
+ */
+indexed_mesh_t make_soup(size_t target_faces) {
+  indexed_mesh_t mesh;
+  mesh.name = "soup";
+  std::mt19937 rng(0x5eed);
+  // The top 24 bits as a float in [0, 1), scaled out to [-100, 100).
+  auto coord = [&rng]() {
+    return float(rng() >> 8) / 16777216.f * 200.f - 100.f;
+  };
+  mesh.positions.reserve(target_faces * 3);
+  mesh.indices.reserve(target_faces * 3);
+  for (size_t i = 0; i < target_faces * 3; ++i) {
+    // Drawn one at a time, the order arguments are evaluated in isn't fixed.
+    const float x = coord();
+    const float y = coord();
+    mesh.positions.emplace_back(x, y, coord());
+    mesh.indices.push_back(uint32_t(i));
+  }
+  return mesh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Measurement and reporting
+
+struct options_t {
+  size_t min_faces = 1000;
+  size_t max_faces = 1000000;
+  double min_time = 0.2;
+  std::string filter;
+  std::string format = "json";
+};
+
+struct result_t {
+  std::string name;
+  size_t iterations;
+  double seconds_per_iteration;
+  double items_per_second;
+  /**
+     Only set by the memory runs: the heap allocations still live after
+     build_from_indexed() that it made, over the elements it built. Memory the
+     kernel held before the build, or maps outside the heap, isn't counted.
+   */
+  double bytes_per_element;
+};
+
+/**
+   Runs fn, which returns the seconds spent on the part worth timing, until
+   min_time has been spent and reports the mean.
+ */
+template<typename TFn>
+result_t measure(const options_t& options, const std::string& name, size_t items, TFn&& fn) {
+  result_t result = { name, 0, 0.0, 0.0, 0.0 };
+  double total = 0.0;
+  while (result.iterations == 0 || (total < options.min_time && result.iterations < 1000)) {
+    total += fn();
+    ++result.iterations;
+  }
+  result.seconds_per_iteration = total / result.iterations;
+  result.items_per_second = result.seconds_per_iteration > 0.0 ? items / result.seconds_per_iteration : 0.0;
+  return result;
+}
+
+template<typename TFn>
+double time_it(TFn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+   Keeps traversal results alive so the loops can't be optimized away.
+ */
+volatile float sink = 0.f;
+
+template<typename TMesh>
+float walk_faces(TMesh& mesh) {
+  float sum = 0.f;
+  for (auto findex : mesh.faces()) {
+    auto first = mesh.face(findex).edge();
+    auto edge = first;
+    do {
+      auto point = edge.vertex().point();
+      sum += point != nullptr ? point->position.x : 0.f;
+      edge = edge.next();
+    } while (edge && edge.index() != first.index());
+  }
+  return sum;
+}
+
+template<typename TMesh>
+float walk_vertex_rings(TMesh& mesh) {
+  size_t valence = 0;
+  for (auto vindex : mesh.vertices()) {
+    for (auto eindex : mesh.vertex(vindex).outgoing_edges()) {
+      valence += eindex.offset & 1;
+    }
+  }
+  return float(valence);
+}
+
+template<typename TKernel>
+void run_kernel(const options_t& options, const indexed_mesh_t& source, const std::string& kernel_name,
+                std::vector<result_t>& results) {
+  const std::string suffix = "/" + source.name + "/" + kernel_name + "/" + std::to_string(source.face_count());
+  auto wanted = [&options, &suffix](const std::string& name) {
+    return options.filter.empty() || (name + suffix).find(options.filter) != std::string::npos;
+  };
+  const size_t faces = source.face_count();
+
+  if (wanted("build_indexed")) {
+    results.push_back(measure(options, "build_indexed" + suffix, faces, [&source]() {
+      hedge::basic_mesh_t<TKernel> mesh;
+      return time_it([&]() { mesh.build_from_indexed(source.positions, source.indices); });
+    }));
+  }
+
+  if (wanted("add_triangle")) {
+    results.push_back(measure(options, "add_triangle" + suffix, faces, [&source]() {
+      hedge::basic_mesh_t<TKernel> mesh;
+      std::vector<hedge::point_index_t> points;
+      points.reserve(source.positions.size());
+      for (auto& position : source.positions) {
+        points.push_back(mesh.add_point(position.x, position.y, position.z));
+      }
+      return time_it([&]() {
+        for (size_t i = 0; i < source.indices.size(); i += 3) {
+          mesh.add_triangle(points[source.indices[i]], points[source.indices[i + 1]], points[source.indices[i + 2]]);
+        }
+      });
+    }));
+  }
+
+  size_t before = live_bytes.load(std::memory_order_relaxed);
+  hedge::basic_mesh_t<TKernel> mesh;
+  mesh.build_from_indexed(source.positions, source.indices);
+  const size_t elements = mesh.point_count() + mesh.vertex_count() + mesh.face_count() + mesh.edge_count();
+
+  if (wanted("memory")) {
+    const size_t after = live_bytes.load(std::memory_order_relaxed);
+    result_t memory = { "memory" + suffix, 1, 0.0, 0.0, double(after - before) / std::max<size_t>(1, elements) };
+    results.push_back(memory);
+  }
+
+  if (wanted("link_adjacent_edges")) {
+    results.push_back(measure(options, "link_adjacent_edges" + suffix, mesh.edge_count(), [&mesh]() {
+      return time_it([&]() { hedge::link_adjacent_edges(mesh); });
+    }));
+  }
+
+  if (wanted("traverse_kernel_t")) {
+    hedge::mesh_t& erased = mesh;
+    results.push_back(measure(options, "traverse_kernel_t" + suffix, mesh.edge_count(), [&erased]() {
+      return time_it([&]() { sink = sink + walk_faces(erased); });
+    }));
+  }
+
+  if (wanted("traverse_typed")) {
+    results.push_back(measure(options, "traverse_typed" + suffix, mesh.edge_count(), [&mesh]() {
+      return time_it([&]() { sink = sink + walk_faces(mesh); });
+    }));
+  }
+
+  if (wanted("vertex_rings")) {
+    results.push_back(measure(options, "vertex_rings" + suffix, mesh.edge_count(), [&mesh]() {
+      return time_it([&]() { sink = sink + walk_vertex_rings(mesh); });
+    }));
+  }
+
+  if (wanted("vertex_normals")) {
+    std::vector<hedge::position_t> normals(mesh.kernel->vertex_table().size);
+    results.push_back(measure(options, "vertex_normals" + suffix, faces, [&mesh, &normals]() {
+      return time_it([&]() { hedge::compute_vertex_normals(mesh, normals.data()); });
+    }));
+  }
+
+  // Reads a UV column by vertex handle, kept apart from the vertices themselves.
+  if (wanted("property_uvs")) {
+    auto uvs = mesh.template add_property<hedge::vertex_index_t>("bench_uv", mathfu::vec2(0.5f, 0.25f));
+    results.push_back(measure(options, "property_uvs" + suffix, mesh.vertex_count(), [&mesh, uvs]() {
+      return time_it([&]() {
+        float total = 0.f;
+        for (auto vindex : mesh.vertices()) {
+          total += uvs[vindex].x + uvs[vindex].y;
+        }
+        sink = sink + total;
+      });
+    }));
+    mesh.template remove_property<hedge::vertex_index_t>("bench_uv");
+  }
+
+  if (wanted("subdivide_loop")) {
+    results.push_back(measure(options, "subdivide_loop" + suffix, faces, [&mesh]() {
+      hedge::basic_mesh_t<TKernel> result;
+      return time_it([&]() { hedge::subdivide_loop(mesh, result); });
+    }));
+  }
+
+  if (wanted("bvh_build")) {
+    results.push_back(measure(options, "bvh_build" + suffix, faces, [&mesh]() {
+      hedge::face_bvh_t bvh;
+      return time_it([&]() { bvh.build(mesh); });
+    }));
+  }
+
+  // The source added again one triangle at a time, every corner its own point.
+  if (wanted("weld_points")) {
+    results.push_back(measure(options, "weld_points" + suffix, faces * 3, [&source]() {
+      hedge::basic_mesh_t<TKernel> soup;
+      for (size_t i = 0; i < source.indices.size(); i += 3) {
+        auto& p0 = source.positions[source.indices[i]];
+        auto& p1 = source.positions[source.indices[i + 1]];
+        auto& p2 = source.positions[source.indices[i + 2]];
+        soup.add_triangle(hedge::point_t(p0.x, p0.y, p0.z), hedge::point_t(p1.x, p1.y, p1.z),
+                          hedge::point_t(p2.x, p2.y, p2.z));
+      }
+      return time_it([&]() { hedge::weld_points(soup); });
+    }));
+  }
+
+  // Every point of the mesh nudged off the surface, answered as one batch. The
+  // soup's triangles overlap all over so it's left out, nothing could prune.
+  if (wanted("bvh_closest_point") && source.name != "soup") {
+    hedge::face_bvh_t bvh;
+    bvh.build(mesh);
+    std::vector<hedge::position_t> queries;
+    for (auto pindex : mesh.points()) {
+      queries.push_back(mesh.kernel->get(pindex)->position + hedge::position_t(0.01f, 0.02f, 0.03f));
+    }
+    std::vector<hedge::closest_point_t> closest(queries.size());
+    results.push_back(measure(options, "bvh_closest_point" + suffix, queries.size(), [&]() {
+      return time_it([&]() { bvh.closest_points(queries.data(), closest.data(), queries.size()); });
+    }));
+  }
+
+  // Removes every other point and emplaces as many again, exercising the free
+  // list on both ends. The points are added on their own for this so no
+  // vertex is left pointing at a removed one.
+  if (wanted("churn")) {
+    std::vector<hedge::point_index_t> points(mesh.point_count());
+    for (size_t i = 0; i < points.size(); ++i) {
+      points[i] = mesh.kernel->emplace(hedge::point_t(float(i), 0.f, 0.f));
+    }
+    results.push_back(measure(options, "churn" + suffix, points.size(), [&mesh, &points]() {
+      return time_it([&]() {
+        for (size_t i = 0; i < points.size(); i += 2) {
+          mesh.kernel->remove(points[i]);
+        }
+        for (size_t i = 0; i < points.size(); i += 2) {
+          points[i] = mesh.kernel->emplace(hedge::point_t(float(i), 0.f, 0.f));
+        }
+      });
+    }));
+  }
+}
+
+/**
+   Growth without a reserve is where the allocation policies differ, so only
+   incremental construction is compared across them.
+ */
+void run_allocations(const options_t& options, const indexed_mesh_t& source, std::vector<result_t>& results) {
+  const std::pair<hedge::allocation_t, const char*> allocations[] = {
+    { hedge::allocation_t::heap, "heap" },
+    { hedge::allocation_t::paged, "paged" },
+    { hedge::allocation_t::huge_pages, "huge_pages" },
+    { hedge::allocation_t::monotonic, "monotonic" }
+  };
+  for (auto& allocation : allocations) {
+    const std::string name = "grow/" + source.name + "/basic-" + allocation.second + "/"
+      + std::to_string(source.face_count());
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+    results.push_back(measure(options, name, source.face_count(), [&source, &allocation]() {
+      hedge::mesh_t mesh(hedge::make_basic_kernel(hedge::validation_t::checked_logging, allocation.first));
+      return time_it([&]() {
+        std::vector<hedge::point_index_t> points;
+        points.reserve(source.positions.size());
+        for (auto& position : source.positions) {
+          points.push_back(mesh.add_point(position.x, position.y, position.z));
+        }
+        for (size_t i = 0; i < source.indices.size(); i += 3) {
+          mesh.add_triangle(points[source.indices[i]], points[source.indices[i + 1]], points[source.indices[i + 2]]);
+        }
+      });
+    }));
+  }
+}
+
+void write_json(const options_t& options, const std::vector<result_t>& results) {
+  std::printf("{\n  \"context\": {\n");
+  std::printf("    \"compact_index\": %s,\n", sizeof(hedge::edge_index_t) <= 4 ? "true" : "false");
+  std::printf("    \"min_time\": %g\n  },\n", options.min_time);
+  std::printf("  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    std::printf("    { \"name\": \"%s\", \"iterations\": %zu, \"real_time_ns\": %.1f, "
+                "\"items_per_second\": %.1f, \"bytes_per_element\": %.2f }%s\n",
+                result.name.c_str(), result.iterations, result.seconds_per_iteration * 1e9,
+                result.items_per_second, result.bytes_per_element, i + 1 < results.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
+
+void write_csv(const std::vector<result_t>& results) {
+  std::printf("name,iterations,real_time_ns,items_per_second,bytes_per_element\n");
+  for (const auto& result : results) {
+    std::printf("%s,%zu,%.1f,%.1f,%.2f\n", result.name.c_str(), result.iterations,
+                result.seconds_per_iteration * 1e9, result.items_per_second, result.bytes_per_element);
+  }
+}
+
+bool parse_options(int argc, char** argv, options_t& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&](const char* name) -> const char* {
+      auto length = std::strlen(name);
+      if (arg.compare(0, length, name) == 0 && arg.size() > length && arg[length] == '=') {
+        return argv[i] + length + 1;
+      }
+      return nullptr;
+    };
+    if (auto v = value("--min-faces")) {
+      options.min_faces = std::strtoull(v, nullptr, 10);
+    }
+    else if (auto v = value("--max-faces")) {
+      options.max_faces = std::strtoull(v, nullptr, 10);
+    }
+    else if (auto v = value("--min-time")) {
+      options.min_time = std::strtod(v, nullptr);
+    }
+    else if (auto v = value("--filter")) {
+      options.filter = v;
+    }
+    else if (auto v = value("--format")) {
+      options.format = v;
+    }
+    else {
+      std::fprintf(stderr,
+                   "usage: hedge_bench [--min-faces=N] [--max-faces=N] [--min-time=SECONDS]\n"
+                   "                   [--filter=SUBSTRING] [--format=json|csv]\n");
+      return false;
+    }
+  }
+  return options.min_faces > 0 && (options.format == "json" || options.format == "csv");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  options_t options;
+  if (!parse_options(argc, argv, options)) {
+    return 1;
+  }
+
+  el::Configurations logging;
+  logging.setToDefault();
+  logging.set(el::Level::Global, el::ConfigurationType::Enabled, "false");
+  el::Loggers::reconfigureAllLoggers(logging);
+
+  std::vector<result_t> results;
+  for (size_t faces = options.min_faces; faces <= options.max_faces; faces *= 10) {
+    for (auto make : { make_grid, make_icosphere, make_soup }) {
+      auto source = make(faces);
+      run_kernel<hedge::basic_kernel_t<>>(options, source, "basic", results);
+      run_kernel<hedge::soa_kernel_t<>>(options, source, "soa", results);
+      run_allocations(options, source, results);
+    }
+  }
+
+  if (options.format == "csv") {
+    write_csv(results);
+  }
+  else {
+    write_json(options, results);
+  }
+  return 0;
+}
@@ -0,0 +1,512 @@
+
+#include "hedge.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <easylogging++.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hedge {
+
+namespace {
+
+/**
+   The file starts with this header followed by the edge, face, vertex and
+   point arrays, each of them aligned to section_alignment. Everything is in
+   native byte order and layout, the header records enough of both to refuse
+   files written by an incompatible build.
+ */
+const char binary_magic[8] = { 'H', 'E', 'D', 'G', 'E', 'B', 'I', 'N' };
+const uint32_t binary_version = 1;
+const uint32_t binary_byte_order = 0x01020304;
+const uint64_t section_alignment = 64;
+
+enum section_t { edge_section, face_section, vertex_section, point_section, section_count };
+
+struct binary_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t index_size;
+  uint32_t generation_bits;
+  uint32_t element_sizes[section_count];
+  uint64_t cells[section_count];
+  uint64_t counts[section_count];
+  uint64_t offsets[section_count];
+  uint64_t file_size;
+  uint64_t data_checksum;
+  uint64_t header_checksum;
+};
+
+uint32_t index_generation_bits() {
+#if defined(HEDGE_COMPACT_INDEX)
+  return HEDGE_INDEX_GENERATION_BITS;
+#else
+  return 0;
+#endif
+}
+
+/**
+   FNV-1a over 64-bit words, the tail is padded with zeros.
+ */
+uint64_t checksum(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+  const uint64_t prime = 0x100000001b3ull;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  if (i < size) {
+    uint64_t word = 0;
+    std::memcpy(&word, data + i, size - i);
+    hash = (hash ^ word) * prime;
+  }
+  return hash;
+}
+
+uint64_t header_checksum(const binary_header_t& header) {
+  return checksum(reinterpret_cast<const char*>(&header), offsetof(binary_header_t, header_checksum));
+}
+
+uint64_t align_section(uint64_t offset) {
+  return (offset + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+/**
+   Builds the whole elements of one table in a zeroed buffer so the padding
+   written out (and checksummed) is deterministic.
+ */
+template<typename TElement, typename TTable, typename TFill>
+std::vector<char> gather_elements(const TTable& table, TFill&& fill) {
+  std::vector<char> buffer(table.size * sizeof(TElement), 0);
+  for (offset_t offset = 0; offset < table.size; ++offset) {
+    auto* element = new (buffer.data() + offset * sizeof(TElement)) TElement();
+    static_cast<element_t&>(*element) = table.element[offset];
+    fill(*element, offset);
+  }
+  return buffer;
+}
+
+} // namespace
+
+bool save_binary(mesh_t& mesh, const std::string& path) {
+  auto edges = mesh.kernel->edge_table();
+  auto faces = mesh.kernel->face_table();
+  auto vertices = mesh.kernel->vertex_table();
+  auto points = mesh.kernel->point_table();
+
+  std::vector<char> sections[section_count] = {
+    gather_elements<edge_t>(edges, [&edges](edge_t& edge, offset_t offset) {
+      edge.vertex_index = edges.vertex_index[offset];
+      edge.face_index = edges.face_index[offset];
+      edge.next_index = edges.next_index[offset];
+      edge.prev_index = edges.prev_index[offset];
+      edge.adjacent_index = edges.adjacent_index[offset];
+    }),
+    gather_elements<face_t>(faces, [&faces](face_t& face, offset_t offset) {
+      face.edge_index = faces.edge_index[offset];
+    }),
+    gather_elements<vertex_t>(vertices, [&vertices](vertex_t& vertex, offset_t offset) {
+      vertex.point_index = vertices.point_index[offset];
+      vertex.edge_index = vertices.edge_index[offset];
+    }),
+    gather_elements<point_t>(points, [&points](point_t& point, offset_t offset) {
+      point.position = points.position[offset];
+    })
+  };
+
+  binary_header_t header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+  header.version = binary_version;
+  header.byte_order = binary_byte_order;
+  header.index_size = sizeof(edge_index_t);
+  header.generation_bits = index_generation_bits();
+  header.element_sizes[edge_section] = sizeof(edge_t);
+  header.element_sizes[face_section] = sizeof(face_t);
+  header.element_sizes[vertex_section] = sizeof(vertex_t);
+  header.element_sizes[point_section] = sizeof(point_t);
+  header.cells[edge_section] = edges.size;
+  header.cells[face_section] = faces.size;
+  header.cells[vertex_section] = vertices.size;
+  header.cells[point_section] = points.size;
+  header.counts[edge_section] = mesh.kernel->edge_count();
+  header.counts[face_section] = mesh.kernel->face_count();
+  header.counts[vertex_section] = mesh.kernel->vertex_count();
+  header.counts[point_section] = mesh.kernel->point_count();
+
+  uint64_t offset = align_section(sizeof(binary_header_t));
+  uint64_t data_checksum = 0xcbf29ce484222325ull;
+  for (int section = 0; section < section_count; ++section) {
+    header.offsets[section] = offset;
+    offset = align_section(offset + sections[section].size());
+    data_checksum = checksum(sections[section].data(), sections[section].size(), data_checksum);
+  }
+  header.file_size = offset;
+  header.data_checksum = data_checksum;
+  header.header_checksum = header_checksum(header);
+
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    LOG(ERROR) << "Couldn't open " << path << " for writing";
+    return false;
+  }
+  const char padding[section_alignment] = {};
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  uint64_t position = sizeof(header);
+  for (int section = 0; written && section < section_count; ++section) {
+    auto gap = header.offsets[section] - position;
+    written = std::fwrite(padding, 1, gap, file) == gap;
+    auto& data = sections[section];
+    written = written && std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    position = header.offsets[section] + data.size();
+  }
+  auto gap = header.file_size - position;
+  written = written && std::fwrite(padding, 1, gap, file) == gap;
+  written = (std::fclose(file) == 0) && written;
+  if (!written) {
+    LOG(ERROR) << "Failed writing " << path;
+  }
+  return written;
+}
+
+#if !defined(_WIN32)
+
+namespace {
+
+/**
+   Kernel over the element arrays of a mapped file. It can't grow so every
+   operation that would add or remove cells is rejected.
+ */
+class mapped_kernel_t final : public kernel_t {
+  void* _mapping;
+  size_t _mapping_size;
+  binary_header_t _header;
+  edge_t* _edges;
+  face_t* _faces;
+  vertex_t* _vertices;
+  point_t* _points;
+  validation_counters_t _counters;
+  validator_t _validator;
+
+  template<typename TElement, typename TIndex>
+  TElement* lookup(TElement* elements, section_t section, TIndex index) const {
+    const auto cells = _header.cells[section];
+    if (_validator.is_checked()) {
+      if (index.offset >= cells) {
+        _validator.invalid_offset(index.offset, cells);
+        return nullptr;
+      }
+      if (!is_same_generation(elements[index.offset].generation, index.generation)) {
+        _validator.generation_mismatch(index.offset, index.generation, elements[index.offset].generation);
+        return nullptr;
+      }
+    }
+    return elements + index.offset;
+  }
+
+  template<typename TElement, typename TIndex>
+  void resolve_index(TElement* elements, section_t section, TIndex* index, TElement** element) const {
+    *element = index->offset < _header.cells[section] ? elements + index->offset : nullptr;
+    if (*element != nullptr) {
+      index->generation = (*element)->generation;
+    }
+  }
+
+  template<typename TTable, typename TElement>
+  TTable table(TElement* elements, section_t section) {
+    TTable table;
+    table.size = _header.cells[section];
+    table.element = column_t<element_t>(elements, sizeof(TElement));
+    table.validator = _validator;
+    return table;
+  }
+
+  static void report_read_only() {
+    LOG(ERROR) << "Mapped kernels are read-only, elements can't be added or removed";
+  }
+
+public:
+  mapped_kernel_t(void* mapping, size_t mapping_size, const binary_header_t& header, validation_t validation)
+    : _mapping(mapping)
+    , _mapping_size(mapping_size)
+    , _header(header)
+    , _validator(validation, &_counters)
+  {
+    auto* base = static_cast<char*>(mapping);
+    _edges = reinterpret_cast<edge_t*>(base + header.offsets[edge_section]);
+    _faces = reinterpret_cast<face_t*>(base + header.offsets[face_section]);
+    _vertices = reinterpret_cast<vertex_t*>(base + header.offsets[vertex_section]);
+    _points = reinterpret_cast<point_t*>(base + header.offsets[point_section]);
+  }
+
+  ~mapped_kernel_t() override {
+    munmap(_mapping, _mapping_size);
+  }
+
+  edge_t* get(edge_index_t index) override {
+    return lookup(_edges, edge_section, index);
+  }
+  face_t* get(face_index_t index) override {
+    return lookup(_faces, face_section, index);
+  }
+  vertex_t* get(vertex_index_t index) override {
+    return lookup(_vertices, vertex_section, index);
+  }
+  point_t* get(point_index_t index) override {
+    return lookup(_points, point_section, index);
+  }
+
+  edge_index_t emplace(edge_t&&) override {
+    report_read_only();
+    return edge_index_t();
+  }
+  face_index_t emplace(face_t&&) override {
+    report_read_only();
+    return face_index_t();
+  }
+  vertex_index_t emplace(vertex_t&&) override {
+    report_read_only();
+    return vertex_index_t();
+  }
+  point_index_t emplace(point_t&&) override {
+    report_read_only();
+    return point_index_t();
+  }
+
+  void remove(edge_index_t) override {
+    report_read_only();
+  }
+  void remove(face_index_t) override {
+    report_read_only();
+  }
+  void remove(vertex_index_t) override {
+    report_read_only();
+  }
+  void remove(point_index_t) override {
+    report_read_only();
+  }
+
+  bool retract(edge_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool retract(face_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool retract(vertex_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool retract(point_index_t) override {
+    report_read_only();
+    return false;
+  }
+
+  bool restore(edge_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool restore(face_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool restore(vertex_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool restore(point_index_t) override {
+    report_read_only();
+    return false;
+  }
+
+  size_t point_count() const override {
+    return _header.counts[point_section];
+  }
+  size_t vertex_count() const override {
+    return _header.counts[vertex_section];
+  }
+  size_t face_count() const override {
+    return _header.counts[face_section];
+  }
+  size_t edge_count() const override {
+    return _header.counts[edge_section];
+  }
+
+  void reserve(size_t, size_t, size_t, size_t) override {}
+
+  remap_table_t compact() override {
+    report_read_only();
+    return remap_table_t();
+  }
+  remap_table_t reorder(const element_order_t&) override {
+    report_read_only();
+    return remap_table_t();
+  }
+
+  void resolve(edge_index_t* index, edge_t** edge) const override {
+    resolve_index(_edges, edge_section, index, edge);
+  }
+  void resolve(face_index_t* index, face_t** face) const override {
+    resolve_index(_faces, face_section, index, face);
+  }
+  void resolve(point_index_t* index, point_t** point) const override {
+    resolve_index(_points, point_section, index, point);
+  }
+  void resolve(vertex_index_t* index, vertex_t** vert) const override {
+    resolve_index(_vertices, vertex_section, index, vert);
+  }
+
+  edge_table_t edge_table() override {
+    auto table = this->table<edge_table_t>(_edges, edge_section);
+    table.vertex_index = make_column(_edges, &edge_t::vertex_index);
+    table.face_index = make_column(_edges, &edge_t::face_index);
+    table.next_index = make_column(_edges, &edge_t::next_index);
+    table.prev_index = make_column(_edges, &edge_t::prev_index);
+    table.adjacent_index = make_column(_edges, &edge_t::adjacent_index);
+    return table;
+  }
+  face_table_t face_table() override {
+    auto table = this->table<face_table_t>(_faces, face_section);
+    table.edge_index = make_column(_faces, &face_t::edge_index);
+    return table;
+  }
+  vertex_table_t vertex_table() override {
+    auto table = this->table<vertex_table_t>(_vertices, vertex_section);
+    table.point_index = make_column(_vertices, &vertex_t::point_index);
+    table.edge_index = make_column(_vertices, &vertex_t::edge_index);
+    return table;
+  }
+  point_table_t point_table() override {
+    auto table = this->table<point_table_t>(_points, point_section);
+    table.position = make_column(_points, &point_t::position);
+    return table;
+  }
+
+  validation_t validation() const override {
+    return _validator.validation;
+  }
+  const validation_counters_t& validation_counters() const override {
+    return _counters;
+  }
+
+  kernel_t::ptr_t snapshot() override {
+    return kernel_t::ptr_t(nullptr, [](kernel_t* k) { delete k; });
+  }
+};
+
+bool check_header(const binary_header_t& header, size_t file_size, const std::string& path) {
+  if (std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0) {
+    LOG(ERROR) << path << " is not a hedge binary mesh";
+    return false;
+  }
+  if (header.header_checksum != header_checksum(header)) {
+    LOG(ERROR) << path << " has a corrupt header";
+    return false;
+  }
+  if (header.version != binary_version || header.byte_order != binary_byte_order) {
+    LOG(ERROR) << path << " is version " << header.version << " with byte order marker "
+               << header.byte_order << ", expected version " << binary_version;
+    return false;
+  }
+  const uint32_t sizes[section_count] = { sizeof(edge_t), sizeof(face_t), sizeof(vertex_t), sizeof(point_t) };
+  if (header.index_size != sizeof(edge_index_t) || header.generation_bits != index_generation_bits()
+      || std::memcmp(header.element_sizes, sizes, sizeof(sizes)) != 0) {
+    LOG(ERROR) << path << " was written with " << header.index_size << " byte indices and "
+               << header.generation_bits << " generation bits, this build doesn't match its layout";
+    return false;
+  }
+  if (header.file_size != file_size) {
+    LOG(ERROR) << path << " is " << file_size << " bytes but its header expects " << header.file_size;
+    return false;
+  }
+  // Every section has to fit in the file past the header without running
+  // into another one, checked without letting the sizes overflow.
+  uint64_t ends[section_count];
+  for (int section = 0; section < section_count; ++section) {
+    const uint64_t offset = header.offsets[section];
+    const uint64_t cells = header.cells[section];
+    if (cells == 0 || offset % section_alignment != 0 || offset < sizeof(binary_header_t) || offset > file_size
+        || cells > (file_size - offset) / header.element_sizes[section] || header.counts[section] > cells) {
+      LOG(ERROR) << path << " has a malformed element section " << section;
+      return false;
+    }
+    ends[section] = offset + cells * header.element_sizes[section];
+    for (int other = 0; other < section; ++other) {
+      if (offset < ends[other] && header.offsets[other] < ends[section]) {
+        LOG(ERROR) << path << " has overlapping element sections " << other << " and " << section;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+kernel_t::ptr_t make_mapped_kernel(const std::string& path, bool verify_checksum, validation_t validation) {
+  kernel_t::ptr_t kernel(nullptr, [](kernel_t* k) { delete k; });
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Couldn't open " << path;
+    return kernel;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(binary_header_t)) {
+    LOG(ERROR) << path << " is too small to be a hedge binary mesh";
+    close(fd);
+    return kernel;
+  }
+  const size_t size = size_t(info.st_size);
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR) << "Couldn't map " << path;
+    return kernel;
+  }
+
+  binary_header_t header;
+  std::memcpy(&header, mapping, sizeof(header));
+  bool valid = check_header(header, size, path);
+  if (valid && verify_checksum) {
+    uint64_t data_checksum = 0xcbf29ce484222325ull;
+    for (int section = 0; section < section_count; ++section) {
+      data_checksum = checksum(static_cast<const char*>(mapping) + header.offsets[section],
+                               header.cells[section] * header.element_sizes[section], data_checksum);
+    }
+    if (data_checksum != header.data_checksum) {
+      LOG(ERROR) << path << " failed its checksum";
+      valid = false;
+    }
+  }
+  if (!valid) {
+    munmap(mapping, size);
+    return kernel;
+  }
+
+  kernel.reset(new mapped_kernel_t(mapping, size, header, validation));
+  return kernel;
+}
+
+#else
+
+kernel_t::ptr_t make_mapped_kernel(const std::string& path, bool, validation_t) {
+  LOG(ERROR) << "Mapping " << path << " isn't supported on this platform yet";
+  return kernel_t::ptr_t(nullptr, [](kernel_t* k) { delete k; });
+}
+
+#endif
+
+} // namespace hedge
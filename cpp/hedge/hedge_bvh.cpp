@@ -0,0 +1,695 @@
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <easylogging++.h>
+#include <vectorial/simd4f.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+/**
+   Nodes deeper than this are split down the middle instead, which bounds the
+   depth of the tree and so the traversal stacks.
+ */
+const size_t max_sah_depth = 48;
+const size_t stack_depth = 96;
+
+/**
+   A node waiting on a traversal stack along with how far away its box was
+   when it was pushed, so it can be passed over once something closer turned
+   up in the meantime.
+ */
+struct pending_t {
+  uint32_t node;
+  float distance;
+};
+
+/**
+   Bounds kept in vector registers while building, the fourth lane goes
+   along unused.
+ */
+struct box_t {
+  simd4f lo;
+  simd4f hi;
+
+  box_t() : lo(simd4f_splat(FLT_MAX)), hi(simd4f_splat(-FLT_MAX)) {}
+
+  void grow(simd4f p) {
+    lo = simd4f_min(lo, p);
+    hi = simd4f_max(hi, p);
+  }
+
+  void grow(const float* p) {
+    grow(simd4f_create(p[0], p[1], p[2], 0.f));
+  }
+
+  void grow(const box_t& box) {
+    lo = simd4f_min(lo, box.lo);
+    hi = simd4f_max(hi, box.hi);
+  }
+
+  simd4f center() const {
+    return simd4f_mul(simd4f_add(lo, hi), simd4f_splat(0.5f));
+  }
+
+  void store(float* out_lo, float* out_hi) const {
+    simd4f_aligned16 float l[4];
+    simd4f_aligned16 float h[4];
+    simd4f_ustore4(lo, l);
+    simd4f_ustore4(hi, h);
+    std::copy(l, l + 3, out_lo);
+    std::copy(h, h + 3, out_hi);
+  }
+
+  /**
+     Half the surface area, which is all the split cost needs.
+   */
+  float area() const {
+    simd4f_aligned16 float e[4];
+    simd4f_ustore4(simd4f_sub(hi, lo), e);
+    if (e[0] < 0.f) {
+      return 0.f;
+    }
+    return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+  }
+};
+
+/**
+   What the build knows about a triangle before it has a place in the tree,
+   its centroid being the center of its box. The build moves these around
+   rather than indices to them so that binning reads them in order.
+ */
+struct primitive_t {
+  box_t box;
+  uint32_t index;
+};
+
+void store(const position_t& p, float* out) {
+  out[0] = p.x;
+  out[1] = p.y;
+  out[2] = p.z;
+}
+
+float dot(const float* a, const float* b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void sub(const float* a, const float* b, float* out) {
+  out[0] = a[0] - b[0];
+  out[1] = a[1] - b[1];
+  out[2] = a[2] - b[2];
+}
+
+void cross(const float* a, const float* b, float* out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/**
+   Where the ray enters the box, or FLT_MAX when it misses it or only gets
+   there past limit.
+ */
+template<typename TNode>
+float enter_box(const TNode& node, const float* origin, const float* inverse, float limit) {
+  float enter = 0.f, leave = limit;
+  for (int axis = 0; axis < 3; ++axis) {
+    float t0 = (node.lo[axis] - origin[axis]) * inverse[axis];
+    float t1 = (node.hi[axis] - origin[axis]) * inverse[axis];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    enter = t0 > enter ? t0 : enter;
+    leave = t1 < leave ? t1 : leave;
+  }
+  return enter <= leave ? enter : FLT_MAX;
+}
+
+template<typename TNode>
+float box_distance_squared(const TNode& node, const float* p) {
+  float sum = 0.f;
+  for (int axis = 0; axis < 3; ++axis) {
+    const float d = std::max(std::max(node.lo[axis] - p[axis], p[axis] - node.hi[axis]), 0.f);
+    sum += d * d;
+  }
+  return sum;
+}
+
+/**
+   Möller-Trumbore, hitting both sides. Returns the distance along the ray
+   or a negative value on a miss.
+ */
+template<typename TTriangle>
+float intersect_triangle(const TTriangle& tri, const float* origin, const float* direction) {
+  float e1[3], e2[3], p[3], s[3], q[3];
+  sub(tri.b, tri.a, e1);
+  sub(tri.c, tri.a, e2);
+  cross(direction, e2, p);
+  const float det = dot(e1, p);
+  if (std::fabs(det) < 1e-12f) {
+    return -1.f;
+  }
+  const float inverse = 1.f / det;
+  sub(origin, tri.a, s);
+  const float u = dot(s, p) * inverse;
+  if (u < 0.f || u > 1.f) {
+    return -1.f;
+  }
+  cross(s, e1, q);
+  const float v = dot(direction, q) * inverse;
+  if (v < 0.f || u + v > 1.f) {
+    return -1.f;
+  }
+  return dot(e2, q) * inverse;
+}
+
+/**
+   The point of a triangle closest to p, by the Voronoi regions of its
+   corners and edges.
+ */
+template<typename TTriangle>
+void closest_on_triangle(const TTriangle& tri, const float* p, float* out) {
+  float ab[3], ac[3], ap[3];
+  sub(tri.b, tri.a, ab);
+  sub(tri.c, tri.a, ac);
+  sub(p, tri.a, ap);
+  const float d1 = dot(ab, ap), d2 = dot(ac, ap);
+  auto blend = [&](float v, float w) {
+    for (int axis = 0; axis < 3; ++axis) {
+      out[axis] = tri.a[axis] + ab[axis] * v + ac[axis] * w;
+    }
+  };
+  if (d1 <= 0.f && d2 <= 0.f) {
+    return blend(0.f, 0.f);
+  }
+  float bp[3];
+  sub(p, tri.b, bp);
+  const float d3 = dot(ab, bp), d4 = dot(ac, bp);
+  if (d3 >= 0.f && d4 <= d3) {
+    return blend(1.f, 0.f);
+  }
+  const float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+    return blend(d1 / (d1 - d3), 0.f);
+  }
+  float cp[3];
+  sub(p, tri.c, cp);
+  const float d5 = dot(ab, cp), d6 = dot(ac, cp);
+  if (d6 >= 0.f && d5 <= d6) {
+    return blend(0.f, 1.f);
+  }
+  const float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+    return blend(0.f, d2 / (d2 - d6));
+  }
+  const float va = d3 * d6 - d5 * d4;
+  if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) {
+    const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    return blend(1.f - w, w);
+  }
+  const float denominator = 1.f / (va + vb + vc);
+  return blend(vb * denominator, vc * denominator);
+}
+
+/**
+   A run of primitives waiting to become a node, with the bounds of its
+   primitives and of their centroids.
+ */
+struct range_t {
+  uint32_t begin;
+  uint32_t end;
+  box_t bounds;
+  box_t centroids;
+};
+
+/**
+   Splits runs of primitives into nodes. Every split takes the next free pair
+   of nodes so children always come after their parent, and the top levels
+   hand one side to a thread of its own while they carry on with the other.
+   The binning of a run hands its sides their bounds and the partition their
+   centroids, so no primitive is visited more than twice per level.
+ */
+template<typename TNode>
+class builder_t {
+  struct bin_t {
+    box_t box;
+    size_t count;
+
+    bin_t() : count(0) {}
+  };
+
+  std::vector<primitive_t>& _primitives;
+  std::vector<TNode>& _nodes;
+  std::atomic<uint32_t> _next;
+  size_t _leaf_size;
+  size_t _bin_count;
+  size_t _spawn_depth;
+
+  /**
+     Where the centroid of a primitive falls on every axis, in bins.
+   */
+  static void place(const primitive_t& primitive, simd4f origin, simd4f scale, float* slots) {
+    simd4f_ustore4(simd4f_mul(simd4f_sub(primitive.box.center(), origin), scale), slots);
+  }
+
+  static size_t bin_of(float slot, size_t bin_count) {
+    return std::min(bin_count - 1, size_t(std::max(slot, 0.f)));
+  }
+
+  /**
+     The first bin of the right side for the cheapest split and the bounds
+     of both sides, or a bin of zero when the centroids can't be told apart.
+     Runs shorter than the bin count get a bin per primitive.
+   */
+  size_t find_split(const range_t& range, size_t bin_count, std::vector<bin_t>& bins, int& best_axis,
+                    box_t& best_left, box_t& best_right, simd4f& scale) const {
+    float lo[3], hi[3], scales[3];
+    range.centroids.store(lo, hi);
+    for (int axis = 0; axis < 3; ++axis) {
+      const float extent = hi[axis] - lo[axis];
+      scales[axis] = extent > 0.f ? float(bin_count) / extent : 0.f;
+    }
+    scale = simd4f_create(scales[0], scales[1], scales[2], 0.f);
+    bins.resize(4 * _bin_count);
+    std::fill(bins.begin(), bins.begin() + 3 * bin_count, bin_t());
+    for (uint32_t i = range.begin; i < range.end; ++i) {
+      auto& primitive = _primitives[i];
+      simd4f_aligned16 float slots[4];
+      place(primitive, range.centroids.lo, scale, slots);
+      for (int axis = 0; axis < 3; ++axis) {
+        auto& bin = bins[axis * bin_count + bin_of(slots[axis], bin_count)];
+        bin.box.grow(primitive.box);
+        ++bin.count;
+      }
+    }
+
+    // The last row keeps the right side of every candidate, box and cost.
+    bin_t* rights = &bins[3 * bin_count];
+    float best_cost = FLT_MAX;
+    size_t best_bin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (scales[axis] == 0.f) {
+        continue;
+      }
+      const bin_t* axis_bins = &bins[axis * bin_count];
+      box_t right;
+      size_t right_count = 0;
+      for (size_t bin = bin_count - 1; bin > 0; --bin) {
+        right.grow(axis_bins[bin].box);
+        right_count += axis_bins[bin].count;
+        rights[bin].box = right;
+        rights[bin].count = right_count;
+      }
+      box_t left;
+      size_t left_count = 0;
+      for (size_t bin = 1; bin < bin_count; ++bin) {
+        left.grow(axis_bins[bin - 1].box);
+        left_count += axis_bins[bin - 1].count;
+        const float cost = left.area() * float(left_count) + rights[bin].box.area() * float(rights[bin].count);
+        if (left_count > 0 && rights[bin].count > 0 && cost < best_cost) {
+          best_cost = cost;
+          best_bin = bin;
+          best_axis = axis;
+          best_left = left;
+          best_right = rights[bin].box;
+        }
+      }
+    }
+    return best_bin;
+  }
+
+  void measure(range_t& range) const {
+    for (uint32_t i = range.begin; i < range.end; ++i) {
+      auto& primitive = _primitives[i];
+      range.bounds.grow(primitive.box);
+      range.centroids.grow(primitive.box.center());
+    }
+  }
+
+  void split(uint32_t nindex, const range_t& range, size_t depth, std::vector<bin_t>& bins) {
+    auto& node = _nodes[nindex];
+    range.bounds.store(node.lo, node.hi);
+    if (range.end - range.begin <= _leaf_size) {
+      node.first = range.begin;
+      node.count = range.end - range.begin;
+      return;
+    }
+
+    int axis = 0;
+    simd4f scale;
+    range_t left, right;
+    const size_t bin_count = std::min<size_t>(_bin_count, range.end - range.begin);
+    const size_t bin = depth < max_sah_depth
+      ? find_split(range, bin_count, bins, axis, left.bounds, right.bounds, scale) : 0;
+    if (bin > 0) {
+      uint32_t i = range.begin, j = range.end;
+      while (i < j) {
+        auto& primitive = _primitives[i];
+        simd4f_aligned16 float slots[4];
+        place(primitive, range.centroids.lo, scale, slots);
+        if (bin_of(slots[axis], bin_count) < bin) {
+          left.centroids.grow(primitive.box.center());
+          ++i;
+        } else {
+          right.centroids.grow(primitive.box.center());
+          std::swap(primitive, _primitives[--j]);
+        }
+      }
+      left.end = right.begin = i;
+    } else {
+      left.end = right.begin = range.begin + (range.end - range.begin) / 2;
+    }
+    left.begin = range.begin;
+    right.end = range.end;
+    if (bin == 0) {
+      measure(left);
+      measure(right);
+    }
+
+    const uint32_t children = _next.fetch_add(2);
+    node.first = children;
+    node.count = 0;
+    if (depth < _spawn_depth) {
+      std::thread thread([this, children, &left, depth]() {
+        std::vector<bin_t> thread_bins;
+        split(children, left, depth + 1, thread_bins);
+      });
+      split(children + 1, right, depth + 1, bins);
+      thread.join();
+    } else {
+      split(children, left, depth + 1, bins);
+      split(children + 1, right, depth + 1, bins);
+    }
+  }
+public:
+  builder_t(std::vector<primitive_t>& primitives, std::vector<TNode>& nodes, const bvh_options_t& options)
+    : _primitives(primitives)
+    , _nodes(nodes)
+    , _next(1)
+    , _leaf_size(std::max<size_t>(1, options.leaf_size))
+    , _bin_count(std::max<size_t>(2, options.bin_count))
+    , _spawn_depth(0)
+  {
+    for (size_t threads = resolve_thread_count(options.thread_count); threads > 1; threads /= 2) {
+      ++_spawn_depth;
+    }
+  }
+
+  size_t run() {
+    _nodes.resize(std::max<size_t>(1, 2 * _primitives.size()));
+    range_t root;
+    root.begin = 0;
+    root.end = uint32_t(_primitives.size());
+    measure(root);
+    std::vector<bin_t> bins;
+    split(0, root, 0, bins);
+    return _next.load();
+  }
+};
+
+} // namespace
+
+face_bvh_t::face_bvh_t(const bvh_options_t& options) : _options(options) {}
+
+bool face_bvh_t::load_triangles(const point_table_t& points, size_t begin, size_t end) {
+  bool complete = true;
+  for (size_t i = begin; i < end; ++i) {
+    float* corners[] = { _triangles[i].a, _triangles[i].b, _triangles[i].c };
+    for (size_t corner = 0; corner < 3; ++corner) {
+      auto pindex = _corners[3 * i + corner];
+      if (points.contains(pindex) && points.element[pindex.offset].status == element_status_t::ACTIVE) {
+        store(points.position[pindex.offset], corners[corner]);
+      } else {
+        complete = false;
+      }
+    }
+  }
+  return complete;
+}
+
+void face_bvh_t::fit_nodes() {
+  parallel_for(_nodes.size(), _options.thread_count, [this](size_t begin, size_t end, size_t) {
+    for (size_t nindex = begin; nindex < end; ++nindex) {
+      auto& node = _nodes[nindex];
+      if (node.count == 0) {
+        continue;
+      }
+      box_t box;
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        box.grow(_triangles[i].a);
+        box.grow(_triangles[i].b);
+        box.grow(_triangles[i].c);
+      }
+      box.store(node.lo, node.hi);
+    }
+  });
+  for (size_t nindex = _nodes.size(); nindex-- > 0;) {
+    auto& node = _nodes[nindex];
+    if (node.count != 0) {
+      continue;
+    }
+    auto& left = _nodes[node.first];
+    auto& right = _nodes[node.first + 1];
+    for (int axis = 0; axis < 3; ++axis) {
+      node.lo[axis] = std::min(left.lo[axis], right.lo[axis]);
+      node.hi[axis] = std::max(left.hi[axis], right.hi[axis]);
+    }
+  }
+}
+
+void face_bvh_t::build(mesh_t& mesh) {
+  _nodes.clear();
+  _triangles.clear();
+  _faces.clear();
+  _corners.clear();
+
+  auto edges = mesh.kernel->edge_table();
+  auto faces = mesh.kernel->face_table();
+  auto vertices = mesh.kernel->vertex_table();
+  auto points = mesh.kernel->point_table();
+
+  std::vector<face_index_t> fan_faces;
+  std::vector<point_index_t> fan_corners;
+  for (size_t offset = 1; offset < faces.size; ++offset) {
+    if (faces.element[offset].status != element_status_t::ACTIVE) {
+      continue;
+    }
+    const face_index_t findex(offset_t(offset), faces.element[offset].generation);
+    const edge_index_t first = faces.edge_index[offset];
+    if (!edges.contains(first)) {
+      continue;
+    }
+    auto corner = [&](edge_index_t eindex) {
+      auto vindex = edges.vertex_index[eindex.offset];
+      return vertices.contains(vindex) ? point_index_t(vertices.point_index[vindex.offset]) : point_index_t();
+    };
+    const point_index_t origin = corner(first);
+    edge_index_t eindex = edges.next_index[first.offset];
+    for (size_t steps = 0; steps < edges.size && eindex != first && edges.contains(eindex); ++steps) {
+      const edge_index_t next = edges.next_index[eindex.offset];
+      if (!next || next == first || !edges.contains(next)) {
+        break;
+      }
+      fan_faces.push_back(findex);
+      fan_corners.push_back(origin);
+      fan_corners.push_back(corner(eindex));
+      fan_corners.push_back(corner(next));
+      eindex = next;
+    }
+  }
+  if (fan_faces.empty()) {
+    return;
+  }
+
+  const size_t count = fan_faces.size();
+  std::vector<primitive_t> primitives(count);
+  parallel_for(count, _options.thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; ++i) {
+      auto& primitive = primitives[i];
+      for (size_t corner = 0; corner < 3; ++corner) {
+        auto pindex = fan_corners[3 * i + corner];
+        float p[3] = { 0.f, 0.f, 0.f };
+        if (points.contains(pindex)) {
+          store(points.position[pindex.offset], p);
+        }
+        primitive.box.grow(p);
+      }
+      primitive.index = uint32_t(i);
+    }
+  });
+
+  builder_t<node_t> builder(primitives, _nodes, _options);
+  _nodes.resize(builder.run());
+
+  _triangles.resize(count);
+  _faces.resize(count);
+  _corners.resize(3 * count);
+  parallel_for(count, _options.thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; ++i) {
+      const size_t from = primitives[i].index;
+      _faces[i] = fan_faces[from];
+      std::copy(fan_corners.begin() + 3 * from, fan_corners.begin() + 3 * from + 3, _corners.begin() + 3 * i);
+    }
+    load_triangles(points, begin, end);
+  });
+}
+
+bool face_bvh_t::refit(mesh_t& mesh) {
+  auto points = mesh.kernel->point_table();
+  std::atomic<bool> complete(true);
+  parallel_for(_triangles.size(), _options.thread_count, [&](size_t begin, size_t end, size_t) {
+    if (!load_triangles(points, begin, end)) {
+      complete = false;
+    }
+  });
+  fit_nodes();
+  if (!complete) {
+    LOG(WARNING) << "Refitting a BVH whose points were removed, it needs to be built again";
+  }
+  return complete;
+}
+
+ray_hit_t face_bvh_t::intersect(const ray_t& ray) const {
+  ray_hit_t hit;
+  if (_nodes.empty()) {
+    return hit;
+  }
+  float origin[3], direction[3], inverse[3];
+  store(ray.origin, origin);
+  store(ray.direction, direction);
+  for (int axis = 0; axis < 3; ++axis) {
+    inverse[axis] = 1.f / direction[axis];
+  }
+
+  float best = ray.max_distance;
+  uint32_t best_triangle = uint32_t(-1);
+  pending_t stack[stack_depth];
+  size_t top = 0;
+  stack[top++] = { 0, enter_box(_nodes[0], origin, inverse, best) };
+  while (top > 0) {
+    const auto pending = stack[--top];
+    if (pending.distance >= best) {
+      continue;
+    }
+    auto& node = _nodes[pending.node];
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        const float t = intersect_triangle(_triangles[i], origin, direction);
+        if (t >= 0.f && t < best) {
+          best = t;
+          best_triangle = i;
+        }
+      }
+      continue;
+    }
+    uint32_t closer = node.first, further = node.first + 1;
+    float closer_t = enter_box(_nodes[closer], origin, inverse, best);
+    float further_t = enter_box(_nodes[further], origin, inverse, best);
+    if (further_t < closer_t) {
+      std::swap(closer, further);
+      std::swap(closer_t, further_t);
+    }
+    if (further_t != FLT_MAX) {
+      stack[top++] = { further, further_t };
+    }
+    if (closer_t != FLT_MAX) {
+      stack[top++] = { closer, closer_t };
+    }
+  }
+
+  if (best_triangle != uint32_t(-1)) {
+    hit.face = _faces[best_triangle];
+    hit.distance = best;
+    hit.position = ray.origin + ray.direction * best;
+  }
+  return hit;
+}
+
+closest_point_t face_bvh_t::closest_point(const position_t& point, float max_distance) const {
+  closest_point_t result;
+  if (_nodes.empty()) {
+    return result;
+  }
+  float p[3], candidate[3], best_point[3] = { 0.f, 0.f, 0.f };
+  store(point, p);
+
+  float best = max_distance < FLT_MAX ? max_distance * max_distance : FLT_MAX;
+  uint32_t best_triangle = uint32_t(-1);
+  pending_t stack[stack_depth];
+  size_t top = 0;
+  stack[top++] = { 0, box_distance_squared(_nodes[0], p) };
+  while (top > 0) {
+    const auto pending = stack[--top];
+    if (pending.distance > best) {
+      continue;
+    }
+    auto& node = _nodes[pending.node];
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        closest_on_triangle(_triangles[i], p, candidate);
+        float offset[3];
+        sub(candidate, p, offset);
+        const float distance = dot(offset, offset);
+        if (distance <= best) {
+          best = distance;
+          best_triangle = i;
+          std::copy(candidate, candidate + 3, best_point);
+        }
+      }
+      continue;
+    }
+    pending_t closer = { node.first, box_distance_squared(_nodes[node.first], p) };
+    pending_t further = { node.first + 1, box_distance_squared(_nodes[node.first + 1], p) };
+    if (further.distance < closer.distance) {
+      std::swap(closer, further);
+    }
+    if (further.distance <= best) {
+      stack[top++] = further;
+    }
+    if (closer.distance <= best) {
+      stack[top++] = closer;
+    }
+  }
+
+  if (best_triangle != uint32_t(-1)) {
+    result.face = _faces[best_triangle];
+    result.distance = std::sqrt(best);
+    result.position = position_t(best_point[0], best_point[1], best_point[2]);
+  }
+  return result;
+}
+
+void face_bvh_t::intersect(const ray_t* rays, ray_hit_t* hits, size_t count) const {
+  parallel_for(count, _options.thread_count, [this, rays, hits](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; ++i) {
+      hits[i] = intersect(rays[i]);
+    }
+  });
+}
+
+void face_bvh_t::closest_points(const position_t* points, closest_point_t* results, size_t count,
+                                float max_distance) const {
+  parallel_for(count, _options.thread_count, [=](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; ++i) {
+      results[i] = closest_point(points[i], max_distance);
+    }
+  });
+}
+
+size_t face_bvh_t::node_count() const {
+  return _nodes.size();
+}
+
+size_t face_bvh_t::triangle_count() const {
+  return _triangles.size();
+}
+
+} // namespace hedge
@@ -0,0 +1,217 @@
+
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <vectorial/simd4f.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+const size_t lane_count = 4;
+
+struct geometry_tables_t {
+  edge_table_t edges;
+  face_table_t faces;
+  vertex_table_t vertices;
+  point_table_t points;
+
+  explicit geometry_tables_t(kernel_t& kernel)
+    : edges(kernel.edge_table())
+    , faces(kernel.face_table())
+    , vertices(kernel.vertex_table())
+    , points(kernel.point_table())
+  {}
+
+  position_t corner(edge_index_t eindex) const {
+    return corner_position(edges, vertices, points, eindex);
+  }
+};
+
+struct lanes_t {
+  simd4f x;
+  simd4f y;
+  simd4f z;
+};
+
+/**
+   Vector areas of the faces in the four cells starting at offset. Every lane
+   fans its own face loop around the first corner; lanes that are done or hold
+   no face keep adding degenerate triangles until the longest loop is over.
+ */
+lanes_t face_vector_areas4(const geometry_tables_t& tables, size_t offset) {
+  edge_index_t first[lane_count];
+  edge_index_t current[lane_count];
+  position_t origin[lane_count];
+  for (size_t lane = 0; lane < lane_count; ++lane) {
+    const size_t cell = offset + lane;
+    if (cell < tables.faces.size && tables.faces.element[cell].status == element_status_t::ACTIVE) {
+      auto eindex = tables.faces.edge_index[cell];
+      if (tables.edges.contains(eindex)) {
+        first[lane] = eindex;
+        current[lane] = tables.edges.next_index[eindex.offset];
+      }
+    }
+    origin[lane] = tables.corner(first[lane]);
+  }
+
+  lanes_t o = {
+    simd4f_create(origin[0].x, origin[1].x, origin[2].x, origin[3].x),
+    simd4f_create(origin[0].y, origin[1].y, origin[2].y, origin[3].y),
+    simd4f_create(origin[0].z, origin[1].z, origin[2].z, origin[3].z)
+  };
+  lanes_t sum = { simd4f_zero(), simd4f_zero(), simd4f_zero() };
+
+  simd4f_aligned16 float b[3][lane_count];
+  simd4f_aligned16 float c[3][lane_count];
+  for (size_t steps = 0; steps < tables.edges.size; ++steps) {
+    bool active = false;
+    for (size_t lane = 0; lane < lane_count; ++lane) {
+      position_t pb = origin[lane];
+      position_t pc = origin[lane];
+      auto eindex = current[lane];
+      if (eindex && eindex != first[lane] && tables.edges.contains(eindex)) {
+        auto next = tables.edges.next_index[eindex.offset];
+        if (next && next != first[lane] && tables.edges.contains(next)) {
+          pb = tables.corner(eindex);
+          pc = tables.corner(next);
+          current[lane] = next;
+          active = true;
+        }
+        else {
+          current[lane].reset();
+        }
+      }
+      b[0][lane] = pb.x; b[1][lane] = pb.y; b[2][lane] = pb.z;
+      c[0][lane] = pc.x; c[1][lane] = pc.y; c[2][lane] = pc.z;
+    }
+    if (!active) {
+      break;
+    }
+
+    const simd4f ux = simd4f_sub(simd4f_uload4(b[0]), o.x);
+    const simd4f uy = simd4f_sub(simd4f_uload4(b[1]), o.y);
+    const simd4f uz = simd4f_sub(simd4f_uload4(b[2]), o.z);
+    const simd4f vx = simd4f_sub(simd4f_uload4(c[0]), o.x);
+    const simd4f vy = simd4f_sub(simd4f_uload4(c[1]), o.y);
+    const simd4f vz = simd4f_sub(simd4f_uload4(c[2]), o.z);
+    sum.x = simd4f_add(sum.x, simd4f_sub(simd4f_mul(uy, vz), simd4f_mul(uz, vy)));
+    sum.y = simd4f_add(sum.y, simd4f_sub(simd4f_mul(uz, vx), simd4f_mul(ux, vz)));
+    sum.z = simd4f_add(sum.z, simd4f_sub(simd4f_mul(ux, vy), simd4f_mul(uy, vx)));
+  }
+
+  const simd4f half = simd4f_splat(0.5f);
+  return { simd4f_mul(sum.x, half), simd4f_mul(sum.y, half), simd4f_mul(sum.z, half) };
+}
+
+simd4f lengths4(const lanes_t& v) {
+  return simd4f_sqrt(simd4f_add(simd4f_add(simd4f_mul(v.x, v.x), simd4f_mul(v.y, v.y)), simd4f_mul(v.z, v.z)));
+}
+
+/**
+   Zero vectors stay zero since their length is clamped before dividing.
+ */
+lanes_t normalize4(const lanes_t& v) {
+  const simd4f scale = simd4f_reciprocal(simd4f_max(lengths4(v), simd4f_splat(FLT_MIN)));
+  return { simd4f_mul(v.x, scale), simd4f_mul(v.y, scale), simd4f_mul(v.z, scale) };
+}
+
+void store4(const lanes_t& v, position_t* out, size_t offset, size_t size) {
+  simd4f_aligned16 float x[lane_count];
+  simd4f_aligned16 float y[lane_count];
+  simd4f_aligned16 float z[lane_count];
+  simd4f_ustore4(v.x, x);
+  simd4f_ustore4(v.y, y);
+  simd4f_ustore4(v.z, z);
+  for (size_t lane = 0; lane < lane_count && offset + lane < size; ++lane) {
+    out[offset + lane] = position_t(x[lane], y[lane], z[lane]);
+  }
+}
+
+/**
+   Calls fn(offset) for every block of four cells out of size, split across
+   thread_count threads.
+ */
+template<typename TFn>
+void for_each_block(size_t size, size_t thread_count, TFn&& fn) {
+  const size_t blocks = (size + lane_count - 1) / lane_count;
+  parallel_for(blocks, thread_count, [&fn](size_t begin, size_t end, size_t) {
+    for (size_t block = begin; block < end; ++block) {
+      fn(block * lane_count);
+    }
+  });
+}
+
+} // namespace
+
+void compute_face_areas(mesh_t& mesh, float* areas, size_t thread_count) {
+  const geometry_tables_t tables(*mesh.kernel);
+  const size_t size = tables.faces.size;
+  for_each_block(size, thread_count, [&](size_t offset) {
+    simd4f_aligned16 float result[lane_count];
+    simd4f_ustore4(lengths4(face_vector_areas4(tables, offset)), result);
+    for (size_t lane = 0; lane < lane_count && offset + lane < size; ++lane) {
+      areas[offset + lane] = result[lane];
+    }
+  });
+}
+
+void compute_face_normals(mesh_t& mesh, position_t* normals, size_t thread_count) {
+  const geometry_tables_t tables(*mesh.kernel);
+  const size_t size = tables.faces.size;
+  for_each_block(size, thread_count, [&](size_t offset) {
+    store4(normalize4(face_vector_areas4(tables, offset)), normals, offset, size);
+  });
+}
+
+void compute_vertex_normals(mesh_t& mesh, position_t* normals, size_t thread_count) {
+  const geometry_tables_t tables(*mesh.kernel);
+  const size_t face_size = tables.faces.size;
+  std::vector<position_t> vector_areas(face_size);
+  for_each_block(face_size, thread_count, [&](size_t offset) {
+    store4(face_vector_areas4(tables, offset), vector_areas.data(), offset, face_size);
+  });
+
+  // Scattering onto the vertices is the one serial pass, two faces sharing a
+  // vertex would race on it otherwise.
+  const size_t vertex_size = tables.vertices.size;
+  std::fill(normals, normals + vertex_size, position_t(0.f, 0.f, 0.f));
+  for (size_t cell = 1; cell < face_size; ++cell) {
+    if (tables.faces.element[cell].status != element_status_t::ACTIVE) {
+      continue;
+    }
+    auto first = tables.faces.edge_index[cell];
+    auto eindex = first;
+    for (size_t steps = 0; steps < tables.edges.size && tables.edges.contains(eindex); ++steps) {
+      auto vindex = tables.edges.vertex_index[eindex.offset];
+      if (tables.vertices.contains(vindex)) {
+        normals[vindex.offset] += vector_areas[cell];
+      }
+      eindex = tables.edges.next_index[eindex.offset];
+      if (eindex == first) {
+        break;
+      }
+    }
+  }
+
+  for_each_block(vertex_size, thread_count, [&](size_t offset) {
+    lanes_t v = { simd4f_zero(), simd4f_zero(), simd4f_zero() };
+    simd4f_aligned16 float x[lane_count] = {};
+    simd4f_aligned16 float y[lane_count] = {};
+    simd4f_aligned16 float z[lane_count] = {};
+    for (size_t lane = 0; lane < lane_count && offset + lane < vertex_size; ++lane) {
+      const auto& normal = normals[offset + lane];
+      x[lane] = normal.x; y[lane] = normal.y; z[lane] = normal.z;
+    }
+    v.x = simd4f_uload4(x);
+    v.y = simd4f_uload4(y);
+    v.z = simd4f_uload4(z);
+    store4(normalize4(v), normals, offset, vertex_size);
+  });
+}
+
+} // namespace hedge
@@ -0,0 +1,375 @@
+
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+using face_edge_circulator_t = circulator_t<face_loop_walk_t, edge_projection_t>;
+using vertex_face_circulator_t = circulator_t<vertex_ring_walk_t, face_projection_t>;
+
+struct export_tables_t {
+  edge_table_t edges;
+  face_table_t faces;
+  vertex_table_t vertices;
+  point_table_t points;
+
+  explicit export_tables_t(kernel_t& kernel)
+    : edges(kernel.edge_table())
+    , faces(kernel.face_table())
+    , vertices(kernel.vertex_table())
+    , points(kernel.point_table())
+  {}
+
+  bool is_active(const element_table_t& table, size_t cell) const {
+    return table.element[cell].status == element_status_t::ACTIVE;
+  }
+
+  /**
+     The edge the loop of a face starts at, or an empty index for removed
+     faces.
+   */
+  edge_index_t first_edge(offset_t cell) const {
+    auto eindex = faces.edge_index[cell];
+    return is_active(faces, cell) && edges.contains(eindex) ? eindex : edge_index_t();
+  }
+
+  size_t triangle_count(edge_index_t first) const {
+    size_t corners = 0;
+    for (face_edge_circulator_t it(&edges, first), end; it != end; ++it) {
+      ++corners;
+    }
+    return corners >= 3 ? corners - 2 : 0;
+  }
+
+  /**
+     Same weighting as compute_vertex_normals(), but for a single vertex by
+     walking the faces around it.
+   */
+  position_t vertex_normal(offset_t cell) const {
+    position_t sum(0.f, 0.f, 0.f);
+    if (!is_active(vertices, cell)) {
+      return sum;
+    }
+    auto start = find_ring_start(edges, vertices.edge_index[cell]);
+    for (vertex_face_circulator_t it(&edges, start), end; it != end; ++it) {
+      auto findex = *it;
+      if (faces.contains(findex) && is_active(faces, findex.offset)) {
+        sum += face_vector_area(edges, vertices, points, faces.edge_index[findex.offset]);
+      }
+    }
+    const float length = sum.Length();
+    return length > FLT_MIN ? sum / length : position_t(0.f, 0.f, 0.f);
+  }
+
+  gpu_vertex_t make_vertex(offset_t cell, const position_t& normal) const {
+    gpu_vertex_t vertex = {};
+    auto pindex = vertices.point_index[cell];
+    if (is_active(vertices, cell) && points.contains(pindex)) {
+      const auto& position = points.position[pindex.offset];
+      for (int axis = 0; axis < 3; ++axis) {
+        vertex.position[axis] = position[axis];
+        vertex.normal[axis] = normal[axis];
+      }
+    }
+    return vertex;
+  }
+};
+
+/**
+   Sorts the ranges and merges those that overlap or sit less than gap apart.
+ */
+void coalesce(std::vector<gpu_range_t>& ranges, size_t gap) {
+  std::sort(ranges.begin(), ranges.end(), [](const gpu_range_t& a, const gpu_range_t& b) {
+    return a.begin < b.begin;
+  });
+  size_t merged = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (merged > 0 && ranges[i].begin <= ranges[merged - 1].end + gap) {
+      ranges[merged - 1].end = std::max(ranges[merged - 1].end, ranges[i].end);
+    }
+    else {
+      ranges[merged++] = ranges[i];
+    }
+  }
+  ranges.resize(merged);
+}
+
+} // namespace
+
+gpu_export_t::gpu_export_t(const gpu_export_options_t& options)
+  : _options(options)
+  , _format(gpu_index_format_t::uint16)
+  , _rebuilt(false)
+  , _invalid(true)
+  , _live_triangles(0)
+{}
+
+void gpu_export_t::write_index(size_t at, offset_t value) {
+  if (_format == gpu_index_format_t::uint16) {
+    _indices16[at] = uint16_t(value);
+  }
+  else {
+    _indices32[at] = uint32_t(value);
+  }
+}
+
+/**
+   Fans the face around its first corner into the slot and fills whatever
+   the slot has left over with degenerate triangles.
+ */
+void gpu_export_t::write_face(const edge_table_t& edges, edge_index_t first, const face_slot_t& slot) {
+  size_t at = size_t(slot.first) * 3;
+  size_t written = 0;
+  if (first && slot.count > 0) {
+    const offset_t origin = edges.vertex_index[first.offset].offset;
+    face_edge_circulator_t it(&edges, first), end;
+    auto prev = (++it).edge();
+    for (++it; it != end && written < slot.count; ++it, ++written) {
+      write_index(at++, origin);
+      write_index(at++, edges.vertex_index[prev.offset].offset);
+      write_index(at++, edges.vertex_index[it.edge().offset].offset);
+      prev = it.edge();
+    }
+  }
+  for (; written < slot.capacity; ++written) {
+    write_index(at++, 0);
+    write_index(at++, 0);
+    write_index(at++, 0);
+  }
+}
+
+void gpu_export_t::record_states(const face_table_t& faces, const vertex_table_t& vertices) {
+  _face_states.resize(faces.size);
+  for (size_t cell = 0; cell < faces.size; ++cell) {
+    _face_states[cell] = { faces.element[cell].status, faces.element[cell].generation };
+  }
+  _vertex_states.resize(vertices.size);
+  for (size_t cell = 0; cell < vertices.size; ++cell) {
+    _vertex_states[cell] = { vertices.element[cell].status, vertices.element[cell].generation };
+  }
+}
+
+void gpu_export_t::rebuild(mesh_t& mesh) {
+  const export_tables_t tables(*mesh.kernel);
+  const size_t face_size = tables.faces.size;
+  const size_t vertex_size = tables.vertices.size;
+  const size_t thread_count = _options.thread_count;
+
+  _format = _options.allow_16bit_indices && vertex_size <= 0x10000
+    ? gpu_index_format_t::uint16 : gpu_index_format_t::uint32;
+
+  std::vector<position_t> normals(vertex_size);
+  compute_vertex_normals(mesh, normals.data(), thread_count);
+  _vertices.resize(vertex_size);
+  parallel_for(vertex_size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t cell = begin; cell < end; ++cell) {
+      _vertices[cell] = tables.make_vertex(offset_t(cell), normals[cell]);
+    }
+  });
+
+  // Runs are sized exactly, so a face has to grow before it moves.
+  _slots.assign(face_size, face_slot_t{ 0, 0, 0 });
+  parallel_for(face_size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t cell = std::max<size_t>(begin, 1); cell < end; ++cell) {
+      const auto triangles = uint32_t(tables.triangle_count(tables.first_edge(offset_t(cell))));
+      _slots[cell].capacity = triangles;
+      _slots[cell].count = triangles;
+    }
+  });
+  size_t total = 0;
+  for (auto& slot : _slots) {
+    slot.first = uint32_t(total);
+    total += slot.capacity;
+  }
+
+  _indices16.clear();
+  _indices32.clear();
+  if (_format == gpu_index_format_t::uint16) {
+    _indices16.resize(total * 3);
+  }
+  else {
+    _indices32.resize(total * 3);
+  }
+  parallel_for(face_size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t cell = begin; cell < end; ++cell) {
+      write_face(tables.edges, tables.first_edge(offset_t(cell)), _slots[cell]);
+    }
+  });
+
+  _live_triangles = total;
+  _rebuilt = true;
+  _invalid = false;
+  _marked_faces.clear();
+  _marked_vertices.clear();
+  _dirty_vertices.clear();
+  _dirty_indices.clear();
+  if (vertex_size > 0) {
+    _dirty_vertices.push_back({ 0, vertex_size });
+  }
+  if (total > 0) {
+    _dirty_indices.push_back({ 0, total * 3 });
+  }
+  record_states(tables.faces, tables.vertices);
+}
+
+void gpu_export_t::update(mesh_t& mesh) {
+  const export_tables_t tables(*mesh.kernel);
+  const size_t face_size = tables.faces.size;
+  const size_t vertex_size = tables.vertices.size;
+  const bool narrow = _options.allow_16bit_indices && vertex_size <= 0x10000;
+
+  // Storage only shrinks when it's compacted, which moves everything.
+  if (_invalid || narrow != (_format == gpu_index_format_t::uint16)
+      || face_size < _face_states.size() || vertex_size < _vertex_states.size()) {
+    rebuild(mesh);
+    return;
+  }
+  _rebuilt = false;
+  _dirty_vertices.clear();
+  _dirty_indices.clear();
+
+  auto changed = [](const std::vector<cell_state_t>& states, const element_table_t& table, size_t cell) {
+    return cell >= states.size() || states[cell].status != table.element[cell].status
+      || states[cell].generation != table.element[cell].generation;
+  };
+  std::vector<uint8_t> face_dirty(face_size, 0);
+  std::vector<uint8_t> vertex_dirty(vertex_size, 0);
+  for (size_t cell = 1; cell < face_size; ++cell) {
+    face_dirty[cell] = changed(_face_states, tables.faces, cell) ? 1 : 0;
+  }
+  for (size_t cell = 1; cell < vertex_size; ++cell) {
+    vertex_dirty[cell] = changed(_vertex_states, tables.vertices, cell) ? 1 : 0;
+  }
+  for (auto findex : _marked_faces) {
+    if (findex.offset < face_size) {
+      face_dirty[findex.offset] = 1;
+    }
+  }
+  for (auto vindex : _marked_vertices) {
+    if (!tables.vertices.contains(vindex)) {
+      continue;
+    }
+    vertex_dirty[vindex.offset] = 1;
+    auto start = find_ring_start(tables.edges, tables.vertices.edge_index[vindex.offset]);
+    for (vertex_face_circulator_t it(&tables.edges, start), end; it != end; ++it) {
+      if (it->offset < face_size) {
+        face_dirty[it->offset] = 1;
+      }
+    }
+  }
+  _marked_faces.clear();
+  _marked_vertices.clear();
+
+  auto read_index = [this](size_t at) -> size_t {
+    return _format == gpu_index_format_t::uint16 ? _indices16[at] : _indices32[at];
+  };
+  _slots.resize(face_size, face_slot_t{ 0, 0, 0 });
+  size_t total = index_count() / 3;
+  for (size_t cell = 1; cell < face_size; ++cell) {
+    if (!face_dirty[cell]) {
+      continue;
+    }
+    auto& slot = _slots[cell];
+    // The corners before and after the edit both need new normals.
+    for (size_t at = size_t(slot.first) * 3; at < (size_t(slot.first) + slot.count) * 3; ++at) {
+      vertex_dirty[std::min(read_index(at), vertex_size - 1)] = 1;
+    }
+    auto first = tables.first_edge(offset_t(cell));
+    for (face_edge_circulator_t it(&tables.edges, first), end; it != end; ++it) {
+      auto vindex = tables.edges.vertex_index[it->offset];
+      if (vindex.offset < vertex_size) {
+        vertex_dirty[vindex.offset] = 1;
+      }
+    }
+
+    const auto triangles = uint32_t(tables.triangle_count(first));
+    if (triangles > slot.capacity) {
+      face_slot_t old = slot;
+      old.count = 0;
+      write_face(tables.edges, edge_index_t(), old);
+      if (old.capacity > 0) {
+        _dirty_indices.push_back({ size_t(old.first) * 3, (size_t(old.first) + old.capacity) * 3 });
+      }
+      slot.first = uint32_t(total);
+      slot.capacity = triangles;
+      total += triangles;
+      _indices16.resize(_format == gpu_index_format_t::uint16 ? total * 3 : 0);
+      _indices32.resize(_format == gpu_index_format_t::uint32 ? total * 3 : 0);
+    }
+    _live_triangles = _live_triangles + triangles - slot.count;
+    slot.count = triangles;
+    write_face(tables.edges, first, slot);
+    if (slot.capacity > 0) {
+      _dirty_indices.push_back({ size_t(slot.first) * 3, (size_t(slot.first) + slot.capacity) * 3 });
+    }
+  }
+
+  if (2 * (total - _live_triangles) > total) {
+    rebuild(mesh);
+    return;
+  }
+
+  _vertices.resize(vertex_size);
+  for (size_t cell = 1; cell < vertex_size; ++cell) {
+    if (vertex_dirty[cell]) {
+      _vertices[cell] = tables.make_vertex(offset_t(cell), tables.vertex_normal(offset_t(cell)));
+      _dirty_vertices.push_back({ cell, cell + 1 });
+    }
+  }
+  coalesce(_dirty_vertices, _options.merge_gap);
+  coalesce(_dirty_indices, _options.merge_gap * 3);
+  record_states(tables.faces, tables.vertices);
+}
+
+void gpu_export_t::mark_face(face_index_t findex) {
+  _marked_faces.push_back(findex);
+}
+
+void gpu_export_t::mark_vertex(vertex_index_t vindex) {
+  _marked_vertices.push_back(vindex);
+}
+
+void gpu_export_t::invalidate() {
+  _invalid = true;
+}
+
+bool gpu_export_t::rebuilt() const {
+  return _rebuilt;
+}
+
+const std::vector<gpu_vertex_t>& gpu_export_t::vertices() const {
+  return _vertices;
+}
+
+gpu_index_format_t gpu_export_t::index_format() const {
+  return _format;
+}
+
+size_t gpu_export_t::index_size() const {
+  return _format == gpu_index_format_t::uint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+size_t gpu_export_t::index_count() const {
+  return _format == gpu_index_format_t::uint16 ? _indices16.size() : _indices32.size();
+}
+
+const void* gpu_export_t::index_data() const {
+  return _format == gpu_index_format_t::uint16
+    ? static_cast<const void*>(_indices16.data()) : static_cast<const void*>(_indices32.data());
+}
+
+const std::vector<gpu_range_t>& gpu_export_t::dirty_vertex_ranges() const {
+  return _dirty_vertices;
+}
+
+const std::vector<gpu_range_t>& gpu_export_t::dirty_index_ranges() const {
+  return _dirty_indices;
+}
+
+} // namespace hedge
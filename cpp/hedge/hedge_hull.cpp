@@ -0,0 +1,550 @@
+#include "hedge.hpp"
+
+#include <easylogging++.h>
+#include <vectorial/simd4f.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+const size_t lane_count = 4;
+
+/**
+   A face plane as its unit normal and distance from the origin, so the
+   signed distance of p is x * p.x + y * p.y + z * p.z - w.
+ */
+struct plane_t {
+  float x;
+  float y;
+  float z;
+  float w;
+
+  float distance(const position_t& p) const {
+    return x * p.x + y * p.y + z * p.z - w;
+  }
+};
+
+/**
+   The points outside of a face that haven't been added to the hull yet,
+   along with the one furthest out.
+ */
+struct conflict_t {
+  std::vector<uint32_t> points;
+  uint32_t furthest;
+  float distance;
+
+  conflict_t() : furthest(0), distance(0.f) {}
+
+  void clear() {
+    points.clear();
+    distance = 0.f;
+  }
+};
+
+/**
+   An edge of the visible region whose adjacent face stays. The new face put
+   on it runs from -> to -> apex and pairs up with outside. The vertices are
+   the ones outside uses, a mesh may give every corner its own, so the cone
+   is closed up by point.
+ */
+struct horizon_t {
+  vertex_index_t from;
+  vertex_index_t to;
+  offset_t from_point;
+  offset_t to_point;
+  edge_index_t outside;
+  edge_index_t to_apex;
+  edge_index_t from_apex;
+};
+
+class hull_builder_t {
+  mesh_t& _mesh;
+  transaction_t* _transaction;
+  std::vector<float> _x;
+  std::vector<float> _y;
+  std::vector<float> _z;
+  float _epsilon;
+  std::vector<plane_t> _planes;
+  std::vector<conflict_t> _conflicts;
+  std::vector<uint32_t> _face_marks;
+  std::vector<uint32_t> _vertex_marks;
+  std::vector<uint32_t> _point_marks;
+  uint32_t _mark;
+  std::vector<face_index_t> _pending;
+  std::vector<face_index_t> _visible;
+  std::vector<face_index_t> _created;
+  std::vector<horizon_t> _horizon;
+  std::vector<uint32_t> _orphans;
+
+public:
+  hull_builder_t(mesh_t& mesh, const std::vector<position_t>& points)
+    : _mesh(mesh)
+    , _transaction(mesh.transaction())
+    , _epsilon(0.f)
+    , _mark(0)
+  {
+    _x.reserve(points.size());
+    _y.reserve(points.size());
+    _z.reserve(points.size());
+    for (const auto& p : points) {
+      _x.push_back(p.x);
+      _y.push_back(p.y);
+      _z.push_back(p.z);
+    }
+  }
+
+  position_t input(uint32_t index) const {
+    return position_t(_x[index], _y[index], _z[index]);
+  }
+
+  /**
+     Works out the tolerance from the extent of the input and the current
+     hull together, computes the face planes and hands every point to the
+     first face it's outside of. Fails on anything but a closed triangle mesh.
+   */
+  bool prepare() {
+    auto edges = _mesh.kernel->edge_table();
+    auto faces = _mesh.kernel->face_table();
+    auto points = _mesh.kernel->point_table();
+
+    float extent[3] = { 0.f, 0.f, 0.f };
+    for (size_t i = 0; i < _x.size(); ++i) {
+      extent[0] = std::max(extent[0], std::abs(_x[i]));
+      extent[1] = std::max(extent[1], std::abs(_y[i]));
+      extent[2] = std::max(extent[2], std::abs(_z[i]));
+    }
+    for (auto pindex : _mesh.points()) {
+      const auto& p = points.position[pindex.offset];
+      extent[0] = std::max(extent[0], std::abs(p.x));
+      extent[1] = std::max(extent[1], std::abs(p.y));
+      extent[2] = std::max(extent[2], std::abs(p.z));
+    }
+    _epsilon = 8.f * FLT_EPSILON * (extent[0] + extent[1] + extent[2]);
+
+    std::vector<face_index_t> all;
+    for (auto findex : _mesh.faces()) {
+      auto first = faces.edge_index[findex.offset];
+      auto eindex = first;
+      for (size_t corner = 0; corner < 3; ++corner) {
+        auto adjacent = edges.adjacent_index[eindex.offset];
+        if (!adjacent || !edges.contains(adjacent)) {
+          LOG(ERROR) << "Convex hulls have to be closed, face " << findex.offset << " is on a boundary";
+          return false;
+        }
+        eindex = edges.next_index[eindex.offset];
+      }
+      if (eindex != first) {
+        LOG(ERROR) << "Convex hulls have to be made of triangles, face " << findex.offset << " isn't one";
+        return false;
+      }
+      all.push_back(findex);
+    }
+    if (all.size() < 4) {
+      LOG(ERROR) << "Convex hulls need at least four faces to start from, got " << all.size();
+      return false;
+    }
+    for (auto findex : all) {
+      update_plane(findex);
+    }
+
+    _orphans.resize(_x.size());
+    for (uint32_t i = 0; i < _orphans.size(); ++i) {
+      _orphans[i] = i;
+    }
+    assign(all);
+    return true;
+  }
+
+  /**
+     Adds the furthest point of a face with points outside of it until there
+     are none left, returning the number of points added.
+   */
+  size_t run() {
+    size_t added = 0;
+    while (!_pending.empty()) {
+      auto findex = _pending.back();
+      _pending.pop_back();
+      if (!_mesh.kernel->face_table().contains(findex) || _conflicts[findex.offset].points.empty()) {
+        continue;
+      }
+      add_point(findex);
+      ++added;
+    }
+    return added;
+  }
+
+private:
+  template<typename TElement>
+  auto emplace(TElement&& element) -> decltype(_mesh.kernel->emplace(std::move(element))) {
+    if (_transaction != nullptr) {
+      return _transaction->emplace(std::move(element));
+    }
+    return _mesh.kernel->emplace(std::move(element));
+  }
+
+  template<typename TIndex>
+  void remove(TIndex index) {
+    if (_transaction != nullptr) {
+      _transaction->remove(index);
+    } else {
+      _mesh.kernel->remove(index);
+    }
+  }
+
+  template<typename TIndex>
+  void touch(TIndex index) {
+    if (_transaction != nullptr) {
+      _transaction->touch(index);
+    }
+  }
+
+  void next_mark() {
+    if (++_mark == 0) {
+      std::fill(_face_marks.begin(), _face_marks.end(), 0);
+      std::fill(_vertex_marks.begin(), _vertex_marks.end(), 0);
+      std::fill(_point_marks.begin(), _point_marks.end(), 0);
+      _mark = 1;
+    }
+    _face_marks.resize(_mesh.kernel->face_table().size, 0);
+    _vertex_marks.resize(_mesh.kernel->vertex_table().size, 0);
+    _point_marks.resize(_mesh.kernel->point_table().size, 0);
+  }
+
+  /**
+     Marks the vertices the faces that stay use around the start of a horizon
+     edge, walking both ways around its point until a visible face.
+   */
+  void keep_fan(const edge_table_t& edges, edge_index_t start) {
+    _vertex_marks[edges.vertex_index[start.offset].offset] = _mark;
+    for (auto eindex = start;;) {
+      eindex = edges.next_index[edges.adjacent_index[eindex.offset].offset];
+      if (eindex == start || _face_marks[edges.face_index[eindex.offset].offset] == _mark) {
+        break;
+      }
+      _vertex_marks[edges.vertex_index[eindex.offset].offset] = _mark;
+    }
+    for (auto eindex = start;;) {
+      eindex = edges.adjacent_index[edges.prev_index[eindex.offset].offset];
+      if (eindex == start || _face_marks[edges.face_index[eindex.offset].offset] == _mark) {
+        break;
+      }
+      _vertex_marks[edges.vertex_index[eindex.offset].offset] = _mark;
+    }
+  }
+
+  void update_plane(face_index_t findex) {
+    auto edges = _mesh.kernel->edge_table();
+    auto faces = _mesh.kernel->face_table();
+    auto vertices = _mesh.kernel->vertex_table();
+    auto points = _mesh.kernel->point_table();
+    if (_planes.size() < faces.size) {
+      _planes.resize(faces.size);
+      _conflicts.resize(faces.size);
+    }
+    auto first = faces.edge_index[findex.offset];
+    const auto a = corner_position(edges, vertices, points, first);
+    const auto b = corner_position(edges, vertices, points, edges.next_index[first.offset]);
+    const auto c = corner_position(edges, vertices, points, edges.prev_index[first.offset]);
+    const double ux = double(b.x) - a.x, uy = double(b.y) - a.y, uz = double(b.z) - a.z;
+    const double vx = double(c.x) - a.x, vy = double(c.y) - a.y, vz = double(c.z) - a.z;
+    double nx = uy * vz - uz * vy;
+    double ny = uz * vx - ux * vz;
+    double nz = ux * vy - uy * vx;
+    const double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+    if (length > 0.0) {
+      nx /= length;
+      ny /= length;
+      nz /= length;
+    }
+    auto& plane = _planes[findex.offset];
+    plane.x = float(nx);
+    plane.y = float(ny);
+    plane.z = float(nz);
+    plane.w = float(nx * a.x + ny * a.y + nz * a.z);
+  }
+
+  /**
+     Hands the orphaned points to the first of the faces they're outside of,
+     testing four points at a time against every plane. Points inside of all
+     of them are inside the hull and dropped.
+   */
+  void assign(const std::vector<face_index_t>& faces) {
+    const size_t count = _orphans.size();
+    for (size_t begin = 0; begin < count; begin += lane_count) {
+      const size_t lanes = std::min(lane_count, count - begin);
+      uint32_t index[lane_count];
+      for (size_t lane = 0; lane < lane_count; ++lane) {
+        index[lane] = _orphans[begin + std::min(lane, lanes - 1)];
+      }
+      const simd4f px = simd4f_create(_x[index[0]], _x[index[1]], _x[index[2]], _x[index[3]]);
+      const simd4f py = simd4f_create(_y[index[0]], _y[index[1]], _y[index[2]], _y[index[3]]);
+      const simd4f pz = simd4f_create(_z[index[0]], _z[index[1]], _z[index[2]], _z[index[3]]);
+
+      const unsigned all = (1u << lanes) - 1;
+      unsigned assigned = 0;
+      for (auto findex : faces) {
+        const auto& plane = _planes[findex.offset];
+        const simd4f distance = simd4f_sub(
+          simd4f_add(simd4f_add(simd4f_mul(px, simd4f_splat(plane.x)), simd4f_mul(py, simd4f_splat(plane.y))),
+                     simd4f_mul(pz, simd4f_splat(plane.z))),
+          simd4f_splat(plane.w));
+        simd4f_aligned16 float out[lane_count];
+        simd4f_ustore4(distance, out);
+        for (size_t lane = 0; lane < lanes; ++lane) {
+          if ((assigned & (1u << lane)) == 0 && out[lane] > _epsilon) {
+            auto& conflict = _conflicts[findex.offset];
+            if (conflict.points.empty()) {
+              _pending.push_back(findex);
+            }
+            if (conflict.points.empty() || out[lane] > conflict.distance) {
+              conflict.furthest = index[lane];
+              conflict.distance = out[lane];
+            }
+            conflict.points.push_back(index[lane]);
+            assigned |= 1u << lane;
+          }
+        }
+        if (assigned == all) {
+          break;
+        }
+      }
+    }
+    _orphans.clear();
+  }
+
+  /**
+     Replaces every face the furthest point outside of findex can see with a
+     cone of faces from the horizon to the point. The faces, edges and any
+     vertex left inside go first so their cells get reused by the cone.
+   */
+  void add_point(face_index_t findex) {
+    const uint32_t apex_index = _conflicts[findex.offset].furthest;
+    const auto apex = input(apex_index);
+    next_mark();
+
+    auto edges = _mesh.kernel->edge_table();
+    auto faces = _mesh.kernel->face_table();
+    auto vertices = _mesh.kernel->vertex_table();
+    _visible.clear();
+    _horizon.clear();
+    _visible.push_back(findex);
+    _face_marks[findex.offset] = _mark;
+    for (size_t i = 0; i < _visible.size(); ++i) {
+      auto first = faces.edge_index[_visible[i].offset];
+      auto eindex = first;
+      do {
+        auto adjacent = edges.adjacent_index[eindex.offset];
+        auto neighbour = edges.face_index[adjacent.offset];
+        if (_face_marks[neighbour.offset] != _mark) {
+          if (_planes[neighbour.offset].distance(apex) > _epsilon) {
+            _face_marks[neighbour.offset] = _mark;
+            _visible.push_back(neighbour);
+          } else {
+            horizon_t horizon;
+            horizon.from = edges.vertex_index[edges.next_index[adjacent.offset].offset];
+            horizon.to = edges.vertex_index[adjacent.offset];
+            horizon.from_point = vertices.point_index[horizon.from.offset].offset;
+            horizon.to_point = vertices.point_index[horizon.to.offset].offset;
+            horizon.outside = adjacent;
+            _horizon.push_back(horizon);
+          }
+        }
+        eindex = edges.next_index[eindex.offset];
+      } while (eindex != first);
+    }
+
+    // Points on the horizon stay along with the vertices the faces that stay
+    // use there, the rest of the visible ones are inside.
+    for (const auto& horizon : _horizon) {
+      _point_marks[horizon.from_point] = _mark;
+      keep_fan(edges, edges.next_index[horizon.outside.offset]);
+    }
+    for (auto visible : _visible) {
+      auto first = faces.edge_index[visible.offset];
+      edge_index_t loop[3] = { first, edges.next_index[first.offset], edges.prev_index[first.offset] };
+      for (auto eindex : loop) {
+        auto vindex = edges.vertex_index[eindex.offset];
+        if (_vertex_marks[vindex.offset] != _mark) {
+          _vertex_marks[vindex.offset] = _mark;
+          auto pindex = vertices.point_index[vindex.offset];
+          if (_point_marks[pindex.offset] != _mark) {
+            _point_marks[pindex.offset] = _mark;
+            remove(pindex);
+          }
+          remove(vindex);
+        }
+        remove(eindex);
+      }
+      auto& conflict = _conflicts[visible.offset];
+      for (auto point : conflict.points) {
+        if (point != apex_index) {
+          _orphans.push_back(point);
+        }
+      }
+      conflict.clear();
+      remove(visible);
+    }
+
+    auto pindex = emplace(point_t(apex.x, apex.y, apex.z));
+    vertex_t apex_vertex;
+    apex_vertex.point_index = pindex;
+    auto vindex = emplace(std::move(apex_vertex));
+
+    _created.clear();
+    for (auto& horizon : _horizon) {
+      auto face = emplace(face_t());
+      _created.push_back(face);
+      edge_t from_edge;
+      from_edge.vertex_index = horizon.from;
+      from_edge.face_index = face;
+      edge_t to_edge;
+      to_edge.vertex_index = horizon.to;
+      to_edge.face_index = face;
+      edge_t apex_edge;
+      apex_edge.vertex_index = vindex;
+      apex_edge.face_index = face;
+      auto along = emplace(std::move(from_edge));
+      horizon.to_apex = emplace(std::move(to_edge));
+      horizon.from_apex = emplace(std::move(apex_edge));
+      touch(horizon.outside);
+      touch(horizon.from);
+      edges = _mesh.kernel->edge_table();
+      edges.adjacent_index.writable(horizon.outside.offset) = along;
+      edges.adjacent_index.writable(along.offset) = horizon.outside;
+      _mesh.kernel->vertex_table().edge_index.writable(horizon.from.offset) = along;
+      _mesh.kernel->face_table().edge_index.writable(face.offset) = along;
+    }
+
+    // Close up the cone: the edge into the apex from the end of one horizon
+    // edge pairs with the edge out of the apex of the one starting there.
+    edges = _mesh.kernel->edge_table();
+    for (auto& horizon : _horizon) {
+      auto along = edges.adjacent_index[horizon.outside.offset];
+      edges.next_index.writable(along.offset) = horizon.to_apex;
+      edges.next_index.writable(horizon.to_apex.offset) = horizon.from_apex;
+      edges.next_index.writable(horizon.from_apex.offset) = along;
+      edges.prev_index.writable(along.offset) = horizon.from_apex;
+      edges.prev_index.writable(horizon.to_apex.offset) = along;
+      edges.prev_index.writable(horizon.from_apex.offset) = horizon.to_apex;
+      for (const auto& other : _horizon) {
+        if (other.from_point == horizon.to_point) {
+          edges.adjacent_index.writable(horizon.to_apex.offset) = other.from_apex;
+          edges.adjacent_index.writable(other.from_apex.offset) = horizon.to_apex;
+          break;
+        }
+      }
+    }
+    if (!_horizon.empty()) {
+      _mesh.kernel->vertex_table().edge_index.writable(vindex.offset) = _horizon.front().from_apex;
+    }
+
+    for (auto face : _created) {
+      update_plane(face);
+    }
+    assign(_created);
+  }
+};
+
+/**
+   Picks four points spanning a tetrahedron: the two furthest apart of the
+   extremes along the axes, the one furthest from the line through them and
+   the one furthest from their plane. Fails when the points are all on a
+   plane.
+ */
+bool initial_simplex(const std::vector<position_t>& points, uint32_t simplex[4]) {
+  uint32_t extremes[6] = { 0, 0, 0, 0, 0, 0 };
+  for (uint32_t i = 1; i < points.size(); ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      if (points[i][axis] < points[extremes[axis * 2]][axis]) {
+        extremes[axis * 2] = i;
+      }
+      if (points[i][axis] > points[extremes[axis * 2 + 1]][axis]) {
+        extremes[axis * 2 + 1] = i;
+      }
+    }
+  }
+  float best = -1.f;
+  for (int i = 0; i < 6; ++i) {
+    for (int j = i + 1; j < 6; ++j) {
+      const float distance = (points[extremes[i]] - points[extremes[j]]).LengthSquared();
+      if (distance > best) {
+        best = distance;
+        simplex[0] = extremes[i];
+        simplex[1] = extremes[j];
+      }
+    }
+  }
+  const float scale = std::max(best, FLT_MIN);
+
+  const auto a = points[simplex[0]];
+  const auto line = points[simplex[1]] - a;
+  best = 0.f;
+  for (uint32_t i = 0; i < points.size(); ++i) {
+    const float distance = position_t::CrossProduct(line, points[i] - a).LengthSquared();
+    if (distance > best) {
+      best = distance;
+      simplex[2] = i;
+    }
+  }
+  if (best <= scale * scale * 1e-10f) {
+    return false;
+  }
+
+  const auto normal = position_t::CrossProduct(line, points[simplex[2]] - a).Normalized();
+  best = 0.f;
+  for (uint32_t i = 0; i < points.size(); ++i) {
+    const float distance = std::abs(position_t::DotProduct(normal, points[i] - a));
+    if (distance > best) {
+      best = distance;
+      simplex[3] = i;
+    }
+  }
+  return best * best > scale * 1e-10f;
+}
+
+} // namespace
+
+bool build_convex_hull(mesh_t& hull, const std::vector<position_t>& points) {
+  if (hull.point_count() != 0 || hull.face_count() != 0) {
+    LOG(ERROR) << "Convex hulls are built into an empty mesh, use extend_convex_hull() to add points";
+    return false;
+  }
+  uint32_t simplex[4] = { 0, 0, 0, 0 };
+  if (points.size() < 4 || !initial_simplex(points, simplex)) {
+    LOG(ERROR) << "Convex hulls need at least four points that aren't on a plane";
+    return false;
+  }
+
+  std::vector<position_t> corners;
+  for (auto index : simplex) {
+    corners.push_back(points[index]);
+  }
+  std::vector<uint32_t> indices;
+  const uint32_t sides[4][4] = { { 0, 1, 2, 3 }, { 0, 3, 1, 2 }, { 1, 3, 2, 0 }, { 2, 3, 0, 1 } };
+  for (const auto& side : sides) {
+    const auto normal = position_t::CrossProduct(corners[side[1]] - corners[side[0]],
+                                                 corners[side[2]] - corners[side[0]]);
+    const bool inwards = position_t::DotProduct(normal, corners[side[3]] - corners[side[0]]) > 0.f;
+    indices.insert(indices.end(), { side[0], inwards ? side[2] : side[1], inwards ? side[1] : side[2] });
+  }
+  if (!hull.build_from_indexed(corners, indices)) {
+    return false;
+  }
+  return extend_convex_hull(hull, points);
+}
+
+bool extend_convex_hull(mesh_t& hull, const std::vector<position_t>& points) {
+  hull_builder_t builder(hull, points);
+  if (!builder.prepare()) {
+    return false;
+  }
+  builder.run();
+  return true;
+}
+
+} // namespace hedge
@@ -0,0 +1,978 @@
+
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+
+#include <easylogging++.h>
+
+namespace hedge {
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared text and binary scanning
+
+struct text_t {
+  const char* begin;
+  const char* end;
+};
+
+/**
+   What every importer produces, laid out the way build_from_indexed() takes it.
+ */
+struct indexed_buffers_t {
+  std::vector<position_t> positions;
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> face_sizes;
+
+  bool build(mesh_t& mesh) {
+    const bool triangles = std::all_of(face_sizes.begin(), face_sizes.end(), [](uint32_t size) {
+      return size == 3;
+    });
+    if (triangles) {
+      face_sizes.clear();
+    }
+    return mesh.build_from_indexed(positions, indices, face_sizes);
+  }
+};
+
+bool read_file(const std::string& path, std::vector<char>& data) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    LOG(ERROR) << "Couldn't open " << path;
+    return false;
+  }
+  bool read = std::fseek(file, 0, SEEK_END) == 0;
+  const long size = read ? std::ftell(file) : -1;
+  read = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+  if (read) {
+    data.resize(size_t(size));
+    read = std::fread(data.data(), 1, data.size(), file) == data.size();
+  }
+  std::fclose(file);
+  if (!read) {
+    LOG(ERROR) << "Couldn't read " << path;
+  }
+  return read;
+}
+
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+void skip_spaces(const char*& p, const char* end) {
+  while (p < end && is_space(*p)) {
+    ++p;
+  }
+}
+
+const char* line_end(const char* p, const char* end) {
+  auto eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  return eol != nullptr ? eol : end;
+}
+
+const char* next_line(const char* eol, const char* end) {
+  return eol < end ? eol + 1 : end;
+}
+
+bool starts_with_word(const char* p, const char* end, const char* word) {
+  const size_t length = std::strlen(word);
+  return size_t(end - p) > length && std::memcmp(p, word, length) == 0 && is_space(p[length]);
+}
+
+/**
+   Decimal floats with an optional exponent, which covers everything mesh
+   exporters write. Anything else (inf, nan, hex floats) goes to strtod.
+ */
+bool parse_float(const char*& p, const char* end, float& value) {
+  skip_spaces(p, end);
+  const char* s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    ++s;
+  }
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  bool any = false;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + uint64_t(*s - '0');
+      digits += mantissa != 0 ? 1 : 0;
+    }
+    else {
+      ++exponent;
+    }
+  }
+  if (s < end && *s == '.') {
+    for (++s; s < end && *s >= '0' && *s <= '9'; ++s, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + uint64_t(*s - '0');
+        digits += mantissa != 0 ? 1 : 0;
+        --exponent;
+      }
+    }
+  }
+  if (!any) {
+    char buffer[64];
+    const size_t length = std::min<size_t>(sizeof(buffer) - 1, end - p);
+    std::memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    char* parsed = nullptr;
+    value = float(std::strtod(buffer, &parsed));
+    if (parsed == buffer) {
+      return false;
+    }
+    p += parsed - buffer;
+    return true;
+  }
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char* e = s + 1;
+    bool negative_exponent = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      negative_exponent = *e == '-';
+      ++e;
+    }
+    if (e < end && *e >= '0' && *e <= '9') {
+      int power = 0;
+      for (; e < end && *e >= '0' && *e <= '9'; ++e) {
+        power = std::min(power * 10 + (*e - '0'), 10000);
+      }
+      exponent += negative_exponent ? -power : power;
+      s = e;
+    }
+  }
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  double result = double(mantissa);
+  if (exponent < 0) {
+    result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+  }
+  else if (exponent > 0) {
+    result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+  }
+  value = float(negative ? -result : result);
+  p = s;
+  return true;
+}
+
+bool parse_int(const char*& p, const char* end, int64_t& value) {
+  skip_spaces(p, end);
+  const char* s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    ++s;
+  }
+  if (s >= end || *s < '0' || *s > '9') {
+    return false;
+  }
+  int64_t result = 0;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s) {
+    result = result * 10 + (*s - '0');
+  }
+  value = negative ? -result : result;
+  p = s;
+  return true;
+}
+
+/**
+   Cuts text into about one chunk per thread, always at a line break. Small
+   inputs stay in one chunk since threads aren't worth it there.
+ */
+std::vector<text_t> split_lines(const char* begin, const char* end, size_t thread_count) {
+  const size_t min_chunk_bytes = 64 * 1024;
+  const size_t size = size_t(end - begin);
+  const size_t chunks = std::max<size_t>(1, std::min(resolve_thread_count(thread_count), size / min_chunk_bytes));
+  std::vector<text_t> result;
+  const char* start = begin;
+  for (size_t chunk = 1; chunk < chunks; ++chunk) {
+    const char* cut = std::max(start, begin + size * chunk / chunks);
+    cut = next_line(line_end(cut, end), end);
+    result.push_back({ start, cut });
+    start = cut;
+  }
+  result.push_back({ start, end });
+  return result;
+}
+
+/**
+   Runs fn(chunk) on its own thread for every chunk.
+ */
+template<typename TFn>
+void for_each_chunk(size_t chunks, TFn&& fn) {
+  parallel_for(chunks, chunks, [&fn](size_t begin, size_t end, size_t) {
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+      fn(chunk);
+    }
+  });
+}
+
+size_t line_number(const std::vector<char>& data, const char* at) {
+  return size_t(std::count(data.data(), at, '\n')) + 1;
+}
+
+bool host_is_little_endian() {
+  const uint16_t probe = 1;
+  uint8_t first;
+  std::memcpy(&first, &probe, 1);
+  return first == 1;
+}
+
+template<typename T>
+T read_scalar(const char* p, bool swap) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, p, sizeof(T));
+  if (swap) {
+    std::reverse(bytes, bytes + sizeof(T));
+  }
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// OBJ
+
+/**
+   Negative OBJ indices count back from the last position read so far, which
+   a chunk only knows relative to its own start. Those slots are listed in
+   relative and fixed up once the chunk's first position is known.
+ */
+struct obj_chunk_t {
+  std::vector<position_t> positions;
+  std::vector<int64_t> indices;
+  std::vector<size_t> relative;
+  std::vector<uint32_t> face_sizes;
+  const char* error;
+
+  obj_chunk_t() : error(nullptr) {}
+};
+
+void parse_obj_chunk(text_t text, obj_chunk_t& chunk) {
+  for (const char* line = text.begin; line < text.end;) {
+    const char* eol = line_end(line, text.end);
+    const char* p = line;
+    skip_spaces(p, eol);
+    if (starts_with_word(p, eol, "v")) {
+      p += 2;
+      float x, y, z;
+      if (!parse_float(p, eol, x) || !parse_float(p, eol, y) || !parse_float(p, eol, z)) {
+        chunk.error = line;
+        return;
+      }
+      chunk.positions.emplace_back(x, y, z);
+    }
+    else if (starts_with_word(p, eol, "f")) {
+      p += 2;
+      uint32_t corners = 0;
+      for (skip_spaces(p, eol); p < eol; skip_spaces(p, eol)) {
+        int64_t index;
+        if (!parse_int(p, eol, index) || index == 0) {
+          chunk.error = line;
+          return;
+        }
+        if (index > 0) {
+          chunk.indices.push_back(index - 1);
+        }
+        else {
+          chunk.relative.push_back(chunk.indices.size());
+          chunk.indices.push_back(int64_t(chunk.positions.size()) + index);
+        }
+        // Texture coordinate and normal indices aren't used.
+        while (p < eol && !is_space(*p)) {
+          ++p;
+        }
+        ++corners;
+      }
+      if (corners < 3) {
+        chunk.error = line;
+        return;
+      }
+      chunk.face_sizes.push_back(corners);
+    }
+    line = next_line(eol, text.end);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// PLY
+
+enum class ply_type_t {
+  int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid
+};
+
+struct ply_property_t {
+  std::string name;
+  ply_type_t type;
+  ply_type_t count_type;
+  bool list;
+};
+
+struct ply_element_t {
+  std::string name;
+  size_t count;
+  std::vector<ply_property_t> properties;
+};
+
+enum class ply_format_t {
+  ascii, binary_little_endian, binary_big_endian
+};
+
+struct ply_header_t {
+  ply_format_t format;
+  std::vector<ply_element_t> elements;
+  size_t body;
+};
+
+ply_type_t parse_ply_type(const std::string& name) {
+  if (name == "char" || name == "int8") return ply_type_t::int8;
+  if (name == "uchar" || name == "uint8") return ply_type_t::uint8;
+  if (name == "short" || name == "int16") return ply_type_t::int16;
+  if (name == "ushort" || name == "uint16") return ply_type_t::uint16;
+  if (name == "int" || name == "int32") return ply_type_t::int32;
+  if (name == "uint" || name == "uint32") return ply_type_t::uint32;
+  if (name == "float" || name == "float32") return ply_type_t::float32;
+  if (name == "double" || name == "float64") return ply_type_t::float64;
+  return ply_type_t::invalid;
+}
+
+size_t ply_type_size(ply_type_t type) {
+  switch (type) {
+  case ply_type_t::int8: case ply_type_t::uint8: return 1;
+  case ply_type_t::int16: case ply_type_t::uint16: return 2;
+  case ply_type_t::int32: case ply_type_t::uint32: case ply_type_t::float32: return 4;
+  case ply_type_t::float64: return 8;
+  default: return 0;
+  }
+}
+
+double read_ply_value(const char* p, ply_type_t type, bool swap) {
+  switch (type) {
+  case ply_type_t::int8: return double(read_scalar<int8_t>(p, swap));
+  case ply_type_t::uint8: return double(read_scalar<uint8_t>(p, swap));
+  case ply_type_t::int16: return double(read_scalar<int16_t>(p, swap));
+  case ply_type_t::uint16: return double(read_scalar<uint16_t>(p, swap));
+  case ply_type_t::int32: return double(read_scalar<int32_t>(p, swap));
+  case ply_type_t::uint32: return double(read_scalar<uint32_t>(p, swap));
+  case ply_type_t::float32: return double(read_scalar<float>(p, swap));
+  case ply_type_t::float64: return read_scalar<double>(p, swap);
+  default: return 0.0;
+  }
+}
+
+bool parse_ply_header(const std::vector<char>& data, const std::string& path, ply_header_t& header) {
+  const char* end = data.data() + data.size();
+  const char* line = data.data();
+  size_t number = 0;
+  bool format = false;
+  for (; line < end; ++number) {
+    const char* eol = line_end(line, end);
+    std::istringstream words(std::string(line, eol));
+    line = next_line(eol, end);
+    std::string keyword;
+    words >> keyword;
+    if (number == 0) {
+      if (keyword != "ply") {
+        LOG(ERROR) << path << " is not a PLY file";
+        return false;
+      }
+    }
+    else if (keyword == "format") {
+      std::string name;
+      words >> name;
+      if (name == "ascii") header.format = ply_format_t::ascii;
+      else if (name == "binary_little_endian") header.format = ply_format_t::binary_little_endian;
+      else if (name == "binary_big_endian") header.format = ply_format_t::binary_big_endian;
+      else {
+        LOG(ERROR) << path << " has an unknown PLY format: " << name;
+        return false;
+      }
+      format = true;
+    }
+    else if (keyword == "element") {
+      ply_element_t element;
+      if (!(words >> element.name >> element.count)) {
+        LOG(ERROR) << path << " has a malformed PLY element on line " << number + 1;
+        return false;
+      }
+      header.elements.push_back(element);
+    }
+    else if (keyword == "property") {
+      ply_property_t property;
+      std::string type;
+      words >> type;
+      property.list = type == "list";
+      if (property.list) {
+        std::string count_type;
+        words >> count_type >> type;
+        property.count_type = parse_ply_type(count_type);
+      }
+      property.type = parse_ply_type(type);
+      words >> property.name;
+      if (header.elements.empty() || property.type == ply_type_t::invalid
+          || (property.list && property.count_type == ply_type_t::invalid)) {
+        LOG(ERROR) << path << " has a malformed PLY property on line " << number + 1;
+        return false;
+      }
+      header.elements.back().properties.push_back(property);
+    }
+    else if (keyword == "end_header") {
+      header.body = size_t(line - data.data());
+      if (!format) {
+        LOG(ERROR) << path << " has no PLY format line";
+      }
+      return format;
+    }
+  }
+  LOG(ERROR) << path << " has no end to its PLY header";
+  return false;
+}
+
+/**
+   Where the fields the importer cares about are within the vertex and face
+   elements.
+ */
+struct ply_layout_t {
+  int vertex_element;
+  int face_element;
+  int xyz[3];
+  int indices;
+
+  ply_layout_t() : vertex_element(-1), face_element(-1), xyz{ -1, -1, -1 }, indices(-1) {}
+};
+
+bool find_ply_layout(const ply_header_t& header, const std::string& path, ply_layout_t& layout) {
+  for (size_t e = 0; e < header.elements.size(); ++e) {
+    auto& element = header.elements[e];
+    for (size_t p = 0; p < element.properties.size(); ++p) {
+      auto& property = element.properties[p];
+      if (element.name == "vertex" && !property.list) {
+        layout.vertex_element = int(e);
+        if (property.name == "x") layout.xyz[0] = int(p);
+        if (property.name == "y") layout.xyz[1] = int(p);
+        if (property.name == "z") layout.xyz[2] = int(p);
+      }
+      if (element.name == "face" && property.list
+          && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+        layout.face_element = int(e);
+        layout.indices = int(p);
+      }
+    }
+  }
+  if (layout.vertex_element < 0 || layout.xyz[0] < 0 || layout.xyz[1] < 0 || layout.xyz[2] < 0) {
+    LOG(ERROR) << path << " has no vertex positions";
+    return false;
+  }
+  return true;
+}
+
+/**
+   Pulls elements out of a binary body, checking every read against the end.
+ */
+struct ply_reader_t {
+  const char* p;
+  const char* end;
+  bool swap;
+  bool ok;
+
+  bool has(size_t bytes) {
+    ok = ok && size_t(end - p) >= bytes;
+    return ok;
+  }
+
+  double value(ply_type_t type) {
+    const size_t size = ply_type_size(type);
+    if (!has(size)) {
+      return 0.0;
+    }
+    double result = read_ply_value(p, type, swap);
+    p += size;
+    return result;
+  }
+
+  /**
+     Reads one element, handing the values of the wanted list to on_index and
+     every other scalar to on_scalar.
+   */
+  template<typename TScalar, typename TList>
+  void element(const ply_element_t& element, int list_property, TScalar&& on_scalar, TList&& on_list) {
+    for (size_t i = 0; ok && i < element.properties.size(); ++i) {
+      auto& property = element.properties[i];
+      if (!property.list) {
+        on_scalar(i, value(property.type));
+        continue;
+      }
+      const double count = value(property.count_type);
+      if (count < 0 || !has(size_t(count) * ply_type_size(property.type))) {
+        ok = false;
+        return;
+      }
+      if (int(i) == list_property) {
+        on_list(size_t(count));
+      }
+      else {
+        p += size_t(count) * ply_type_size(property.type);
+      }
+    }
+  }
+};
+
+bool parse_ply_binary(const std::vector<char>& data, const ply_header_t& header, const ply_layout_t& layout,
+                      const std::string& path, size_t thread_count, indexed_buffers_t& buffers) {
+  ply_reader_t reader = { data.data() + header.body, data.data() + data.size(),
+                          (header.format == ply_format_t::binary_little_endian) != host_is_little_endian(), true };
+  auto ignore = [](size_t, double) {};
+
+  for (size_t e = 0; reader.ok && e < header.elements.size(); ++e) {
+    auto& element = header.elements[e];
+    const bool fixed = std::none_of(element.properties.begin(), element.properties.end(),
+                                    [](const ply_property_t& property) { return property.list; });
+
+    // Every element takes at least its scalars and list counts, which bounds
+    // the count the header declares by what's left of the file before
+    // anything gets sized from it.
+    size_t least = 0;
+    for (auto& property : element.properties) {
+      least += ply_type_size(property.list ? property.count_type : property.type);
+    }
+    if (least > 0 && element.count > size_t(reader.end - reader.p) / least) {
+      reader.ok = false;
+      break;
+    }
+
+    if (int(e) == layout.vertex_element && fixed) {
+      // Every vertex has the same size so they can be read in parallel.
+      size_t stride = 0;
+      size_t offsets[3] = {};
+      for (size_t i = 0; i < element.properties.size(); ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+          if (int(i) == layout.xyz[axis]) {
+            offsets[axis] = stride;
+          }
+        }
+        stride += ply_type_size(element.properties[i].type);
+      }
+      if (!reader.has(stride * element.count)) {
+        break;
+      }
+      buffers.positions.resize(element.count);
+      const char* base = reader.p;
+      const auto& properties = element.properties;
+      parallel_for(element.count, thread_count, [&](size_t begin, size_t end, size_t) {
+        for (size_t v = begin; v < end; ++v) {
+          const char* vertex = base + v * stride;
+          float xyz[3];
+          for (int axis = 0; axis < 3; ++axis) {
+            xyz[axis] = float(read_ply_value(vertex + offsets[axis], properties[layout.xyz[axis]].type, reader.swap));
+          }
+          buffers.positions[v] = position_t(xyz[0], xyz[1], xyz[2]);
+        }
+      });
+      reader.p += stride * element.count;
+    }
+    else if (int(e) == layout.vertex_element) {
+      buffers.positions.resize(element.count);
+      for (size_t v = 0; reader.ok && v < element.count; ++v) {
+        auto& position = buffers.positions[v];
+        reader.element(element, -1, [&](size_t i, double value) {
+          for (int axis = 0; axis < 3; ++axis) {
+            if (int(i) == layout.xyz[axis]) {
+              position[axis] = float(value);
+            }
+          }
+        }, [](size_t) {});
+      }
+    }
+    else if (int(e) == layout.face_element) {
+      auto& property = element.properties[layout.indices];
+      buffers.face_sizes.reserve(element.count);
+      buffers.indices.reserve(element.count * 3);
+      for (size_t f = 0; reader.ok && f < element.count; ++f) {
+        reader.element(element, layout.indices, ignore, [&](size_t count) {
+          for (size_t i = 0; i < count; ++i) {
+            const double index = read_ply_value(reader.p, property.type, reader.swap);
+            reader.p += ply_type_size(property.type);
+            reader.ok = reader.ok && index >= 0;
+            buffers.indices.push_back(uint32_t(index));
+          }
+          buffers.face_sizes.push_back(uint32_t(count));
+        });
+      }
+    }
+    else if (fixed) {
+      size_t stride = 0;
+      for (auto& property : element.properties) {
+        stride += ply_type_size(property.type);
+      }
+      if (reader.has(stride * element.count)) {
+        reader.p += stride * element.count;
+      }
+    }
+    else {
+      for (size_t i = 0; reader.ok && i < element.count; ++i) {
+        reader.element(element, -1, ignore, [](size_t) {});
+      }
+    }
+  }
+
+  if (!reader.ok) {
+    LOG(ERROR) << path << " ends in the middle of its PLY data or holds a negative index";
+  }
+  return reader.ok;
+}
+
+/**
+   Text bodies are cut into chunks and every chunk first counts its lines, so
+   that each line can then be matched to its element while all the chunks
+   are parsed at the same time. Positions go straight to their final slot,
+   faces are gathered per chunk and joined in order.
+ */
+bool parse_ply_ascii(const std::vector<char>& data, const ply_header_t& header, const ply_layout_t& layout,
+                     const std::string& path, size_t thread_count, indexed_buffers_t& buffers) {
+  const char* body = data.data() + header.body;
+  const char* end = data.data() + data.size();
+  auto chunks = split_lines(body, end, thread_count);
+
+  std::vector<size_t> first_line(chunks.size() + 1, 0);
+  for_each_chunk(chunks.size(), [&](size_t chunk) {
+    first_line[chunk + 1] = size_t(std::count(chunks[chunk].begin, chunks[chunk].end, '\n'));
+  });
+  std::partial_sum(first_line.begin(), first_line.end(), first_line.begin());
+
+  // Every element takes a line, so the counts are checked against the lines
+  // left rather than summed first, where they could wrap around.
+  const size_t lines = first_line.back() + (end > body && end[-1] != '\n' ? 1 : 0);
+  std::vector<size_t> element_start(header.elements.size() + 1, 0);
+  for (size_t e = 0; e < header.elements.size(); ++e) {
+    if (header.elements[e].count > lines - element_start[e]) {
+      LOG(ERROR) << path << " has fewer PLY lines than its header declares";
+      return false;
+    }
+    element_start[e + 1] = element_start[e] + header.elements[e].count;
+  }
+
+  const size_t vertex_count = header.elements[layout.vertex_element].count;
+  const size_t vertex_start = element_start[layout.vertex_element];
+  buffers.positions.resize(vertex_count);
+
+  struct chunk_faces_t {
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> face_sizes;
+    const char* error = nullptr;
+  };
+  std::vector<chunk_faces_t> faces(chunks.size());
+
+  for_each_chunk(chunks.size(), [&](size_t chunk) {
+    auto& result = faces[chunk];
+    size_t number = first_line[chunk];
+    for (const char* line = chunks[chunk].begin; line < chunks[chunk].end && !result.error; ++number) {
+      const char* eol = line_end(line, chunks[chunk].end);
+      const char* p = line;
+      if (number >= vertex_start && number < vertex_start + vertex_count) {
+        auto& element = header.elements[layout.vertex_element];
+        auto& position = buffers.positions[number - vertex_start];
+        for (size_t i = 0; i < element.properties.size(); ++i) {
+          float value;
+          if (!parse_float(p, eol, value)) {
+            result.error = line;
+            break;
+          }
+          for (int axis = 0; axis < 3; ++axis) {
+            if (int(i) == layout.xyz[axis]) {
+              position[axis] = value;
+            }
+          }
+        }
+      }
+      else if (layout.face_element >= 0 && number >= element_start[layout.face_element]
+               && number < element_start[layout.face_element + 1]) {
+        auto& element = header.elements[layout.face_element];
+        for (size_t i = 0; i < element.properties.size() && !result.error; ++i) {
+          auto& property = element.properties[i];
+          int64_t count = 1;
+          if (property.list && (!parse_int(p, eol, count) || count < 0)) {
+            result.error = line;
+            break;
+          }
+          for (int64_t item = 0; item < count; ++item) {
+            if (int(i) == layout.indices) {
+              int64_t index;
+              if (!parse_int(p, eol, index) || index < 0) {
+                result.error = line;
+                break;
+              }
+              result.indices.push_back(uint32_t(index));
+            }
+            else {
+              float ignored;
+              if (!parse_float(p, eol, ignored)) {
+                result.error = line;
+                break;
+              }
+            }
+          }
+          if (int(i) == layout.indices) {
+            result.face_sizes.push_back(uint32_t(count));
+          }
+        }
+      }
+      line = next_line(eol, chunks[chunk].end);
+    }
+  });
+
+  size_t index_count = 0, face_count = 0;
+  for (auto& chunk : faces) {
+    if (chunk.error) {
+      LOG(ERROR) << path << " has a malformed PLY line " << line_number(data, chunk.error);
+      return false;
+    }
+    index_count += chunk.indices.size();
+    face_count += chunk.face_sizes.size();
+  }
+  buffers.indices.reserve(index_count);
+  buffers.face_sizes.reserve(face_count);
+  for (auto& chunk : faces) {
+    buffers.indices.insert(buffers.indices.end(), chunk.indices.begin(), chunk.indices.end());
+    buffers.face_sizes.insert(buffers.face_sizes.end(), chunk.face_sizes.begin(), chunk.face_sizes.end());
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// STL
+
+/**
+   Merges corners at exactly the same position, keeping the first occurrence
+   of each so the welded positions stay in file order.
+ */
+void weld_positions(indexed_buffers_t& buffers) {
+  auto& positions = buffers.positions;
+  auto bits = [&positions](uint32_t index) {
+    std::array<uint32_t, 3> key;
+    for (int axis = 0; axis < 3; ++axis) {
+      // Adding zero folds -0 into 0.
+      float value = positions[index][axis] + 0.f;
+      std::memcpy(&key[axis], &value, sizeof(float));
+    }
+    return key;
+  };
+
+  std::vector<uint32_t> order(positions.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&bits](uint32_t a, uint32_t b) {
+    auto ka = bits(a), kb = bits(b);
+    return ka != kb ? ka < kb : a < b;
+  });
+
+  std::vector<uint32_t> canonical(positions.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    canonical[order[i]] = (i > 0 && bits(order[i]) == bits(order[i - 1])) ? canonical[order[i - 1]] : order[i];
+  }
+
+  std::vector<uint32_t> remap(positions.size());
+  std::vector<position_t> welded;
+  welded.reserve(positions.size());
+  for (uint32_t index = 0; index < positions.size(); ++index) {
+    if (canonical[index] == index) {
+      remap[index] = uint32_t(welded.size());
+      welded.push_back(positions[index]);
+    }
+    else {
+      remap[index] = remap[canonical[index]];
+    }
+  }
+  for (auto& index : buffers.indices) {
+    index = remap[index];
+  }
+  positions.swap(welded);
+}
+
+bool parse_stl_binary(const std::vector<char>& data, size_t thread_count, indexed_buffers_t& buffers) {
+  const size_t triangles = read_scalar<uint32_t>(data.data() + 80, !host_is_little_endian());
+  const bool swap = !host_is_little_endian();
+  buffers.positions.resize(triangles * 3);
+  const char* base = data.data() + 84;
+  parallel_for(triangles, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t t = begin; t < end; ++t) {
+      // Skip the facet normal, the corners follow it.
+      const char* corner = base + t * 50 + 12;
+      for (size_t c = 0; c < 3; ++c, corner += 12) {
+        buffers.positions[t * 3 + c] = position_t(read_scalar<float>(corner, swap),
+                                                  read_scalar<float>(corner + 4, swap),
+                                                  read_scalar<float>(corner + 8, swap));
+      }
+    }
+  });
+  return true;
+}
+
+bool parse_stl_ascii(const std::vector<char>& data, const std::string& path, size_t thread_count,
+                     indexed_buffers_t& buffers) {
+  auto chunks = split_lines(data.data(), data.data() + data.size(), thread_count);
+  struct chunk_corners_t {
+    std::vector<position_t> positions;
+    const char* error = nullptr;
+  };
+  std::vector<chunk_corners_t> corners(chunks.size());
+  for_each_chunk(chunks.size(), [&](size_t chunk) {
+    auto& result = corners[chunk];
+    for (const char* line = chunks[chunk].begin; line < chunks[chunk].end;) {
+      const char* eol = line_end(line, chunks[chunk].end);
+      const char* p = line;
+      skip_spaces(p, eol);
+      if (starts_with_word(p, eol, "vertex")) {
+        p += 7;
+        float x, y, z;
+        if (!parse_float(p, eol, x) || !parse_float(p, eol, y) || !parse_float(p, eol, z)) {
+          result.error = line;
+          return;
+        }
+        result.positions.emplace_back(x, y, z);
+      }
+      line = next_line(eol, chunks[chunk].end);
+    }
+  });
+
+  size_t count = 0;
+  for (auto& chunk : corners) {
+    if (chunk.error) {
+      LOG(ERROR) << path << " has a malformed STL vertex on line " << line_number(data, chunk.error);
+      return false;
+    }
+    count += chunk.positions.size();
+  }
+  if (count % 3 != 0) {
+    LOG(ERROR) << path << " has " << count << " STL vertices, which doesn't make whole triangles";
+    return false;
+  }
+  buffers.positions.reserve(count);
+  for (auto& chunk : corners) {
+    buffers.positions.insert(buffers.positions.end(), chunk.positions.begin(), chunk.positions.end());
+  }
+  return true;
+}
+
+} // namespace
+
+bool import_obj(mesh_t& mesh, const std::string& path, const import_options_t& options) {
+  std::vector<char> data;
+  if (!read_file(path, data)) {
+    return false;
+  }
+
+  auto text = split_lines(data.data(), data.data() + data.size(), options.thread_count);
+  std::vector<obj_chunk_t> chunks(text.size());
+  for_each_chunk(text.size(), [&](size_t chunk) {
+    parse_obj_chunk(text[chunk], chunks[chunk]);
+  });
+
+  indexed_buffers_t buffers;
+  size_t position_count = 0, index_count = 0, face_count = 0;
+  for (auto& chunk : chunks) {
+    if (chunk.error) {
+      LOG(ERROR) << path << " has a malformed OBJ line " << line_number(data, chunk.error);
+      return false;
+    }
+    position_count += chunk.positions.size();
+    index_count += chunk.indices.size();
+    face_count += chunk.face_sizes.size();
+  }
+  buffers.positions.reserve(position_count);
+  buffers.indices.reserve(index_count);
+  buffers.face_sizes.reserve(face_count);
+
+  for (auto& chunk : chunks) {
+    const int64_t base = int64_t(buffers.positions.size());
+    for (auto slot : chunk.relative) {
+      chunk.indices[slot] += base;
+    }
+    for (auto index : chunk.indices) {
+      if (index < 0 || index > int64_t(UINT32_MAX)) {
+        LOG(ERROR) << path << " refers to a position out of range: " << index + 1;
+        return false;
+      }
+      buffers.indices.push_back(uint32_t(index));
+    }
+    buffers.positions.insert(buffers.positions.end(), chunk.positions.begin(), chunk.positions.end());
+    buffers.face_sizes.insert(buffers.face_sizes.end(), chunk.face_sizes.begin(), chunk.face_sizes.end());
+  }
+  return buffers.build(mesh);
+}
+
+bool import_ply(mesh_t& mesh, const std::string& path, const import_options_t& options) {
+  std::vector<char> data;
+  ply_header_t header;
+  ply_layout_t layout;
+  if (!read_file(path, data) || !parse_ply_header(data, path, header) || !find_ply_layout(header, path, layout)) {
+    return false;
+  }
+
+  indexed_buffers_t buffers;
+  const bool parsed = header.format == ply_format_t::ascii
+    ? parse_ply_ascii(data, header, layout, path, options.thread_count, buffers)
+    : parse_ply_binary(data, header, layout, path, options.thread_count, buffers);
+  return parsed && buffers.build(mesh);
+}
+
+bool import_stl(mesh_t& mesh, const std::string& path, const import_options_t& options) {
+  std::vector<char> data;
+  if (!read_file(path, data)) {
+    return false;
+  }
+
+  // Binary files may start with "solid" too, their size gives them away.
+  indexed_buffers_t buffers;
+  bool parsed = false;
+  if (data.size() >= 84 && 84 + 50 * size_t(read_scalar<uint32_t>(data.data() + 80, !host_is_little_endian())) == data.size()) {
+    parsed = parse_stl_binary(data, options.thread_count, buffers);
+  }
+  else if (data.size() >= 5 && std::memcmp(data.data(), "solid", 5) == 0) {
+    parsed = parse_stl_ascii(data, path, options.thread_count, buffers);
+  }
+  else {
+    LOG(ERROR) << path << " is neither an ascii nor a binary STL file";
+  }
+  if (!parsed) {
+    return false;
+  }
+
+  buffers.indices.resize(buffers.positions.size());
+  std::iota(buffers.indices.begin(), buffers.indices.end(), 0);
+  if (options.weld_stl) {
+    weld_positions(buffers);
+  }
+  return buffers.build(mesh);
+}
+
+bool import_mesh(mesh_t& mesh, const std::string& path, const import_options_t& options) {
+  auto dot = path.find_last_of('.');
+  std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) {
+    return char(std::tolower(static_cast<unsigned char>(c)));
+  });
+  if (extension == "obj") {
+    return import_obj(mesh, path, options);
+  }
+  if (extension == "ply") {
+    return import_ply(mesh, path, options);
+  }
+  if (extension == "stl") {
+    return import_stl(mesh, path, options);
+  }
+  LOG(ERROR) << "No importer for the extension of " << path;
+  return false;
+}
+
+} // namespace hedge
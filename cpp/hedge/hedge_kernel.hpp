@@ -0,0 +1,1475 @@
+#pragma once
+
+#include "hedge.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace hedge {
+
+/**
+   A range of address space for paged storage, see allocation_t. Reserving
+   only sets the addresses aside; pages get backed by memory when they're
+   first written. Huge page regions are aligned to 2MB and advised to be
+   merged into huge pages. Explicit huge pages from the system pool are
+   committed as soon as they're mapped, so they only back the sizes asked
+   for through commit_huge_pages() rather than the whole reservation. The
+   base is null when nothing could be reserved.
+ */
+struct page_region_t {
+  char* base;
+  size_t bytes;
+  size_t huge_bytes;
+
+  page_region_t() : base(nullptr), bytes(0), huge_bytes(0) {}
+};
+
+page_region_t reserve_pages(size_t bytes, bool huge_pages);
+
+/**
+   Backs the region with explicit huge pages up to bytes, starting past
+   live_bytes and whatever was committed before since the pages are mapped
+   over. Keeps the ordinary pages when the pool can't provide them.
+ */
+void commit_huge_pages(page_region_t& region, size_t live_bytes, size_t bytes);
+void release_pages(page_region_t& region);
+
+/**
+   Hands the pages past the first keep_bytes back to the system while keeping
+   the addresses reserved.
+ */
+void discard_pages(const page_region_t& region, size_t keep_bytes);
+
+/**
+   Bump allocator behind monotonic storage. Memory comes in blocks that double
+   in size and is only released with the arena. The most recent allocation
+   can be grown in place as long as its block has room.
+ */
+class monotonic_arena_t {
+  struct block_t {
+    std::unique_ptr<char[]> data;
+    size_t size;
+    size_t used;
+  };
+  std::vector<block_t> _blocks;
+  char* _last;
+
+  static char* align_up(char* p, size_t alignment) {
+    auto address = reinterpret_cast<uintptr_t>(p);
+    return p + ((alignment - address % alignment) % alignment);
+  }
+public:
+  static const size_t min_block_bytes = 64 * 1024;
+
+  monotonic_arena_t() : _last(nullptr) {}
+  monotonic_arena_t(const monotonic_arena_t&) = delete;
+  monotonic_arena_t& operator=(const monotonic_arena_t&) = delete;
+
+  void* allocate(size_t bytes, size_t alignment) {
+    if (!_blocks.empty()) {
+      auto& block = _blocks.back();
+      char* p = align_up(block.data.get() + block.used, alignment);
+      if (p + bytes <= block.data.get() + block.size) {
+        block.used = size_t(p + bytes - block.data.get());
+        return _last = p;
+      }
+    }
+    const size_t size = std::max({ min_block_bytes, bytes + alignment,
+                                   _blocks.empty() ? size_t(0) : _blocks.back().size * 2 });
+    _blocks.push_back({ std::unique_ptr<char[]>(new char[size]), size, 0 });
+    auto& block = _blocks.back();
+    char* p = align_up(block.data.get(), alignment);
+    block.used = size_t(p + bytes - block.data.get());
+    return _last = p;
+  }
+
+  bool extend(void* p, size_t bytes) {
+    if (p == nullptr || p != _last) {
+      return false;
+    }
+    auto& block = _blocks.back();
+    if (_last + bytes > block.data.get() + block.size) {
+      return false;
+    }
+    block.used = std::max(block.used, size_t(_last + bytes - block.data.get()));
+    return true;
+  }
+
+  size_t reserved_bytes() const {
+    size_t bytes = 0;
+    for (auto& block : _blocks) {
+      bytes += block.size;
+    }
+    return bytes;
+  }
+};
+
+/**
+   The growable array under element_vector_t, with the parts of the std::vector
+   interface the storage uses. Where the memory comes from is decided by the
+   allocation_t it's created with; paged storage falls back to the heap when
+   no address space can be reserved.
+ */
+template<typename T>
+class element_buffer_t {
+  T* _data;
+  size_t _size;
+  size_t _capacity;
+  allocation_t _allocation;
+  monotonic_arena_t* _arena;
+  page_region_t _region;
+
+  /**
+     Paged storage reserves room for this many elements at first, or for the
+     largest offset an index can hold if that is smaller.
+   */
+  static size_t paged_elements() {
+    const size_t elements = size_t(1) << 28;
+    return size_t(index_offset_max) < elements ? size_t(index_offset_max) + 1 : elements;
+  }
+
+  void release() {
+    for (size_t i = 0; i < _size; ++i) {
+      _data[i].~T();
+    }
+    if (_allocation == allocation_t::heap) {
+      ::operator delete(_data);
+    }
+    else if (_region.base != nullptr) {
+      release_pages(_region);
+    }
+    _data = nullptr;
+  }
+
+  void relocate(size_t capacity) {
+    T* data = nullptr;
+    page_region_t region;
+    if (_allocation == allocation_t::paged || _allocation == allocation_t::huge_pages) {
+      const size_t bytes = std::max(capacity, _region.base ? _capacity * 2 : paged_elements()) * sizeof(T);
+      region = reserve_pages(bytes, _allocation == allocation_t::huge_pages);
+      if (region.base == nullptr) {
+        // Keep what we have in the heap from here on.
+        T* heap = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        move_into(heap);
+        for (size_t i = 0; i < _size; ++i) {
+          _data[i].~T();
+        }
+        if (_region.base != nullptr) {
+          release_pages(_region);
+        }
+        _allocation = allocation_t::heap;
+        _data = heap;
+        _capacity = capacity;
+        return;
+      }
+      data = reinterpret_cast<T*>(region.base);
+      capacity = region.bytes / sizeof(T);
+    }
+    else if (_allocation == allocation_t::monotonic) {
+      if (_arena->extend(_data, capacity * sizeof(T))) {
+        _capacity = capacity;
+        return;
+      }
+      data = static_cast<T*>(_arena->allocate(capacity * sizeof(T), alignof(T)));
+    }
+    else {
+      data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+    }
+    const size_t size = _size;
+    move_into(data);
+    release();
+    _data = data;
+    _size = size;
+    _capacity = capacity;
+    _region = region;
+  }
+
+  void move_into(T* data) {
+    for (size_t i = 0; i < _size; ++i) {
+      new (data + i) T(std::move(_data[i]));
+    }
+  }
+
+  void grow(size_t minimum) {
+    relocate(std::max({ minimum, _capacity * 2, size_t(16) }));
+  }
+public:
+  explicit element_buffer_t(allocation_t allocation = allocation_t::heap, monotonic_arena_t* arena = nullptr)
+    : _data(nullptr), _size(0), _capacity(0)
+    , _allocation(allocation == allocation_t::monotonic && arena == nullptr ? allocation_t::heap : allocation)
+    , _arena(arena)
+  {}
+
+  element_buffer_t(const element_buffer_t&) = delete;
+  element_buffer_t& operator=(const element_buffer_t&) = delete;
+
+  ~element_buffer_t() {
+    release();
+  }
+
+  size_t size() const {
+    return _size;
+  }
+  size_t capacity() const {
+    return _capacity;
+  }
+  allocation_t allocation() const {
+    return _allocation;
+  }
+  monotonic_arena_t* arena() const {
+    return _arena;
+  }
+
+  T* data() {
+    return _data;
+  }
+  const T* data() const {
+    return _data;
+  }
+
+  T& operator[](size_t i) {
+    return _data[i];
+  }
+  const T& operator[](size_t i) const {
+    return _data[i];
+  }
+
+  void reserve(size_t capacity) {
+    if (capacity > _capacity) {
+      relocate(capacity);
+    }
+    if (_allocation == allocation_t::huge_pages && _region.base != nullptr) {
+      commit_huge_pages(_region, _size * sizeof(T), capacity * sizeof(T));
+    }
+  }
+
+  template<typename... TArgs>
+  void emplace_back(TArgs&&... args) {
+    if (_size == _capacity) {
+      grow(_size + 1);
+    }
+    new (_data + _size) T(std::forward<TArgs>(args)...);
+    ++_size;
+  }
+
+  void push_back(T&& value) {
+    emplace_back(std::move(value));
+  }
+
+  void resize(size_t size) {
+    reserve(size);
+    for (; _size > size; --_size) {
+      _data[_size - 1].~T();
+    }
+    for (; _size < size; ++_size) {
+      new (_data + _size) T();
+    }
+  }
+
+  /**
+     Heap storage moves into an exact fit, paged storage returns the pages
+     past the end to the system, the arena keeps its memory.
+   */
+  void shrink_to_fit() {
+    if (_allocation == allocation_t::heap && _capacity > _size) {
+      relocate(_size);
+    }
+    else if (_region.base != nullptr) {
+      discard_pages(_region, _size * sizeof(T));
+    }
+  }
+
+  /**
+     Takes in elements that were constructed straight into the spare capacity
+     past the end, up to the new size.
+   */
+  void adopt(size_t size) {
+    _size = std::max(_size, std::min(size, _capacity));
+  }
+
+  void swap(element_buffer_t& other) {
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_capacity, other._capacity);
+    std::swap(_allocation, other._allocation);
+    std::swap(_arena, other._arena);
+    std::swap(_region, other._region);
+  }
+};
+
+
+/**
+   Rather than create a bunch of preprocessor macros to prevent copypasta I decided
+   to create a simple templated wrapper over element_buffer_t which implements the
+   requirements for element storage.
+
+   TValidation decides how get() treats bad indices, see validation_t. Removal
+   always checks the index regardless since it isn't on any hot path.
+
+   Removed cells form a free list threaded through the cells themselves, the
+   offset of the next free cell is written over the first bytes past the
+   element header since nothing reads an inactive element's fields. Cell 0 is
+   the sentinel so it doubles as the end of the list.
+ */
+template<typename TElement, typename TElementIndex,
+         validation_t TValidation = validation_t::checked_logging>
+class element_vector_t {
+  static_assert(sizeof(TElement) >= sizeof(element_t) + sizeof(offset_t),
+                "element types need room for the free list link past their header");
+public:
+  using collection_t = element_buffer_t<TElement>;
+
+  explicit element_vector_t(validation_counters_t* counters = nullptr,
+                            allocation_t allocation = allocation_t::heap,
+                            monotonic_arena_t* arena = nullptr)
+    : collection(allocation, arena), free_head(0), free_count(0), claimed(0), validator(TValidation, counters)
+  {
+    collection.emplace_back( TElement {} );
+  }
+
+  void reserve(size_t elements) {
+    collection.reserve(elements);
+  }
+
+  size_t count() const {
+    return collection.size() - free_count;
+  }
+
+  size_t size() const {
+    return collection.size();
+  }
+
+  TElement* data() {
+    return collection.data();
+  }
+
+  TElement* get(TElementIndex index) const {
+    TElement* element = get(index.offset);
+    if (TValidation != validation_t::unchecked && element != nullptr) {
+      if (!is_same_generation(element->generation, index.generation)) {
+        validator.generation_mismatch(index.offset, index.generation, element->generation);
+        element = nullptr;
+      }
+    }
+    return element;
+  }
+
+  TElement* get(offset_t offset) const {
+    TElement* element = nullptr;
+    if (TValidation == validation_t::unchecked || offset < collection.size()) {
+      element = (TElement*)collection.data() + offset;
+    }
+    else {
+      validator.invalid_offset(offset, collection.size());
+    }
+    return element;
+  }
+
+  bool contains(TElementIndex index) const {
+    return index.offset < collection.size()
+      && is_same_generation(collection[index.offset].generation, index.generation);
+  }
+
+  TElementIndex emplace(TElement&& element) {
+    TElementIndex index;
+    if (free_head != 0) {
+      auto& cell = collection[free_head];
+      element.generation = cell.generation;
+      index = TElementIndex(free_head, cell.generation);
+      free_head = free_link(free_head);
+      --free_count;
+      cell = std::move(element);
+    }
+    else if (collection.size() > index_offset_max) {
+      report_storage_exhausted();
+    }
+    else {
+      index.offset = collection.size();
+      index.generation = element.generation;
+      collection.emplace_back(std::move(element));
+    }
+    return index;
+  }
+
+  void remove(TElementIndex index) {
+    if (contains(index) && collection[index.offset].status == element_status_t::ACTIVE) {
+      auto& cell = collection[index.offset];
+      cell.generation++;
+      cell.status = element_status_t::INACTIVE;
+      set_free_link(index.offset, free_head);
+      free_head = index.offset;
+      ++free_count;
+    }
+  }
+
+  /**
+     Undoes the emplace of index, see kernel_t::retract(). The cell goes back
+     on the free list with its generation bumped like remove() so that indices
+     to the undone element go stale, even a cell the emplace added at the end:
+     dropping that one would lose the generation and the next emplace there
+     would bring the stale indices back to life. restore() puts the
+     generation back.
+   */
+  bool retract(TElementIndex index) {
+    if (index.offset == 0 || !contains(index) || collection[index.offset].status != element_status_t::ACTIVE) {
+      return false;
+    }
+    collection[index.offset].generation++;
+    collection[index.offset].status = element_status_t::INACTIVE;
+    set_free_link(index.offset, free_head);
+    free_head = index.offset;
+    ++free_count;
+    return true;
+  }
+
+  /**
+     Undoes the remove of index, see kernel_t::restore(). The cell has to be
+     the head of the free list.
+   */
+  bool restore(TElementIndex index) {
+    if (index.offset == 0 || index.offset != free_head) {
+      return false;
+    }
+    auto& cell = collection[index.offset];
+    free_head = free_link(index.offset);
+    --free_count;
+    cell.generation = index.generation;
+    cell.status = element_status_t::ACTIVE;
+    return true;
+  }
+
+  /**
+     Moves the active elements down over the free cells, keeping their order
+     and generations, and releases the space left at the end. Returns where
+     every old cell went (the empty index for free ones); references held in
+     the elements still have to be rewritten through it by the kernel.
+   */
+  std::vector<TElementIndex> compact() {
+    std::vector<TElementIndex> remap(collection.size());
+    offset_t next = 1;
+    for (offset_t offset = 1; offset < collection.size(); ++offset) {
+      auto& element = collection[offset];
+      if (element.status != element_status_t::ACTIVE) {
+        continue;
+      }
+      remap[offset] = TElementIndex(next, element.generation);
+      if (next != offset) {
+        collection[next] = std::move(element);
+      }
+      ++next;
+    }
+    collection.resize(next);
+    collection.shrink_to_fit();
+    free_head = 0;
+    free_count = 0;
+    return remap;
+  }
+
+  /**
+     Like compact() but puts the listed cells first in the given order, see
+     element_order_t. Elements are moved into a new buffer.
+   */
+  std::vector<TElementIndex> reorder(const std::vector<offset_t>& order) {
+    std::vector<TElementIndex> remap(collection.size());
+    collection_t reordered(collection.allocation(), collection.arena());
+    reordered.reserve(count());
+    reordered.push_back(std::move(collection[0]));
+    auto take = [&](offset_t offset) {
+      if (offset == 0 || offset >= collection.size() || remap[offset]
+          || collection[offset].status != element_status_t::ACTIVE) {
+        return;
+      }
+      remap[offset] = TElementIndex(reordered.size(), collection[offset].generation);
+      reordered.push_back(std::move(collection[offset]));
+    };
+    for (auto offset : order) {
+      take(offset);
+    }
+    for (offset_t offset = 1; offset < collection.size(); ++offset) {
+      take(offset);
+    }
+    collection.swap(reordered);
+    free_head = 0;
+    free_count = 0;
+    return remap;
+  }
+
+  /**
+     Concurrent emplacement happens between begin_concurrent() and
+     end_concurrent(), and only through claim() and place(). Threads claim
+     blocks of fresh cells past the end with one atomic add and then fill
+     them on their own. Claims never reach into the free list and fail once
+     the capacity set aside by begin_concurrent() is used up, since growing
+     would move the cells out from under the other threads. Cells that were
+     claimed but never filled are left inactive and join the free list at
+     the end.
+   */
+  void begin_concurrent(size_t elements) {
+    collection.reserve(collection.size() + elements);
+    claimed.store(collection.size(), std::memory_order_relaxed);
+  }
+
+  /**
+     Claims up to count cells, returning the first one and how many were
+     granted; none when the capacity is exhausted.
+   */
+  offset_t claim(size_t count, size_t& granted) {
+    const size_t first = claimed.fetch_add(count, std::memory_order_relaxed);
+    const size_t capacity = std::min<size_t>(collection.capacity(), size_t(index_offset_max));
+    granted = first < capacity ? std::min(count, capacity - first) : 0;
+    TElement* cells = collection.data() + first;
+    for (size_t i = 0; i < granted; ++i) {
+      new (cells + i) TElement();
+      cells[i].status = element_status_t::INACTIVE;
+    }
+    return granted > 0 ? offset_t(first) : 0;
+  }
+
+  TElementIndex place(offset_t offset, TElement&& element) {
+    auto& cell = collection.data()[offset];
+    cell = std::move(element);
+    return TElementIndex(offset, cell.generation);
+  }
+
+  /**
+     A claimed cell, which can't go through get() before end_concurrent()
+     since it's still past the end.
+   */
+  TElement* claimed_cell(offset_t offset) {
+    return collection.data() + offset;
+  }
+
+  size_t capacity() const {
+    return collection.capacity();
+  }
+
+  void end_concurrent() {
+    const size_t begin = collection.size();
+    collection.adopt(claimed.load(std::memory_order_relaxed));
+    // Pushed from the back so the lowest free cell gets reused first.
+    for (size_t offset = collection.size(); offset-- > begin;) {
+      if (collection[offset].status != element_status_t::ACTIVE) {
+        set_free_link(offset_t(offset), free_head);
+        free_head = offset_t(offset);
+        ++free_count;
+      }
+    }
+  }
+
+  void swap(TElementIndex aindex, TElementIndex bindex) {
+    auto* element_a = get(aindex);
+    auto* element_b = get(bindex);
+    if (element_a && element_b) {
+      element_a->generation++;
+      element_b->generation++;
+
+      TElement temp = *element_a;
+      *element_a = *element_b;
+      *element_b = temp;
+    }
+  }
+
+  template<typename TTable>
+  TTable table() {
+    TTable table;
+    table.size = collection.size();
+    table.element = column_t<element_t>(collection.data(), sizeof(TElement));
+    table.validator = validator;
+    return table;
+  }
+
+private:
+  offset_t free_link(offset_t offset) const {
+    offset_t next;
+    std::memcpy(&next, reinterpret_cast<const char*>(&collection[offset]) + sizeof(element_t), sizeof(next));
+    return next;
+  }
+
+  void set_free_link(offset_t offset, offset_t next) {
+    std::memcpy(reinterpret_cast<char*>(&collection[offset]) + sizeof(element_t), &next, sizeof(next));
+  }
+
+  collection_t collection;
+  offset_t free_head;
+  size_t free_count;
+  std::atomic<size_t> claimed;
+  validator_t validator;
+};
+
+/**
+   Rewrites the indices stored in every element of a freshly compacted kernel.
+ */
+template<typename TKernel>
+void remap_references(TKernel& kernel, const remap_table_t& remap) {
+  auto edges = kernel.edge_table();
+  for (offset_t offset = 1; offset < edges.size; ++offset) {
+    edges.vertex_index.writable(offset) = remap(edges.vertex_index[offset]);
+    edges.face_index.writable(offset) = remap(edges.face_index[offset]);
+    edges.next_index.writable(offset) = remap(edges.next_index[offset]);
+    edges.prev_index.writable(offset) = remap(edges.prev_index[offset]);
+    edges.adjacent_index.writable(offset) = remap(edges.adjacent_index[offset]);
+  }
+  auto faces = kernel.face_table();
+  for (offset_t offset = 1; offset < faces.size; ++offset) {
+    faces.edge_index.writable(offset) = remap(faces.edge_index[offset]);
+  }
+  auto vertices = kernel.vertex_table();
+  for (offset_t offset = 1; offset < vertices.size; ++offset) {
+    vertices.point_index.writable(offset) = remap(vertices.point_index[offset]);
+    vertices.edge_index.writable(offset) = remap(vertices.edge_index[offset]);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+template<validation_t TValidation = validation_t::checked_logging>
+class basic_kernel_t final : public kernel_t {
+  validation_counters_t counters;
+  monotonic_arena_t arena;
+  element_vector_t<vertex_t, vertex_index_t, TValidation> vertices;
+  element_vector_t<face_t, face_index_t, TValidation>     faces;
+  element_vector_t<edge_t, edge_index_t, TValidation>     edges;
+  element_vector_t<point_t, point_index_t, TValidation>   points;
+
+public:
+  explicit basic_kernel_t(allocation_t allocation = allocation_t::heap)
+    : vertices(&counters, allocation, &arena)
+    , faces(&counters, allocation, &arena)
+    , edges(&counters, allocation, &arena)
+    , points(&counters, allocation, &arena)
+  {}
+
+  edge_t* get(edge_index_t index) override {
+    return edges.get(index);
+  }
+  face_t* get(face_index_t index) override {
+    return faces.get(index);
+  }
+  vertex_t* get(vertex_index_t index) override {
+    return vertices.get(index);
+  }
+  point_t* get(point_index_t index) override {
+    return points.get(index);
+  }
+
+  edge_index_t emplace(edge_t&& edge) override {
+    return created(edges.emplace(std::move(edge)));
+  }
+  face_index_t emplace(face_t&& face) override {
+    return created(faces.emplace(std::move(face)));
+  }
+  vertex_index_t emplace(vertex_t&& vertex) override {
+    return created(vertices.emplace(std::move(vertex)));
+  }
+  point_index_t emplace(point_t&& point) override {
+    return created(points.emplace(std::move(point)));
+  }
+
+  void remove(edge_index_t index) override {
+    return edges.remove(index);
+  }
+  void remove(face_index_t index) override {
+    return faces.remove(index);
+  }
+  void remove(vertex_index_t index) override {
+    return vertices.remove(index);
+  }
+  void remove(point_index_t index) override {
+    return points.remove(index);
+  }
+
+  bool retract(edge_index_t index) override {
+    return edges.retract(index);
+  }
+  bool retract(face_index_t index) override {
+    return faces.retract(index);
+  }
+  bool retract(vertex_index_t index) override {
+    return vertices.retract(index);
+  }
+  bool retract(point_index_t index) override {
+    return points.retract(index);
+  }
+
+  bool restore(edge_index_t index) override {
+    return edges.restore(index);
+  }
+  bool restore(face_index_t index) override {
+    return faces.restore(index);
+  }
+  bool restore(vertex_index_t index) override {
+    return vertices.restore(index);
+  }
+  bool restore(point_index_t index) override {
+    return points.restore(index);
+  }
+
+  size_t point_count() const override {
+    return points.count();
+  }
+
+  size_t vertex_count() const override {
+    return vertices.count();
+  }
+
+  size_t face_count() const override {
+    return faces.count();
+  }
+
+  size_t edge_count() const override {
+    return edges.count();
+  }
+
+  void reserve(size_t point_count, size_t vertex_count, size_t face_count, size_t edge_count) override {
+    points.reserve(points.size() + point_count);
+    vertices.reserve(vertices.size() + vertex_count);
+    faces.reserve(faces.size() + face_count);
+    edges.reserve(edges.size() + edge_count);
+  }
+
+  remap_table_t compact() override {
+    remap_table_t remap;
+    remap.edges = edges.compact();
+    remap.faces = faces.compact();
+    remap.vertices = vertices.compact();
+    remap.points = points.compact();
+    remap_references(*this, remap);
+    return remapped(std::move(remap));
+  }
+
+  remap_table_t reorder(const element_order_t& order) override {
+    remap_table_t remap;
+    remap.edges = edges.reorder(order.edges);
+    remap.faces = faces.reorder(order.faces);
+    remap.vertices = vertices.reorder(order.vertices);
+    remap.points = points.reorder(order.points);
+    remap_references(*this, remap);
+    return remapped(std::move(remap));
+  }
+
+  void resolve(edge_index_t* index, edge_t** edge) const override {
+    *edge = edges.get(index->offset);
+    index->generation = (*edge)->generation;
+  }
+  void resolve(face_index_t* index, face_t** face) const override {
+    *face = faces.get(index->offset);
+    index->generation = (*face)->generation;
+  }
+  void resolve(point_index_t* index, point_t** point) const override {
+    *point = points.get(index->offset);
+    index->generation = (*point)->generation;
+  }
+  void resolve(vertex_index_t* index, vertex_t** vert) const override {
+    *vert = vertices.get(index->offset);
+    index->generation = (*vert)->generation;
+  }
+
+  edge_table_t edge_table() override {
+    auto table = edges.template table<edge_table_t>();
+    auto* data = edges.data();
+    table.vertex_index = make_column(data, &edge_t::vertex_index);
+    table.face_index = make_column(data, &edge_t::face_index);
+    table.next_index = make_column(data, &edge_t::next_index);
+    table.prev_index = make_column(data, &edge_t::prev_index);
+    table.adjacent_index = make_column(data, &edge_t::adjacent_index);
+    return table;
+  }
+  face_table_t face_table() override {
+    auto table = faces.template table<face_table_t>();
+    auto* data = faces.data();
+    table.edge_index = make_column(data, &face_t::edge_index);
+    return table;
+  }
+  vertex_table_t vertex_table() override {
+    auto table = vertices.template table<vertex_table_t>();
+    auto* data = vertices.data();
+    table.point_index = make_column(data, &vertex_t::point_index);
+    table.edge_index = make_column(data, &vertex_t::edge_index);
+    return table;
+  }
+  point_table_t point_table() override {
+    auto table = points.template table<point_table_t>();
+    table.position = make_column(points.data(), &point_t::position);
+    return table;
+  }
+
+  validation_t validation() const override {
+    return TValidation;
+  }
+  const validation_counters_t& validation_counters() const override {
+    return counters;
+  }
+
+  kernel_t::ptr_t snapshot() override {
+    return kernel_t::ptr_t(nullptr, [](kernel_t* k) { delete k; });
+  }
+
+  /**
+     Sets aside room for the elements that are about to be emplaced from
+     several threads through concurrent_emplacer_t. Until end_concurrent()
+     nothing else may touch the kernel, the cells claimed by other threads
+     aren't even part of the storage yet. Paged storage already has room for
+     far more than any mesh needs, so the counts only matter on the heap.
+   */
+  void begin_concurrent(size_t point_count, size_t vertex_count, size_t face_count, size_t edge_count) {
+    points.begin_concurrent(point_count);
+    vertices.begin_concurrent(vertex_count);
+    faces.begin_concurrent(face_count);
+    edges.begin_concurrent(edge_count);
+  }
+
+  void end_concurrent() {
+    const size_t begin[] = { points.size(), vertices.size(), faces.size(), edges.size() };
+    points.end_concurrent();
+    vertices.end_concurrent();
+    faces.end_concurrent();
+    edges.end_concurrent();
+    properties().points.created(begin[0], points.size());
+    properties().vertices.created(begin[1], vertices.size());
+    properties().faces.created(begin[2], faces.size());
+    properties().edges.created(begin[3], edges.size());
+  }
+
+  element_vector_t<edge_t, edge_index_t, TValidation>& storage(edge_index_t) {
+    return edges;
+  }
+  element_vector_t<face_t, face_index_t, TValidation>& storage(face_index_t) {
+    return faces;
+  }
+  element_vector_t<vertex_t, vertex_index_t, TValidation>& storage(vertex_index_t) {
+    return vertices;
+  }
+  element_vector_t<point_t, point_index_t, TValidation>& storage(point_index_t) {
+    return points;
+  }
+};
+
+/**
+   One thread's handle for emplacing into a basic kernel between
+   begin_concurrent() and end_concurrent(). Every element type has its own
+   block of claimed cells which is refilled block_size cells at a time, so
+   the threads only meet on one atomic add per block. An emplacer may only
+   read and write the elements it emplaced itself, through get(); everything
+   else has to wait for end_concurrent(). Emplacing fails with an empty index
+   once the kernel runs out of the room set aside for it.
+ */
+template<typename TKernel>
+class concurrent_emplacer_t {
+  struct block_t {
+    offset_t next;
+    offset_t end;
+    block_t() : next(0), end(0) {}
+  };
+
+  TKernel& _kernel;
+  size_t _block_size;
+  block_t _edges;
+  block_t _faces;
+  block_t _vertices;
+  block_t _points;
+
+  block_t& block(edge_index_t) { return _edges; }
+  block_t& block(face_index_t) { return _faces; }
+  block_t& block(vertex_index_t) { return _vertices; }
+  block_t& block(point_index_t) { return _points; }
+
+  template<typename TIndex, typename TElement>
+  TIndex place(TElement&& element) {
+    auto& storage = _kernel.storage(TIndex());
+    auto& block = this->block(TIndex());
+    if (block.next == block.end) {
+      size_t granted = 0;
+      block.next = storage.claim(_block_size, granted);
+      block.end = offset_t(block.next + granted);
+      if (granted == 0) {
+        report_claim_exhausted(storage.capacity());
+        return TIndex();
+      }
+    }
+    return storage.place(block.next++, std::move(element));
+  }
+public:
+  explicit concurrent_emplacer_t(TKernel& kernel, size_t block_size = 1024)
+    : _kernel(kernel), _block_size(std::max<size_t>(1, block_size))
+  {}
+
+  edge_index_t emplace(edge_t&& edge) {
+    return place<edge_index_t>(std::move(edge));
+  }
+  face_index_t emplace(face_t&& face) {
+    return place<face_index_t>(std::move(face));
+  }
+  vertex_index_t emplace(vertex_t&& vertex) {
+    return place<vertex_index_t>(std::move(vertex));
+  }
+  point_index_t emplace(point_t&& point) {
+    return place<point_index_t>(std::move(point));
+  }
+
+  template<typename TIndex>
+  typename element_traits_t<TIndex>::element_type* get(TIndex index) {
+    return index ? _kernel.storage(index).claimed_cell(index.offset) : nullptr;
+  }
+};
+
+// basic_kernel_t
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+   The column sets describe how each element type is split apart into dense
+   arrays by the element_columns_t storage below.
+ */
+struct edge_columns_t {
+  std::vector<vertex_index_t> vertex_index;
+  std::vector<face_index_t> face_index;
+  std::vector<edge_index_t> next_index;
+  std::vector<edge_index_t> prev_index;
+  std::vector<edge_index_t> adjacent_index;
+
+  void reserve(size_t elements) {
+    vertex_index.reserve(elements);
+    face_index.reserve(elements);
+    next_index.reserve(elements);
+    prev_index.reserve(elements);
+    adjacent_index.reserve(elements);
+  }
+
+  void push_back(const edge_t& edge) {
+    vertex_index.push_back(edge.vertex_index);
+    face_index.push_back(edge.face_index);
+    next_index.push_back(edge.next_index);
+    prev_index.push_back(edge.prev_index);
+    adjacent_index.push_back(edge.adjacent_index);
+  }
+
+  void push_back(const edge_columns_t& other, offset_t offset) {
+    vertex_index.push_back(other.vertex_index[offset]);
+    face_index.push_back(other.face_index[offset]);
+    next_index.push_back(other.next_index[offset]);
+    prev_index.push_back(other.prev_index[offset]);
+    adjacent_index.push_back(other.adjacent_index[offset]);
+  }
+
+  void assign(offset_t offset, const edge_t& edge) {
+    vertex_index[offset] = edge.vertex_index;
+    face_index[offset] = edge.face_index;
+    next_index[offset] = edge.next_index;
+    prev_index[offset] = edge.prev_index;
+    adjacent_index[offset] = edge.adjacent_index;
+  }
+
+  void move(offset_t from, offset_t to) {
+    vertex_index[to] = vertex_index[from];
+    face_index[to] = face_index[from];
+    next_index[to] = next_index[from];
+    prev_index[to] = prev_index[from];
+    adjacent_index[to] = adjacent_index[from];
+  }
+
+  void resize(size_t elements) {
+    vertex_index.resize(elements);
+    vertex_index.shrink_to_fit();
+    face_index.resize(elements);
+    face_index.shrink_to_fit();
+    next_index.resize(elements);
+    next_index.shrink_to_fit();
+    prev_index.resize(elements);
+    prev_index.shrink_to_fit();
+    adjacent_index.resize(elements);
+    adjacent_index.shrink_to_fit();
+  }
+
+  offset_t free_link(offset_t offset) const {
+    return vertex_index[offset].offset;
+  }
+
+  void set_free_link(offset_t offset, offset_t next) {
+    vertex_index[offset] = vertex_index_t(next);
+  }
+
+  void fill(edge_table_t& table) {
+    table.vertex_index = column_t<vertex_index_t>(vertex_index.data());
+    table.face_index = column_t<face_index_t>(face_index.data());
+    table.next_index = column_t<edge_index_t>(next_index.data());
+    table.prev_index = column_t<edge_index_t>(prev_index.data());
+    table.adjacent_index = column_t<edge_index_t>(adjacent_index.data());
+  }
+};
+
+struct face_columns_t {
+  std::vector<edge_index_t> edge_index;
+
+  void reserve(size_t elements) {
+    edge_index.reserve(elements);
+  }
+
+  void push_back(const face_t& face) {
+    edge_index.push_back(face.edge_index);
+  }
+
+  void push_back(const face_columns_t& other, offset_t offset) {
+    edge_index.push_back(other.edge_index[offset]);
+  }
+
+  void assign(offset_t offset, const face_t& face) {
+    edge_index[offset] = face.edge_index;
+  }
+
+  void move(offset_t from, offset_t to) {
+    edge_index[to] = edge_index[from];
+  }
+
+  void resize(size_t elements) {
+    edge_index.resize(elements);
+    edge_index.shrink_to_fit();
+  }
+
+  offset_t free_link(offset_t offset) const {
+    return edge_index[offset].offset;
+  }
+
+  void set_free_link(offset_t offset, offset_t next) {
+    edge_index[offset] = edge_index_t(next);
+  }
+
+  void fill(face_table_t& table) {
+    table.edge_index = column_t<edge_index_t>(edge_index.data());
+  }
+};
+
+struct vertex_columns_t {
+  std::vector<point_index_t> point_index;
+  std::vector<edge_index_t> edge_index;
+
+  void reserve(size_t elements) {
+    point_index.reserve(elements);
+    edge_index.reserve(elements);
+  }
+
+  void push_back(const vertex_t& vertex) {
+    point_index.push_back(vertex.point_index);
+    edge_index.push_back(vertex.edge_index);
+  }
+
+  void push_back(const vertex_columns_t& other, offset_t offset) {
+    point_index.push_back(other.point_index[offset]);
+    edge_index.push_back(other.edge_index[offset]);
+  }
+
+  void assign(offset_t offset, const vertex_t& vertex) {
+    point_index[offset] = vertex.point_index;
+    edge_index[offset] = vertex.edge_index;
+  }
+
+  void move(offset_t from, offset_t to) {
+    point_index[to] = point_index[from];
+    edge_index[to] = edge_index[from];
+  }
+
+  void resize(size_t elements) {
+    point_index.resize(elements);
+    point_index.shrink_to_fit();
+    edge_index.resize(elements);
+    edge_index.shrink_to_fit();
+  }
+
+  offset_t free_link(offset_t offset) const {
+    return point_index[offset].offset;
+  }
+
+  void set_free_link(offset_t offset, offset_t next) {
+    point_index[offset] = point_index_t(next);
+  }
+
+  void fill(vertex_table_t& table) {
+    table.point_index = column_t<point_index_t>(point_index.data());
+    table.edge_index = column_t<edge_index_t>(edge_index.data());
+  }
+};
+
+/**
+   The structure-of-arrays counterpart to element_vector_t. The element headers
+   live in their own array and every other field is scattered into the columns
+   on emplace, which means there's no element structure to hand out from get().
+   The free list link goes into the first column of a removed cell.
+ */
+template<typename TElement, typename TElementIndex, typename TColumns,
+         validation_t TValidation = validation_t::checked_logging>
+class element_columns_t {
+public:
+  using headers_t = std::vector<element_t>;
+
+  explicit element_columns_t(validation_counters_t* counters = nullptr)
+    : free_head(0), free_count(0), validator(TValidation, counters)
+  {
+    headers.emplace_back();
+    columns.push_back(TElement {});
+  }
+
+  void reserve(size_t elements) {
+    headers.reserve(elements);
+    columns.reserve(elements);
+  }
+
+  size_t count() const {
+    return headers.size() - free_count;
+  }
+
+  size_t size() const {
+    return headers.size();
+  }
+
+  element_t* header(TElementIndex index) const {
+    element_t* element = header(index.offset);
+    if (TValidation != validation_t::unchecked && element != nullptr) {
+      if (!is_same_generation(element->generation, index.generation)) {
+        validator.generation_mismatch(index.offset, index.generation, element->generation);
+        element = nullptr;
+      }
+    }
+    return element;
+  }
+
+  element_t* header(offset_t offset) const {
+    element_t* element = nullptr;
+    if (TValidation == validation_t::unchecked || offset < headers.size()) {
+      element = (element_t*)headers.data() + offset;
+    }
+    else {
+      validator.invalid_offset(offset, headers.size());
+    }
+    return element;
+  }
+
+  bool contains(TElementIndex index) const {
+    return index.offset < headers.size()
+      && is_same_generation(headers[index.offset].generation, index.generation);
+  }
+
+  TElementIndex emplace(TElement&& element) {
+    TElementIndex index;
+    if (free_head != 0) {
+      auto offset = free_head;
+      element.generation = headers[offset].generation;
+      index = TElementIndex(offset, element.generation);
+      free_head = columns.free_link(offset);
+      --free_count;
+      headers[offset] = element;
+      columns.assign(offset, element);
+    }
+    else if (headers.size() > index_offset_max) {
+      report_storage_exhausted();
+    }
+    else {
+      index.offset = headers.size();
+      index.generation = element.generation;
+      headers.push_back(element);
+      columns.push_back(element);
+    }
+    return index;
+  }
+
+  void remove(TElementIndex index) {
+    if (contains(index) && headers[index.offset].status == element_status_t::ACTIVE) {
+      auto& header_at_index = headers[index.offset];
+      header_at_index.generation++;
+      header_at_index.status = element_status_t::INACTIVE;
+      columns.set_free_link(index.offset, free_head);
+      free_head = index.offset;
+      ++free_count;
+    }
+  }
+
+  /**
+     See element_vector_t::retract().
+   */
+  bool retract(TElementIndex index) {
+    if (index.offset == 0 || !contains(index) || headers[index.offset].status != element_status_t::ACTIVE) {
+      return false;
+    }
+    headers[index.offset].generation++;
+    headers[index.offset].status = element_status_t::INACTIVE;
+    columns.set_free_link(index.offset, free_head);
+    free_head = index.offset;
+    ++free_count;
+    return true;
+  }
+
+  /**
+     See element_vector_t::restore().
+   */
+  bool restore(TElementIndex index) {
+    if (index.offset == 0 || index.offset != free_head) {
+      return false;
+    }
+    free_head = columns.free_link(index.offset);
+    --free_count;
+    headers[index.offset].generation = index.generation;
+    headers[index.offset].status = element_status_t::ACTIVE;
+    return true;
+  }
+
+  /**
+     See element_vector_t::compact().
+   */
+  std::vector<TElementIndex> compact() {
+    std::vector<TElementIndex> remap(headers.size());
+    offset_t next = 1;
+    for (offset_t offset = 1; offset < headers.size(); ++offset) {
+      if (headers[offset].status != element_status_t::ACTIVE) {
+        continue;
+      }
+      remap[offset] = TElementIndex(next, headers[offset].generation);
+      if (next != offset) {
+        headers[next] = headers[offset];
+        columns.move(offset, next);
+      }
+      ++next;
+    }
+    headers.resize(next);
+    headers.shrink_to_fit();
+    columns.resize(next);
+    free_head = 0;
+    free_count = 0;
+    return remap;
+  }
+
+  /**
+     See element_vector_t::reorder().
+   */
+  std::vector<TElementIndex> reorder(const std::vector<offset_t>& order) {
+    std::vector<TElementIndex> remap(headers.size());
+    headers_t reordered_headers;
+    TColumns reordered_columns;
+    reordered_headers.reserve(count());
+    reordered_columns.reserve(count());
+    reordered_headers.push_back(headers[0]);
+    reordered_columns.push_back(columns, 0);
+    auto take = [&](offset_t offset) {
+      if (offset == 0 || offset >= headers.size() || remap[offset]
+          || headers[offset].status != element_status_t::ACTIVE) {
+        return;
+      }
+      remap[offset] = TElementIndex(reordered_headers.size(), headers[offset].generation);
+      reordered_headers.push_back(headers[offset]);
+      reordered_columns.push_back(columns, offset);
+    };
+    for (auto offset : order) {
+      take(offset);
+    }
+    for (offset_t offset = 1; offset < headers.size(); ++offset) {
+      take(offset);
+    }
+    headers.swap(reordered_headers);
+    columns = std::move(reordered_columns);
+    free_head = 0;
+    free_count = 0;
+    return remap;
+  }
+
+  template<typename TTable>
+  TTable table() {
+    TTable table;
+    table.size = headers.size();
+    table.element = column_t<element_t>(headers.data());
+    table.validator = validator;
+    columns.fill(table);
+    return table;
+  }
+
+private:
+  headers_t headers;
+  TColumns columns;
+  offset_t free_head;
+  size_t free_count;
+  validator_t validator;
+};
+
+template<validation_t TValidation = validation_t::checked_logging>
+class soa_kernel_t final : public kernel_t {
+  validation_counters_t counters;
+  element_columns_t<vertex_t, vertex_index_t, vertex_columns_t, TValidation> vertices;
+  element_columns_t<face_t, face_index_t, face_columns_t, TValidation>       faces;
+  element_columns_t<edge_t, edge_index_t, edge_columns_t, TValidation>       edges;
+  element_vector_t<point_t, point_index_t, TValidation>                      points;
+
+  template<typename TColumns, typename TIndex>
+  static void resolve_generation(const TColumns& columns, TIndex* index) {
+    if (index->offset < columns.size()) {
+      index->generation = columns.header(index->offset)->generation;
+    }
+  }
+
+public:
+  soa_kernel_t()
+    : vertices(&counters)
+    , faces(&counters)
+    , edges(&counters)
+    , points(&counters)
+  {}
+
+  edge_t* get(edge_index_t) override {
+    return nullptr;
+  }
+  face_t* get(face_index_t) override {
+    return nullptr;
+  }
+  vertex_t* get(vertex_index_t) override {
+    return nullptr;
+  }
+  point_t* get(point_index_t index) override {
+    return points.get(index);
+  }
+
+  edge_index_t emplace(edge_t&& edge) override {
+    return created(edges.emplace(std::move(edge)));
+  }
+  face_index_t emplace(face_t&& face) override {
+    return created(faces.emplace(std::move(face)));
+  }
+  vertex_index_t emplace(vertex_t&& vertex) override {
+    return created(vertices.emplace(std::move(vertex)));
+  }
+  point_index_t emplace(point_t&& point) override {
+    return created(points.emplace(std::move(point)));
+  }
+
+  void remove(edge_index_t index) override {
+    return edges.remove(index);
+  }
+  void remove(face_index_t index) override {
+    return faces.remove(index);
+  }
+  void remove(vertex_index_t index) override {
+    return vertices.remove(index);
+  }
+  void remove(point_index_t index) override {
+    return points.remove(index);
+  }
+
+  bool retract(edge_index_t index) override {
+    return edges.retract(index);
+  }
+  bool retract(face_index_t index) override {
+    return faces.retract(index);
+  }
+  bool retract(vertex_index_t index) override {
+    return vertices.retract(index);
+  }
+  bool retract(point_index_t index) override {
+    return points.retract(index);
+  }
+
+  bool restore(edge_index_t index) override {
+    return edges.restore(index);
+  }
+  bool restore(face_index_t index) override {
+    return faces.restore(index);
+  }
+  bool restore(vertex_index_t index) override {
+    return vertices.restore(index);
+  }
+  bool restore(point_index_t index) override {
+    return points.restore(index);
+  }
+
+  size_t point_count() const override {
+    return points.count();
+  }
+
+  size_t vertex_count() const override {
+    return vertices.count();
+  }
+
+  size_t face_count() const override {
+    return faces.count();
+  }
+
+  size_t edge_count() const override {
+    return edges.count();
+  }
+
+  void reserve(size_t point_count, size_t vertex_count, size_t face_count, size_t edge_count) override {
+    points.reserve(points.size() + point_count);
+    vertices.reserve(vertices.size() + vertex_count);
+    faces.reserve(faces.size() + face_count);
+    edges.reserve(edges.size() + edge_count);
+  }
+
+  remap_table_t compact() override {
+    remap_table_t remap;
+    remap.edges = edges.compact();
+    remap.faces = faces.compact();
+    remap.vertices = vertices.compact();
+    remap.points = points.compact();
+    remap_references(*this, remap);
+    return remapped(std::move(remap));
+  }
+
+  remap_table_t reorder(const element_order_t& order) override {
+    remap_table_t remap;
+    remap.edges = edges.reorder(order.edges);
+    remap.faces = faces.reorder(order.faces);
+    remap.vertices = vertices.reorder(order.vertices);
+    remap.points = points.reorder(order.points);
+    remap_references(*this, remap);
+    return remapped(std::move(remap));
+  }
+
+  void resolve(edge_index_t* index, edge_t** edge) const override {
+    *edge = nullptr;
+    resolve_generation(edges, index);
+  }
+  void resolve(face_index_t* index, face_t** face) const override {
+    *face = nullptr;
+    resolve_generation(faces, index);
+  }
+  void resolve(point_index_t* index, point_t** point) const override {
+    *point = index->offset < points.size() ? points.get(index->offset) : nullptr;
+    if (*point != nullptr) {
+      index->generation = (*point)->generation;
+    }
+  }
+  void resolve(vertex_index_t* index, vertex_t** vert) const override {
+    *vert = nullptr;
+    resolve_generation(vertices, index);
+  }
+
+  edge_table_t edge_table() override {
+    return edges.template table<edge_table_t>();
+  }
+  face_table_t face_table() override {
+    return faces.template table<face_table_t>();
+  }
+  vertex_table_t vertex_table() override {
+    return vertices.template table<vertex_table_t>();
+  }
+  point_table_t point_table() override {
+    auto table = points.template table<point_table_t>();
+    table.position = make_column(points.data(), &point_t::position);
+    return table;
+  }
+
+  validation_t validation() const override {
+    return TValidation;
+  }
+  const validation_counters_t& validation_counters() const override {
+    return counters;
+  }
+
+  kernel_t::ptr_t snapshot() override {
+    return kernel_t::ptr_t(nullptr, [](kernel_t* k) { delete k; });
+  }
+};
+
+// soa_kernel_t
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace hedge
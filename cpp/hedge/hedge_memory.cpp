@@ -0,0 +1,125 @@
+
+#include "hedge.hpp"
+#include "hedge_kernel.hpp"
+
+#include <easylogging++.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace hedge {
+
+#if !defined(_WIN32)
+
+namespace {
+
+const size_t huge_page_bytes = size_t(2) << 20;
+
+size_t round_up(size_t bytes, size_t alignment) {
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+size_t page_bytes() {
+  static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+} // namespace
+
+page_region_t reserve_pages(size_t bytes, bool huge_pages) {
+  page_region_t region;
+  // Huge page regions get room to slide their base up to a 2MB boundary, so
+  // that explicit huge pages can be mapped over them later.
+  const size_t alignment = huge_pages ? huge_page_bytes : page_bytes();
+  region.bytes = round_up(bytes, alignment);
+  const size_t slack = huge_pages ? huge_page_bytes : 0;
+  void* base = mmap(nullptr, region.bytes + slack, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    LOG(WARNING) << "Couldn't reserve " << region.bytes << " bytes of address space, using the heap instead";
+    return page_region_t();
+  }
+  char* begin = static_cast<char*>(base);
+  if (slack != 0) {
+    char* aligned = reinterpret_cast<char*>(round_up(reinterpret_cast<uintptr_t>(begin), huge_page_bytes));
+    if (aligned != begin) {
+      munmap(begin, size_t(aligned - begin));
+    }
+    if (aligned + region.bytes != begin + region.bytes + slack) {
+      munmap(aligned + region.bytes, size_t(begin + slack - aligned));
+    }
+    begin = aligned;
+  }
+#if defined(MADV_HUGEPAGE)
+  if (huge_pages) {
+    madvise(begin, region.bytes, MADV_HUGEPAGE);
+  }
+#endif
+  region.base = begin;
+  return region;
+}
+
+void commit_huge_pages(page_region_t& region, size_t live_bytes, size_t bytes) {
+#if defined(MAP_HUGETLB)
+  const size_t begin = std::max(region.huge_bytes, round_up(live_bytes, huge_page_bytes));
+  const size_t end = std::min(round_up(bytes, huge_page_bytes), region.bytes);
+  if (region.base == nullptr || begin >= end) {
+    return;
+  }
+  // Explicit huge pages come from a pool set aside by the administrator and
+  // are taken up front, so only the size that was asked for is mapped.
+  void* at = mmap(region.base + begin, end - begin, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+  if (at == MAP_FAILED) {
+    // The pool is too small. Make sure the range is still backed by the
+    // ordinary mapping in case the failed attempt dropped it.
+    at = mmap(region.base + begin, end - begin, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+#if defined(MADV_HUGEPAGE)
+    if (at != MAP_FAILED) {
+      madvise(at, end - begin, MADV_HUGEPAGE);
+    }
+#endif
+    return;
+  }
+  region.huge_bytes = end;
+#else
+  (void)region; (void)live_bytes; (void)bytes;
+#endif
+}
+
+void release_pages(page_region_t& region) {
+  if (region.base != nullptr) {
+    munmap(region.base, region.bytes);
+  }
+  region = page_region_t();
+}
+
+void discard_pages(const page_region_t& region, size_t keep_bytes) {
+  // Explicit huge pages can only be handed back whole.
+  const size_t keep = round_up(keep_bytes, keep_bytes < region.huge_bytes ? huge_page_bytes : page_bytes());
+  if (region.base != nullptr && keep < region.bytes) {
+    madvise(region.base + keep, region.bytes - keep, MADV_DONTNEED);
+  }
+}
+
+#else
+
+page_region_t reserve_pages(size_t, bool) {
+  LOG(WARNING) << "Paged element storage isn't supported on this platform, using the heap instead";
+  return page_region_t();
+}
+
+void commit_huge_pages(page_region_t&, size_t, size_t) {}
+
+void release_pages(page_region_t& region) {
+  region = page_region_t();
+}
+
+void discard_pages(const page_region_t&, size_t) {}
+
+#endif
+
+} // namespace hedge
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace hedge {
+
+/**
+   Zero means "use every core", anything else is taken as is.
+ */
+inline size_t resolve_thread_count(size_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+  return thread_count;
+}
+
+/**
+   Splits [0, count) into at most thread_count contiguous chunks and calls
+   fn(begin, end, chunk) for each of them on its own thread. The calling thread
+   takes the first chunk so a single thread never spawns anything.
+ */
+template<typename TFn>
+void parallel_for(size_t count, size_t thread_count, TFn&& fn) {
+  thread_count = std::max<size_t>(1, std::min(resolve_thread_count(thread_count), count));
+  const size_t chunk_size = (count + thread_count - 1) / std::max<size_t>(1, thread_count);
+
+  std::vector<std::thread> threads;
+  threads.reserve(thread_count);
+  for (size_t chunk = 1; chunk < thread_count; ++chunk) {
+    const size_t begin = std::min(count, chunk * chunk_size);
+    const size_t end = std::min(count, begin + chunk_size);
+    threads.emplace_back([&fn, begin, end, chunk]() { fn(begin, end, chunk); });
+  }
+  fn(0, std::min(count, chunk_size), 0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/**
+   Calls fn(index) for every element of the range from thread_count threads,
+   handing each thread a contiguous slice of the storage cells.
+ */
+template<typename TRange, typename TFn>
+void parallel_for_each(const TRange& range, size_t thread_count, TFn&& fn) {
+  parallel_for(range.cells(), thread_count, [&range, &fn](size_t begin, size_t end, size_t) {
+    for (auto index : range.slice(begin, end)) {
+      fn(index);
+    }
+  });
+}
+
+} // namespace hedge
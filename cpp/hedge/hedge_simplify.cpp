@@ -0,0 +1,738 @@
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+/**
+   Collapses that turn any face normal further than this (as a cosine) are
+   taken as folding the face over.
+ */
+const double min_normal_cosine = 0.2;
+
+using vec3d_t = mathfu::Vector<double, 3>;
+
+vec3d_t to_double(const position_t& p) {
+  return vec3d_t(p.x, p.y, p.z);
+}
+
+/**
+   Summed squared distance to a set of planes, kept as the upper triangle of
+   the symmetric 4x4 matrix in the order xx xy xz xw yy yz yw zz zw ww.
+ */
+struct quadric_t {
+  double m[10];
+
+  quadric_t() {
+    std::fill(m, m + 10, 0.0);
+  }
+
+  quadric_t(const vec3d_t& n, double d, double weight) {
+    m[0] = n.x * n.x * weight; m[1] = n.x * n.y * weight; m[2] = n.x * n.z * weight; m[3] = n.x * d * weight;
+    m[4] = n.y * n.y * weight; m[5] = n.y * n.z * weight; m[6] = n.y * d * weight;
+    m[7] = n.z * n.z * weight; m[8] = n.z * d * weight;
+    m[9] = d * d * weight;
+  }
+
+  quadric_t& operator+=(const quadric_t& other) {
+    for (size_t i = 0; i < 10; ++i) {
+      m[i] += other.m[i];
+    }
+    return *this;
+  }
+
+  double error(const vec3d_t& p) const {
+    return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x
+      + m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y
+      + m[7] * p.z * p.z + 2.0 * m[8] * p.z
+      + m[9];
+  }
+
+  /**
+     Solves for the position of least error, which fails when the planes
+     don't pin down a point (a flat or a cylindrical patch).
+   */
+  bool minimum(vec3d_t& p) const {
+    const double c00 = m[4] * m[7] - m[5] * m[5];
+    const double c01 = m[2] * m[5] - m[1] * m[7];
+    const double c02 = m[1] * m[5] - m[2] * m[4];
+    const double det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+    const double scale = m[0] + m[4] + m[7];
+    if (scale <= 0.0 || std::abs(det) <= 1e-9 * scale * scale * scale) {
+      return false;
+    }
+    const double c11 = m[0] * m[7] - m[2] * m[2];
+    const double c12 = m[1] * m[2] - m[0] * m[5];
+    const double c22 = m[0] * m[4] - m[1] * m[1];
+    p.x = -(c00 * m[3] + c01 * m[6] + c02 * m[8]) / det;
+    p.y = -(c01 * m[3] + c11 * m[6] + c12 * m[8]) / det;
+    p.z = -(c02 * m[3] + c12 * m[6] + c22 * m[8]) / det;
+    return true;
+  }
+};
+
+/**
+   A queued collapse of an edge into its origin. It's stale once the edge is
+   gone or either vertex was changed by another collapse after it was queued.
+ */
+struct collapse_t {
+  double cost;
+  edge_index_t eindex;
+  offset_t from;
+  offset_t to;
+  uint32_t from_stamp;
+  uint32_t to_stamp;
+  vec3d_t position;
+
+  bool operator<(const collapse_t& other) const {
+    return cost > other.cost;
+  }
+};
+
+/**
+   The queue and scratch space of one pass over a partition, or over the
+   whole mesh when the partition is negative.
+ */
+struct pass_t {
+  int partition;
+  size_t collapses;
+  double max_error;
+  std::priority_queue<collapse_t> queue;
+  std::vector<edge_index_t> from_ring;
+  std::vector<edge_index_t> to_ring;
+  std::vector<offset_t> from_neighbours;
+  std::vector<offset_t> to_neighbours;
+
+  explicit pass_t(int p) : partition(p), collapses(0), max_error(0.0) {}
+};
+
+class simplifier_t {
+  mesh_t& _mesh;
+  const simplify_options_t& _options;
+  transaction_t* _transaction;
+  edge_table_t _edges;
+  face_table_t _faces;
+  vertex_table_t _vertices;
+  point_table_t _points;
+  std::vector<quadric_t> _quadrics;
+  std::vector<uint32_t> _stamps;
+  std::vector<uint32_t> _vertex_users;
+  std::vector<uint32_t> _point_users;
+  std::vector<int> _point_partition;
+  std::vector<uint8_t> _dead_edges;
+  std::vector<uint8_t> _dead_faces;
+  std::vector<uint8_t> _dead_vertices;
+  std::vector<uint8_t> _dead_points;
+  bool _deferred;
+
+public:
+  simplifier_t(mesh_t& mesh, const simplify_options_t& options)
+    : _mesh(mesh)
+    , _options(options)
+    , _transaction(mesh.transaction())
+    , _edges(mesh.kernel->edge_table())
+    , _faces(mesh.kernel->face_table())
+    , _vertices(mesh.kernel->vertex_table())
+    , _points(mesh.kernel->point_table())
+    , _quadrics(_vertices.size)
+    , _stamps(_vertices.size, 0)
+    , _vertex_users(_vertices.size, 0)
+    , _point_users(_points.size, 0)
+    , _dead_edges(_edges.size, 0)
+    , _dead_faces(_faces.size, 0)
+    , _dead_vertices(_vertices.size, 0)
+    , _dead_points(_points.size, 0)
+    , _deferred(false)
+  {
+    for (offset_t offset = 1; offset < _edges.size; ++offset) {
+      auto vindex = _edges.vertex_index[offset];
+      if (is_edge(edge_index_t(offset, _edges.element[offset].generation)) && _vertices.contains(vindex)) {
+        ++_vertex_users[vindex.offset];
+      }
+    }
+    for (offset_t offset = 1; offset < _vertices.size; ++offset) {
+      auto pindex = _vertices.point_index[offset];
+      if (is_vertex(offset) && _points.contains(pindex)) {
+        ++_point_users[pindex.offset];
+      }
+    }
+    gather_quadrics();
+  }
+
+  bool is_parallel() const {
+    return _transaction == nullptr;
+  }
+
+  /**
+     Cuts the points into count slabs of equal size along the longest axis.
+   */
+  void partition(size_t count) {
+    // The partitions write side by side from here on and would race to copy
+    // the pages a versioned kernel still shares with its snapshots, so every
+    // such page of the tables they write is copied now: with a snapshot
+    // alive that's a copy of all edges, vertices and points however few the
+    // collapses turn out to be, on the order of the pass over every cell
+    // that gathered the quadrics. Faces only go once flush() runs serially.
+    // A serial run (thread_count 1) copies only the pages it writes.
+    _edges.make_writable();
+    _vertices.make_writable();
+    _points.make_writable();
+    position_t lo(FLT_MAX, FLT_MAX, FLT_MAX);
+    position_t hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    std::vector<offset_t> order;
+    order.reserve(_points.size);
+    for (offset_t offset = 1; offset < _points.size; ++offset) {
+      if (_point_users[offset] > 0) {
+        lo = position_t::Min(lo, _points.position[offset]);
+        hi = position_t::Max(hi, _points.position[offset]);
+        order.push_back(offset);
+      }
+    }
+    const auto extent = hi - lo;
+    const size_t axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    std::sort(order.begin(), order.end(), [this, axis](offset_t a, offset_t b) {
+      return _points.position[a][axis] < _points.position[b][axis];
+    });
+    _point_partition.assign(_points.size, -1);
+    for (size_t i = 0; i < order.size(); ++i) {
+      _point_partition[order[i]] = int(i * count / order.size());
+    }
+  }
+
+  /**
+     Queues every edge of the pass, once per adjacent pair. Seeding reads
+     across partitions so it has to be done before any pass starts running.
+   */
+  void seed(pass_t& pass) {
+    for (offset_t offset = 1; offset < _edges.size; ++offset) {
+      edge_index_t eindex(offset, _edges.element[offset].generation);
+      if (is_edge(eindex)) {
+        enqueue_pair(pass, eindex);
+      }
+    }
+  }
+
+  /**
+     Collapses edges until removable faces are gone, the queue runs dry or
+     the next collapse costs more than the error bound. Partitioned passes
+     only mark what they remove so that passes over other partitions can run
+     at the same time, flush() removes it afterwards.
+   */
+  size_t run(pass_t& pass, size_t removable) {
+    size_t removed = 0;
+    while (removed < removable && !pass.queue.empty()) {
+      auto collapse = pass.queue.top();
+      pass.queue.pop();
+      if (collapse.cost > _options.max_error) {
+        break;
+      }
+      if (!is_current(collapse)) {
+        continue;
+      }
+      if (!can_collapse(pass, collapse)) {
+        continue;
+      }
+      removed += apply(pass, collapse);
+      ++pass.collapses;
+      pass.max_error = std::max(pass.max_error, collapse.cost);
+      requeue(pass, collapse.from);
+    }
+    return removed;
+  }
+
+  void defer_removal(bool deferred) {
+    _deferred = deferred;
+  }
+
+  void flush() {
+    flush(_dead_faces, _faces);
+    flush(_dead_edges, _edges);
+    flush(_dead_vertices, _vertices);
+    flush(_dead_points, _points);
+  }
+
+private:
+  bool is_edge(edge_index_t eindex) const {
+    return eindex && _edges.contains(eindex) && !_dead_edges[eindex.offset] &&
+      _edges.element[eindex.offset].status == element_status_t::ACTIVE;
+  }
+
+  bool is_vertex(offset_t offset) const {
+    return _vertices.element[offset].status == element_status_t::ACTIVE && !_dead_vertices[offset];
+  }
+
+  bool in_partition(const pass_t& pass, offset_t vertex) const {
+    return pass.partition < 0 || _point_partition[_vertices.point_index[vertex].offset] == pass.partition;
+  }
+
+  offset_t origin(edge_index_t eindex) const {
+    return _edges.vertex_index[eindex.offset].offset;
+  }
+
+  offset_t destination(edge_index_t eindex) const {
+    return origin(_edges.next_index[eindex.offset]);
+  }
+
+  vec3d_t position(offset_t vertex) const {
+    return to_double(_points.position[_vertices.point_index[vertex].offset]);
+  }
+
+  bool is_triangle(edge_index_t eindex) const {
+    auto next = _edges.next_index[eindex.offset];
+    return _edges.next_index[_edges.next_index[next.offset].offset] == eindex && next != eindex;
+  }
+
+  void gather_quadrics() {
+    for (offset_t offset = 1; offset < _faces.size; ++offset) {
+      if (_faces.element[offset].status != element_status_t::ACTIVE) {
+        continue;
+      }
+      auto first = _faces.edge_index[offset];
+      if (!is_edge(first)) {
+        continue;
+      }
+      auto area = to_double(face_vector_area(_edges, _vertices, _points, first));
+      const double length = area.Length();
+      if (length <= 0.0) {
+        continue;
+      }
+      const vec3d_t normal = area / length;
+      const double d = -vec3d_t::DotProduct(normal, position(origin(first)));
+      const quadric_t plane(normal, d, 1.0);
+
+      auto eindex = first;
+      for (size_t steps = 0; steps < _edges.size; ++steps) {
+        _quadrics[origin(eindex)] += plane;
+        if (!is_edge(_edges.adjacent_index[eindex.offset])) {
+          // A plane through the boundary edge, square to the face, keeps the
+          // outline from shrinking.
+          const auto p0 = position(origin(eindex));
+          const auto side = vec3d_t::CrossProduct(position(destination(eindex)) - p0, normal);
+          const double side_length = side.Length();
+          if (side_length > 0.0) {
+            const vec3d_t side_normal = side / side_length;
+            const quadric_t boundary(side_normal, -vec3d_t::DotProduct(side_normal, p0), _options.boundary_weight);
+            _quadrics[origin(eindex)] += boundary;
+            _quadrics[destination(eindex)] += boundary;
+          }
+        }
+        eindex = _edges.next_index[eindex.offset];
+        if (eindex == first || !is_edge(eindex)) {
+          break;
+        }
+      }
+    }
+  }
+
+  void enqueue(pass_t& pass, edge_index_t eindex) {
+    collapse_t collapse;
+    collapse.eindex = eindex;
+    collapse.from = origin(eindex);
+    collapse.to = destination(eindex);
+    if (!in_partition(pass, collapse.from) || !in_partition(pass, collapse.to)) {
+      return;
+    }
+    collapse.from_stamp = _stamps[collapse.from];
+    collapse.to_stamp = _stamps[collapse.to];
+
+    auto quadric = _quadrics[collapse.from];
+    quadric += _quadrics[collapse.to];
+    const auto p0 = position(collapse.from);
+    const auto p1 = position(collapse.to);
+    collapse.position = (p0 + p1) * 0.5;
+    if (quadric.minimum(collapse.position)) {
+      collapse.cost = quadric.error(collapse.position);
+    } else {
+      const vec3d_t candidates[] = { collapse.position, p0, p1 };
+      collapse.cost = DBL_MAX;
+      for (const auto& candidate : candidates) {
+        const double cost = quadric.error(candidate);
+        if (cost < collapse.cost) {
+          collapse.cost = cost;
+          collapse.position = candidate;
+        }
+      }
+    }
+    // A degenerate quadric can leave every candidate without a usable cost,
+    // such an edge is never worth collapsing.
+    if (!std::isfinite(collapse.cost) || collapse.cost == DBL_MAX) {
+      return;
+    }
+    collapse.cost = std::max(0.0, collapse.cost);
+    pass.queue.push(collapse);
+  }
+
+  void enqueue_pair(pass_t& pass, edge_index_t eindex) {
+    auto adjacent = _edges.adjacent_index[eindex.offset];
+    if (!is_edge(adjacent)) {
+      enqueue(pass, eindex);
+    } else {
+      enqueue(pass, eindex.offset < adjacent.offset ? eindex : adjacent);
+    }
+  }
+
+  /**
+     Queues the edges around a vertex that moved, including the boundary
+     edge coming into it which isn't adjacent to any outgoing edge.
+   */
+  void requeue(pass_t& pass, offset_t vertex) {
+    gather_ring(vertex, pass.from_ring);
+    for (auto eindex : pass.from_ring) {
+      enqueue_pair(pass, eindex);
+      auto prev = _edges.prev_index[eindex.offset];
+      if (!is_edge(_edges.adjacent_index[prev.offset])) {
+        enqueue(pass, prev);
+      }
+    }
+  }
+
+  bool is_current(const collapse_t& collapse) const {
+    return is_edge(collapse.eindex) &&
+      origin(collapse.eindex) == collapse.from && destination(collapse.eindex) == collapse.to &&
+      _stamps[collapse.from] == collapse.from_stamp && _stamps[collapse.to] == collapse.to_stamp;
+  }
+
+  /**
+     Gathers the outgoing edges around a vertex starting from the boundary
+     when there is one, returning whether the vertex is on it.
+   */
+  bool gather_ring(offset_t vertex, std::vector<edge_index_t>& ring) const {
+    ring.clear();
+    auto first = find_ring_start(_edges, _vertices.edge_index[vertex]);
+    if (!is_edge(first)) {
+      return false;
+    }
+    auto eindex = first;
+    for (size_t steps = 0; steps < _edges.size; ++steps) {
+      ring.push_back(eindex);
+      auto next = vertex_ring_walk_t::step(_edges, eindex);
+      if (!is_edge(next)) {
+        return true;
+      }
+      if (next == first) {
+        return false;
+      }
+      eindex = next;
+    }
+    return false;
+  }
+
+  void gather_neighbours(const std::vector<edge_index_t>& ring, std::vector<offset_t>& neighbours) const {
+    neighbours.clear();
+    for (auto eindex : ring) {
+      neighbours.push_back(destination(eindex));
+      neighbours.push_back(origin(_edges.prev_index[eindex.offset]));
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+  }
+
+  bool can_collapse(pass_t& pass, const collapse_t& collapse) {
+    const auto h = collapse.eindex;
+    const auto t = _edges.adjacent_index[h.offset];
+    const bool has_twin = is_edge(t);
+    if (!is_triangle(h) || (has_twin && !is_triangle(t))) {
+      return false;
+    }
+    const auto hn = _edges.next_index[h.offset];
+    const auto hp = _edges.prev_index[h.offset];
+    if (!is_edge(_edges.adjacent_index[hn.offset]) && !is_edge(_edges.adjacent_index[hp.offset])) {
+      return false;
+    }
+    if (has_twin) {
+      const auto tn = _edges.next_index[t.offset];
+      const auto tp = _edges.prev_index[t.offset];
+      if (!is_edge(_edges.adjacent_index[tn.offset]) && !is_edge(_edges.adjacent_index[tp.offset])) {
+        return false;
+      }
+    }
+
+    const bool from_boundary = gather_ring(collapse.from, pass.from_ring);
+    const bool to_boundary = gather_ring(collapse.to, pass.to_ring);
+    if (pass.from_ring.empty() || pass.to_ring.empty() || (has_twin && from_boundary && to_boundary)) {
+      return false;
+    }
+    for (auto eindex : pass.from_ring) {
+      if (!is_triangle(eindex)) {
+        return false;
+      }
+    }
+    for (auto eindex : pass.to_ring) {
+      if (!is_triangle(eindex)) {
+        return false;
+      }
+    }
+    gather_neighbours(pass.from_ring, pass.from_neighbours);
+    gather_neighbours(pass.to_ring, pass.to_neighbours);
+    for (auto vertex : pass.from_neighbours) {
+      if (!in_partition(pass, vertex)) {
+        return false;
+      }
+    }
+    for (auto vertex : pass.to_neighbours) {
+      if (!in_partition(pass, vertex)) {
+        return false;
+      }
+    }
+
+    // Link condition: the only vertices both ends share are the tips of the
+    // one or two triangles on the edge.
+    size_t shared = 0;
+    size_t merged = 0;
+    auto a = pass.from_neighbours.begin();
+    auto b = pass.to_neighbours.begin();
+    while (a != pass.from_neighbours.end() || b != pass.to_neighbours.end()) {
+      if (b == pass.to_neighbours.end() || (a != pass.from_neighbours.end() && *a < *b)) {
+        merged += *a != collapse.to;
+        ++a;
+      } else if (a == pass.from_neighbours.end() || *b < *a) {
+        merged += *b != collapse.from;
+        ++b;
+      } else {
+        ++shared;
+        ++merged;
+        ++a;
+        ++b;
+      }
+    }
+    if (shared != (has_twin ? 2u : 1u) || merged <= shared) {
+      return false;
+    }
+
+    const auto f0 = _edges.face_index[h.offset].offset;
+    const auto f1 = has_twin ? _edges.face_index[t.offset].offset : 0;
+    return !folds_over(pass.from_ring, collapse, f0, f1) && !folds_over(pass.to_ring, collapse, f0, f1);
+  }
+
+  bool folds_over(const std::vector<edge_index_t>& ring, const collapse_t& collapse, offset_t f0, offset_t f1) const {
+    for (auto eindex : ring) {
+      const auto face = _edges.face_index[eindex.offset].offset;
+      if (face == f0 || face == f1) {
+        continue;
+      }
+      const auto corner = position(origin(eindex));
+      const auto b = position(destination(eindex));
+      const auto c = position(origin(_edges.prev_index[eindex.offset]));
+      const auto before = vec3d_t::CrossProduct(b - corner, c - corner);
+      const auto after = vec3d_t::CrossProduct(b - collapse.position, c - collapse.position);
+      const double length = after.Length();
+      if (length <= 0.0 || vec3d_t::DotProduct(before, after) < min_normal_cosine * before.Length() * length) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+     Merges the destination of the edge into its origin, removing the one or
+     two triangles on the edge, and returns how many faces went.
+   */
+  size_t apply(pass_t& pass, const collapse_t& collapse) {
+    const auto h = collapse.eindex;
+    const auto hn = _edges.next_index[h.offset];
+    const auto hp = _edges.prev_index[h.offset];
+    const auto t = _edges.adjacent_index[h.offset];
+    const bool has_twin = is_edge(t);
+    const auto tn = has_twin ? _edges.next_index[t.offset] : edge_index_t();
+    const auto tp = has_twin ? _edges.prev_index[t.offset] : edge_index_t();
+    const edge_index_t dying[] = { h, hn, hp, t, tn, tp };
+    auto is_dying = [&dying](edge_index_t eindex) {
+      return std::find(std::begin(dying), std::end(dying), eindex) != std::end(dying);
+    };
+
+    const auto kept = _edges.vertex_index[h.offset];
+    const auto gone = _edges.vertex_index[hn.offset];
+    for (auto eindex : pass.to_ring) {
+      // Meshes built a triangle at a time give every corner its own vertex,
+      // which goes once the last edge leaving it does.
+      const auto corner = _edges.vertex_index[eindex.offset];
+      touch(eindex);
+      _edges.vertex_index.writable(eindex.offset) = kept;
+      ++_vertex_users[kept.offset];
+      release(corner);
+    }
+
+    link(_edges.adjacent_index[hn.offset], _edges.adjacent_index[hp.offset]);
+    if (has_twin) {
+      link(_edges.adjacent_index[tn.offset], _edges.adjacent_index[tp.offset]);
+    }
+
+    for (const auto* ring : { &pass.from_ring, &pass.to_ring }) {
+      auto survivor = std::find_if(ring->begin(), ring->end(), [&is_dying](edge_index_t e) { return !is_dying(e); });
+      if (survivor != ring->end()) {
+        touch(kept);
+        _vertices.edge_index.writable(kept.offset) = *survivor;
+        break;
+      }
+    }
+    reseat(_edges.vertex_index[hp.offset], hp, hn);
+    if (has_twin) {
+      reseat(_edges.vertex_index[tp.offset], tp, tn);
+    }
+
+    const auto kept_point = _vertices.point_index[kept.offset];
+    touch(kept_point);
+    _points.position.writable(kept_point.offset) = position_t(
+      float(collapse.position.x), float(collapse.position.y), float(collapse.position.z));
+    _quadrics[kept.offset] += _quadrics[gone.offset];
+    ++_stamps[kept.offset];
+    ++_stamps[gone.offset];
+
+    remove(_edges.face_index[h.offset], _dead_faces);
+    for (auto eindex : { h, hn, hp }) {
+      release(_edges.vertex_index[eindex.offset]);
+      remove(eindex, _dead_edges);
+    }
+    if (has_twin) {
+      remove(_edges.face_index[t.offset], _dead_faces);
+      for (auto eindex : { t, tn, tp }) {
+        release(_edges.vertex_index[eindex.offset]);
+        remove(eindex, _dead_edges);
+      }
+    }
+    return has_twin ? 2 : 1;
+  }
+
+  /**
+     Drops an edge's use of a vertex, removing the vertex when no edge leaves
+     it anymore and its point when no vertex is left on it.
+   */
+  void release(vertex_index_t vindex) {
+    if (--_vertex_users[vindex.offset] > 0) {
+      return;
+    }
+    const auto pindex = _vertices.point_index[vindex.offset];
+    remove(vindex, _dead_vertices);
+    if (_points.contains(pindex) && --_point_users[pindex.offset] == 0) {
+      remove(pindex, _dead_points);
+    }
+  }
+
+  void link(edge_index_t a, edge_index_t b) {
+    const bool has_a = is_edge(a);
+    const bool has_b = is_edge(b);
+    if (has_a) {
+      touch(a);
+      _edges.adjacent_index.writable(a.offset) = has_b ? b : edge_index_t();
+    }
+    if (has_b) {
+      touch(b);
+      _edges.adjacent_index.writable(b.offset) = has_a ? a : edge_index_t();
+    }
+  }
+
+  /**
+     Moves the edge of the tip of a removed triangle off the edge leaving it,
+     onto the one that took over from the edge coming into it.
+   */
+  void reseat(vertex_index_t tip, edge_index_t leaving, edge_index_t incoming) {
+    if (_vertices.edge_index[tip.offset] != leaving) {
+      return;
+    }
+    auto replacement = _edges.adjacent_index[incoming.offset];
+    if (!is_edge(replacement)) {
+      auto adjacent = _edges.adjacent_index[leaving.offset];
+      replacement = is_edge(adjacent) ? _edges.next_index[adjacent.offset] : edge_index_t();
+    }
+    touch(tip);
+    _vertices.edge_index.writable(tip.offset) = replacement;
+  }
+
+  template<typename TIndex>
+  void touch(TIndex index) {
+    if (_transaction != nullptr) {
+      _transaction->touch(index);
+    }
+  }
+
+  template<typename TIndex>
+  void remove(TIndex index, std::vector<uint8_t>& dead) {
+    if (_deferred) {
+      dead[index.offset] = 1;
+    } else if (_transaction != nullptr) {
+      _transaction->remove(index);
+    } else {
+      _mesh.kernel->remove(index);
+    }
+  }
+
+  template<typename TTable>
+  void flush(std::vector<uint8_t>& dead, const TTable& table) {
+    for (offset_t offset = 1; offset < dead.size(); ++offset) {
+      if (dead[offset]) {
+        dead[offset] = 0;
+        remove_cell(table, offset);
+      }
+    }
+  }
+
+  void remove_cell(const edge_table_t& table, offset_t offset) {
+    _mesh.kernel->remove(edge_index_t(offset, table.element[offset].generation));
+  }
+  void remove_cell(const face_table_t& table, offset_t offset) {
+    _mesh.kernel->remove(face_index_t(offset, table.element[offset].generation));
+  }
+  void remove_cell(const vertex_table_t& table, offset_t offset) {
+    _mesh.kernel->remove(vertex_index_t(offset, table.element[offset].generation));
+  }
+  void remove_cell(const point_table_t& table, offset_t offset) {
+    _mesh.kernel->remove(point_index_t(offset, table.element[offset].generation));
+  }
+};
+
+} // namespace
+
+simplify_report_t simplify(mesh_t& mesh, const simplify_options_t& options) {
+  simplify_report_t report;
+  report.faces_before = mesh.face_count();
+  report.faces_after = report.faces_before;
+  if (report.faces_before <= options.target_faces) {
+    return report;
+  }
+
+  simplifier_t simplifier(mesh, options);
+  size_t removable = report.faces_before - options.target_faces;
+  const size_t partitions = resolve_thread_count(options.thread_count);
+  if (partitions > 1 && simplifier.is_parallel()) {
+    simplifier.partition(partitions);
+    simplifier.defer_removal(true);
+    std::vector<pass_t> passes;
+    for (size_t partition = 0; partition < partitions; ++partition) {
+      passes.emplace_back(int(partition));
+    }
+    std::vector<size_t> removed(partitions, 0);
+    parallel_for(partitions, partitions, [&](size_t begin, size_t end, size_t) {
+      for (size_t partition = begin; partition < end; ++partition) {
+        simplifier.seed(passes[partition]);
+      }
+    });
+    parallel_for(partitions, partitions, [&](size_t begin, size_t end, size_t) {
+      for (size_t partition = begin; partition < end; ++partition) {
+        removed[partition] = simplifier.run(passes[partition], removable / partitions);
+      }
+    });
+    simplifier.defer_removal(false);
+    simplifier.flush();
+    for (size_t partition = 0; partition < partitions; ++partition) {
+      removable -= std::min(removable, removed[partition]);
+      report.collapses += passes[partition].collapses;
+      report.max_error = std::max(report.max_error, passes[partition].max_error);
+    }
+  }
+
+  pass_t pass(-1);
+  simplifier.seed(pass);
+  simplifier.run(pass, removable);
+  report.collapses += pass.collapses;
+  report.max_error = std::max(report.max_error, pass.max_error);
+  report.faces_after = mesh.face_count();
+  return report;
+}
+
+} // namespace hedge
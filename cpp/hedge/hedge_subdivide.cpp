@@ -0,0 +1,511 @@
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <easylogging++.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+const float two_pi = 6.28318530718f;
+
+template<typename TTable>
+bool is_active(const TTable& table, offset_t offset) {
+  return table.element[offset].status == element_status_t::ACTIVE;
+}
+
+/**
+   Numbers the active cells that pass keep() in offset order, so the i-th one
+   ends up at rank i whatever the thread count. Counts per chunk first and
+   offsets every chunk by the ones before it after. Returns the total.
+ */
+template<typename TKeep>
+size_t rank_cells(size_t cells, size_t thread_count, std::vector<offset_t>& ranks, TKeep&& keep) {
+  ranks.resize(cells);
+  std::vector<size_t> chunk_counts(resolve_thread_count(thread_count) + 1, 0);
+  parallel_for(cells, thread_count, [&](size_t begin, size_t end, size_t chunk) {
+    size_t count = 0;
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (keep(offset_t(offset))) {
+        ranks[offset] = offset_t(count++);
+      }
+    }
+    chunk_counts[chunk + 1] = count;
+  });
+  for (size_t chunk = 1; chunk < chunk_counts.size(); ++chunk) {
+    chunk_counts[chunk] += chunk_counts[chunk - 1];
+  }
+  parallel_for(cells, thread_count, [&](size_t begin, size_t end, size_t chunk) {
+    for (size_t offset = begin; offset < end; ++offset) {
+      ranks[offset] += offset_t(chunk_counts[chunk]);
+    }
+  });
+  return chunk_counts.back();
+}
+
+/**
+   The mesh being subdivided along with the rank of every active cell, and of
+   every edge pair for the edges that stand for their pair: the one with the
+   lower offset or the only one on the boundary.
+ */
+struct source_t {
+  edge_table_t edges;
+  face_table_t faces;
+  vertex_table_t vertices;
+  point_table_t points;
+  std::vector<offset_t> edge_ranks;
+  std::vector<offset_t> pair_ranks;
+  std::vector<offset_t> face_ranks;
+  std::vector<offset_t> vertex_ranks;
+  size_t edge_count;
+  size_t pair_count;
+  size_t face_count;
+  size_t vertex_count;
+
+  source_t(kernel_t& kernel, size_t thread_count)
+    : edges(kernel.edge_table())
+    , faces(kernel.face_table())
+    , vertices(kernel.vertex_table())
+    , points(kernel.point_table())
+  {
+    edge_count = rank_cells(edges.size, thread_count, edge_ranks, [this](offset_t offset) {
+      return is_active(edges, offset);
+    });
+    pair_count = rank_cells(edges.size, thread_count, pair_ranks, [this](offset_t offset) {
+      return is_active(edges, offset) && is_pair_owner(offset);
+    });
+    face_count = rank_cells(faces.size, thread_count, face_ranks, [this](offset_t offset) {
+      return is_active(faces, offset);
+    });
+    vertex_count = rank_cells(vertices.size, thread_count, vertex_ranks, [this](offset_t offset) {
+      return is_active(vertices, offset);
+    });
+  }
+
+  bool has_adjacent(edge_index_t eindex) const {
+    auto adjacent = edges.adjacent_index[eindex.offset];
+    return adjacent && edges.contains(adjacent);
+  }
+
+  bool is_pair_owner(offset_t offset) const {
+    auto adjacent = edges.adjacent_index[offset];
+    return !adjacent || !edges.contains(adjacent) || offset < adjacent.offset;
+  }
+
+  edge_index_t edge(offset_t offset) const {
+    return edge_index_t(offset, edges.element[offset].generation);
+  }
+
+  offset_t pair_rank(edge_index_t eindex) const {
+    return is_pair_owner(eindex.offset) ? pair_ranks[eindex.offset]
+                                        : pair_ranks[edges.adjacent_index[eindex.offset].offset];
+  }
+
+  position_t position(vertex_index_t vindex) const {
+    return points.position[vertices.point_index[vindex.offset].offset];
+  }
+
+  position_t corner(edge_index_t eindex) const {
+    return position(edges.vertex_index[eindex.offset]);
+  }
+
+  /**
+     Where a triangle edge sits in the loop of its face, counted from the
+     edge the face points at.
+   */
+  offset_t slot(edge_index_t eindex) const {
+    auto first = faces.edge_index[edges.face_index[eindex.offset].offset];
+    if (eindex == first) {
+      return 0;
+    }
+    return eindex == edges.next_index[first.offset] ? 1 : 2;
+  }
+
+  /**
+     Walks the ring of a vertex from its start, returning the number of
+     outgoing edges and, for a boundary vertex, the two neighbours along the
+     boundary.
+   */
+  template<typename TVisit>
+  size_t walk_ring(vertex_index_t vindex, bool& boundary, position_t& ends, TVisit&& visit) const {
+    boundary = false;
+    auto first = find_ring_start(edges, vertices.edge_index[vindex.offset]);
+    if (!first || !edges.contains(first)) {
+      return 0;
+    }
+    size_t valence = 0;
+    auto eindex = first;
+    for (size_t steps = 0; steps < edges.size; ++steps) {
+      visit(eindex);
+      ++valence;
+      auto next = vertex_ring_walk_t::step(edges, eindex);
+      if (!next || !edges.contains(next)) {
+        boundary = true;
+        ends = corner(edges.next_index[first.offset]) + corner(edges.prev_index[eindex.offset]);
+        break;
+      }
+      if (next == first) {
+        break;
+      }
+      eindex = next;
+    }
+    return valence;
+  }
+};
+
+/**
+   The freshly emplaced, contiguous cells of the result and the generation
+   they came out with.
+ */
+struct target_t {
+  edge_table_t edges;
+  face_table_t faces;
+  vertex_table_t vertices;
+  point_table_t points;
+  generation_t edge_generation;
+  generation_t face_generation;
+  generation_t vertex_generation;
+  generation_t point_generation;
+
+  edge_index_t edge(size_t rank) const { return edge_index_t(offset_t(rank + 1), edge_generation); }
+  face_index_t face(size_t rank) const { return face_index_t(offset_t(rank + 1), face_generation); }
+  vertex_index_t vertex(size_t rank) const { return vertex_index_t(offset_t(rank + 1), vertex_generation); }
+  point_index_t point(size_t rank) const { return point_index_t(offset_t(rank + 1), point_generation); }
+
+  void set_edge(size_t rank, size_t vertex, size_t face, size_t next, size_t prev) {
+    const offset_t offset = offset_t(rank + 1);
+    edges.vertex_index.writable(offset) = this->vertex(vertex);
+    edges.face_index.writable(offset) = this->face(face);
+    edges.next_index.writable(offset) = edge(next);
+    edges.prev_index.writable(offset) = edge(prev);
+  }
+
+  void set_adjacent(size_t rank, edge_index_t adjacent) {
+    edges.adjacent_index.writable(offset_t(rank + 1)) = adjacent;
+  }
+
+  void set_vertex(size_t rank, const position_t& position, edge_index_t eindex) {
+    const offset_t offset = offset_t(rank + 1);
+    vertices.point_index.writable(offset) = point(rank);
+    vertices.edge_index.writable(offset) = eindex;
+    points.position.writable(offset) = position;
+  }
+
+  const position_t& position(size_t rank) const {
+    return points.position[offset_t(rank + 1)];
+  }
+};
+
+template<typename TElement>
+bool emplace_cells(mesh_t& mesh, size_t count, generation_t& generation) {
+  auto* transaction = mesh.transaction();
+  for (size_t i = 0; i < count; ++i) {
+    auto index = transaction != nullptr ? transaction->emplace(TElement()) : mesh.kernel->emplace(TElement());
+    if (index.offset != i + 1) {
+      return false;
+    }
+    generation = index.generation;
+  }
+  return true;
+}
+
+/**
+   Reserves the result once and emplaces every cell it's going to need, in
+   order, so that ranks map straight onto offsets.
+ */
+bool prepare_target(mesh_t& mesh, mesh_t& result, target_t& target,
+                    size_t points, size_t faces, size_t edges) {
+  if (&mesh == &result) {
+    LOG(ERROR) << "Subdivision can't write into the mesh it reads from";
+    return false;
+  }
+  result.kernel->reserve(points, points, faces, edges);
+  if (!emplace_cells<point_t>(result, points, target.point_generation) ||
+      !emplace_cells<vertex_t>(result, points, target.vertex_generation) ||
+      !emplace_cells<face_t>(result, faces, target.face_generation) ||
+      !emplace_cells<edge_t>(result, edges, target.edge_generation)) {
+    LOG(ERROR) << "Subdivision needs an empty mesh to write into";
+    return false;
+  }
+  target.edges = result.kernel->edge_table();
+  target.faces = result.kernel->face_table();
+  target.vertices = result.kernel->vertex_table();
+  target.points = result.kernel->point_table();
+  // Every cell gets written, from several threads.
+  target.edges.make_writable();
+  target.faces.make_writable();
+  target.vertices.make_writable();
+  target.points.make_writable();
+  return true;
+}
+
+bool is_empty(const mesh_t& mesh) {
+  return mesh.point_count() == 0 && mesh.vertex_count() == 0 && mesh.face_count() == 0 && mesh.edge_count() == 0;
+}
+
+} // namespace
+
+bool subdivide_loop(mesh_t& mesh, mesh_t& result, size_t thread_count) {
+  if (!is_empty(result)) {
+    LOG(ERROR) << "Subdivision needs an empty mesh to write into";
+    return false;
+  }
+  source_t source(*mesh.kernel, thread_count);
+
+  std::atomic<size_t> polygons(0);
+  parallel_for(source.faces.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (is_active(source.faces, offset_t(offset))) {
+        auto first = source.faces.edge_index[offset];
+        auto third = source.edges.next_index[source.edges.next_index[first.offset].offset];
+        if (source.edges.next_index[third.offset] != first) {
+          polygons.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+  });
+  if (polygons.load() > 0) {
+    LOG(ERROR) << "Loop subdivision only takes triangles, found " << polygons.load() << " other faces";
+    return false;
+  }
+
+  // Every triangle becomes a triangle in each corner and one in the middle,
+  // which take edges 3i to 3i+2 and 9 to 11 of the twelve it gets.
+  const size_t even_count = source.vertex_count;
+  target_t target;
+  if (!prepare_target(mesh, result, target, even_count + source.pair_count,
+                      source.face_count * 4, source.face_count * 12)) {
+    return false;
+  }
+
+  parallel_for(source.faces.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.faces, offset_t(offset))) {
+        continue;
+      }
+      const size_t face = source.face_ranks[offset] * 4;
+      const size_t base = source.face_ranks[offset] * 12;
+      edge_index_t loop[3];
+      loop[0] = source.faces.edge_index[offset];
+      loop[1] = source.edges.next_index[loop[0].offset];
+      loop[2] = source.edges.next_index[loop[1].offset];
+      size_t midpoints[3];
+      for (size_t i = 0; i < 3; ++i) {
+        midpoints[i] = even_count + source.pair_rank(loop[i]);
+      }
+      for (size_t i = 0; i < 3; ++i) {
+        const size_t corner = base + 3 * i;
+        const size_t before = (i + 2) % 3;
+        target.set_edge(corner, source.vertex_ranks[source.edges.vertex_index[loop[i].offset].offset],
+                        face + i, corner + 1, corner + 2);
+        target.set_edge(corner + 1, midpoints[i], face + i, corner + 2, corner);
+        target.set_edge(corner + 2, midpoints[before], face + i, corner, corner + 1);
+        target.set_edge(base + 9 + i, midpoints[i], face + 3, base + 9 + (i + 1) % 3, base + 9 + before);
+        target.faces.edge_index.writable(target.face(face + i).offset) = target.edge(corner);
+
+        // The halves of an edge pair up with the opposite halves of its
+        // adjacent edge, the inner edges with the middle triangle.
+        auto adjacent = source.edges.adjacent_index[loop[i].offset];
+        const size_t second_half = base + 3 * ((i + 1) % 3) + 2;
+        if (source.has_adjacent(loop[i])) {
+          const size_t other = source.face_ranks[source.edges.face_index[adjacent.offset].offset] * 12;
+          const offset_t slot = source.slot(adjacent);
+          target.set_adjacent(corner, target.edge(other + 3 * ((slot + 1) % 3) + 2));
+          target.set_adjacent(second_half, target.edge(other + 3 * slot));
+        } else {
+          target.set_adjacent(corner, edge_index_t());
+          target.set_adjacent(second_half, edge_index_t());
+        }
+        target.set_adjacent(corner + 1, target.edge(base + 9 + before));
+        target.set_adjacent(base + 9 + before, target.edge(corner + 1));
+      }
+      target.faces.edge_index.writable(target.face(face + 3).offset) = target.edge(base + 9);
+    }
+  });
+
+  parallel_for(source.edges.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.edges, offset_t(offset)) || !source.is_pair_owner(offset_t(offset))) {
+        continue;
+      }
+      auto eindex = source.edge(offset_t(offset));
+      const auto a = source.corner(eindex);
+      const auto b = source.corner(source.edges.next_index[offset]);
+      position_t position = (a + b) * 0.5f;
+      if (source.has_adjacent(eindex)) {
+        const auto c = source.corner(source.edges.prev_index[offset]);
+        const auto d = source.corner(source.edges.prev_index[source.edges.adjacent_index[offset].offset]);
+        position = (a + b) * 0.375f + (c + d) * 0.125f;
+      }
+      const size_t base = source.face_ranks[source.edges.face_index[offset].offset] * 12;
+      target.set_vertex(even_count + source.pair_ranks[offset], position,
+                        target.edge(base + 3 * source.slot(eindex) + 1));
+    }
+  });
+
+  parallel_for(source.vertices.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.vertices, offset_t(offset))) {
+        continue;
+      }
+      vertex_index_t vindex(offset_t(offset), source.vertices.element[offset].generation);
+      const auto v = source.position(vindex);
+      position_t sum(0.f, 0.f, 0.f);
+      position_t ends(0.f, 0.f, 0.f);
+      bool boundary = false;
+      const size_t valence = source.walk_ring(vindex, boundary, ends, [&](edge_index_t eindex) {
+        sum += source.corner(source.edges.next_index[eindex.offset]);
+      });
+
+      position_t position = v;
+      edge_index_t eindex;
+      if (valence > 0) {
+        if (boundary) {
+          position = v * 0.75f + ends * 0.125f;
+        } else {
+          const float n = float(valence);
+          const float c = 0.375f + 0.25f * std::cos(two_pi / n);
+          const float beta = (0.625f - c * c) / n;
+          position = v * (1.f - n * beta) + sum * beta;
+        }
+        auto first = source.vertices.edge_index[offset];
+        eindex = target.edge(source.face_ranks[source.edges.face_index[first.offset].offset] * 12 +
+                             3 * source.slot(first));
+      }
+      target.set_vertex(source.vertex_ranks[offset], position, eindex);
+    }
+  });
+  return true;
+}
+
+bool subdivide_catmull_clark(mesh_t& mesh, mesh_t& result, size_t thread_count) {
+  if (!is_empty(result)) {
+    LOG(ERROR) << "Subdivision needs an empty mesh to write into";
+    return false;
+  }
+  source_t source(*mesh.kernel, thread_count);
+
+  // Every edge of a face leads the quad around its origin, which takes edges
+  // 4r to 4r+3 for the edge ranked r: corner to edge point, edge point to
+  // face point, face point to the previous edge point and back to the corner.
+  const size_t pair_base = source.vertex_count;
+  const size_t face_base = pair_base + source.pair_count;
+  target_t target;
+  if (!prepare_target(mesh, result, target, face_base + source.face_count,
+                      source.edge_count, source.edge_count * 4)) {
+    return false;
+  }
+
+  parallel_for(source.faces.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.faces, offset_t(offset))) {
+        continue;
+      }
+      auto first = source.faces.edge_index[offset];
+      position_t sum(0.f, 0.f, 0.f);
+      size_t corners = 0;
+      auto eindex = first;
+      do {
+        sum += source.corner(eindex);
+        ++corners;
+        eindex = source.edges.next_index[eindex.offset];
+      } while (eindex != first && corners < source.edges.size);
+      target.set_vertex(face_base + source.face_ranks[offset], sum / float(corners),
+                        target.edge(source.edge_ranks[first.offset] * 4 + 2));
+    }
+  });
+
+  parallel_for(source.edges.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.edges, offset_t(offset))) {
+        continue;
+      }
+      auto eindex = source.edge(offset_t(offset));
+      auto next = source.edges.next_index[offset];
+      auto prev = source.edges.prev_index[offset];
+      const size_t quad = source.edge_ranks[offset] * 4;
+      const size_t face = face_base + source.face_ranks[source.edges.face_index[offset].offset];
+      const size_t midpoint = pair_base + source.pair_rank(eindex);
+      const size_t previous_midpoint = pair_base + source.pair_rank(prev);
+      const size_t rank = source.edge_ranks[offset];
+
+      target.set_edge(quad, source.vertex_ranks[source.edges.vertex_index[offset].offset], rank, quad + 1, quad + 3);
+      target.set_edge(quad + 1, midpoint, rank, quad + 2, quad);
+      target.set_edge(quad + 2, face, rank, quad + 3, quad + 1);
+      target.set_edge(quad + 3, previous_midpoint, rank, quad, quad + 2);
+      target.faces.edge_index.writable(target.face(rank).offset) = target.edge(quad);
+
+      auto adjacent = source.edges.adjacent_index[offset];
+      auto prev_adjacent = source.edges.adjacent_index[prev.offset];
+      target.set_adjacent(quad, source.has_adjacent(eindex)
+        ? target.edge(source.edge_ranks[source.edges.next_index[adjacent.offset].offset] * 4 + 3)
+        : edge_index_t());
+      target.set_adjacent(quad + 1, target.edge(source.edge_ranks[next.offset] * 4 + 2));
+      target.set_adjacent(quad + 2, target.edge(source.edge_ranks[prev.offset] * 4 + 1));
+      target.set_adjacent(quad + 3, source.has_adjacent(prev)
+        ? target.edge(source.edge_ranks[prev_adjacent.offset] * 4)
+        : edge_index_t());
+    }
+  });
+
+  // Edge points need the face points in place, vertices both.
+  parallel_for(source.edges.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.edges, offset_t(offset)) || !source.is_pair_owner(offset_t(offset))) {
+        continue;
+      }
+      auto eindex = source.edge(offset_t(offset));
+      const auto a = source.corner(eindex);
+      const auto b = source.corner(source.edges.next_index[offset]);
+      position_t position = (a + b) * 0.5f;
+      if (source.has_adjacent(eindex)) {
+        auto adjacent = source.edges.adjacent_index[offset];
+        const size_t f0 = face_base + source.face_ranks[source.edges.face_index[offset].offset];
+        const size_t f1 = face_base + source.face_ranks[source.edges.face_index[adjacent.offset].offset];
+        position = (a + b + target.position(f0) + target.position(f1)) * 0.25f;
+      }
+      target.set_vertex(pair_base + source.pair_ranks[offset], position,
+                        target.edge(source.edge_ranks[offset] * 4 + 1));
+    }
+  });
+
+  parallel_for(source.vertices.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (!is_active(source.vertices, offset_t(offset))) {
+        continue;
+      }
+      vertex_index_t vindex(offset_t(offset), source.vertices.element[offset].generation);
+      const auto v = source.position(vindex);
+      position_t face_sum(0.f, 0.f, 0.f);
+      position_t edge_sum(0.f, 0.f, 0.f);
+      position_t ends(0.f, 0.f, 0.f);
+      bool boundary = false;
+      const size_t valence = source.walk_ring(vindex, boundary, ends, [&](edge_index_t eindex) {
+        const size_t face = face_base + source.face_ranks[source.edges.face_index[eindex.offset].offset];
+        face_sum += target.position(face);
+        edge_sum += (v + source.corner(source.edges.next_index[eindex.offset])) * 0.5f;
+      });
+
+      position_t position = v;
+      edge_index_t eindex;
+      if (valence > 0) {
+        if (boundary) {
+          position = v * 0.75f + ends * 0.125f;
+        } else {
+          const float n = float(valence);
+          position = (face_sum / n + edge_sum * (2.f / n) + v * (n - 3.f)) / n;
+        }
+        eindex = target.edge(source.edge_ranks[source.vertices.edge_index[offset].offset] * 4);
+      }
+      target.set_vertex(source.vertex_ranks[offset], position, eindex);
+    }
+  });
+  return true;
+}
+
+} // namespace hedge
@@ -3,7 +3,20 @@
 #include <catch.hpp>
 #include <easylogging++.h>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+
 #include "hedge.hpp"
+#include "hedge_kernel.hpp"
+#include "hedge_parallel.hpp"
 
 INITIALIZE_EASYLOGGINGPP;
 
@@ -32,6 +45,27 @@ TEST_CASE( "An index can be compared with other indexes of the same type.", "[in
   REQUIRE(e2 < e3);
 }
 
+#if defined(HEDGE_COMPACT_INDEX)
+TEST_CASE( "Compact indices pack the offset and generation into 32 bits.", "[index_types]") {
+  REQUIRE(sizeof(hedge::edge_index_t) == 4);
+  REQUIRE(sizeof(hedge::edge_t) == sizeof(hedge::element_t) + 5 * 4);
+  REQUIRE(sizeof(hedge::vertex_t) == sizeof(hedge::element_t) + 2 * 4);
+
+  hedge::mesh_t mesh;
+  auto pindex = mesh.add_point(0.f, 0.f, 0.f);
+
+  // Recycle the cell past the point where the packed generation wraps.
+  for (int i = 0; i < (1 << HEDGE_INDEX_GENERATION_BITS) + 3; ++i) {
+    auto stale = pindex;
+    mesh.kernel->remove(pindex);
+    pindex = mesh.add_point(1.f, 0.f, 0.f);
+    REQUIRE(pindex.offset == stale.offset);
+    REQUIRE_FALSE(mesh.kernel->get(stale));
+    REQUIRE(mesh.kernel->get(pindex));
+  }
+}
+#endif
+
 TEST_CASE( "Edges can be created and updated.", "[edges]") {
   hedge::edge_t edge;
   hedge::vertex_index_t vert(3, 0);
@@ -109,8 +143,9 @@ TEST_CASE( "Removing an element doesn't invalidate other cells", "[kernel_operat
   REQUIRE(p->position.y == 1.f);
   REQUIRE(p->position.z == 1.f);
 
-  REQUIRE(pindex1.offset == 3);
-  REQUIRE(pindex2.offset == 2);
+  // The most recently freed cell is the first one to be reused.
+  REQUIRE(pindex1.offset == 2);
+  REQUIRE(pindex2.offset == 3);
 }
 
 SCENARIO( "Essential kernel operations allow you to create a triangle.", "[kernel_operations]" ) {
@@ -245,3 +280,2817 @@ TEST_CASE( "High level mesh api can easily add geometry", "[mesh_operations]" )
   REQUIRE(edge.next().next().index().offset == 3);
   REQUIRE(edge.prev().index().offset == 3);
 }
+
+TEST_CASE( "A mesh can be created with a structure-of-arrays kernel", "[soa_kernel]" ) {
+  hedge::mesh_t mesh(hedge::make_soa_kernel());
+
+  REQUIRE(mesh.kernel->edge_count() == 1);
+  REQUIRE(mesh.point_count() == 0);
+
+  auto findex0 = mesh.add_triangle(
+    hedge::point_t(0.f, 0.f, 0.f),
+    hedge::point_t(1.f, 0.f, 0.f),
+    hedge::point_t(0.f, 1.f, 0.f)
+    );
+
+  REQUIRE(mesh.edge_count() == 3);
+  REQUIRE(mesh.point_count() == 3);
+  REQUIRE(mesh.vertex_count() == 3);
+  REQUIRE(mesh.face_count() == 1);
+
+  // There are no edge structures to hand out, only the columns.
+  auto edge = mesh.face(findex0).edge();
+  REQUIRE(edge);
+  REQUIRE(edge.element() == nullptr);
+  REQUIRE(edge.is_boundary());
+  REQUIRE(edge.index().offset == 1);
+  REQUIRE(edge.next().index().offset == 2);
+  REQUIRE(edge.next().next().index().offset == 3);
+  REQUIRE(edge.prev().index().offset == 3);
+  REQUIRE(edge.face().index() == findex0);
+
+  auto edges = mesh.kernel->edge_table();
+  REQUIRE(edges.size == 4);
+  REQUIRE(edges.next_index.stride() == sizeof(hedge::edge_index_t));
+  REQUIRE(edges.next_index[1].offset == 2);
+
+  auto* p1 = edge.next().vertex().point();
+  REQUIRE(p1 != nullptr);
+  REQUIRE(p1->position.x == 1.f);
+  REQUIRE(p1->position.y == 0.f);
+}
+
+TEST_CASE( "The structure-of-arrays kernel recycles removed cells", "[soa_kernel]" ) {
+  hedge::mesh_t mesh(hedge::make_soa_kernel());
+
+  auto eindex0 = mesh.kernel->emplace(hedge::edge_t());
+  auto eindex1 = mesh.kernel->emplace(hedge::edge_t());
+  REQUIRE(mesh.edge_count() == 2);
+
+  mesh.kernel->remove(eindex0);
+  REQUIRE(mesh.edge_count() == 1);
+  REQUIRE_FALSE(mesh.edge(eindex0));
+  REQUIRE(mesh.edge(eindex1));
+
+  hedge::edge_t edge;
+  edge.next_index = eindex1;
+  auto eindex2 = mesh.kernel->emplace(std::move(edge));
+  REQUIRE(eindex2.offset == eindex0.offset);
+  REQUIRE(eindex2.generation == 1);
+  REQUIRE(mesh.edge(eindex2).next().index() == eindex1);
+
+  // Out of range indices resolve to nothing and keep their generation.
+  hedge::edge_index_t stale(99, 7);
+  hedge::edge_t* resolved = &edge;
+  mesh.kernel->resolve(&stale, &resolved);
+  REQUIRE(resolved == nullptr);
+  REQUIRE(stale.generation == 7);
+  REQUIRE(mesh.point(99) == nullptr);
+}
+
+template<typename TKernel>
+void check_typed_mesh_traversal() {
+  hedge::basic_mesh_t<TKernel> mesh;
+
+  auto findex0 = mesh.add_triangle(
+    hedge::point_t(0.f, 0.f, 0.f),
+    hedge::point_t(1.f, 0.f, 0.f),
+    hedge::point_t(0.f, 1.f, 0.f)
+    );
+  REQUIRE(mesh.face_count() == 1);
+
+  auto edge = mesh.face(findex0).edge();
+  static_assert(std::is_same<decltype(edge), hedge::basic_edge_fn_t<TKernel>>::value,
+                "Function sets from a typed mesh should be bound to the concrete kernel");
+  REQUIRE(edge);
+  REQUIRE(edge.is_boundary());
+  REQUIRE(edge.index().offset == 1);
+  REQUIRE(edge.next().index().offset == 2);
+  REQUIRE(edge.next().next().next().index() == edge.index());
+  REQUIRE(edge.prev().index().offset == 3);
+  REQUIRE(edge.face().index() == findex0);
+
+  auto* p1 = edge.next().vertex().point();
+  REQUIRE(p1 != nullptr);
+  REQUIRE(p1->position.x == 1.f);
+
+  // The type erased function sets see the same mesh.
+  hedge::mesh_t& erased = mesh;
+  REQUIRE(erased.face(findex0).edge().next().index() == edge.next().index());
+}
+
+TEST_CASE( "A typed mesh traverses a basic kernel without the kernel_t facade", "[typed_mesh]" ) {
+  check_typed_mesh_traversal<hedge::basic_kernel_t<>>();
+}
+
+TEST_CASE( "A typed mesh traverses a structure-of-arrays kernel without the kernel_t facade", "[typed_mesh]" ) {
+  check_typed_mesh_traversal<hedge::soa_kernel_t<>>();
+}
+
+TEST_CASE( "Silent validation counts rejected indices instead of logging them", "[validation]" ) {
+  hedge::mesh_t mesh(hedge::make_basic_kernel(hedge::validation_t::checked_silent));
+  REQUIRE(mesh.kernel->validation() == hedge::validation_t::checked_silent);
+
+  auto findex0 = mesh.add_triangle(
+    hedge::point_t(0.f, 0.f, 0.f),
+    hedge::point_t(1.f, 0.f, 0.f),
+    hedge::point_t(0.f, 1.f, 0.f)
+    );
+
+  auto& counters = mesh.kernel->validation_counters();
+  auto edge = mesh.face(findex0).edge();
+  REQUIRE(edge.is_boundary());
+  REQUIRE(counters.generation_mismatches == 0);
+  REQUIRE(counters.empty_function_sets == 0);
+
+  auto pindex = mesh.add_point(0.f, 0.f, 1.f);
+  mesh.kernel->remove(pindex);
+  REQUIRE_FALSE(mesh.kernel->get(pindex));
+  REQUIRE(counters.generation_mismatches == 1);
+
+  auto stale = hedge::edge_index_t(edge.index().offset, 7);
+  REQUIRE_FALSE(mesh.edge(stale).next());
+  REQUIRE(counters.generation_mismatches == 2);
+  REQUIRE(counters.empty_function_sets == 1);
+
+  REQUIRE_FALSE(mesh.kernel->get(hedge::edge_index_t(100)));
+  REQUIRE(counters.invalid_offsets == 1);
+}
+
+TEST_CASE( "Unchecked kernels trust the indices they are given", "[validation]" ) {
+  hedge::basic_mesh_t<hedge::soa_kernel_t<hedge::validation_t::unchecked>> mesh;
+
+  auto findex0 = mesh.add_triangle(
+    hedge::point_t(0.f, 0.f, 0.f),
+    hedge::point_t(1.f, 0.f, 0.f),
+    hedge::point_t(0.f, 1.f, 0.f)
+    );
+
+  auto edge = mesh.face(findex0).edge();
+  REQUIRE(edge.next().next().next().index() == edge.index());
+  REQUIRE(edge.is_boundary());
+
+  // Removal still refuses stale indices.
+  auto pindex = mesh.add_point(0.f, 0.f, 1.f);
+  mesh.kernel->remove(pindex);
+  mesh.kernel->remove(pindex);
+  REQUIRE(mesh.point_count() == 3);
+
+  auto& counters = mesh.kernel->validation_counters();
+  REQUIRE(counters.generation_mismatches == 0);
+  REQUIRE(counters.invalid_offsets == 0);
+}
+
+SCENARIO( "Meshes can be built from indexed polygon buffers.", "[mesh_operations]" ) {
+  GIVEN("A quad split into two triangles next to a quad face.") {
+    //  3---2---5
+    //  | \ |   |
+    //  0---1---4
+    std::vector<hedge::position_t> positions = {
+      { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 1.f, 1.f, 0.f },
+      { 0.f, 1.f, 0.f }, { 2.f, 0.f, 0.f }, { 2.f, 1.f, 0.f }
+    };
+    std::vector<uint32_t> indices = { 0, 1, 3,  1, 2, 3,  1, 4, 5, 2 };
+    std::vector<uint32_t> face_sizes = { 3, 3, 4 };
+
+    auto check = [](hedge::mesh_t& mesh) {
+      REQUIRE(mesh.point_count() == 6);
+      REQUIRE(mesh.vertex_count() == 6);
+      REQUIRE(mesh.edge_count() == 10);
+      REQUIRE(mesh.face_count() == 3);
+
+      auto quad = mesh.face(hedge::face_index_t(3));
+      auto edge = quad.edge();
+      REQUIRE(edge.next().next().next().next().index() == edge.index());
+      REQUIRE(edge.prev().prev().prev().prev().index() == edge.index());
+      REQUIRE(edge.face().index() == quad.index());
+
+      // The diagonal and the edge between the triangle and quad are shared.
+      size_t interior = 0;
+      for (hedge::offset_t offset = 1; offset <= 10; ++offset) {
+        auto e = mesh.edge(hedge::edge_index_t(offset));
+        if (!e.is_boundary()) {
+          ++interior;
+          REQUIRE(e.adjacent().adjacent().index() == e.index());
+          auto points = mesh.points(e.index());
+          auto adjacent_points = mesh.points(e.adjacent().index());
+          REQUIRE(points.first == adjacent_points.second);
+          REQUIRE(points.second == adjacent_points.first);
+        }
+      }
+      REQUIRE(interior == 4);
+    };
+
+    WHEN("The mesh uses the basic kernel") {
+      hedge::mesh_t mesh;
+      REQUIRE(mesh.build_from_indexed(positions, indices, face_sizes));
+      THEN("Every face loop and shared edge is linked") {
+        check(mesh);
+      }
+    }
+
+    WHEN("The mesh uses the structure-of-arrays kernel") {
+      hedge::mesh_t mesh(hedge::make_soa_kernel());
+      REQUIRE(mesh.build_from_indexed(positions, indices, face_sizes));
+      THEN("Every face loop and shared edge is linked") {
+        check(mesh);
+      }
+    }
+
+    WHEN("The buffers are inconsistent") {
+      hedge::mesh_t mesh;
+      THEN("Nothing is added to the mesh") {
+        REQUIRE_FALSE(mesh.build_from_indexed(positions, indices, { 3, 3, 3 }));
+        REQUIRE_FALSE(mesh.build_from_indexed(positions, { 0, 1, 6 }));
+        REQUIRE_FALSE(mesh.build_from_indexed(positions, { 0, 1 }));
+        REQUIRE(mesh.point_count() == 0);
+        REQUIRE(mesh.face_count() == 0);
+      }
+    }
+  }
+}
+
+TEST_CASE( "Adjacent edges can be linked after the fact", "[link_adjacent_edges]" ) {
+  hedge::mesh_t mesh;
+  auto p0 = mesh.add_point(0.f, 0.f, 0.f);
+  auto p1 = mesh.add_point(1.f, 0.f, 0.f);
+  auto p2 = mesh.add_point(1.f, 1.f, 0.f);
+  auto p3 = mesh.add_point(0.f, 1.f, 0.f);
+
+  auto findex0 = mesh.add_triangle(p0, p1, p3);
+  auto findex1 = mesh.add_triangle(p1, p2, p3);
+
+  auto diagonal = mesh.face(findex0).edge().next();
+  REQUIRE(diagonal.is_boundary());
+
+  auto report = hedge::link_adjacent_edges(mesh);
+  REQUIRE(report.linked_pairs == 1);
+  REQUIRE(report.boundary_edges == 4);
+  REQUIRE(report.non_manifold_edges.empty());
+
+  REQUIRE_FALSE(diagonal.is_boundary());
+  REQUIRE(diagonal.adjacent().face().index() == findex1);
+  REQUIRE(diagonal.adjacent().adjacent().index() == diagonal.index());
+
+  // A third face on the diagonal makes it non-manifold rather than
+  // overwriting the existing link.
+  auto p4 = mesh.add_point(1.f, 1.f, 1.f);
+  mesh.add_triangle(p1, p3, p4);
+  report = hedge::link_adjacent_edges(mesh);
+  REQUIRE(report.linked_pairs == 0);
+  REQUIRE(report.non_manifold_edges.size() == 3);
+  REQUIRE(diagonal.is_boundary());
+}
+
+TEST_CASE( "Linking adjacent edges inside a transaction can be undone", "[link_adjacent_edges]" ) {
+  hedge::mesh_t mesh;
+  auto p0 = mesh.add_point(0.f, 0.f, 0.f);
+  auto p1 = mesh.add_point(1.f, 0.f, 0.f);
+  auto p2 = mesh.add_point(1.f, 1.f, 0.f);
+  auto p3 = mesh.add_point(0.f, 1.f, 0.f);
+  auto findex0 = mesh.add_triangle(p0, p1, p3);
+  mesh.add_triangle(p1, p2, p3);
+
+  auto diagonal = mesh.face(findex0).edge().next();
+  REQUIRE(diagonal.is_boundary());
+
+  hedge::mesh_delta_t delta;
+  {
+    hedge::transaction_t transaction(mesh);
+    REQUIRE(hedge::link_adjacent_edges(mesh).linked_pairs == 1);
+    delta = transaction.commit();
+  }
+  REQUIRE_FALSE(diagonal.is_boundary());
+  REQUIRE_FALSE(delta.empty());
+
+  REQUIRE(delta.undo(mesh));
+  for (auto eindex : mesh.edges()) {
+    REQUIRE(mesh.edge(eindex).is_boundary());
+  }
+  REQUIRE(delta.redo(mesh));
+  REQUIRE(diagonal.adjacent().adjacent().index() == diagonal.index());
+}
+
+TEST_CASE( "Triangles can be added onto boundary edges", "[mesh_operations]" ) {
+  hedge::mesh_t mesh;
+  auto findex0 = mesh.add_triangle(
+    hedge::point_t(0.f, 0.f, 0.f),
+    hedge::point_t(1.f, 0.f, 0.f),
+    hedge::point_t(0.f, 1.f, 0.f)
+    );
+  auto edge = mesh.face(findex0).edge().next();
+  auto pindex = mesh.add_point(1.f, 1.f, 0.f);
+
+  auto findex1 = mesh.add_triangle(edge.index(), pindex);
+  REQUIRE(findex1);
+  REQUIRE(mesh.face_count() == 2);
+  REQUIRE_FALSE(edge.is_boundary());
+  REQUIRE(edge.adjacent().face().index() == findex1);
+
+  auto points = mesh.points(edge.index());
+  auto adjacent_points = mesh.points(edge.adjacent().index());
+  REQUIRE(points.first == adjacent_points.second);
+  REQUIRE(points.second == adjacent_points.first);
+
+  REQUIRE_FALSE(mesh.add_triangle(edge.index(), pindex));
+}
+
+namespace {
+
+/**
+   The points of a grid of size by size unit squares, lifted into a wave when
+   wavy, and the indices of the two triangles each square is split into.
+ */
+std::vector<hedge::position_t> grid_positions(uint32_t size, bool wavy) {
+  std::vector<hedge::position_t> positions;
+  for (uint32_t y = 0; y <= size; ++y) {
+    for (uint32_t x = 0; x <= size; ++x) {
+      positions.emplace_back(float(x), float(y), wavy ? std::sin(x * 0.7f) * std::cos(y * 0.3f) : 0.f);
+    }
+  }
+  return positions;
+}
+
+std::vector<uint32_t> grid_indices(uint32_t size) {
+  std::vector<uint32_t> indices;
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      uint32_t i = y * (size + 1) + x;
+      indices.insert(indices.end(), { i, i + 1, i + size + 2, i, i + size + 2, i + size + 1 });
+    }
+  }
+  return indices;
+}
+
+template<typename TMesh>
+void build_grid(TMesh& mesh, uint32_t size, bool wavy = false) {
+  REQUIRE(mesh.build_from_indexed(grid_positions(size, wavy), grid_indices(size)));
+}
+
+template<typename TMesh>
+void build_wavy_grid(TMesh& mesh, uint32_t size) {
+  build_grid(mesh, size, true);
+}
+
+} // namespace
+
+TEST_CASE( "Linking adjacent edges gives the same result on any number of threads", "[link_adjacent_edges]" ) {
+  const uint32_t size = 40;
+  hedge::mesh_t mesh;
+  build_grid(mesh, size);
+
+  auto edges = mesh.kernel->edge_table();
+  auto adjacent = [&edges]() {
+    std::vector<hedge::edge_index_t> result;
+    for (size_t offset = 1; offset < edges.size; ++offset) {
+      result.push_back(edges.adjacent_index[offset]);
+    }
+    return result;
+  };
+
+  auto single = hedge::link_adjacent_edges(mesh, 1);
+  auto single_adjacent = adjacent();
+
+  auto multi = hedge::link_adjacent_edges(mesh, 7);
+  REQUIRE(single.linked_pairs == multi.linked_pairs);
+  REQUIRE(single.boundary_edges == multi.boundary_edges);
+  REQUIRE(single.linked_pairs == (3 * size * size - 2 * size));
+  REQUIRE(single.boundary_edges == 4 * size);
+  REQUIRE(single_adjacent == adjacent());
+}
+
+TEST_CASE( "Element ranges visit every active element and skip removed cells", "[ranges]" ) {
+  hedge::mesh_t mesh;
+  REQUIRE(mesh.faces().empty());
+
+  std::vector<hedge::point_index_t> pindices;
+  for (int i = 0; i < 10; ++i) {
+    pindices.push_back(mesh.add_point(float(i), 0.f, 0.f));
+  }
+
+  auto points = mesh.points();
+  REQUIRE(std::distance(points.begin(), points.end()) == 10);
+  REQUIRE(*points.begin() == pindices[0]);
+  REQUIRE(*std::prev(points.end()) == pindices[9]);
+
+  mesh.kernel->remove(pindices[0]);
+  mesh.kernel->remove(pindices[3]);
+  mesh.kernel->remove(pindices[4]);
+  mesh.kernel->remove(pindices[9]);
+
+  std::vector<hedge::point_index_t> visited;
+  for (auto pindex : mesh.points()) {
+    REQUIRE(mesh.point(pindex) != nullptr);
+    visited.push_back(pindex);
+  }
+  REQUIRE(visited.size() == mesh.point_count());
+  REQUIRE(visited.front() == pindices[1]);
+  REQUIRE(visited.back() == pindices[8]);
+  REQUIRE(std::count(visited.begin(), visited.end(), pindices[3]) == 0);
+
+  // Slicing the range anywhere still covers each element exactly once.
+  points = mesh.points();
+  REQUIRE(points.cells() == 10);
+  for (size_t cut = 0; cut <= points.cells(); ++cut) {
+    auto head = points.slice(0, cut);
+    auto tail = points.slice(cut, points.cells());
+    std::vector<hedge::point_index_t> joined(head.begin(), head.end());
+    joined.insert(joined.end(), tail.begin(), tail.end());
+    REQUIRE(joined == visited);
+  }
+
+  // Walking backwards stops at the first active cell, past removed leading
+  // ones and the reserved first cell.
+  std::vector<hedge::point_index_t> reversed(visited.rbegin(), visited.rend());
+  std::vector<hedge::point_index_t> backwards(std::reverse_iterator<decltype(points.end())>(points.end()),
+                                              std::reverse_iterator<decltype(points.begin())>(points.begin()));
+  REQUIRE(backwards == reversed);
+  for (size_t cut = 0; cut <= points.cells(); ++cut) {
+    auto tail = points.slice(cut, points.cells());
+    std::vector<hedge::point_index_t> forwards(tail.begin(), tail.end());
+    backwards.clear();
+    for (auto it = tail.end(); it != tail.begin();) {
+      --it;
+      REQUIRE(mesh.point(*it) != nullptr);
+      backwards.push_back(*it);
+    }
+    REQUIRE(std::equal(forwards.rbegin(), forwards.rend(), backwards.begin(), backwards.end()));
+  }
+  auto first = points.begin();
+  REQUIRE(--first == points.begin());
+  REQUIRE(*first == pindices[1]);
+
+  std::atomic<size_t> parallel_visits(0);
+  hedge::parallel_for_each(mesh.points(), 3, [&](hedge::point_index_t pindex) {
+    if (mesh.kernel->get(pindex) != nullptr) {
+      parallel_visits++;
+    }
+  });
+  REQUIRE(parallel_visits == visited.size());
+
+  // Recycled cells show up again with their new generation.
+  auto pindex = mesh.add_point(0.f, 0.f, 1.f);
+  REQUIRE(pindex.offset == pindices[9].offset);
+  REQUIRE(*std::prev(mesh.points().end()) == pindex);
+}
+
+TEST_CASE( "Element ranges work on the faces, edges and vertices of a mesh", "[ranges]" ) {
+  hedge::mesh_t mesh(hedge::make_soa_kernel());
+  std::vector<hedge::position_t> positions = {
+    { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 1.f, 1.f, 0.f }, { 0.f, 1.f, 0.f }
+  };
+  REQUIRE(mesh.build_from_indexed(positions, { 0, 1, 3, 1, 2, 3 }));
+
+  size_t boundary = 0;
+  std::for_each(mesh.edges().begin(), mesh.edges().end(), [&](hedge::edge_index_t eindex) {
+    boundary += mesh.edge(eindex).is_boundary() ? 1 : 0;
+  });
+  REQUIRE(boundary == 4);
+
+  std::set<hedge::offset_t> faces;
+  for (auto findex : mesh.faces()) {
+    auto edge = mesh.face(findex).edge();
+    REQUIRE(edge.face().index() == findex);
+    faces.insert(findex.offset);
+  }
+  REQUIRE(faces.size() == 2);
+
+  size_t vertices = 0;
+  for (auto vindex : mesh.vertices()) {
+    REQUIRE(mesh.vertex(vindex).point() != nullptr);
+    ++vertices;
+  }
+  REQUIRE(vertices == 4);
+}
+
+template<typename TKernel>
+void check_grid_circulators() {
+  const uint32_t size = 4;
+  hedge::basic_mesh_t<TKernel> mesh;
+  build_grid(mesh, size);
+
+  for (auto findex : mesh.faces()) {
+    size_t count = 0;
+    for (auto eindex : mesh.face(findex).edges()) {
+      REQUIRE(mesh.edge(eindex).face().index() == findex);
+      ++count;
+    }
+    REQUIRE(count == 3);
+    std::set<hedge::offset_t> vertices;
+    for (auto vindex : mesh.face(findex).vertices()) {
+      vertices.insert(vindex.offset);
+    }
+    REQUIRE(vertices.size() == 3);
+  }
+
+  // Every vertex ring has to match a brute force search for its outgoing edges,
+  // including the rings that stop at the boundary.
+  size_t interior = 0;
+  for (auto vindex : mesh.vertices()) {
+    std::set<hedge::offset_t> expected;
+    for (auto eindex : mesh.edges()) {
+      if (mesh.edge(eindex).vertex().index() == vindex) {
+        expected.insert(eindex.offset);
+      }
+    }
+
+    std::set<hedge::offset_t> outgoing;
+    size_t steps = 0;
+    for (auto eindex : mesh.vertex(vindex).outgoing_edges()) {
+      outgoing.insert(eindex.offset);
+      ++steps;
+    }
+    REQUIRE(steps == outgoing.size());
+    REQUIRE(outgoing == expected);
+
+    size_t faces = 0;
+    for (auto findex : mesh.vertex(vindex).faces()) {
+      REQUIRE(findex);
+      ++faces;
+    }
+    REQUIRE(faces == expected.size());
+
+    if (expected.size() == 6) {
+      ++interior;
+    }
+  }
+  REQUIRE(interior == (size - 1) * (size - 1));
+
+  size_t boundary = 0;
+  for (auto eindex : mesh.edges()) {
+    auto range = mesh.edge(eindex).faces();
+    auto faces = std::distance(range.begin(), range.end());
+    REQUIRE(*range.begin() == mesh.edge(eindex).face().index());
+    if (faces == 1) {
+      REQUIRE(mesh.edge(eindex).is_boundary());
+      ++boundary;
+    }
+    else {
+      REQUIRE(faces == 2);
+    }
+  }
+  REQUIRE(boundary == 4 * size);
+}
+
+TEST_CASE( "Circulators walk around faces, vertices and edges of a basic kernel", "[circulators]" ) {
+  check_grid_circulators<hedge::basic_kernel_t<>>();
+}
+
+TEST_CASE( "Circulators walk around faces, vertices and edges of a structure-of-arrays kernel", "[circulators]" ) {
+  check_grid_circulators<hedge::soa_kernel_t<>>();
+}
+
+TEST_CASE( "Circulators over missing elements are empty", "[circulators]" ) {
+  hedge::mesh_t mesh;
+  REQUIRE(mesh.face(hedge::face_index_t()).edges().empty());
+  REQUIRE(mesh.vertex(hedge::vertex_index_t()).outgoing_edges().empty());
+  REQUIRE(mesh.edge(hedge::edge_index_t()).faces().empty());
+
+  auto vindex = mesh.kernel->emplace(hedge::vertex_t());
+  auto range = mesh.vertex(vindex).faces();
+  REQUIRE(range.begin() == range.end());
+}
+
+TEST_CASE( "Face areas and normals are computed for single faces and in batches", "[geometry]" ) {
+  hedge::mesh_t mesh;
+  std::vector<hedge::position_t> positions = {
+    { 0.f, 0.f, 0.f }, { 2.f, 0.f, 0.f }, { 2.f, 1.f, 0.f }, { 0.f, 1.f, 0.f },
+    { 2.f, 0.f, -1.f }, { 2.f, 1.f, -1.f }
+  };
+  REQUIRE(mesh.build_from_indexed(positions, { 0, 1, 2, 3, 1, 4, 5, 1, 5, 2 }, { 4, 3, 3 }));
+
+  std::vector<hedge::face_index_t> faces(mesh.faces().begin(), mesh.faces().end());
+  REQUIRE(faces.size() == 3);
+  REQUIRE(mesh.face(faces[0]).area() == Approx(2.f));
+  REQUIRE(mesh.face(faces[1]).area() == Approx(0.5f));
+  REQUIRE(mesh.face(faces[2]).area() == Approx(0.5f));
+  REQUIRE(mesh.face(faces[0]).normal().z == Approx(1.f));
+  REQUIRE(mesh.face(faces[1]).normal().x == Approx(1.f));
+  REQUIRE(mesh.face(hedge::face_index_t()).area() == 0.f);
+
+  const size_t face_cells = mesh.kernel->face_table().size;
+  std::vector<float> areas(face_cells, -1.f);
+  std::vector<hedge::position_t> normals(face_cells);
+  hedge::compute_face_areas(mesh, areas.data());
+  hedge::compute_face_normals(mesh, normals.data());
+  REQUIRE(areas[0] == 0.f);
+  for (auto findex : faces) {
+    auto normal = mesh.face(findex).normal();
+    REQUIRE(areas[findex.offset] == Approx(mesh.face(findex).area()));
+    REQUIRE(normals[findex.offset].x == Approx(normal.x));
+    REQUIRE(normals[findex.offset].y == Approx(normal.y));
+    REQUIRE(normals[findex.offset].z == Approx(normal.z));
+  }
+
+  mesh.kernel->remove(faces[1]);
+  hedge::compute_face_areas(mesh, areas.data());
+  REQUIRE(areas[faces[1].offset] == 0.f);
+  REQUIRE(areas[faces[2].offset] == Approx(0.5f));
+}
+
+TEST_CASE( "Batched normals match the per face results on a deformed grid", "[geometry]" ) {
+  hedge::basic_mesh_t<hedge::soa_kernel_t<>> mesh;
+  build_wavy_grid(mesh, 13);
+
+  std::vector<hedge::position_t> face_normals(mesh.kernel->face_table().size);
+  hedge::compute_face_normals(mesh, face_normals.data(), 3);
+  for (auto findex : mesh.faces()) {
+    auto normal = mesh.face(findex).normal();
+    REQUIRE(face_normals[findex.offset].x == Approx(normal.x).margin(1e-5));
+    REQUIRE(face_normals[findex.offset].y == Approx(normal.y).margin(1e-5));
+    REQUIRE(face_normals[findex.offset].z == Approx(normal.z).margin(1e-5));
+  }
+
+  std::vector<hedge::position_t> vertex_normals(mesh.kernel->vertex_table().size);
+  hedge::compute_vertex_normals(mesh, vertex_normals.data(), 3);
+  for (auto vindex : mesh.vertices()) {
+    hedge::position_t expected(0.f, 0.f, 0.f);
+    for (auto findex : mesh.vertex(vindex).faces()) {
+      expected += mesh.face(findex).normal() * mesh.face(findex).area();
+    }
+    expected.Normalize();
+    REQUIRE(vertex_normals[vindex.offset].x == Approx(expected.x).margin(1e-5));
+    REQUIRE(vertex_normals[vindex.offset].y == Approx(expected.y).margin(1e-5));
+    REQUIRE(vertex_normals[vindex.offset].z == Approx(expected.z).margin(1e-5));
+  }
+}
+
+template<typename TKernel>
+void check_compaction() {
+  const uint32_t size = 4;
+  const auto positions = grid_positions(size, false);
+  const auto indices = grid_indices(size);
+
+  hedge::basic_mesh_t<TKernel> mesh;
+  // Leave holes at the front of the point storage.
+  std::vector<hedge::point_index_t> scratch;
+  for (int i = 0; i < 5; ++i) {
+    scratch.push_back(mesh.add_point(-1.f, -1.f, -1.f));
+  }
+  REQUIRE(mesh.build_from_indexed(positions, indices));
+  for (auto pindex : scratch) {
+    mesh.kernel->remove(pindex);
+  }
+
+  // Take out one face and its edges, the edges next to it become boundaries.
+  std::vector<hedge::face_index_t> faces(mesh.faces().begin(), mesh.faces().end());
+  auto removed_face = faces[7];
+  std::vector<hedge::edge_index_t> removed_edges;
+  for (auto eindex : mesh.face(removed_face).edges()) {
+    removed_edges.push_back(eindex);
+  }
+  for (auto eindex : removed_edges) {
+    mesh.kernel->remove(eindex);
+  }
+  mesh.kernel->remove(removed_face);
+
+  auto corners = [&mesh](hedge::face_index_t findex) {
+    std::vector<float> result;
+    for (auto vindex : mesh.face(findex).vertices()) {
+      auto point = mesh.vertex(vindex).point();
+      result.push_back(point->position.x);
+      result.push_back(point->position.y);
+    }
+    return result;
+  };
+  std::vector<std::vector<float>> before;
+  for (auto findex : mesh.faces()) {
+    before.push_back(corners(findex));
+  }
+  const size_t point_count = mesh.point_count();
+  const size_t edge_count = mesh.edge_count();
+
+  auto remap = mesh.kernel->compact();
+  REQUIRE(mesh.point_count() == point_count);
+  REQUIRE(mesh.edge_count() == edge_count);
+  REQUIRE(mesh.kernel->point_table().size == point_count + 1);
+  REQUIRE(mesh.kernel->edge_table().size == edge_count + 1);
+  REQUIRE(mesh.kernel->face_table().size == mesh.face_count() + 1);
+
+  // Faces keep their order and their loops still reach the same corners.
+  size_t f = 0;
+  for (auto findex : mesh.faces()) {
+    REQUIRE(corners(findex) == before[f++]);
+  }
+  REQUIRE(f == before.size());
+  REQUIRE(remap(faces[8]).offset == 8);
+  REQUIRE(mesh.face(remap(faces[8])));
+  REQUIRE_FALSE(remap(removed_face));
+  REQUIRE_FALSE(remap(scratch[0]));
+
+  size_t boundary = 0;
+  for (auto eindex : mesh.edges()) {
+    boundary += mesh.edge(eindex).is_boundary() ? 1 : 0;
+    REQUIRE(mesh.edge(eindex).next().prev().index() == eindex);
+  }
+  REQUIRE(boundary == 4 * size + 3);
+
+  // New elements go at the end again now that there are no free cells.
+  auto pindex = mesh.add_point(0.f, 0.f, 0.f);
+  REQUIRE(pindex.offset == point_count + 1);
+}
+
+TEST_CASE( "Compacting a basic kernel squeezes out free cells and rewrites indices", "[compaction]" ) {
+  check_compaction<hedge::basic_kernel_t<>>();
+}
+
+TEST_CASE( "Compacting a structure-of-arrays kernel squeezes out free cells and rewrites indices", "[compaction]" ) {
+  check_compaction<hedge::soa_kernel_t<>>();
+}
+
+template<typename TKernel>
+void check_locality_reorder(hedge::locality_order_t order) {
+  const uint32_t size = 24;
+  const auto positions = grid_positions(size, false);
+  const auto grid = grid_indices(size);
+  std::vector<std::array<uint32_t, 3>> triangles;
+  for (size_t at = 0; at < grid.size(); at += 3) {
+    triangles.push_back({ { grid[at], grid[at + 1], grid[at + 2] } });
+  }
+  // Imports rarely come in a nice order.
+  std::mt19937 rng(7);
+  std::shuffle(triangles.begin(), triangles.end(), rng);
+  std::vector<uint32_t> indices;
+  for (auto& triangle : triangles) {
+    indices.insert(indices.end(), triangle.begin(), triangle.end());
+  }
+
+  hedge::basic_mesh_t<TKernel> mesh;
+  REQUIRE(mesh.build_from_indexed(positions, indices));
+
+  auto corners = [&mesh](hedge::face_index_t findex) {
+    std::vector<std::pair<float, float>> result;
+    for (auto vindex : mesh.face(findex).vertices()) {
+      auto point = mesh.vertex(vindex).point();
+      result.emplace_back(point->position.x, point->position.y);
+    }
+    return result;
+  };
+  // The mean distance in storage between a face and its neighbours.
+  auto spread = [&mesh]() {
+    double total = 0.0;
+    size_t pairs = 0;
+    for (auto eindex : mesh.edges()) {
+      auto adjacent = mesh.edge(eindex).adjacent();
+      if (adjacent) {
+        auto a = mesh.edge(eindex).face().index().offset;
+        auto b = adjacent.face().index().offset;
+        total += a > b ? a - b : b - a;
+        ++pairs;
+      }
+    }
+    return total / pairs;
+  };
+
+  std::vector<hedge::face_index_t> faces(mesh.faces().begin(), mesh.faces().end());
+  std::vector<std::vector<std::pair<float, float>>> before;
+  for (auto findex : faces) {
+    before.push_back(corners(findex));
+  }
+  const double spread_before = spread();
+  const size_t edge_count = mesh.edge_count();
+
+  auto remap = hedge::reorder_for_locality(mesh, order);
+  REQUIRE(mesh.edge_count() == edge_count);
+  REQUIRE(spread() * 4 < spread_before);
+  for (size_t f = 0; f < faces.size(); ++f) {
+    REQUIRE(corners(remap(faces[f])) == before[f]);
+  }
+
+  size_t boundary = 0;
+  for (auto eindex : mesh.edges()) {
+    boundary += mesh.edge(eindex).is_boundary() ? 1 : 0;
+    REQUIRE(mesh.edge(eindex).next().prev().index() == eindex);
+    REQUIRE(mesh.vertex(mesh.edge(eindex).vertex().index()).edge());
+  }
+  REQUIRE(boundary == 4 * size);
+}
+
+TEST_CASE( "Meshes can be reordered along a Morton curve", "[reorder]" ) {
+  check_locality_reorder<hedge::basic_kernel_t<>>(hedge::locality_order_t::morton);
+  check_locality_reorder<hedge::soa_kernel_t<>>(hedge::locality_order_t::morton);
+}
+
+TEST_CASE( "Meshes can be reordered breadth first across adjacent faces", "[reorder]" ) {
+  check_locality_reorder<hedge::basic_kernel_t<>>(hedge::locality_order_t::breadth_first);
+  check_locality_reorder<hedge::soa_kernel_t<>>(hedge::locality_order_t::breadth_first);
+}
+
+void check_binary_round_trip(hedge::kernel_t::ptr_t&& kernel) {
+  const std::string path = "hedge_test_mesh.bin";
+  hedge::mesh_t mesh(std::move(kernel));
+  std::vector<hedge::position_t> positions = {
+    { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 1.f, 1.f, 0.f }, { 0.f, 1.f, 0.f }, { 2.f, 0.5f, 0.f }
+  };
+  auto stale = mesh.add_point(9.f, 9.f, 9.f);
+  REQUIRE(mesh.build_from_indexed(positions, { 0, 1, 2, 3, 1, 4, 2 }, { 4, 3 }));
+  mesh.kernel->remove(stale);
+  REQUIRE(hedge::save_binary(mesh, path));
+
+  auto mapped_kernel = hedge::make_mapped_kernel(path, true);
+  REQUIRE(mapped_kernel);
+  hedge::mesh_t mapped(std::move(mapped_kernel));
+  REQUIRE(mapped.point_count() == mesh.point_count());
+  REQUIRE(mapped.vertex_count() == mesh.vertex_count());
+  REQUIRE(mapped.edge_count() == mesh.edge_count());
+  REQUIRE(mapped.face_count() == mesh.face_count());
+
+  // Indices from the original mesh stay valid, stale ones stay stale.
+  REQUIRE_FALSE(mapped.kernel->point_table().contains(stale));
+  for (auto findex : mesh.faces()) {
+    REQUIRE(mapped.face(findex).area() == Approx(mesh.face(findex).area()));
+    std::vector<hedge::edge_index_t> loop(mapped.face(findex).edges().begin(), mapped.face(findex).edges().end());
+    std::vector<hedge::edge_index_t> expected(mesh.face(findex).edges().begin(), mesh.face(findex).edges().end());
+    REQUIRE(loop == expected);
+  }
+  for (auto eindex : mesh.edges()) {
+    REQUIRE(mapped.edge(eindex).adjacent().index() == mesh.edge(eindex).adjacent().index());
+    REQUIRE(mapped.kernel->get(eindex) != nullptr);
+  }
+
+  // The storage can't change shape.
+  REQUIRE_FALSE(mapped.kernel->emplace(hedge::point_t(0.f, 0.f, 0.f)));
+  REQUIRE(mapped.point_count() == mesh.point_count());
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE( "Meshes can be saved to a binary file and mapped back read-only", "[binary]" ) {
+  check_binary_round_trip(hedge::make_basic_kernel());
+  check_binary_round_trip(hedge::make_soa_kernel());
+}
+
+TEST_CASE( "Mapping rejects damaged binary files", "[binary]" ) {
+  const std::string path = "hedge_test_damaged.bin";
+  hedge::mesh_t mesh;
+  REQUIRE(mesh.build_from_indexed({ { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f } }, { 0, 1, 2 }));
+  REQUIRE(hedge::save_binary(mesh, path));
+
+  std::vector<char> bytes;
+  {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    int c;
+    while ((c = std::fgetc(file)) != EOF) {
+      bytes.push_back(char(c));
+    }
+    std::fclose(file);
+  }
+  auto write = [&path](const std::vector<char>& data) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    std::fwrite(data.data(), 1, data.size(), file);
+    std::fclose(file);
+  };
+
+  // Flipping a byte of element data is only caught by the checksum.
+  auto damaged = bytes;
+  damaged[damaged.size() - 70] ^= 0x5a;
+  write(damaged);
+  REQUIRE(hedge::make_mapped_kernel(path));
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path, true));
+
+  damaged = bytes;
+  damaged[12] ^= 0x01;
+  write(damaged);
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path));
+
+  damaged = bytes;
+  damaged.resize(damaged.size() - 64);
+  write(damaged);
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path));
+
+  // Headers with a valid checksum but sections whose size wraps around or
+  // that overlap each other or the header are refused before any data is read.
+  const size_t cells_at = 40, offsets_at = 104, header_checksum_at = 152;
+  auto reseal = [&](std::vector<char>& data) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < header_checksum_at; i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, data.data() + i, sizeof(word));
+      hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    std::memcpy(data.data() + header_checksum_at, &hash, sizeof(hash));
+    write(data);
+  };
+  auto set_field = [](std::vector<char>& data, size_t at, uint64_t value) {
+    std::memcpy(data.data() + at, &value, sizeof(value));
+  };
+  damaged = bytes;
+  set_field(damaged, cells_at, (uint64_t(1) << 63) / sizeof(hedge::edge_t) * 2 + 1);
+  reseal(damaged);
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path, true));
+
+  damaged = bytes;
+  uint64_t first_offset;
+  std::memcpy(&first_offset, damaged.data() + offsets_at, sizeof(first_offset));
+  set_field(damaged, offsets_at + sizeof(uint64_t), first_offset);
+  reseal(damaged);
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path, true));
+
+  damaged = bytes;
+  set_field(damaged, offsets_at, 0);
+  reseal(damaged);
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path, true));
+
+  reseal(bytes);
+  REQUIRE(hedge::make_mapped_kernel(path, true));
+
+  std::remove(path.c_str());
+  REQUIRE_FALSE(hedge::make_mapped_kernel(path));
+}
+
+namespace {
+
+void write_text(const std::string& path, const std::string& text) {
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  REQUIRE(file != nullptr);
+  std::fwrite(text.data(), 1, text.size(), file);
+  std::fclose(file);
+}
+
+size_t count_boundary_edges(hedge::mesh_t& mesh) {
+  size_t count = 0;
+  for (auto eindex : mesh.edges()) {
+    count += mesh.edge(eindex).adjacent().index() ? 0 : 1;
+  }
+  return count;
+}
+
+template<typename T>
+void append_bytes(std::string& bytes, T value) {
+  bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+} // namespace
+
+TEST_CASE( "OBJ files import polygons and negative indices", "[import]" ) {
+  const std::string path = "hedge_test_import.obj";
+  write_text(path,
+             "# a quad and a triangle sharing an edge\n"
+             "v 0 0 0\n"
+             "v 1.0 0.0 0.0\r\n"
+             "v 1 1e0 0\n"
+             "v 0 1 -0.0\n"
+             "vt 0 0\n"
+             "vn 0 0 1\n"
+             "f 1/1/1 2/1/1 3/1/1 4/1/1\n"
+             "v 2 0.5 0\n"
+             "f -4 -1 -3\n");
+  hedge::mesh_t mesh;
+  REQUIRE(hedge::import_mesh(mesh, path));
+  REQUIRE(mesh.point_count() == 5);
+  REQUIRE(mesh.face_count() == 2);
+  REQUIRE(mesh.edge_count() == 7);
+  REQUIRE(count_boundary_edges(mesh) == 5);
+  REQUIRE(mesh.point(hedge::point_index_t(3))->position.y == Approx(1.f));
+
+  write_text(path, "v 0 0 0\nv 1 0 0\nf 1 2\n");
+  hedge::mesh_t broken;
+  REQUIRE_FALSE(hedge::import_obj(broken, path));
+  write_text(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 7\n");
+  REQUIRE_FALSE(hedge::import_obj(broken, path));
+  REQUIRE(broken.face_count() == 0);
+
+  std::remove(path.c_str());
+  REQUIRE_FALSE(hedge::import_obj(broken, path));
+}
+
+TEST_CASE( "Large OBJ files parse the same in parallel chunks", "[import]" ) {
+  const std::string path = "hedge_test_grid.obj";
+  const int size = 120;
+  std::string text;
+  for (int y = 0; y <= size; ++y) {
+    for (int x = 0; x <= size; ++x) {
+      text += "v " + std::to_string(x * 0.25f) + " " + std::to_string(y * 0.25f) + " 0\n";
+    }
+  }
+  // Negative indices reach back across chunk boundaries.
+  const int total = (size + 1) * (size + 1);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      const int corner = y * (size + 1) + x + 1;
+      text += "f " + std::to_string(corner) + " " + std::to_string(corner + 1) + " "
+        + std::to_string(corner + size + 2 - total - 1) + "\n";
+      text += "f " + std::to_string(corner) + " " + std::to_string(corner + size + 2) + " "
+        + std::to_string(corner + size + 1) + "\n";
+    }
+  }
+  write_text(path, text);
+
+  hedge::import_options_t serial;
+  serial.thread_count = 1;
+  hedge::import_options_t parallel;
+  parallel.thread_count = 4;
+  hedge::mesh_t a, b;
+  REQUIRE(hedge::import_obj(a, path, serial));
+  REQUIRE(hedge::import_obj(b, path, parallel));
+  REQUIRE(a.face_count() == size_t(size * size * 2));
+  REQUIRE(b.face_count() == a.face_count());
+  REQUIRE(b.edge_count() == a.edge_count());
+  REQUIRE(count_boundary_edges(a) == size_t(size * 4));
+  REQUIRE(count_boundary_edges(b) == count_boundary_edges(a));
+  for (auto pindex : a.points()) {
+    REQUIRE(b.point(pindex)->position.x == a.point(pindex)->position.x);
+    REQUIRE(b.point(pindex)->position.y == a.point(pindex)->position.y);
+  }
+  for (auto eindex : a.edges()) {
+    REQUIRE(b.edge(eindex).vertex().point_index() == a.edge(eindex).vertex().point_index());
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE( "PLY files import from ascii and binary bodies", "[import]" ) {
+  const std::string path = "hedge_test_import.ply";
+  write_text(path,
+             "ply\n"
+             "format ascii 1.0\n"
+             "comment two triangles\n"
+             "element vertex 4\n"
+             "property float x\n"
+             "property float y\n"
+             "property float z\n"
+             "property uchar red\n"
+             "element face 2\n"
+             "property list uchar int vertex_indices\n"
+             "end_header\n"
+             "0 0 0 255\n"
+             "1 0 0 255\n"
+             "1 1 0 255\n"
+             "0 1 0 255\n"
+             "3 0 1 2\n"
+             "3 0 2 3\n");
+  hedge::mesh_t ascii;
+  REQUIRE(hedge::import_mesh(ascii, path));
+  REQUIRE(ascii.point_count() == 4);
+  REQUIRE(ascii.face_count() == 2);
+  REQUIRE(count_boundary_edges(ascii) == 4);
+
+  const float positions[] = { 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 1.f, 0.f, 0.f, 1.f, 0.f };
+  auto binary_ply = [&positions](bool big_endian) {
+    std::string bytes = std::string("ply\nformat ") + (big_endian ? "binary_big_endian" : "binary_little_endian")
+      + " 1.0\nelement vertex 4\nproperty double x\nproperty double y\nproperty double z\n"
+        "element face 1\nproperty list uchar uint vertex_indices\nproperty uchar flags\nend_header\n";
+    auto append = [&bytes, big_endian](const void* data, size_t size) {
+      std::string value(static_cast<const char*>(data), size);
+      if (big_endian) {
+        std::reverse(value.begin(), value.end());
+      }
+      bytes += value;
+    };
+    for (float position : positions) {
+      const double value = position;
+      append(&value, sizeof(value));
+    }
+    bytes += char(4);
+    for (uint32_t index = 0; index < 4; ++index) {
+      append(&index, sizeof(index));
+    }
+    bytes += char(7);
+    return bytes;
+  };
+
+  for (bool big_endian : { false, true }) {
+    auto bytes = binary_ply(big_endian);
+    write_text(path, bytes);
+    hedge::mesh_t binary;
+    REQUIRE(hedge::import_ply(binary, path));
+    REQUIRE(binary.point_count() == 4);
+    REQUIRE(binary.face_count() == 1);
+    REQUIRE(binary.edge_count() == 4);
+    REQUIRE(binary.point(hedge::point_index_t(3))->position.x == Approx(1.f));
+    REQUIRE(binary.point(hedge::point_index_t(3))->position.y == Approx(1.f));
+
+    bytes.resize(bytes.size() - 5);
+    write_text(path, bytes);
+    hedge::mesh_t truncated;
+    REQUIRE_FALSE(hedge::import_ply(truncated, path));
+  }
+
+  // Counts far beyond the size of the file are refused before anything is
+  // sized from them, including the ones that wrap around when multiplied by
+  // the vertex size or summed up with the other elements.
+  const std::string vertex = "element vertex 3\nproperty float x\nproperty float y\nproperty float z\n";
+  const std::string face = "element face 1\nproperty list uchar int vertex_indices\n";
+  const std::string huge_face = "element face 4611686018427387904\nproperty list uchar int vertex_indices\n";
+  const std::string headers[] = {
+    "ply\nformat binary_little_endian 1.0\n" + vertex + huge_face + "end_header\n",
+    "ply\nformat binary_little_endian 1.0\nelement vertex 1537228672809129302\n"
+      "property float x\nproperty float y\nproperty float z\n" + face + "end_header\n",
+    "ply\nformat ascii 1.0\n" + vertex + huge_face + "end_header\n",
+    "ply\nformat ascii 1.0\n" + vertex + "element face 18446744073709551614\n"
+      "property list uchar int vertex_indices\nend_header\n"
+  };
+  for (const auto& header : headers) {
+    write_text(path, header + std::string(64, '\0'));
+    hedge::mesh_t crafted;
+    REQUIRE_FALSE(hedge::import_ply(crafted, path));
+    REQUIRE(crafted.point_count() == 0);
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE( "STL files import as triangle soups or welded meshes", "[import]" ) {
+  const std::string path = "hedge_test_import.stl";
+  write_text(path,
+             "solid square\n"
+             "  facet normal 0 0 1\n"
+             "    outer loop\n"
+             "      vertex 0 0 0\n"
+             "      vertex 1 0 0\n"
+             "      vertex 1 1 0\n"
+             "    endloop\n"
+             "  endfacet\n"
+             "  facet normal 0 0 1\n"
+             "    outer loop\n"
+             "      vertex 0 0 0\n"
+             "      vertex 1 1 0\n"
+             "      vertex 0 1 0\n"
+             "    endloop\n"
+             "  endfacet\n"
+             "endsolid square\n");
+  hedge::mesh_t soup;
+  REQUIRE(hedge::import_mesh(soup, path));
+  REQUIRE(soup.point_count() == 6);
+  REQUIRE(soup.face_count() == 2);
+  REQUIRE(count_boundary_edges(soup) == 6);
+
+  hedge::import_options_t options;
+  options.weld_stl = true;
+  hedge::mesh_t welded;
+  REQUIRE(hedge::import_stl(welded, path, options));
+  REQUIRE(welded.point_count() == 4);
+  REQUIRE(welded.face_count() == 2);
+  REQUIRE(count_boundary_edges(welded) == 4);
+
+  // Binary files can start with "solid" as well.
+  std::string bytes = "solid but binary";
+  bytes.resize(80, ' ');
+  append_bytes(bytes, uint32_t(2));
+  const float corners[2][9] = {
+    { 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 1.f, 0.f },
+    { 0.f, 0.f, -0.f, 1.f, 1.f, 0.f, 0.f, 1.f, 0.f }
+  };
+  for (auto& triangle : corners) {
+    for (int i = 0; i < 3; ++i) {
+      append_bytes(bytes, 0.f);
+    }
+    for (float value : triangle) {
+      append_bytes(bytes, value);
+    }
+    append_bytes(bytes, uint16_t(0));
+  }
+  write_text(path, bytes);
+  hedge::mesh_t binary;
+  REQUIRE(hedge::import_stl(binary, path, options));
+  REQUIRE(binary.point_count() == 4);
+  REQUIRE(binary.face_count() == 2);
+  REQUIRE(count_boundary_edges(binary) == 4);
+
+  write_text(path, "not a mesh");
+  hedge::mesh_t broken;
+  REQUIRE_FALSE(hedge::import_stl(broken, path));
+
+  std::remove(path.c_str());
+}
+
+namespace {
+
+uint32_t exported_index(const hedge::gpu_export_t& exporter, size_t at) {
+  if (exporter.index_format() == hedge::gpu_index_format_t::uint16) {
+    return static_cast<const uint16_t*>(exporter.index_data())[at];
+  }
+  return static_cast<const uint32_t*>(exporter.index_data())[at];
+}
+
+/**
+   The triangles of an export that aren't degenerate filler, in a canonical
+   order so exports with different layouts can be compared.
+ */
+std::multiset<std::array<uint32_t, 3>> exported_triangles(const hedge::gpu_export_t& exporter) {
+  std::multiset<std::array<uint32_t, 3>> triangles;
+  for (size_t at = 0; at + 2 < exporter.index_count(); at += 3) {
+    std::array<uint32_t, 3> triangle = {
+      exported_index(exporter, at), exported_index(exporter, at + 1), exported_index(exporter, at + 2)
+    };
+    if (triangle[0] != triangle[1] || triangle[1] != triangle[2]) {
+      std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+      triangles.insert(triangle);
+    }
+  }
+  return triangles;
+}
+
+void check_same_export(const hedge::gpu_export_t& incremental, hedge::mesh_t& mesh) {
+  hedge::gpu_export_t fresh;
+  fresh.update(mesh);
+  REQUIRE(fresh.rebuilt());
+  REQUIRE(exported_triangles(incremental) == exported_triangles(fresh));
+  REQUIRE(incremental.vertices().size() == fresh.vertices().size());
+  for (size_t cell = 0; cell < fresh.vertices().size(); ++cell) {
+    for (int axis = 0; axis < 3; ++axis) {
+      REQUIRE(incremental.vertices()[cell].position[axis] == fresh.vertices()[cell].position[axis]);
+      REQUIRE(incremental.vertices()[cell].normal[axis] == Approx(fresh.vertices()[cell].normal[axis]).margin(1e-4));
+    }
+  }
+}
+
+size_t covered(const std::vector<hedge::gpu_range_t>& ranges) {
+  size_t count = 0;
+  for (auto& range : ranges) {
+    count += range.end - range.begin;
+  }
+  return count;
+}
+
+} // namespace
+
+TEST_CASE( "Meshes export to interleaved vertex and triangle index buffers", "[gpu_export]" ) {
+  hedge::mesh_t mesh;
+  build_wavy_grid(mesh, 8);
+  hedge::position_t quad[] = { { 10.f, 0.f, 0.f }, { 11.f, 0.f, 0.f }, { 11.f, 1.f, 0.f }, { 10.f, 1.f, 0.f } };
+  std::vector<hedge::position_t> positions(std::begin(quad), std::end(quad));
+  hedge::mesh_t quads;
+  REQUIRE(quads.build_from_indexed(positions, { 0, 1, 2, 3 }, { 4 }));
+
+  hedge::gpu_export_t exporter;
+  exporter.update(mesh);
+  REQUIRE(exporter.rebuilt());
+  REQUIRE(exporter.index_format() == hedge::gpu_index_format_t::uint16);
+  REQUIRE(exporter.index_size() == 2);
+  REQUIRE(exporter.index_count() == 8 * 8 * 2 * 3);
+  REQUIRE(exporter.vertices().size() == mesh.kernel->vertex_table().size);
+  REQUIRE(exporter.dirty_vertex_ranges().size() == 1);
+  REQUIRE(exporter.dirty_index_ranges().size() == 1);
+  REQUIRE(covered(exporter.dirty_index_ranges()) == exporter.index_count());
+
+  std::vector<hedge::position_t> normals(mesh.kernel->vertex_table().size);
+  hedge::compute_vertex_normals(mesh, normals.data());
+  for (auto vindex : mesh.vertices()) {
+    auto& vertex = exporter.vertices()[vindex.offset];
+    auto& position = mesh.point(vindex)->position;
+    for (int axis = 0; axis < 3; ++axis) {
+      REQUIRE(vertex.position[axis] == position[axis]);
+      REQUIRE(vertex.normal[axis] == normals[vindex.offset][axis]);
+    }
+  }
+  for (size_t at = 0; at < exporter.index_count(); ++at) {
+    auto cell = exported_index(exporter, at);
+    REQUIRE(cell > 0);
+    REQUIRE(mesh.kernel->vertex_table().element[cell].status == hedge::element_status_t::ACTIVE);
+  }
+
+  // Triangles keep the winding of their face.
+  for (size_t at = 0; at < exporter.index_count(); at += 3) {
+    const float* p[3];
+    for (int corner = 0; corner < 3; ++corner) {
+      p[corner] = exporter.vertices()[exported_index(exporter, at + corner)].position;
+    }
+    const float cross_z = (p[1][0] - p[0][0]) * (p[2][1] - p[0][1]) - (p[1][1] - p[0][1]) * (p[2][0] - p[0][0]);
+    REQUIRE(cross_z > 0.f);
+  }
+
+  hedge::gpu_export_options_t options;
+  options.allow_16bit_indices = false;
+  hedge::gpu_export_t wide(options);
+  wide.update(quads);
+  REQUIRE(wide.index_format() == hedge::gpu_index_format_t::uint32);
+  REQUIRE(wide.index_size() == 4);
+  REQUIRE(wide.index_count() == 6);
+  REQUIRE(exported_triangles(wide).size() == 2);
+}
+
+TEST_CASE( "Exports only rewrite what changed since the last update", "[gpu_export]" ) {
+  hedge::mesh_t mesh;
+  build_wavy_grid(mesh, 16);
+  hedge::gpu_export_t exporter;
+  exporter.update(mesh);
+
+  // Nothing changed, nothing to upload.
+  exporter.update(mesh);
+  REQUIRE_FALSE(exporter.rebuilt());
+  REQUIRE(exporter.dirty_vertex_ranges().empty());
+  REQUIRE(exporter.dirty_index_ranges().empty());
+
+  // Moving a point touches the vertex and the corners of the faces around it.
+  auto vindex = *mesh.vertices().begin();
+  for (auto candidate : mesh.vertices()) {
+    if (mesh.point(candidate)->position.x == 8.f && mesh.point(candidate)->position.y == 8.f) {
+      vindex = candidate;
+    }
+  }
+  mesh.point(vindex)->position.z += 0.5f;
+  exporter.mark_vertex(vindex);
+  exporter.update(mesh);
+  REQUIRE_FALSE(exporter.rebuilt());
+  REQUIRE(covered(exporter.dirty_vertex_ranges()) < exporter.vertices().size() / 4);
+  REQUIRE(covered(exporter.dirty_index_ranges()) < exporter.index_count() / 4);
+  check_same_export(exporter, mesh);
+
+  // Added faces go to the end of the index buffer.
+  const size_t index_count = exporter.index_count();
+  auto findex = mesh.add_triangle(hedge::point_t(20.f, 0.f, 0.f), hedge::point_t(21.f, 0.f, 0.f),
+                                  hedge::point_t(20.f, 1.f, 0.f));
+  REQUIRE(findex);
+  exporter.update(mesh);
+  REQUIRE_FALSE(exporter.rebuilt());
+  REQUIRE(exporter.index_count() == index_count + 3);
+  REQUIRE(exporter.dirty_index_ranges().size() == 1);
+  REQUIRE(exporter.dirty_index_ranges()[0].begin == index_count);
+  REQUIRE(exporter.dirty_index_ranges()[0].end == index_count + 3);
+  check_same_export(exporter, mesh);
+
+  // Removed faces leave degenerate triangles in place.
+  mesh.kernel->remove(findex);
+  exporter.update(mesh);
+  REQUIRE_FALSE(exporter.rebuilt());
+  REQUIRE(exporter.index_count() == index_count + 3);
+  REQUIRE(covered(exporter.dirty_index_ranges()) == 3);
+  check_same_export(exporter, mesh);
+
+  // Once most of the buffer is filler it gets rebuilt.
+  std::vector<hedge::face_index_t> faces(mesh.faces().begin(), mesh.faces().end());
+  for (size_t i = 0; i < faces.size() * 3 / 4; ++i) {
+    mesh.kernel->remove(faces[i]);
+  }
+  exporter.update(mesh);
+  REQUIRE(exporter.rebuilt());
+  REQUIRE(exporter.index_count() == (faces.size() - faces.size() * 3 / 4) * 3);
+  check_same_export(exporter, mesh);
+
+  exporter.invalidate();
+  exporter.update(mesh);
+  REQUIRE(exporter.rebuilt());
+}
+
+TEST_CASE( "Exports switch to 32-bit indices once the vertices outgrow 16 bits", "[gpu_export]" ) {
+  hedge::mesh_t mesh;
+  build_wavy_grid(mesh, 4);
+  hedge::gpu_export_t exporter;
+  exporter.update(mesh);
+  REQUIRE(exporter.index_format() == hedge::gpu_index_format_t::uint16);
+
+  mesh.kernel->reserve(0x10000, 0x10000, 0, 0);
+  for (uint32_t i = 0; i < 0x10000 / 3 + 1; ++i) {
+    mesh.add_triangle(hedge::point_t(float(i), 0.f, 0.f), hedge::point_t(float(i) + 1.f, 0.f, 0.f),
+                      hedge::point_t(float(i), 1.f, 0.f));
+  }
+  exporter.update(mesh);
+  REQUIRE(exporter.rebuilt());
+  REQUIRE(exporter.index_format() == hedge::gpu_index_format_t::uint32);
+  check_same_export(exporter, mesh);
+}
+
+namespace {
+
+void check_allocation(hedge::allocation_t allocation) {
+  hedge::mesh_t mesh(hedge::make_basic_kernel(hedge::validation_t::checked_logging, allocation));
+  build_wavy_grid(mesh, 8);
+  auto first_edge = *mesh.edges().begin();
+  auto* edge = mesh.kernel->get(first_edge);
+  const auto face = edge->face_index;
+
+  hedge::mesh_t reference;
+  build_wavy_grid(reference, 40);
+  std::vector<hedge::position_t> positions;
+  for (auto pindex : reference.points()) {
+    positions.push_back(reference.point(pindex)->position);
+  }
+  for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+    hedge::point_t p[3];
+    for (size_t c = 0; c < 3; ++c) {
+      p[c].position = positions[i + c] + hedge::position_t(100.f, 0.f, 0.f);
+    }
+    REQUIRE(mesh.add_triangle(p[0], p[1], p[2]));
+  }
+  REQUIRE(mesh.face_count() == 8 * 8 * 2 + positions.size() / 3);
+
+  // Growing paged storage never moves the elements.
+  if (allocation == hedge::allocation_t::paged || allocation == hedge::allocation_t::huge_pages) {
+    REQUIRE(mesh.kernel->get(first_edge) == edge);
+  }
+  REQUIRE(mesh.kernel->get(first_edge)->face_index == face);
+
+  std::vector<hedge::face_index_t> faces(mesh.faces().begin(), mesh.faces().end());
+  for (size_t i = 0; i < faces.size(); i += 2) {
+    mesh.kernel->remove(faces[i]);
+  }
+  auto remap = mesh.kernel->compact();
+  REQUIRE(mesh.face_count() == faces.size() / 2);
+  for (size_t i = 1; i < faces.size(); i += 2) {
+    auto findex = remap(faces[i]);
+    REQUIRE(mesh.face(findex).edge().face().index() == findex);
+  }
+  reorder_for_locality(mesh);
+  for (auto findex : mesh.faces()) {
+    REQUIRE(mesh.face(findex).edge().face().index() == findex);
+  }
+}
+
+} // namespace
+
+TEST_CASE( "Basic kernels can keep their elements in any kind of storage", "[allocation]" ) {
+  check_allocation(hedge::allocation_t::heap);
+  check_allocation(hedge::allocation_t::paged);
+  check_allocation(hedge::allocation_t::huge_pages);
+  check_allocation(hedge::allocation_t::monotonic);
+}
+
+TEST_CASE( "Monotonic arenas grow their latest allocation in place", "[allocation]" ) {
+  hedge::monotonic_arena_t arena;
+  void* a = arena.allocate(64, 16);
+  REQUIRE(reinterpret_cast<uintptr_t>(a) % 16 == 0);
+  REQUIRE(arena.extend(a, 1024));
+  void* b = arena.allocate(16, 8);
+  REQUIRE(static_cast<char*>(b) >= static_cast<char*>(a) + 1024);
+  REQUIRE_FALSE(arena.extend(a, 2048));
+  REQUIRE_FALSE(arena.extend(b, hedge::monotonic_arena_t::min_block_bytes * 2));
+
+  void* c = arena.allocate(hedge::monotonic_arena_t::min_block_bytes * 3, 16);
+  REQUIRE(c != nullptr);
+  REQUIRE(arena.reserved_bytes() >= hedge::monotonic_arena_t::min_block_bytes * 4);
+
+  hedge::element_buffer_t<hedge::edge_t> edges(hedge::allocation_t::monotonic, &arena);
+  edges.emplace_back();
+  auto* data = edges.data();
+  edges.reserve(1000);
+  REQUIRE(edges.data() == data);
+  hedge::element_buffer_t<hedge::edge_t> heap(hedge::allocation_t::monotonic);
+  REQUIRE(heap.allocation() == hedge::allocation_t::heap);
+}
+
+TEST_CASE( "Huge page storage only takes pool pages for the reserved size", "[allocation]" ) {
+  const size_t huge_page = size_t(2) << 20;
+  auto region = hedge::reserve_pages(size_t(1) << 30, true);
+  REQUIRE(region.base != nullptr);
+  REQUIRE(reinterpret_cast<uintptr_t>(region.base) % huge_page == 0);
+  REQUIRE(region.huge_bytes == 0);
+  region.base[0] = 42;
+
+  // Pages holding data are never mapped over, and with no pool to draw on
+  // the ordinary pages stay.
+  hedge::commit_huge_pages(region, 1, 3 * huge_page + 1);
+  REQUIRE((region.huge_bytes == 0 || region.huge_bytes == 4 * huge_page));
+  REQUIRE(region.base[0] == 42);
+  region.base[5 * huge_page] = 7;
+  REQUIRE(region.base[5 * huge_page] == 7);
+  hedge::release_pages(region);
+
+  // The buffer keeps its whole reservation so reserving never moves it.
+  hedge::element_buffer_t<hedge::point_t> points(hedge::allocation_t::huge_pages);
+  points.emplace_back(hedge::point_t(1.f, 2.f, 3.f));
+  auto* data = points.data();
+  const size_t capacity = points.capacity();
+  points.reserve(100000);
+  REQUIRE(points.data() == data);
+  REQUIRE(points.capacity() == capacity);
+  REQUIRE(points[0].position.y == 2.f);
+  points.resize(100000);
+  REQUIRE(points[99999].position.x == 0.f);
+}
+
+namespace {
+
+/**
+   A grid of triangles with its own points, linked up the way a procedural
+   generator would do it with nothing but the emplacer.
+ */
+template<typename TEmplacer>
+void emit_patch(TEmplacer& emplacer, float x0, uint32_t size) {
+  std::vector<hedge::vertex_index_t> vertices;
+  for (auto position : grid_positions(size, false)) {
+    hedge::vertex_t vertex;
+    vertex.point_index = emplacer.emplace(hedge::point_t(x0 + position.x, position.y, position.z));
+    vertices.push_back(emplacer.emplace(std::move(vertex)));
+  }
+  auto triangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+    const uint32_t corners[3] = { a, b, c };
+    auto findex = emplacer.emplace(hedge::face_t());
+    hedge::edge_index_t edges[3];
+    for (int i = 0; i < 3; ++i) {
+      hedge::edge_t edge;
+      edge.vertex_index = vertices[corners[i]];
+      edge.face_index = findex;
+      edges[i] = emplacer.emplace(std::move(edge));
+    }
+    for (int i = 0; i < 3; ++i) {
+      emplacer.get(edges[i])->next_index = edges[(i + 1) % 3];
+      emplacer.get(edges[i])->prev_index = edges[(i + 2) % 3];
+      emplacer.get(vertices[corners[i]])->edge_index = edges[i];
+    }
+    emplacer.get(findex)->edge_index = edges[0];
+  };
+  const auto indices = grid_indices(size);
+  for (size_t at = 0; at < indices.size(); at += 3) {
+    triangle(indices[at], indices[at + 1], indices[at + 2]);
+  }
+}
+
+} // namespace
+
+TEST_CASE( "Threads can emplace into a basic kernel concurrently", "[concurrent]" ) {
+  using kernel_t = hedge::basic_kernel_t<>;
+  const size_t thread_count = 8;
+  const uint32_t size = 20;
+  hedge::basic_mesh_t<kernel_t> mesh(hedge::allocation_t::paged);
+  auto& kernel = mesh.typed_kernel();
+
+  kernel.begin_concurrent(0, 0, 0, 0);
+  hedge::parallel_for(thread_count, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t patch = begin; patch < end; ++patch) {
+      hedge::concurrent_emplacer_t<kernel_t> emplacer(kernel, 64);
+      emit_patch(emplacer, float(patch) * 100.f, size);
+    }
+  });
+  kernel.end_concurrent();
+
+  const size_t faces = thread_count * size * size * 2;
+  REQUIRE(mesh.point_count() == thread_count * (size + 1) * (size + 1));
+  REQUIRE(mesh.vertex_count() == mesh.point_count());
+  REQUIRE(mesh.face_count() == faces);
+  REQUIRE(mesh.edge_count() == faces * 3);
+
+  auto report = hedge::link_adjacent_edges(mesh);
+  REQUIRE(report.boundary_edges == thread_count * size * 4);
+  for (auto findex : mesh.faces()) {
+    auto face = mesh.face(findex);
+    auto origin = face.edge().vertex().point()->position;
+    size_t corners = 0;
+    for (auto vindex : face.vertices()) {
+      auto position = mesh.point(vindex)->position;
+      // Every corner of a face comes from the same patch.
+      REQUIRE(std::floor(position.x / 100.f) == std::floor(origin.x / 100.f));
+      ++corners;
+    }
+    REQUIRE(corners == 3);
+  }
+
+  // Cells claimed but never filled were handed to the free list.
+  const size_t point_cells = kernel.point_table().size;
+  REQUIRE(point_cells > mesh.point_count() + 1);
+  auto pindex = mesh.add_point(0.f, 0.f, 1.f);
+  REQUIRE(pindex.offset < point_cells);
+  REQUIRE(kernel.point_table().size == point_cells);
+}
+
+TEST_CASE( "Concurrent emplacement stops at the room set aside for it", "[concurrent]" ) {
+  using kernel_t = hedge::basic_kernel_t<>;
+  kernel_t kernel;
+  kernel.begin_concurrent(7, 0, 0, 0);
+  const size_t capacity = kernel.storage(hedge::point_index_t()).size() + 7;
+  hedge::concurrent_emplacer_t<kernel_t> emplacer(kernel, 4);
+  size_t placed = 0;
+  for (size_t i = 0; i < 32; ++i) {
+    placed += emplacer.emplace(hedge::point_t(float(i), 0.f, 0.f)) ? 1 : 0;
+  }
+  kernel.end_concurrent();
+  REQUIRE(placed >= 7);
+  REQUIRE(placed < 32);
+  REQUIRE(kernel.point_count() == placed + 1);
+  REQUIRE(kernel.point_table().size >= capacity);
+}
+
+namespace {
+
+std::vector<hedge::position_t> face_corners(hedge::mesh_t& mesh) {
+  std::vector<hedge::position_t> corners;
+  for (auto findex : mesh.faces()) {
+    for (auto vindex : mesh.face(findex).vertices()) {
+      corners.push_back(mesh.point(vindex)->position);
+    }
+  }
+  return corners;
+}
+
+} // namespace
+
+TEST_CASE( "Snapshots keep their view while the writer edits", "[snapshot]" ) {
+  REQUIRE_FALSE(hedge::make_basic_kernel()->snapshot());
+
+  hedge::mesh_t mesh(hedge::make_versioned_kernel());
+  build_wavy_grid(mesh, 30);
+  const size_t faces = mesh.face_count();
+  const size_t edges = mesh.edge_count();
+  const auto corners = face_corners(mesh);
+
+  hedge::mesh_t snapshot(mesh.kernel->snapshot());
+  REQUIRE(snapshot.kernel);
+
+  // Edit through get(), the tables, removal and emplacement.
+  std::vector<hedge::point_index_t> points(mesh.points().begin(), mesh.points().end());
+  mesh.kernel->get(points[3])->position.z = 10.f;
+  auto positions = mesh.kernel->point_table().position;
+  for (size_t i = 0; i < points.size(); i += 7) {
+    positions.writable(points[i].offset).x += 0.5f;
+  }
+  std::vector<hedge::face_index_t> removed(mesh.faces().begin(), mesh.faces().end());
+  removed.resize(5);
+  for (auto findex : removed) {
+    mesh.kernel->remove(findex);
+  }
+  for (int i = 0; i < 2000; ++i) {
+    mesh.add_point(float(i), -1.f, 0.f);
+  }
+  REQUIRE(mesh.face_count() == faces - 5);
+  REQUIRE(mesh.point(points[3])->position.z == 10.f);
+
+  REQUIRE(snapshot.face_count() == faces);
+  REQUIRE(snapshot.edge_count() == edges);
+  REQUIRE(snapshot.point_count() == points.size());
+  REQUIRE(face_corners(snapshot) == corners);
+  for (auto findex : removed) {
+    REQUIRE(snapshot.face(findex));
+  }
+  size_t boundary = 0;
+  for (auto eindex : snapshot.edges()) {
+    boundary += snapshot.edge(eindex).is_boundary() ? 1 : 0;
+    REQUIRE(snapshot.edge(eindex).next().prev().index() == eindex);
+  }
+  REQUIRE(boundary == 4 * 30);
+  REQUIRE_FALSE(snapshot.kernel->emplace(hedge::point_t(0.f, 0.f, 0.f)));
+  REQUIRE(snapshot.point_count() == points.size());
+
+  // Compaction moves everything into new pages, snapshots of either side
+  // still see their own layout.
+  hedge::mesh_t before(snapshot.kernel->snapshot());
+  auto remap = mesh.kernel->compact();
+  hedge::mesh_t after(mesh.kernel->snapshot());
+  REQUIRE(after.face_count() == faces - 5);
+  REQUIRE(after.kernel->face_table().size == faces - 4);
+  REQUIRE(after.point(remap(points[3]))->position.z == 10.f);
+  REQUIRE(face_corners(before) == corners);
+
+  // Snapshots outlive the kernel they were taken from.
+  mesh.kernel.reset();
+  REQUIRE(face_corners(snapshot) == corners);
+  REQUIRE(after.face_count() == faces - 5);
+}
+
+namespace {
+
+/**
+   Start of every page of 1024 cells below size, compared before and after an
+   edit to see which pages it copied.
+ */
+template<typename TTable>
+std::vector<const void*> page_starts(const TTable& table, size_t size) {
+  std::vector<const void*> starts;
+  for (size_t offset = 0; offset < size; offset += 1024) {
+    starts.push_back(&table.element[hedge::offset_t(offset)]);
+  }
+  return starts;
+}
+
+template<typename TTable>
+size_t copied_pages(const std::vector<const void*>& starts, const TTable& table) {
+  size_t copied = 0;
+  for (size_t page = 0; page < starts.size(); ++page) {
+    copied += starts[page] != &table.element[hedge::offset_t(page * 1024)] ? 1 : 0;
+  }
+  return copied;
+}
+
+} // namespace
+
+TEST_CASE( "The first edit after a snapshot only copies the pages it writes", "[snapshot]" ) {
+  hedge::mesh_t mesh(hedge::make_versioned_kernel());
+  build_wavy_grid(mesh, 40);
+  const size_t edges = mesh.edge_count();
+  hedge::mesh_t snapshot(mesh.kernel->snapshot());
+
+  // A boundary edge away from the first and last page, so its page and the
+  // tail pages the new cells go to are told apart.
+  const size_t edge_cells = mesh.kernel->edge_table().size;
+  const size_t face_cells = mesh.kernel->face_table().size;
+  const size_t vertex_cells = mesh.kernel->vertex_table().size;
+  const size_t point_cells = mesh.kernel->point_table().size;
+  REQUIRE(edge_cells > 4 * 1024);
+  hedge::edge_index_t boundary;
+  for (auto eindex : mesh.edges()) {
+    const size_t page = eindex.offset / 1024;
+    if (mesh.edge(eindex).is_boundary() && page > 0 && page + 1 < edge_cells / 1024) {
+      boundary = eindex;
+      break;
+    }
+  }
+  REQUIRE(boundary);
+
+  const auto edge_pages = page_starts(mesh.kernel->edge_table(), edge_cells);
+  const auto face_pages = page_starts(mesh.kernel->face_table(), face_cells);
+  const auto vertex_pages = page_starts(mesh.kernel->vertex_table(), vertex_cells);
+  const auto point_pages = page_starts(mesh.kernel->point_table(), point_cells);
+  REQUIRE(copied_pages(edge_pages, snapshot.kernel->edge_table()) == 0);
+
+  REQUIRE(mesh.add_triangle(boundary, mesh.add_point(20.f, -1.f, 0.f)));
+  REQUIRE_FALSE(mesh.edge(boundary).is_boundary());
+
+  // The boundary edge's page and the tail pages, nothing else.
+  REQUIRE(copied_pages(edge_pages, mesh.kernel->edge_table()) == 2);
+  REQUIRE(copied_pages(face_pages, mesh.kernel->face_table()) <= 1);
+  REQUIRE(copied_pages(vertex_pages, mesh.kernel->vertex_table()) <= 1);
+  REQUIRE(copied_pages(point_pages, mesh.kernel->point_table()) <= 1);
+  REQUIRE(copied_pages(edge_pages, snapshot.kernel->edge_table()) == 0);
+  REQUIRE(snapshot.edge(boundary).is_boundary());
+  REQUIRE(snapshot.edge_count() == edges);
+}
+
+TEST_CASE( "Reader threads traverse snapshots while the writer keeps editing", "[snapshot]" ) {
+  const size_t reader_count = 4;
+  const float rounds = 40.f;
+  hedge::mesh_t mesh(hedge::make_versioned_kernel());
+  build_wavy_grid(mesh, 40);
+  std::vector<hedge::point_index_t> points(mesh.points().begin(), mesh.points().end());
+
+  std::mutex mutex;
+  std::shared_ptr<hedge::mesh_t> latest;
+  auto publish = [&]() {
+    std::shared_ptr<hedge::mesh_t> snapshot(new hedge::mesh_t(mesh.kernel->snapshot()));
+    std::lock_guard<std::mutex> lock(mutex);
+    latest = snapshot;
+  };
+  auto take = [&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return latest;
+  };
+  for (auto pindex : points) {
+    mesh.point(pindex)->position.z = 0.f;
+  }
+  publish();
+
+  // Every round lifts all points to the same height, half of them through
+  // get() and the rest through the point table, so a consistent view never
+  // sees two heights.
+  std::vector<size_t> torn(reader_count, 0);
+  std::vector<size_t> seen(reader_count, 0);
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r < reader_count; ++r) {
+    readers.emplace_back([&, r]() {
+      float last = 0.f;
+      while (last < rounds) {
+        auto snapshot = take();
+        const float height = snapshot->point(points[0])->position.z;
+        for (auto findex : snapshot->faces()) {
+          for (auto vindex : snapshot->face(findex).vertices()) {
+            torn[r] += snapshot->point(vindex)->position.z != height ? 1 : 0;
+          }
+        }
+        seen[r] += height != last ? 1 : 0;
+        last = height;
+      }
+    });
+  }
+  for (float round = 1.f; round <= rounds; round += 1.f) {
+    for (size_t i = 0; i < points.size() / 2; ++i) {
+      mesh.kernel->get(points[i])->position.z = round;
+    }
+    auto positions = mesh.kernel->point_table().position;
+    for (size_t i = points.size() / 2; i < points.size(); ++i) {
+      positions.writable(points[i].offset).z = round;
+    }
+    publish();
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  for (size_t r = 0; r < reader_count; ++r) {
+    REQUIRE(torn[r] == 0);
+    REQUIRE(seen[r] > 0);
+  }
+}
+
+namespace {
+
+/**
+   Everything about a mesh a journal replay has to bring back: the counts,
+   every face with the offsets and positions of its corners and the links
+   of every edge.
+ */
+std::vector<double> mesh_state(hedge::mesh_t& mesh) {
+  std::vector<double> state = {
+    double(mesh.point_count()), double(mesh.vertex_count()), double(mesh.edge_count()), double(mesh.face_count())
+  };
+  for (auto findex : mesh.faces()) {
+    state.push_back(double(findex.offset));
+    state.push_back(double(findex.generation));
+    for (auto vindex : mesh.face(findex).vertices()) {
+      auto& position = mesh.point(vindex)->position;
+      state.insert(state.end(), { double(vindex.offset), position.x, position.y, position.z });
+    }
+  }
+  auto edges = mesh.kernel->edge_table();
+  for (auto eindex : mesh.edges()) {
+    state.insert(state.end(), {
+      double(eindex.offset), double(edges.next_index[eindex.offset].offset),
+      double(edges.prev_index[eindex.offset].offset), double(edges.adjacent_index[eindex.offset].offset),
+      double(edges.face_index[eindex.offset].offset)
+    });
+  }
+  return state;
+}
+
+hedge::edge_index_t find_boundary_edge(hedge::mesh_t& mesh) {
+  for (auto eindex : mesh.edges()) {
+    if (mesh.edge(eindex).is_boundary()) {
+      return eindex;
+    }
+  }
+  return hedge::edge_index_t();
+}
+
+void check_transactions(hedge::kernel_t::ptr_t&& kernel) {
+  hedge::mesh_t mesh(std::move(kernel));
+  build_wavy_grid(mesh, 6);
+  const auto original = mesh_state(mesh);
+
+  // Going out of scope without a commit takes everything back.
+  {
+    hedge::transaction_t transaction(mesh);
+    mesh.add_triangle(find_boundary_edge(mesh), mesh.add_point(3.f, -1.f, 0.f));
+    mesh.add_triangle(hedge::point_t(9.f, 9.f, 0.f), hedge::point_t(10.f, 9.f, 0.f), hedge::point_t(9.f, 10.f, 0.f));
+    REQUIRE(mesh.face_count() == 6 * 6 * 2 + 2);
+  }
+  REQUIRE(mesh_state(mesh) == original);
+
+  // Grow a triangle off the boundary, take out a face and move a point.
+  hedge::transaction_t first(mesh);
+  auto grown = mesh.add_triangle(find_boundary_edge(mesh), mesh.add_point(3.f, -1.f, 0.f));
+  auto removed = *mesh.faces().begin();
+  first.remove(removed);
+  auto moved = *mesh.points().begin();
+  first.touch(moved);
+  mesh.kernel->point_table().position.writable(moved.offset).z = 5.f;
+  auto first_delta = first.commit();
+  REQUIRE_FALSE(first.is_open());
+  REQUIRE_FALSE(first_delta.empty());
+  const auto after_first = mesh_state(mesh);
+
+  // Removing first and creating after reuses the freed cell.
+  hedge::transaction_t second(mesh);
+  second.remove(grown);
+  auto reused = mesh.add_triangle(hedge::point_t(9.f, 9.f, 0.f), hedge::point_t(10.f, 9.f, 0.f),
+                                  hedge::point_t(9.f, 10.f, 0.f));
+  auto second_delta = second.commit();
+  const auto after_second = mesh_state(mesh);
+  REQUIRE(mesh.face(reused));
+
+  REQUIRE(second_delta.undo(mesh));
+  REQUIRE(mesh_state(mesh) == after_first);
+  REQUIRE(mesh.face(grown));
+  REQUIRE_FALSE(second_delta.undo(mesh));
+  REQUIRE(first_delta.undo(mesh));
+  REQUIRE(mesh_state(mesh) == original);
+  REQUIRE(mesh.face(removed));
+  REQUIRE_FALSE(mesh.kernel->face_table().contains(grown));
+
+  REQUIRE(first_delta.redo(mesh));
+  REQUIRE(mesh_state(mesh) == after_first);
+  REQUIRE(second_delta.redo(mesh));
+  REQUIRE(mesh_state(mesh) == after_second);
+  REQUIRE(mesh.face(reused));
+  REQUIRE(mesh.point(moved)->position.z == 5.f);
+
+  // The deltas only hold the cells that changed, not the mesh.
+  const size_t mesh_bytes = (mesh.edge_count() * sizeof(hedge::edge_t) + mesh.point_count() * sizeof(hedge::point_t));
+  REQUIRE(first_delta.bytes() < mesh_bytes / 4);
+
+  // An edit that wasn't recorded leaves the deltas stranded.
+  mesh.add_point(0.f, 0.f, 0.f);
+  const auto edited = mesh_state(mesh);
+  REQUIRE_FALSE(second_delta.undo(mesh));
+  REQUIRE(mesh_state(mesh) == edited);
+}
+
+} // namespace
+
+TEST_CASE( "Transactions roll back and their deltas undo and redo on every kernel", "[transaction]" ) {
+  check_transactions(hedge::make_basic_kernel());
+  check_transactions(hedge::make_soa_kernel());
+  check_transactions(hedge::make_versioned_kernel());
+}
+
+TEST_CASE( "Kernels retract and restore cells exactly backwards through their history", "[transaction]" ) {
+  hedge::basic_kernel_t<> kernel;
+  auto a = kernel.emplace(hedge::point_t(1.f, 0.f, 0.f));
+  auto b = kernel.emplace(hedge::point_t(2.f, 0.f, 0.f));
+  auto c = kernel.emplace(hedge::point_t(3.f, 0.f, 0.f));
+  kernel.remove(c);
+  kernel.remove(a);
+  auto d = kernel.emplace(hedge::point_t(4.f, 0.f, 0.f));
+  REQUIRE(d.offset == a.offset);
+
+  // Cells only come back in the reverse order they went.
+  REQUIRE_FALSE(kernel.restore(a));
+  REQUIRE_FALSE(kernel.retract(a));
+  REQUIRE(kernel.retract(d));
+  REQUIRE_FALSE(kernel.retract(d));
+  REQUIRE(kernel.restore(a));
+  REQUIRE(kernel.restore(c));
+  REQUIRE(kernel.point_count() == 4);
+  REQUIRE(kernel.get(a) != nullptr);
+  REQUIRE(kernel.get(c) != nullptr);
+
+  // A cell added at the end stays and keeps its bumped generation, so the
+  // next emplace there doesn't bring the retracted index back.
+  const size_t cells = kernel.point_table().size;
+  auto e = kernel.emplace(hedge::point_t(5.f, 0.f, 0.f));
+  REQUIRE(kernel.retract(e));
+  REQUIRE(kernel.point_table().size == cells + 1);
+  REQUIRE(kernel.point_count() == 4);
+  auto f = kernel.emplace(hedge::point_t(6.f, 0.f, 0.f));
+  REQUIRE(f.offset == e.offset);
+  REQUIRE(f != e);
+  REQUIRE_FALSE(kernel.point_table().contains(e));
+  REQUIRE(kernel.get(b)->position.x == 2.f);
+}
+
+namespace {
+
+void check_stale_after_undo(hedge::kernel_t::ptr_t&& kernel) {
+  hedge::mesh_t mesh(std::move(kernel));
+  auto a = mesh.add_point(1.f, 0.f, 0.f);
+  auto b = mesh.add_point(2.f, 0.f, 0.f);
+  mesh.add_point(3.f, 0.f, 0.f);
+  mesh.kernel->remove(b);
+
+  // One emplace reuses a free cell, the other one grows the storage.
+  hedge::mesh_delta_t delta;
+  hedge::point_index_t reused, appended;
+  {
+    hedge::transaction_t transaction(mesh);
+    reused = mesh.add_point(4.f, 0.f, 0.f);
+    appended = mesh.add_point(5.f, 0.f, 0.f);
+    delta = transaction.commit();
+  }
+  REQUIRE(reused.offset == b.offset);
+  REQUIRE(delta.undo(mesh));
+  REQUIRE(mesh.point_count() == 2);
+
+  // Indices to the undone elements don't resolve and can't be removed again.
+  REQUIRE_FALSE(mesh.point(reused));
+  REQUIRE_FALSE(mesh.point(appended));
+  mesh.kernel->remove(reused);
+  mesh.kernel->remove(appended);
+  REQUIRE(mesh.point_count() == 2);
+  auto c = mesh.add_point(6.f, 0.f, 0.f);
+  auto d = mesh.add_point(7.f, 0.f, 0.f);
+  REQUIRE(c.offset != d.offset);
+  REQUIRE(mesh.point_count() == 4);
+  REQUIRE(mesh.point(a)->position.x == 1.f);
+
+  // Nor once later emplaces have taken their cells again.
+  REQUIRE(c.offset == reused.offset);
+  REQUIRE(d.offset == appended.offset);
+  REQUIRE_FALSE(mesh.point(reused));
+  REQUIRE_FALSE(mesh.point(appended));
+  REQUIRE(mesh.point(c)->position.x == 6.f);
+  REQUIRE(mesh.point(d)->position.x == 7.f);
+}
+
+std::vector<float> point_xs(hedge::mesh_t& mesh) {
+  std::vector<float> xs;
+  for (auto pindex : mesh.points()) {
+    xs.push_back(mesh.point(pindex)->position.x);
+  }
+  return xs;
+}
+
+void check_redo_into_freed_cells(hedge::kernel_t::ptr_t&& kernel) {
+  hedge::mesh_t mesh(std::move(kernel));
+  mesh.add_point(1.f, 0.f, 0.f);
+  auto b = mesh.add_point(2.f, 0.f, 0.f);
+  auto c = mesh.add_point(3.f, 0.f, 0.f);
+  mesh.add_point(4.f, 0.f, 0.f);
+
+  // The cells were free before the transaction took them.
+  mesh.kernel->remove(b);
+  mesh.kernel->remove(c);
+  hedge::mesh_delta_t delta;
+  hedge::point_index_t first, second;
+  {
+    hedge::transaction_t transaction(mesh);
+    first = mesh.add_point(5.f, 0.f, 0.f);
+    second = mesh.add_point(6.f, 0.f, 0.f);
+    delta = transaction.commit();
+  }
+  REQUIRE(first.offset == c.offset);
+  REQUIRE(second.offset == b.offset);
+  const auto edited = point_xs(mesh);
+
+  // Redo puts the elements back in their cells under their old indices.
+  REQUIRE(delta.undo(mesh));
+  REQUIRE(mesh.point_count() == 2);
+  REQUIRE(delta.redo(mesh));
+  REQUIRE(point_xs(mesh) == edited);
+  REQUIRE(mesh.point(first)->position.x == 5.f);
+  REQUIRE(mesh.point(second)->position.x == 6.f);
+
+  // Unrecorded edits that leave the counts and the cells alone but shuffle
+  // the free list make the second creation miss its cell halfway through
+  // the redo, which then takes the first one back as well.
+  REQUIRE(delta.undo(mesh));
+  auto x = mesh.add_point(7.f, 0.f, 0.f);
+  auto y = mesh.add_point(8.f, 0.f, 0.f);
+  auto z = mesh.add_point(9.f, 0.f, 0.f);
+  mesh.kernel->remove(y);
+  mesh.kernel->remove(z);
+  mesh.kernel->remove(x);
+  const auto undone = point_xs(mesh);
+  REQUIRE(mesh.point_count() == 2);
+  REQUIRE_FALSE(delta.redo(mesh));
+  REQUIRE(mesh.point_count() == 2);
+  REQUIRE(point_xs(mesh) == undone);
+  REQUIRE_FALSE(mesh.point(first));
+  REQUIRE_FALSE(mesh.point(second));
+  REQUIRE(mesh.add_point(10.f, 0.f, 0.f).offset == first.offset);
+}
+
+} // namespace
+
+TEST_CASE( "Indices to undone emplaces go stale on every kernel", "[transaction]" ) {
+  check_stale_after_undo(hedge::make_basic_kernel(hedge::validation_t::checked_silent));
+  check_stale_after_undo(hedge::make_soa_kernel(hedge::validation_t::checked_silent));
+  check_stale_after_undo(hedge::make_versioned_kernel(hedge::validation_t::checked_silent));
+}
+
+TEST_CASE( "Redo puts elements back in cells that were free before the transaction", "[transaction]" ) {
+  check_redo_into_freed_cells(hedge::make_basic_kernel(hedge::validation_t::checked_silent));
+  check_redo_into_freed_cells(hedge::make_soa_kernel(hedge::validation_t::checked_silent));
+  check_redo_into_freed_cells(hedge::make_versioned_kernel(hedge::validation_t::checked_silent));
+}
+
+namespace {
+
+void build_torus(hedge::mesh_t& mesh, uint32_t around, uint32_t across) {
+  std::vector<hedge::position_t> positions;
+  std::vector<uint32_t> indices;
+  for (uint32_t u = 0; u < around; ++u) {
+    const float a = 6.2831853f * u / around;
+    for (uint32_t v = 0; v < across; ++v) {
+      const float b = 6.2831853f * v / across;
+      const float r = 3.f + std::cos(b);
+      positions.emplace_back(r * std::cos(a), r * std::sin(a), std::sin(b));
+    }
+  }
+  for (uint32_t u = 0; u < around; ++u) {
+    for (uint32_t v = 0; v < across; ++v) {
+      const uint32_t i = u * across + v;
+      const uint32_t j = ((u + 1) % around) * across + v;
+      const uint32_t k = ((u + 1) % around) * across + (v + 1) % across;
+      const uint32_t l = u * across + (v + 1) % across;
+      indices.insert(indices.end(), { i, j, k, i, k, l });
+    }
+  }
+  REQUIRE(mesh.build_from_indexed(positions, indices));
+}
+
+/**
+   Checks that every face is a closed loop of the given number of corners,
+   that adjacent edges pair up in opposite directions and that every vertex
+   leads out along one of its own edges. Returns the number of boundary edges.
+ */
+size_t check_linked_mesh(hedge::mesh_t& mesh, size_t corners = 3) {
+  auto edges = mesh.kernel->edge_table();
+  auto faces = mesh.kernel->face_table();
+  auto vertices = mesh.kernel->vertex_table();
+  size_t boundary = 0;
+  for (auto eindex : mesh.edges()) {
+    auto next = edges.next_index[eindex.offset];
+    REQUIRE(edges.prev_index[next.offset] == eindex);
+    auto last = next;
+    for (size_t corner = 2; corner < corners; ++corner) {
+      last = edges.next_index[last.offset];
+    }
+    REQUIRE(edges.next_index[last.offset] == eindex);
+    REQUIRE(edges.face_index[next.offset] == edges.face_index[eindex.offset]);
+    REQUIRE(faces.contains(edges.face_index[eindex.offset]));
+    REQUIRE(vertices.contains(edges.vertex_index[eindex.offset]));
+    auto adjacent = edges.adjacent_index[eindex.offset];
+    if (!adjacent) {
+      ++boundary;
+      continue;
+    }
+    REQUIRE(edges.contains(adjacent));
+    REQUIRE(edges.adjacent_index[adjacent.offset] == eindex);
+    REQUIRE(edges.vertex_index[adjacent.offset] == edges.vertex_index[next.offset]);
+  }
+  for (auto vindex : mesh.vertices()) {
+    auto eindex = vertices.edge_index[vindex.offset];
+    REQUIRE(edges.contains(eindex));
+    REQUIRE(edges.vertex_index[eindex.offset] == vindex);
+  }
+  return boundary;
+}
+
+} // namespace
+
+TEST_CASE( "Simplification keeps flat grids flat and their outline in place", "[simplify]" ) {
+  hedge::mesh_t mesh;
+  build_grid(mesh, 16);
+
+  hedge::simplify_options_t options;
+  options.target_faces = 64;
+  auto report = hedge::simplify(mesh, options);
+  REQUIRE(report.faces_before == 512);
+  REQUIRE(report.faces_after == mesh.face_count());
+  REQUIRE(report.faces_after <= 64);
+  REQUIRE(report.faces_after >= 62);
+  REQUIRE(report.max_error < 1e-6);
+  REQUIRE(check_linked_mesh(mesh) > 0);
+
+  hedge::position_t lo(FLT_MAX, FLT_MAX, FLT_MAX);
+  hedge::position_t hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for (auto pindex : mesh.points()) {
+    auto& position = mesh.point(pindex)->position;
+    REQUIRE(position.z == Approx(0.f).margin(1e-5));
+    lo = hedge::position_t::Min(lo, position);
+    hi = hedge::position_t::Max(hi, position);
+  }
+  REQUIRE(lo.x == Approx(0.f).margin(1e-4));
+  REQUIRE(lo.y == Approx(0.f).margin(1e-4));
+  REQUIRE(hi.x == Approx(16.f).margin(1e-4));
+  REQUIRE(hi.y == Approx(16.f).margin(1e-4));
+}
+
+TEST_CASE( "Simplification keeps closed meshes closed and stops at the error bound", "[simplify]" ) {
+  hedge::mesh_t torus(hedge::make_soa_kernel());
+  build_torus(torus, 32, 16);
+  hedge::simplify_options_t options;
+  options.target_faces = 200;
+  auto report = hedge::simplify(torus, options);
+  REQUIRE(report.faces_after <= 200);
+  REQUIRE(report.collapses > 0);
+  REQUIRE(check_linked_mesh(torus) == 0);
+  REQUIRE(torus.vertex_count() + torus.face_count() == torus.edge_count() / 2);
+
+  hedge::mesh_t grid;
+  build_wavy_grid(grid, 24);
+  options.target_faces = 0;
+  options.max_error = 1e-3;
+  report = hedge::simplify(grid, options);
+  REQUIRE(report.collapses > 0);
+  REQUIRE(report.faces_after > 24);
+  REQUIRE(report.max_error <= 1e-3);
+  check_linked_mesh(grid);
+
+  // Edges whose quadrics have no finite cost anywhere stay where they are.
+  hedge::mesh_t broken;
+  build_wavy_grid(broken, 12);
+  auto pindex = *broken.points().begin();
+  broken.point(pindex)->position.x = NAN;
+  options.max_error = DBL_MAX;
+  report = hedge::simplify(broken, options);
+  REQUIRE(report.collapses > 0);
+  REQUIRE(std::isfinite(report.max_error));
+  REQUIRE(broken.point(pindex) != nullptr);
+  REQUIRE(std::isnan(broken.point(pindex)->position.x));
+  check_linked_mesh(broken);
+}
+
+TEST_CASE( "Simplification runs partitions side by side and records into transactions", "[simplify]" ) {
+  hedge::mesh_t mesh;
+  build_wavy_grid(mesh, 40);
+  hedge::simplify_options_t options;
+  options.target_faces = 600;
+  options.thread_count = 4;
+  auto report = hedge::simplify(mesh, options);
+  REQUIRE(report.faces_after <= 600);
+  REQUIRE(report.faces_after == mesh.face_count());
+  check_linked_mesh(mesh);
+
+  // Partitions copy the pages they share with a snapshot before they start.
+  hedge::mesh_t versioned(hedge::make_versioned_kernel());
+  build_wavy_grid(versioned, 40);
+  hedge::mesh_t snapshot(versioned.kernel->snapshot());
+  const auto taken = mesh_state(snapshot);
+  report = hedge::simplify(versioned, options);
+  REQUIRE(report.faces_after <= 600);
+  check_linked_mesh(versioned);
+  REQUIRE(mesh_state(snapshot) == taken);
+
+  hedge::mesh_t edited(hedge::make_versioned_kernel());
+  build_wavy_grid(edited, 12);
+  const auto original = mesh_state(edited);
+  hedge::transaction_t transaction(edited);
+  options.target_faces = 100;
+  report = hedge::simplify(edited, options);
+  REQUIRE(report.faces_after <= 100);
+  check_linked_mesh(edited);
+  auto delta = transaction.commit();
+  REQUIRE(delta.undo(edited));
+  REQUIRE(mesh_state(edited) == original);
+  REQUIRE(delta.redo(edited));
+  REQUIRE(edited.face_count() == report.faces_after);
+  check_linked_mesh(edited);
+}
+
+TEST_CASE( "Simplification removes the corners and points it no longer uses", "[simplify]" ) {
+  for (size_t threads : { 1, 4 }) {
+    // Triangles added one at a time give every corner its own vertex.
+    hedge::mesh_t mesh;
+    std::vector<hedge::point_index_t> points;
+    for (auto& position : grid_positions(12, false)) {
+      points.push_back(mesh.add_point(position.x, position.y, position.z));
+    }
+    const auto indices = grid_indices(12);
+    for (size_t at = 0; at < indices.size(); at += 3) {
+      mesh.add_triangle(points[indices[at]], points[indices[at + 1]], points[indices[at + 2]]);
+    }
+    hedge::link_adjacent_edges(mesh);
+    REQUIRE(mesh.vertex_count() == 864);
+
+    hedge::simplify_options_t options;
+    options.target_faces = 72;
+    options.thread_count = threads;
+    auto report = hedge::simplify(mesh, options);
+    REQUIRE(report.faces_after <= 72);
+
+    auto edges = mesh.kernel->edge_table();
+    auto vertices = mesh.kernel->vertex_table();
+    std::set<hedge::offset_t> used_vertices, used_points;
+    for (auto eindex : mesh.edges()) {
+      auto vindex = edges.vertex_index[eindex.offset];
+      REQUIRE(vertices.contains(vindex));
+      used_vertices.insert(vindex.offset);
+      used_points.insert(vertices.point_index[vindex.offset].offset);
+    }
+    REQUIRE(mesh.vertex_count() == used_vertices.size());
+    REQUIRE(mesh.point_count() == used_points.size());
+  }
+}
+
+TEST_CASE( "Loop subdivision splits every triangle in four the same way on any thread count", "[subdivide]" ) {
+  hedge::mesh_t torus;
+  build_torus(torus, 12, 8);
+  hedge::mesh_t serial;
+  REQUIRE(hedge::subdivide_loop(torus, serial, 1));
+  REQUIRE(serial.face_count() == torus.face_count() * 4);
+  REQUIRE(serial.edge_count() == torus.edge_count() * 4);
+  REQUIRE(serial.vertex_count() == torus.vertex_count() + torus.edge_count() / 2);
+  REQUIRE(check_linked_mesh(serial) == 0);
+
+  hedge::mesh_t parallel(hedge::make_soa_kernel());
+  REQUIRE(hedge::subdivide_loop(torus, parallel, 4));
+  REQUIRE(mesh_state(parallel) == mesh_state(serial));
+
+  // Cells freed in the source don't leave gaps in the result.
+  hedge::simplify_options_t options;
+  options.target_faces = 100;
+  hedge::simplify(torus, options);
+  hedge::mesh_t holes;
+  REQUIRE(hedge::subdivide_loop(torus, holes));
+  REQUIRE(holes.face_count() == torus.face_count() * 4);
+  REQUIRE(holes.kernel->face_table().size == holes.face_count() + 1);
+  REQUIRE(check_linked_mesh(holes) == 0);
+
+  // Regular vertices of a flat grid and its straight boundary stay put.
+  hedge::mesh_t grid;
+  build_grid(grid, 4);
+  hedge::mesh_t fine;
+  REQUIRE(hedge::subdivide_loop(grid, fine, 2));
+  REQUIRE(check_linked_mesh(fine) == 32);
+  for (auto pindex : fine.points()) {
+    REQUIRE(fine.point(pindex)->position.z == 0.f);
+  }
+  REQUIRE(fine.point(hedge::point_index_t(7))->position.x == Approx(1.f));
+  REQUIRE(fine.point(hedge::point_index_t(7))->position.y == Approx(1.f));
+
+  REQUIRE_FALSE(hedge::subdivide_loop(grid, fine));
+  REQUIRE_FALSE(hedge::subdivide_loop(grid, grid));
+}
+
+TEST_CASE( "Catmull-Clark subdivision turns every corner into a quad", "[subdivide]" ) {
+  hedge::mesh_t cube;
+  std::vector<hedge::position_t> corners;
+  for (int i = 0; i < 8; ++i) {
+    corners.emplace_back(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : -1.f);
+  }
+  REQUIRE(cube.build_from_indexed(corners, {
+    0, 2, 3, 1,  4, 5, 7, 6,  0, 1, 5, 4,  2, 6, 7, 3,  0, 4, 6, 2,  1, 3, 7, 5
+  }, { 4, 4, 4, 4, 4, 4 }));
+
+  hedge::mesh_t once;
+  REQUIRE(hedge::subdivide_catmull_clark(cube, once, 3));
+  REQUIRE(once.face_count() == 24);
+  REQUIRE(once.vertex_count() == 8 + 12 + 6);
+  REQUIRE(check_linked_mesh(once, 4) == 0);
+  // Corners pull in to 5/9, edge points to 3/4, face points stay put.
+  for (uint32_t i = 1; i <= 8; ++i) {
+    auto& position = once.point(hedge::point_index_t(i))->position;
+    REQUIRE(std::abs(position.x) == Approx(5.f / 9.f));
+    REQUIRE(std::abs(position.z) == Approx(5.f / 9.f));
+  }
+  REQUIRE(once.point(hedge::point_index_t(8 + 12 + 1))->position.LengthSquared() == Approx(1.f));
+
+  hedge::mesh_t twice(hedge::make_soa_kernel());
+  REQUIRE(hedge::subdivide_catmull_clark(once, twice, 0));
+  REQUIRE(twice.face_count() == 96);
+  REQUIRE(check_linked_mesh(twice, 4) == 0);
+  REQUIRE(twice.vertex_count() + twice.face_count() == twice.edge_count() / 2 + 2);
+
+  // Triangles become three quads each, the open boundary stays linked.
+  hedge::mesh_t grid;
+  build_wavy_grid(grid, 6);
+  hedge::mesh_t quads;
+  REQUIRE(hedge::subdivide_catmull_clark(grid, quads));
+  REQUIRE(quads.face_count() == grid.face_count() * 3);
+  REQUIRE(check_linked_mesh(quads, 4) == 24 * 2);
+
+  hedge::mesh_t loop;
+  REQUIRE_FALSE(hedge::subdivide_loop(cube, loop));
+}
+
+namespace {
+
+/**
+   Checks that the hull is closed and convex with every point inside or on
+   it, returning the number of points at its corners.
+ */
+size_t check_hull(hedge::mesh_t& hull, const std::vector<hedge::position_t>& points) {
+  REQUIRE(check_linked_mesh(hull) == 0);
+  REQUIRE(hull.vertex_count() + hull.face_count() == hull.edge_count() / 2 + 2);
+  REQUIRE(hull.point_count() == hull.vertex_count());
+  auto edges = hull.kernel->edge_table();
+  auto faces = hull.kernel->face_table();
+  auto vertices = hull.kernel->vertex_table();
+  auto positions = hull.kernel->point_table();
+  size_t outside = 0;
+  for (auto findex : hull.faces()) {
+    auto first = faces.edge_index[findex.offset];
+    auto a = hedge::corner_position(edges, vertices, positions, first);
+    auto normal = hedge::face_vector_area(edges, vertices, positions, first).Normalized();
+    for (const auto& point : points) {
+      outside += hedge::position_t::DotProduct(normal, point - a) >= 1e-4f;
+    }
+  }
+  REQUIRE(outside == 0);
+  return hull.point_count();
+}
+
+std::vector<hedge::position_t> sphere_points(size_t count, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::normal_distribution<float> normal;
+  std::vector<hedge::position_t> points;
+  for (size_t i = 0; i < count; ++i) {
+    points.push_back(hedge::position_t(normal(random), normal(random), normal(random)).Normalized() * 4.f);
+  }
+  return points;
+}
+
+} // namespace
+
+TEST_CASE( "Quickhull wraps point clouds in closed convex meshes", "[hull]" ) {
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> inside(-0.99f, 0.99f);
+  std::vector<hedge::position_t> cube;
+  for (int i = 0; i < 2000; ++i) {
+    cube.emplace_back(inside(random), inside(random), inside(random));
+  }
+  for (int i = 0; i < 8; ++i) {
+    cube.emplace_back(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : -1.f);
+  }
+  hedge::mesh_t box;
+  REQUIRE(hedge::build_convex_hull(box, cube));
+  REQUIRE(check_hull(box, cube) == 8);
+  REQUIRE(box.face_count() == 12);
+
+  auto sphere = sphere_points(500, 3);
+  hedge::mesh_t ball(hedge::make_soa_kernel());
+  REQUIRE(hedge::build_convex_hull(ball, sphere));
+  REQUIRE(check_hull(ball, sphere) == 500);
+  REQUIRE(ball.face_count() == 996);
+
+  // Faces get replaced all the time but the free cells are taken again.
+  REQUIRE(ball.kernel->face_table().size < ball.face_count() * 2);
+
+  std::vector<hedge::position_t> flat = { { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 1.f, 1.f, 0.f } };
+  hedge::mesh_t none;
+  REQUIRE_FALSE(hedge::build_convex_hull(none, flat));
+  REQUIRE_FALSE(hedge::build_convex_hull(box, sphere));
+  hedge::mesh_t grid;
+  build_wavy_grid(grid, 2);
+  REQUIRE_FALSE(hedge::extend_convex_hull(grid, sphere));
+}
+
+TEST_CASE( "Convex hulls take more points incrementally", "[hull]" ) {
+  auto sphere = sphere_points(300, 11);
+  const std::vector<hedge::position_t> first_half(sphere.begin(), sphere.begin() + 150);
+  const std::vector<hedge::position_t> second_half(sphere.begin() + 150, sphere.end());
+
+  hedge::mesh_t hull;
+  REQUIRE(hedge::build_convex_hull(hull, first_half));
+  REQUIRE(check_hull(hull, first_half) == 150);
+  REQUIRE(hedge::extend_convex_hull(hull, second_half));
+  REQUIRE(check_hull(hull, sphere) == 300);
+
+  // One at a time, and points already inside change nothing.
+  hedge::mesh_t single;
+  REQUIRE(hedge::build_convex_hull(single, first_half));
+  for (const auto& point : second_half) {
+    REQUIRE(hedge::extend_convex_hull(single, { point }));
+  }
+  REQUIRE(check_hull(single, sphere) == 300);
+  const auto before = mesh_state(single);
+  REQUIRE(hedge::extend_convex_hull(single, { hedge::position_t(0.f, 0.f, 0.f), sphere[5] * 0.5f }));
+  REQUIRE(mesh_state(single) == before);
+
+  // Extending inside a transaction can be undone.
+  const std::vector<hedge::position_t> far = { { 10.f, 0.f, 0.f }, { 0.f, -10.f, 0.f } };
+  hedge::transaction_t transaction(single);
+  REQUIRE(hedge::extend_convex_hull(single, far));
+  sphere.insert(sphere.end(), far.begin(), far.end());
+  check_hull(single, sphere);
+  auto delta = transaction.commit();
+  REQUIRE(delta.undo(single));
+  REQUIRE(mesh_state(single) == before);
+}
+
+TEST_CASE( "Convex hulls extend meshes that give every corner its own vertex", "[hull]" ) {
+  hedge::mesh_t hull;
+  std::vector<hedge::position_t> points = { { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f } };
+  std::vector<hedge::point_index_t> pindices;
+  for (const auto& point : points) {
+    pindices.push_back(hull.add_point(point.x, point.y, point.z));
+  }
+  const uint32_t triangles[4][3] = { { 0, 2, 1 }, { 0, 1, 3 }, { 0, 3, 2 }, { 1, 2, 3 } };
+  for (const auto& triangle : triangles) {
+    hull.add_triangle(pindices[triangle[0]], pindices[triangle[1]], pindices[triangle[2]]);
+  }
+  hedge::link_adjacent_edges(hull);
+  REQUIRE(hull.vertex_count() == 12);
+
+  // The point sees the bottom and the slanted face, so the horizon crosses
+  // corners of faces that stay and of faces that go.
+  points.emplace_back(1.f, 1.f, -0.1f);
+  REQUIRE(hedge::extend_convex_hull(hull, { points.back() }));
+  REQUIRE(hull.face_count() == 6);
+  REQUIRE(hull.point_count() == 5);
+
+  auto check = [&hull, &points]() {
+    auto edges = hull.kernel->edge_table();
+    auto faces = hull.kernel->face_table();
+    auto vertices = hull.kernel->vertex_table();
+    auto positions = hull.kernel->point_table();
+    std::set<hedge::offset_t> used;
+    for (auto eindex : hull.edges()) {
+      auto vindex = edges.vertex_index[eindex.offset];
+      REQUIRE(vertices.contains(vindex));
+      REQUIRE(positions.contains(vertices.point_index[vindex.offset]));
+      used.insert(vindex.offset);
+      auto adjacent = edges.adjacent_index[eindex.offset];
+      REQUIRE(edges.contains(adjacent));
+      REQUIRE(edges.adjacent_index[adjacent.offset] == eindex);
+      auto next = edges.vertex_index[edges.next_index[eindex.offset].offset];
+      REQUIRE(vertices.point_index[edges.vertex_index[adjacent.offset].offset] == vertices.point_index[next.offset]);
+    }
+    REQUIRE(hull.vertex_count() == used.size());
+    for (auto vindex : hull.vertices()) {
+      REQUIRE(edges.vertex_index[vertices.edge_index[vindex.offset].offset] == vindex);
+    }
+    for (auto findex : hull.faces()) {
+      auto first = faces.edge_index[findex.offset];
+      auto a = hedge::corner_position(edges, vertices, positions, first);
+      auto normal = hedge::face_vector_area(edges, vertices, positions, first).Normalized();
+      for (const auto& point : points) {
+        REQUIRE(hedge::position_t::DotProduct(normal, point - a) < 1e-4f);
+      }
+    }
+  };
+  check();
+
+  // Corners the cone reuses and the ones it leaves inside hold up over many
+  // more points.
+  auto sphere = sphere_points(200, 5);
+  points.insert(points.end(), sphere.begin(), sphere.end());
+  REQUIRE(hedge::extend_convex_hull(hull, sphere));
+  REQUIRE(hull.point_count() == 200);
+  check();
+}
+
+namespace {
+
+std::vector<hedge::ray_t> random_rays(size_t count, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> around(-6.f, 6.f);
+  auto sphere = sphere_points(count, seed + 1);
+  std::vector<hedge::ray_t> rays;
+  for (size_t i = 0; i < count; ++i) {
+    const hedge::position_t origin(around(random), around(random), around(random));
+    rays.emplace_back(origin, sphere[i] * 0.25f, i % 4 == 0 ? 6.f : FLT_MAX);
+  }
+  return rays;
+}
+
+/**
+   Checks the queries of a tree against one that keeps every triangle in a
+   single leaf and so tests them all. Returns the number of rays that hit.
+ */
+size_t check_bvh(const hedge::face_bvh_t& bvh, hedge::mesh_t& mesh, const std::vector<hedge::ray_t>& rays) {
+  hedge::bvh_options_t options;
+  options.leaf_size = size_t(-1);
+  hedge::face_bvh_t flat(options);
+  flat.build(mesh);
+  REQUIRE(flat.node_count() == 1);
+  REQUIRE(flat.triangle_count() == bvh.triangle_count());
+
+  size_t hits = 0, mismatches = 0;
+  for (const auto& ray : rays) {
+    auto hit = bvh.intersect(ray);
+    auto expected = flat.intersect(ray);
+    mismatches += bool(hit.face) != bool(expected.face) || std::fabs(hit.distance - expected.distance) > 1e-4f;
+    mismatches += hit.face && !mesh.face(hit.face);
+    hits += bool(hit.face);
+
+    auto closest = bvh.closest_point(ray.origin);
+    auto expected_closest = flat.closest_point(ray.origin);
+    mismatches += !closest.face || std::fabs(closest.distance - expected_closest.distance) > 1e-4f;
+    mismatches += std::fabs((closest.position - ray.origin).Length() - closest.distance) > 1e-4f;
+  }
+  REQUIRE(mismatches == 0);
+  return hits;
+}
+
+} // namespace
+
+TEST_CASE( "Face BVHs answer ray and closest point queries", "[bvh]" ) {
+  hedge::mesh_t torus;
+  build_torus(torus, 48, 24);
+  hedge::face_bvh_t bvh;
+  bvh.build(torus);
+  REQUIRE(bvh.triangle_count() == torus.face_count());
+  REQUIRE(bvh.node_count() > 2 * torus.face_count() / 4 - 1);
+  REQUIRE(bvh.node_count() < 2 * torus.face_count());
+
+  const auto rays = random_rays(400, 5);
+  const size_t hits = check_bvh(bvh, torus, rays);
+  REQUIRE(hits > 40);
+  REQUIRE(hits < 360);
+
+  // Straight down through the hole misses, straight down the tube hits its top.
+  REQUIRE_FALSE(bvh.intersect(hedge::ray_t({ 0.f, 0.f, 5.f }, { 0.f, 0.f, -1.f })).face);
+  auto hit = bvh.intersect(hedge::ray_t({ 3.f, 0.f, 5.f }, { 0.f, 0.f, -1.f }));
+  REQUIRE(hit.face);
+  REQUIRE(hit.distance == Approx(4.f).epsilon(0.01));
+  REQUIRE(hit.position.z == Approx(1.f).epsilon(0.01));
+  REQUIRE_FALSE(bvh.intersect(hedge::ray_t({ 3.f, 0.f, 5.f }, { 0.f, 0.f, -1.f }, 3.5f)).face);
+
+  auto closest = bvh.closest_point({ 0.f, 0.f, 0.f });
+  REQUIRE(closest.face);
+  REQUIRE(closest.distance == Approx(2.f).epsilon(0.01));
+  REQUIRE_FALSE(bvh.closest_point({ 0.f, 0.f, 0.f }, 1.5f).face);
+
+  // Quads are fanned into two triangles that both answer for the quad.
+  hedge::mesh_t quads;
+  REQUIRE(hedge::subdivide_catmull_clark(torus, quads));
+  hedge::face_bvh_t quad_bvh;
+  quad_bvh.build(quads);
+  REQUIRE(quad_bvh.triangle_count() == 2 * quads.face_count());
+  check_bvh(quad_bvh, quads, rays);
+
+  hedge::mesh_t empty;
+  hedge::face_bvh_t nothing;
+  nothing.build(empty);
+  REQUIRE(nothing.node_count() == 0);
+  REQUIRE_FALSE(nothing.intersect(rays[0]).face);
+  REQUIRE_FALSE(nothing.closest_point({ 0.f, 0.f, 0.f }).face);
+}
+
+TEST_CASE( "Face BVHs refit after points move and answer batches", "[bvh]" ) {
+  hedge::mesh_t grid(hedge::make_soa_kernel());
+  build_wavy_grid(grid, 40);
+  hedge::bvh_options_t options;
+  options.thread_count = 4;
+  hedge::face_bvh_t bvh(options);
+  bvh.build(grid);
+
+  const hedge::ray_t down({ 12.3f, 17.6f, 10.f }, { 0.f, 0.f, -1.f });
+  const auto before = bvh.intersect(down);
+  REQUIRE(before.face);
+
+  // Lifting every point moves the hits along the rays but not their faces.
+  for (auto pindex : grid.points()) {
+    grid.kernel->get(pindex)->position.z += 2.f;
+  }
+  REQUIRE(bvh.refit(grid));
+  const auto rays = random_rays(300, 9);
+  check_bvh(bvh, grid, rays);
+  const auto after = bvh.intersect(down);
+  REQUIRE(after.face == before.face);
+  REQUIRE(after.distance == Approx(before.distance - 2.f));
+
+  // Batches answer exactly what one query at a time does.
+  std::vector<hedge::ray_hit_t> hits(rays.size());
+  bvh.intersect(rays.data(), hits.data(), rays.size());
+  std::vector<hedge::position_t> origins;
+  for (const auto& ray : rays) {
+    origins.push_back(ray.origin);
+  }
+  std::vector<hedge::closest_point_t> closest(origins.size());
+  bvh.closest_points(origins.data(), closest.data(), origins.size(), 3.f);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < rays.size(); ++i) {
+    auto hit = bvh.intersect(rays[i]);
+    mismatches += hits[i].face != hit.face || hits[i].distance != hit.distance;
+    auto point = bvh.closest_point(origins[i], 3.f);
+    mismatches += closest[i].face != point.face || closest[i].distance != point.distance;
+  }
+  REQUIRE(mismatches == 0);
+
+  // Removing a point leaves its triangles where they were until a rebuild.
+  grid.kernel->remove(*grid.points().begin());
+  REQUIRE_FALSE(bvh.refit(grid));
+}
+
+namespace {
+
+/**
+   The triangles of a mesh added again as a soup, every corner its own point
+   moved by up to jitter along each axis.
+ */
+void build_soup(hedge::mesh_t& soup, hedge::mesh_t& mesh, float jitter = 0.f, uint32_t seed = 1) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> nudge(-jitter, jitter);
+  for (auto findex : mesh.faces()) {
+    std::vector<hedge::point_t> corners;
+    for (auto vindex : mesh.face(findex).vertices()) {
+      auto& position = mesh.point(vindex)->position;
+      corners.emplace_back(position.x + nudge(random), position.y + nudge(random), position.z + nudge(random));
+    }
+    REQUIRE(corners.size() == 3);
+    soup.add_triangle(corners[0], corners[1], corners[2]);
+  }
+}
+
+} // namespace
+
+TEST_CASE( "Welding merges the corners of triangle soups", "[weld]" ) {
+  hedge::mesh_t torus;
+  build_torus(torus, 24, 12);
+  hedge::mesh_t soup;
+  build_soup(soup, torus);
+  REQUIRE(soup.point_count() == torus.face_count() * 3);
+
+  auto report = hedge::weld_points(soup);
+  REQUIRE(report.merged_points == torus.face_count() * 3 - torus.point_count());
+  REQUIRE(report.merged_vertices == report.merged_points);
+  REQUIRE(soup.vertex_count() == torus.vertex_count());
+  REQUIRE(soup.point_count() == torus.point_count());
+  auto links = hedge::link_adjacent_edges(soup);
+  REQUIRE(links.boundary_edges == 0);
+  REQUIRE(links.non_manifold_edges.empty());
+  REQUIRE(check_linked_mesh(soup) == 0);
+
+  // Every point that stays is the first of its group, position and all.
+  std::vector<hedge::point_index_t> kept(soup.points().begin(), soup.points().end());
+  REQUIRE(kept.front().offset == 1);
+  REQUIRE(hedge::weld_points(soup).merged_points == 0);
+
+  // Within a tolerance, jittered corners merge the same way on any number of
+  // threads, while exact welding finds nothing to merge.
+  hedge::mesh_t jittered;
+  build_soup(jittered, torus, 0.002f);
+  REQUIRE(hedge::weld_points(jittered).merged_points == 0);
+  hedge::mesh_t serial;
+  build_soup(serial, torus, 0.002f);
+  hedge::weld_options_t options;
+  options.tolerance = 0.01f;
+  options.thread_count = 4;
+  REQUIRE(hedge::weld_points(jittered, options).merged_points == report.merged_points);
+  options.thread_count = 1;
+  REQUIRE(hedge::weld_points(serial, options).merged_points == report.merged_points);
+  REQUIRE(mesh_state(jittered) == mesh_state(serial));
+  REQUIRE(hedge::link_adjacent_edges(jittered).boundary_edges == 0);
+
+  options.tolerance = -1.f;
+  REQUIRE(hedge::weld_points(jittered, options).merged_points == 0);
+}
+
+TEST_CASE( "Welding inside a transaction can be undone", "[weld]" ) {
+  hedge::mesh_t grid;
+  build_wavy_grid(grid, 6);
+  hedge::mesh_t soup(hedge::make_soa_kernel());
+  build_soup(soup, grid);
+  const auto before = mesh_state(soup);
+
+  hedge::transaction_t transaction(soup);
+  auto report = hedge::weld_points(soup);
+  REQUIRE(report.merged_points == grid.face_count() * 3 - grid.point_count());
+  REQUIRE(soup.point_count() == grid.point_count());
+  auto delta = transaction.commit();
+  REQUIRE(delta.undo(soup));
+  REQUIRE(mesh_state(soup) == before);
+  REQUIRE(delta.redo(soup));
+  REQUIRE(soup.point_count() == grid.point_count());
+  REQUIRE(hedge::link_adjacent_edges(soup).boundary_edges == 6 * 4);
+}
+
+namespace {
+
+void check_properties(hedge::kernel_t::ptr_t&& kernel) {
+  hedge::mesh_t mesh(std::move(kernel));
+  build_wavy_grid(mesh, 8);
+
+  auto colors = mesh.add_property<hedge::point_index_t>("color", hedge::color_t(0.f, 0.f, 0.f, 1.f));
+  auto uvs = mesh.add_property<hedge::vertex_index_t>("uv", mathfu::vec2(-1.f, -1.f));
+  auto tags = mesh.add_property<hedge::face_index_t>("tag", uint32_t(0));
+  auto creases = mesh.add_property<hedge::edge_index_t, float>("crease");
+  REQUIRE(colors);
+  REQUIRE(uvs);
+  REQUIRE(tags);
+  REQUIRE(creases);
+  REQUIRE(colors.size() == mesh.kernel->point_table().size);
+  REQUIRE(colors[*mesh.points().begin()].w == 1.f);
+
+  // Names are per element type and looked up with their value type.
+  REQUIRE_FALSE(mesh.add_property<hedge::point_index_t>("color", 0.f));
+  REQUIRE(mesh.add_property<hedge::face_index_t>("color", 0.f));
+  REQUIRE(mesh.property<hedge::point_index_t, hedge::color_t>("color").data() == colors.data());
+  REQUIRE_FALSE(mesh.property<hedge::point_index_t, float>("color"));
+  REQUIRE_FALSE(mesh.property<hedge::point_index_t, float>("missing"));
+  REQUIRE(mesh.remove_property<hedge::face_index_t>("color"));
+  REQUIRE_FALSE(mesh.remove_property<hedge::face_index_t>("color"));
+
+  uint32_t tag = 0;
+  for (auto findex : mesh.faces()) {
+    tags[findex] = ++tag;
+    for (auto eindex : mesh.face(findex).edges()) {
+      creases[eindex] = float(tag);
+    }
+  }
+  for (auto vindex : mesh.vertices()) {
+    auto& position = mesh.point(vindex)->position;
+    uvs[vindex] = mathfu::vec2(position.x, position.y);
+  }
+  for (auto pindex : mesh.points()) {
+    auto& position = mesh.point(pindex)->position;
+    colors[pindex] = hedge::color_t(position.x, position.y, position.z, 1.f);
+  }
+
+  // A cell taken back off the free list starts over from the initial value.
+  auto extra = mesh.add_point(100.f, 0.f, 0.f);
+  colors[extra] = hedge::color_t(1.f, 1.f, 1.f, 1.f);
+  mesh.kernel->remove(extra);
+  auto reused = mesh.add_point(200.f, 0.f, 0.f);
+  REQUIRE(reused.offset == extra.offset);
+  REQUIRE(colors[reused] == hedge::color_t(0.f, 0.f, 0.f, 1.f));
+  mesh.kernel->remove(reused);
+
+  // Values follow their elements through compaction and reordering.
+  std::vector<hedge::face_index_t> removed;
+  for (auto findex : mesh.faces()) {
+    if (tags[findex] % 3 == 0) {
+      removed.push_back(findex);
+    }
+  }
+  std::vector<std::pair<uint32_t, hedge::face_index_t>> kept;
+  for (auto findex : removed) {
+    mesh.kernel->remove(findex);
+  }
+  for (auto findex : mesh.faces()) {
+    kept.emplace_back(tags[findex], findex);
+  }
+  auto check_values = [&]() {
+    REQUIRE(tags.size() == mesh.kernel->face_table().size);
+    REQUIRE(colors.size() == mesh.kernel->point_table().size);
+    for (auto& entry : kept) {
+      REQUIRE(tags[entry.second] == entry.first);
+      for (auto eindex : mesh.face(entry.second).edges()) {
+        REQUIRE(creases[eindex] == float(entry.first));
+      }
+    }
+    for (auto vindex : mesh.vertices()) {
+      auto& position = mesh.point(vindex)->position;
+      REQUIRE(uvs[vindex] == mathfu::vec2(position.x, position.y));
+      REQUIRE(colors[mesh.kernel->vertex_table().point_index[vindex.offset]].z == position.z);
+    }
+  };
+  auto remap = mesh.kernel->compact();
+  for (auto& entry : kept) {
+    entry.second = remap(entry.second);
+  }
+  check_values();
+  remap = hedge::reorder_for_locality(mesh, hedge::locality_order_t::breadth_first);
+  for (auto& entry : kept) {
+    entry.second = remap(entry.second);
+  }
+  check_values();
+
+  // Undoing a remove brings the cell back with its values.
+  auto pindex = *mesh.points().begin();
+  const auto color = colors[pindex];
+  {
+    hedge::transaction_t transaction(mesh);
+    transaction.remove(pindex);
+    REQUIRE_FALSE(mesh.point(pindex));
+  }
+  REQUIRE(mesh.point(pindex));
+  REQUIRE(colors[pindex] == color);
+}
+
+} // namespace
+
+TEST_CASE( "Property columns stay in step with the elements of every kernel", "[properties]" ) {
+  check_properties(hedge::make_basic_kernel());
+  check_properties(hedge::make_soa_kernel());
+  check_properties(hedge::make_versioned_kernel());
+}
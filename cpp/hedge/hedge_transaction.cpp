@@ -0,0 +1,441 @@
+#include "hedge.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include <easylogging++.h>
+
+namespace hedge {
+
+namespace {
+
+// The fields of a cell go through the tables so the journal works the same
+// over kernels that don't store whole elements. Status and generation belong
+// to the kernel and only change through retract() and restore().
+
+void copy_header(const element_t& from, element_t& to) {
+  to.status = from.status;
+  to.tag = from.tag;
+  to.generation = from.generation;
+}
+
+edge_t load(const edge_table_t& edges, offset_t offset) {
+  edge_t edge;
+  copy_header(edges.element[offset], edge);
+  edge.vertex_index = edges.vertex_index[offset];
+  edge.face_index = edges.face_index[offset];
+  edge.next_index = edges.next_index[offset];
+  edge.prev_index = edges.prev_index[offset];
+  edge.adjacent_index = edges.adjacent_index[offset];
+  return edge;
+}
+
+face_t load(const face_table_t& faces, offset_t offset) {
+  face_t face;
+  copy_header(faces.element[offset], face);
+  face.edge_index = faces.edge_index[offset];
+  return face;
+}
+
+vertex_t load(const vertex_table_t& vertices, offset_t offset) {
+  vertex_t vertex;
+  copy_header(vertices.element[offset], vertex);
+  vertex.point_index = vertices.point_index[offset];
+  vertex.edge_index = vertices.edge_index[offset];
+  return vertex;
+}
+
+point_t load(const point_table_t& points, offset_t offset) {
+  point_t point;
+  copy_header(points.element[offset], point);
+  point.position = points.position[offset];
+  return point;
+}
+
+void store(const edge_table_t& edges, offset_t offset, const edge_t& edge) {
+  edges.element.writable(offset).tag = edge.tag;
+  edges.vertex_index.writable(offset) = edge.vertex_index;
+  edges.face_index.writable(offset) = edge.face_index;
+  edges.next_index.writable(offset) = edge.next_index;
+  edges.prev_index.writable(offset) = edge.prev_index;
+  edges.adjacent_index.writable(offset) = edge.adjacent_index;
+}
+
+void store(const face_table_t& faces, offset_t offset, const face_t& face) {
+  faces.element.writable(offset).tag = face.tag;
+  faces.edge_index.writable(offset) = face.edge_index;
+}
+
+void store(const vertex_table_t& vertices, offset_t offset, const vertex_t& vertex) {
+  vertices.element.writable(offset).tag = vertex.tag;
+  vertices.point_index.writable(offset) = vertex.point_index;
+  vertices.edge_index.writable(offset) = vertex.edge_index;
+}
+
+void store(const point_table_t& points, offset_t offset, const point_t& point) {
+  points.element.writable(offset).tag = point.tag;
+  points.position.writable(offset) = point.position;
+}
+
+bool same_header(const element_t& a, const element_t& b) {
+  return a.status == b.status && a.tag == b.tag && a.generation == b.generation;
+}
+
+bool same(const edge_t& a, const edge_t& b) {
+  return same_header(a, b) && a.vertex_index == b.vertex_index && a.face_index == b.face_index
+    && a.next_index == b.next_index && a.prev_index == b.prev_index && a.adjacent_index == b.adjacent_index;
+}
+
+bool same(const face_t& a, const face_t& b) {
+  return same_header(a, b) && a.edge_index == b.edge_index;
+}
+
+bool same(const vertex_t& a, const vertex_t& b) {
+  return same_header(a, b) && a.point_index == b.point_index && a.edge_index == b.edge_index;
+}
+
+bool same(const point_t& a, const point_t& b) {
+  return same_header(a, b) && a.position.x == b.position.x && a.position.y == b.position.y
+    && a.position.z == b.position.z;
+}
+
+size_t element_count(const kernel_t& kernel, edge_index_t) {
+  return kernel.edge_count();
+}
+size_t element_count(const kernel_t& kernel, face_index_t) {
+  return kernel.face_count();
+}
+size_t element_count(const kernel_t& kernel, vertex_index_t) {
+  return kernel.vertex_count();
+}
+size_t element_count(const kernel_t& kernel, point_index_t) {
+  return kernel.point_count();
+}
+
+/**
+   An element the journal wants back in a cell: inactive ones only need the
+   cell not to be in use, active ones need the same generation, compared the
+   way indices compare it.
+ */
+template<typename TIndex, typename TTable, typename TElement>
+bool cell_matches(const TTable& table, offset_t offset, const TElement& expected) {
+  const bool active = offset < table.size && table.element[offset].status == element_status_t::ACTIVE;
+  if (expected.status != element_status_t::ACTIVE) {
+    return !active;
+  }
+  return active && is_same_generation(table.element[offset].generation, TIndex(0, expected.generation).generation);
+}
+
+template<typename TIndex, typename TJournal>
+bool journal_matches(kernel_t& kernel, const TJournal& journal, bool after) {
+  if (element_count(kernel, TIndex()) != (after ? journal.count_after : journal.count_before)) {
+    return false;
+  }
+  auto table = element_traits_t<TIndex>::table(kernel);
+  for (auto& image : journal.images) {
+    if (!cell_matches<TIndex>(table, image.offset, after ? image.after : image.before)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+   Takes back the first count changes of the journal, newest first.
+ */
+template<typename TIndex, typename TJournal>
+bool unwind_changes(kernel_t& kernel, const TJournal& journal, size_t count) {
+  while (count-- > 0) {
+    auto& change = journal.changes[count];
+    const TIndex index(change.offset, change.generation);
+    if (!(change.created ? kernel.retract(index) : kernel.restore(index))) {
+      LOG(ERROR) << "Couldn't take back the " << (change.created ? "creation" : "removal")
+                 << " of cell " << change.offset << ", the kernel's free list has moved on";
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+   Makes the changes again, creations back in the exact cell and generation
+   through restore() since the cell went back on the free list with its
+   generation bumped. Whatever got replayed is taken back again when a change
+   doesn't fit the kernel, so a failed replay leaves the kernel as it was.
+ */
+template<typename TIndex, typename TJournal>
+bool replay_changes(kernel_t& kernel, const TJournal& journal) {
+  for (size_t at = 0; at < journal.changes.size(); ++at) {
+    auto& change = journal.changes[at];
+    const TIndex index(change.offset, change.generation);
+    bool replayed = false;
+    if (change.created) {
+      replayed = kernel.restore(index);
+    }
+    else {
+      auto table = element_traits_t<TIndex>::table(kernel);
+      replayed = table.contains(index) && table.element[index.offset].status == element_status_t::ACTIVE;
+      if (replayed) {
+        kernel.remove(index);
+      }
+    }
+    if (!replayed) {
+      LOG(ERROR) << "Couldn't make the " << (change.created ? "creation" : "removal")
+                 << " of cell " << change.offset << " again, the kernel's free list has moved on";
+      unwind_changes<TIndex>(kernel, journal, at);
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename TIndex, typename TJournal>
+void store_images(kernel_t& kernel, const TJournal& journal, bool after) {
+  auto table = element_traits_t<TIndex>::table(kernel);
+  for (auto& image : journal.images) {
+    auto& element = after ? image.after : image.before;
+    if (element.status == element_status_t::ACTIVE) {
+      store(table, image.offset, element);
+    }
+  }
+}
+
+template<typename TIndex, typename TJournal>
+void close_journal(kernel_t& kernel, TJournal& journal) {
+  journal.count_after = element_count(kernel, TIndex());
+  auto table = element_traits_t<TIndex>::table(kernel);
+  for (auto& image : journal.images) {
+    if (image.offset < table.size) {
+      image.after = load(table, image.offset);
+    }
+    else {
+      image.after.status = element_status_t::INACTIVE;
+    }
+  }
+  // Cells that were touched but came out the same don't need replaying.
+  auto unchanged = [](const typename TJournal::image_t& image) {
+    return same(image.before, image.after);
+  };
+  journal.images.erase(std::remove_if(journal.images.begin(), journal.images.end(), unchanged), journal.images.end());
+}
+
+template<typename TJournal>
+size_t journal_bytes(const TJournal& journal) {
+  return journal.changes.capacity() * sizeof(typename TJournal::change_t)
+    + journal.images.capacity() * sizeof(typename TJournal::image_t);
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool mesh_delta_t::matches(kernel_t& kernel, bool after) const {
+  return journal_matches<edge_index_t>(kernel, _edges, after)
+    && journal_matches<face_index_t>(kernel, _faces, after)
+    && journal_matches<vertex_index_t>(kernel, _vertices, after)
+    && journal_matches<point_index_t>(kernel, _points, after);
+}
+
+bool mesh_delta_t::undo(mesh_t& mesh) const {
+  auto& kernel = *mesh.kernel;
+  if (!matches(kernel, true)) {
+    LOG(ERROR) << "The mesh isn't in the state the edits left it in, they can't be undone";
+    return false;
+  }
+  if (!unwind_changes<edge_index_t>(kernel, _edges, _edges.changes.size())
+      || !unwind_changes<face_index_t>(kernel, _faces, _faces.changes.size())
+      || !unwind_changes<vertex_index_t>(kernel, _vertices, _vertices.changes.size())
+      || !unwind_changes<point_index_t>(kernel, _points, _points.changes.size())) {
+    return false;
+  }
+  store_images<edge_index_t>(kernel, _edges, false);
+  store_images<face_index_t>(kernel, _faces, false);
+  store_images<vertex_index_t>(kernel, _vertices, false);
+  store_images<point_index_t>(kernel, _points, false);
+  return true;
+}
+
+bool mesh_delta_t::redo(mesh_t& mesh) const {
+  auto& kernel = *mesh.kernel;
+  if (!matches(kernel, false)) {
+    LOG(ERROR) << "The mesh isn't in the state the edits were made in, they can't be redone";
+    return false;
+  }
+  // Each journal takes back its own changes when it fails, the ones replayed
+  // before it are taken back here.
+  if (!replay_changes<edge_index_t>(kernel, _edges)) {
+    return false;
+  }
+  if (!replay_changes<face_index_t>(kernel, _faces)) {
+    unwind_changes<edge_index_t>(kernel, _edges, _edges.changes.size());
+    return false;
+  }
+  if (!replay_changes<vertex_index_t>(kernel, _vertices)) {
+    unwind_changes<face_index_t>(kernel, _faces, _faces.changes.size());
+    unwind_changes<edge_index_t>(kernel, _edges, _edges.changes.size());
+    return false;
+  }
+  if (!replay_changes<point_index_t>(kernel, _points)) {
+    unwind_changes<vertex_index_t>(kernel, _vertices, _vertices.changes.size());
+    unwind_changes<face_index_t>(kernel, _faces, _faces.changes.size());
+    unwind_changes<edge_index_t>(kernel, _edges, _edges.changes.size());
+    return false;
+  }
+  store_images<edge_index_t>(kernel, _edges, true);
+  store_images<face_index_t>(kernel, _faces, true);
+  store_images<vertex_index_t>(kernel, _vertices, true);
+  store_images<point_index_t>(kernel, _points, true);
+  return true;
+}
+
+bool mesh_delta_t::empty() const {
+  return _edges.changes.empty() && _edges.images.empty()
+    && _faces.changes.empty() && _faces.images.empty()
+    && _vertices.changes.empty() && _vertices.images.empty()
+    && _points.changes.empty() && _points.images.empty();
+}
+
+size_t mesh_delta_t::bytes() const {
+  return journal_bytes(_edges) + journal_bytes(_faces) + journal_bytes(_vertices) + journal_bytes(_points);
+}
+
+// mesh_delta_t
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+
+transaction_t::transaction_t(mesh_t& mesh)
+  : _mesh(mesh)
+  , _open(false)
+{
+  if (mesh.open_transaction != nullptr) {
+    LOG(ERROR) << "A transaction is already open on this mesh, nothing will be recorded";
+    return;
+  }
+  _open = true;
+  mesh.open_transaction = this;
+  _delta._edges.count_before = mesh.kernel->edge_count();
+  _delta._faces.count_before = mesh.kernel->face_count();
+  _delta._vertices.count_before = mesh.kernel->vertex_count();
+  _delta._points.count_before = mesh.kernel->point_count();
+}
+
+transaction_t::~transaction_t() {
+  if (_open) {
+    rollback();
+  }
+}
+
+template<typename TIndex>
+void transaction_t::save(TIndex index, bool created) {
+  auto& slots = this->slots(index);
+  if (!_open || !index || slots.count(index.offset) != 0) {
+    return;
+  }
+  auto& journal = _delta.journal(index);
+  typename mesh_delta_t::journal_t<TIndex>::image_t image;
+  image.offset = index.offset;
+  if (created) {
+    image.before.status = element_status_t::INACTIVE;
+  }
+  else {
+    auto table = element_traits_t<TIndex>::table(*_mesh.kernel);
+    if (index.offset >= table.size) {
+      return;
+    }
+    image.before = load(table, index.offset);
+  }
+  slots.emplace(offset_t(index.offset), journal.images.size());
+  journal.images.push_back(image);
+}
+
+template<typename TIndex, typename TElement>
+TIndex transaction_t::record_emplace(TElement&& element) {
+  TIndex index = _mesh.kernel->emplace(std::move(element));
+  if (_open && index) {
+    save(index, true);
+    _delta.journal(index).changes.push_back({ index.offset, uint32_t(index.generation), true });
+  }
+  return index;
+}
+
+template<typename TIndex>
+void transaction_t::record_remove(TIndex index) {
+  if (_open) {
+    auto table = element_traits_t<TIndex>::table(*_mesh.kernel);
+    if (!table.contains(index) || table.element[index.offset].status != element_status_t::ACTIVE) {
+      return;
+    }
+    save(index, false);
+    _delta.journal(index).changes.push_back({ index.offset, table.element[index.offset].generation, false });
+  }
+  _mesh.kernel->remove(index);
+}
+
+edge_index_t transaction_t::emplace(edge_t&& edge) {
+  return record_emplace<edge_index_t>(std::move(edge));
+}
+face_index_t transaction_t::emplace(face_t&& face) {
+  return record_emplace<face_index_t>(std::move(face));
+}
+vertex_index_t transaction_t::emplace(vertex_t&& vertex) {
+  return record_emplace<vertex_index_t>(std::move(vertex));
+}
+point_index_t transaction_t::emplace(point_t&& point) {
+  return record_emplace<point_index_t>(std::move(point));
+}
+
+void transaction_t::remove(edge_index_t index) {
+  record_remove(index);
+}
+void transaction_t::remove(face_index_t index) {
+  record_remove(index);
+}
+void transaction_t::remove(vertex_index_t index) {
+  record_remove(index);
+}
+void transaction_t::remove(point_index_t index) {
+  record_remove(index);
+}
+
+void transaction_t::touch(edge_index_t index) {
+  save(index, false);
+}
+void transaction_t::touch(face_index_t index) {
+  save(index, false);
+}
+void transaction_t::touch(vertex_index_t index) {
+  save(index, false);
+}
+void transaction_t::touch(point_index_t index) {
+  save(index, false);
+}
+
+bool transaction_t::is_open() const {
+  return _open;
+}
+
+mesh_delta_t transaction_t::commit() {
+  if (!_open) {
+    return mesh_delta_t();
+  }
+  auto& kernel = *_mesh.kernel;
+  close_journal<edge_index_t>(kernel, _delta._edges);
+  close_journal<face_index_t>(kernel, _delta._faces);
+  close_journal<vertex_index_t>(kernel, _delta._vertices);
+  close_journal<point_index_t>(kernel, _delta._points);
+  _open = false;
+  _mesh.open_transaction = nullptr;
+  return std::move(_delta);
+}
+
+void transaction_t::rollback() {
+  if (_open) {
+    commit().undo(_mesh);
+  }
+}
+
+// transaction_t
+///////////////////////////////////////////////////////////////////////////////
+
+} // namespace hedge
@@ -0,0 +1,830 @@
+#include "hedge.hpp"
+#include "hedge_kernel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+
+#include <easylogging++.h>
+
+namespace hedge {
+
+namespace {
+
+using epoch_t = uint64_t;
+
+constexpr unsigned page_shift = 10;
+constexpr size_t page_cells = size_t(1) << page_shift;
+constexpr epoch_t never = std::numeric_limits<epoch_t>::max();
+
+/**
+   A page the writer stopped using, still visible to the snapshots taken
+   from the epoch it was born in up to the one before it was retired.
+ */
+struct retired_page_t {
+  char* data;
+  epoch_t born;
+  epoch_t retired;
+};
+
+/**
+   The state the writer shares with its snapshots: which epochs are still
+   held by a snapshot and the pages waiting for them to go. Whoever lets go
+   last frees the rest, so snapshots can outlive the writer.
+ */
+struct version_registry_t {
+  std::mutex mutex;
+  std::multiset<epoch_t> snapshots;
+  std::vector<retired_page_t> retired;
+  std::atomic<epoch_t> newest;
+
+  version_registry_t() : newest(0) {}
+
+  ~version_registry_t() {
+    for (auto& page : retired) {
+      ::operator delete(page.data);
+    }
+  }
+
+  void retire(const retired_page_t& page) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retired.push_back(page);
+  }
+
+  void acquire(epoch_t epoch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshots.insert(epoch);
+    newest.store(*snapshots.rbegin(), std::memory_order_release);
+  }
+
+  void release(epoch_t epoch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshots.erase(snapshots.find(epoch));
+    newest.store(snapshots.empty() ? 0 : *snapshots.rbegin(), std::memory_order_release);
+    reclaim();
+  }
+
+  /**
+     Frees the retired pages no live snapshot can see, has to be called
+     with the mutex held.
+   */
+  void reclaim() {
+    auto kept = std::remove_if(retired.begin(), retired.end(), [this](const retired_page_t& page) {
+      auto held = snapshots.lower_bound(page.born);
+      if (held != snapshots.end() && *held < page.retired) {
+        return false;
+      }
+      ::operator delete(page.data);
+      return true;
+    });
+    retired.erase(kept, retired.end());
+  }
+};
+
+/**
+   The writer's epoch, which is the one the next snapshot gets, and the
+   registry it shares with the snapshots.
+ */
+struct version_clock_t {
+  epoch_t current;
+  std::shared_ptr<version_registry_t> registry;
+
+  version_clock_t()
+    : current(1)
+    , registry(std::make_shared<version_registry_t>())
+  {}
+
+  /**
+     A page born in an epoch that a live snapshot has already been taken
+     in is shared with it. Releases on other threads can only make the
+     answer stale towards sharing, which costs a copy but never a torn read.
+   */
+  bool is_shared(epoch_t born) const {
+    return born <= registry->newest.load(std::memory_order_acquire);
+  }
+};
+
+/**
+   The pages of one element type as a snapshot sees them.
+ */
+struct page_view_t {
+  std::vector<char*> pages;
+  size_t size;
+  size_t count;
+
+  page_view_t() : size(0), count(0) {}
+};
+
+template<typename TElement>
+TElement* page_cell(char* const* pages, offset_t offset) {
+  return reinterpret_cast<TElement*>(pages[offset >> page_shift]) + (offset & (page_cells - 1));
+}
+
+/**
+   Tables over pages, the writer hears about every page written through
+   them. Snapshots hand out tables without one.
+ */
+template<typename TTable, typename TElement>
+TTable paged_table(const std::vector<char*>& pages, size_t size, validator_t validator, page_writer_t* writer) {
+  TTable table;
+  table.size = size;
+  table.element = column_t<element_t>(pages.data(), page_shift, 0, sizeof(TElement), writer);
+  table.validator = validator;
+  return table;
+}
+
+template<typename TField, typename TElement>
+column_t<TField> paged_column(const std::vector<char*>& pages, TField TElement::*field, page_writer_t* writer) {
+  static const TElement probe{};
+  const size_t offset = reinterpret_cast<const char*>(&(probe.*field)) - reinterpret_cast<const char*>(&probe);
+  return column_t<TField>(pages.data(), page_shift, offset, sizeof(TElement), writer);
+}
+
+template<typename TTable>
+TTable edge_columns(TTable table, const std::vector<char*>& pages, page_writer_t* writer) {
+  table.vertex_index = paged_column(pages, &edge_t::vertex_index, writer);
+  table.face_index = paged_column(pages, &edge_t::face_index, writer);
+  table.next_index = paged_column(pages, &edge_t::next_index, writer);
+  table.prev_index = paged_column(pages, &edge_t::prev_index, writer);
+  table.adjacent_index = paged_column(pages, &edge_t::adjacent_index, writer);
+  return table;
+}
+
+template<typename TTable>
+TTable face_columns(TTable table, const std::vector<char*>& pages, page_writer_t* writer) {
+  table.edge_index = paged_column(pages, &face_t::edge_index, writer);
+  return table;
+}
+
+template<typename TTable>
+TTable vertex_columns(TTable table, const std::vector<char*>& pages, page_writer_t* writer) {
+  table.point_index = paged_column(pages, &vertex_t::point_index, writer);
+  table.edge_index = paged_column(pages, &vertex_t::edge_index, writer);
+  return table;
+}
+
+template<typename TTable>
+TTable point_columns(TTable table, const std::vector<char*>& pages, page_writer_t* writer) {
+  table.position = paged_column(pages, &point_t::position, writer);
+  return table;
+}
+
+/**
+   The writer's storage for one element type, the same free list scheme as
+   element_vector_t laid over fixed size pages. Every page remembers the
+   epoch it was born in; writing to one that a live snapshot shares copies
+   it first and retires the original to the registry.
+ */
+template<typename TElement, typename TElementIndex>
+class paged_store_t final : public page_writer_t {
+  static_assert(sizeof(TElement) >= sizeof(element_t) + sizeof(offset_t),
+                "element types need room for the free list link past their header");
+  static_assert(alignof(TElement) <= alignof(std::max_align_t),
+                "pages come from operator new which only guarantees the fundamental alignment");
+
+  version_clock_t* _clock;
+  std::vector<char*> _pages;
+  std::vector<epoch_t> _born;
+  size_t _size;
+  offset_t _free_head;
+  size_t _free_count;
+  validator_t _validator;
+
+  char* allocate_page() {
+    return static_cast<char*>(::operator new(page_cells * sizeof(TElement)));
+  }
+
+  void add_page() {
+    _pages.push_back(allocate_page());
+    _born.push_back(_clock->current);
+  }
+
+  void unshare(size_t page) {
+    if (!_clock->is_shared(_born[page])) {
+      return;
+    }
+    char* copy = allocate_page();
+    const size_t used = std::min(page_cells, _size - (page << page_shift));
+    std::memcpy(copy, _pages[page], used * sizeof(TElement));
+    _clock->registry->retire(retired_page_t{ _pages[page], _born[page], _clock->current });
+    _pages[page] = copy;
+    _born[page] = _clock->current;
+  }
+
+  offset_t free_link(offset_t offset) const {
+    offset_t next;
+    std::memcpy(&next, reinterpret_cast<const char*>(cell(offset)) + sizeof(element_t), sizeof(next));
+    return next;
+  }
+
+  void set_free_link(offset_t offset, offset_t next) {
+    std::memcpy(reinterpret_cast<char*>(writable(offset)) + sizeof(element_t), &next, sizeof(next));
+  }
+
+public:
+  paged_store_t(version_clock_t* clock, validator_t validator)
+    : _clock(clock), _size(0), _free_head(0), _free_count(0), _validator(validator)
+  {
+    push_back(TElement{});
+  }
+
+  ~paged_store_t() {
+    // Snapshots may still be reading these, so they go through the registry
+    // like any other retired page. The registry is freed later if need be.
+    std::lock_guard<std::mutex> lock(_clock->registry->mutex);
+    for (size_t page = 0; page < _pages.size(); ++page) {
+      _clock->registry->retired.push_back(retired_page_t{ _pages[page], _born[page], never });
+    }
+    _clock->registry->reclaim();
+  }
+
+  paged_store_t(const paged_store_t&) = delete;
+  paged_store_t& operator=(const paged_store_t&) = delete;
+
+  size_t size() const {
+    return _size;
+  }
+
+  size_t count() const {
+    return _size - _free_count;
+  }
+
+  const std::vector<char*>& pages() const {
+    return _pages;
+  }
+
+  void reserve(size_t elements) {
+    _pages.reserve((elements + page_cells - 1) >> page_shift);
+    _born.reserve(_pages.capacity());
+  }
+
+  TElement* cell(offset_t offset) const {
+    return page_cell<TElement>(_pages.data(), offset);
+  }
+
+  TElement* writable(offset_t offset) {
+    unshare(offset >> page_shift);
+    return cell(offset);
+  }
+
+  void write_page(size_t page) override {
+    unshare(page);
+  }
+
+  /**
+     Copies every page still shared with a snapshot.
+   */
+  void write_pages() override {
+    for (size_t page = 0; page < _pages.size(); ++page) {
+      unshare(page);
+    }
+  }
+
+  TElement* get(TElementIndex index) {
+    if (_validator.is_checked()) {
+      if (index.offset >= _size) {
+        _validator.invalid_offset(index.offset, _size);
+        return nullptr;
+      }
+      const auto generation = cell(index.offset)->generation;
+      if (!is_same_generation(generation, index.generation)) {
+        _validator.generation_mismatch(index.offset, index.generation, generation);
+        return nullptr;
+      }
+    }
+    return writable(index.offset);
+  }
+
+  void resolve(TElementIndex* index, TElement** element) {
+    *element = index->offset < _size ? writable(index->offset) : nullptr;
+    if (*element != nullptr) {
+      index->generation = (*element)->generation;
+    }
+  }
+
+  bool contains(TElementIndex index) const {
+    return index.offset < _size && is_same_generation(cell(index.offset)->generation, index.generation);
+  }
+
+  void push_back(TElement&& element) {
+    if (_size == _pages.size() * page_cells) {
+      add_page();
+    }
+    new (writable(offset_t(_size))) TElement(std::move(element));
+    ++_size;
+  }
+
+  TElementIndex emplace(TElement&& element) {
+    TElementIndex index;
+    if (_free_head != 0) {
+      auto* target = writable(_free_head);
+      element.generation = target->generation;
+      index = TElementIndex(_free_head, target->generation);
+      _free_head = free_link(_free_head);
+      --_free_count;
+      *target = std::move(element);
+    }
+    else if (_size > index_offset_max) {
+      report_storage_exhausted();
+    }
+    else {
+      index.offset = offset_t(_size);
+      index.generation = element.generation;
+      push_back(std::move(element));
+    }
+    return index;
+  }
+
+  void remove(TElementIndex index) {
+    if (contains(index) && cell(index.offset)->status == element_status_t::ACTIVE) {
+      auto* target = writable(index.offset);
+      target->generation++;
+      target->status = element_status_t::INACTIVE;
+      set_free_link(index.offset, _free_head);
+      _free_head = index.offset;
+      ++_free_count;
+    }
+  }
+
+  /**
+     See element_vector_t::retract().
+   */
+  bool retract(TElementIndex index) {
+    if (index.offset == 0 || !contains(index) || cell(index.offset)->status != element_status_t::ACTIVE) {
+      return false;
+    }
+    auto* target = writable(index.offset);
+    target->generation++;
+    target->status = element_status_t::INACTIVE;
+    set_free_link(index.offset, _free_head);
+    _free_head = index.offset;
+    ++_free_count;
+    return true;
+  }
+
+  /**
+     See element_vector_t::restore().
+   */
+  bool restore(TElementIndex index) {
+    if (index.offset == 0 || index.offset != _free_head) {
+      return false;
+    }
+    auto* target = writable(index.offset);
+    _free_head = free_link(index.offset);
+    --_free_count;
+    target->generation = index.generation;
+    target->status = element_status_t::ACTIVE;
+    return true;
+  }
+
+  /**
+     Copies the active elements into fresh pages, the listed ones first like
+     element_vector_t::reorder(). The old pages are all retired at once, so
+     snapshots keep the layout they were taken with.
+   */
+  std::vector<TElementIndex> reorder(const std::vector<offset_t>& order) {
+    std::vector<TElementIndex> remap(_size);
+    std::vector<char*> old_pages;
+    std::vector<epoch_t> old_born;
+    old_pages.swap(_pages);
+    old_born.swap(_born);
+    const size_t old_size = _size;
+    auto old_cell = [&](offset_t offset) {
+      return page_cell<TElement>(old_pages.data(), offset);
+    };
+
+    _size = 0;
+    _free_head = 0;
+    _free_count = 0;
+    push_back(TElement(*old_cell(0)));
+    auto take = [&](offset_t offset) {
+      if (offset == 0 || offset >= old_size || remap[offset]
+          || old_cell(offset)->status != element_status_t::ACTIVE) {
+        return;
+      }
+      remap[offset] = TElementIndex(offset_t(_size), old_cell(offset)->generation);
+      push_back(TElement(*old_cell(offset)));
+    };
+    for (auto offset : order) {
+      take(offset);
+    }
+    for (offset_t offset = 1; offset < old_size; ++offset) {
+      take(offset);
+    }
+
+    std::lock_guard<std::mutex> lock(_clock->registry->mutex);
+    for (size_t page = 0; page < old_pages.size(); ++page) {
+      _clock->registry->retired.push_back(retired_page_t{ old_pages[page], old_born[page], _clock->current });
+    }
+    _clock->registry->reclaim();
+    return remap;
+  }
+
+  page_view_t view() const {
+    page_view_t view;
+    view.pages = _pages;
+    view.size = _size;
+    view.count = count();
+    return view;
+  }
+};
+
+/**
+   A read-only kernel over the pages a versioned kernel had when the
+   snapshot was taken. It holds its epoch in the registry until it goes,
+   which keeps those pages alive however the writer moves on.
+ */
+class snapshot_kernel_t final : public kernel_t {
+  std::shared_ptr<version_registry_t> _registry;
+  epoch_t _epoch;
+  page_view_t _edges;
+  page_view_t _faces;
+  page_view_t _vertices;
+  page_view_t _points;
+  validation_counters_t _counters;
+  validator_t _validator;
+
+  template<typename TElement, typename TIndex>
+  TElement* lookup(const page_view_t& view, TIndex index) const {
+    if (_validator.is_checked()) {
+      if (index.offset >= view.size) {
+        _validator.invalid_offset(index.offset, view.size);
+        return nullptr;
+      }
+      const auto generation = page_cell<TElement>(view.pages.data(), index.offset)->generation;
+      if (!is_same_generation(generation, index.generation)) {
+        _validator.generation_mismatch(index.offset, index.generation, generation);
+        return nullptr;
+      }
+    }
+    return page_cell<TElement>(view.pages.data(), index.offset);
+  }
+
+  template<typename TElement, typename TIndex>
+  void resolve_index(const page_view_t& view, TIndex* index, TElement** element) const {
+    *element = index->offset < view.size ? page_cell<TElement>(view.pages.data(), index->offset) : nullptr;
+    if (*element != nullptr) {
+      index->generation = (*element)->generation;
+    }
+  }
+
+  static void report_read_only() {
+    LOG(ERROR) << "Snapshots are read-only, elements can't be added or removed";
+  }
+
+public:
+  snapshot_kernel_t(std::shared_ptr<version_registry_t> registry, epoch_t epoch,
+                    page_view_t edges, page_view_t faces, page_view_t vertices, page_view_t points,
+                    validation_t validation)
+    : _registry(std::move(registry))
+    , _epoch(epoch)
+    , _edges(std::move(edges))
+    , _faces(std::move(faces))
+    , _vertices(std::move(vertices))
+    , _points(std::move(points))
+    , _validator(validation, &_counters)
+  {
+    _registry->acquire(_epoch);
+  }
+
+  ~snapshot_kernel_t() override {
+    _registry->release(_epoch);
+  }
+
+  edge_t* get(edge_index_t index) override {
+    return lookup<edge_t>(_edges, index);
+  }
+  face_t* get(face_index_t index) override {
+    return lookup<face_t>(_faces, index);
+  }
+  vertex_t* get(vertex_index_t index) override {
+    return lookup<vertex_t>(_vertices, index);
+  }
+  point_t* get(point_index_t index) override {
+    return lookup<point_t>(_points, index);
+  }
+
+  edge_index_t emplace(edge_t&&) override {
+    report_read_only();
+    return edge_index_t();
+  }
+  face_index_t emplace(face_t&&) override {
+    report_read_only();
+    return face_index_t();
+  }
+  vertex_index_t emplace(vertex_t&&) override {
+    report_read_only();
+    return vertex_index_t();
+  }
+  point_index_t emplace(point_t&&) override {
+    report_read_only();
+    return point_index_t();
+  }
+
+  void remove(edge_index_t) override {
+    report_read_only();
+  }
+  void remove(face_index_t) override {
+    report_read_only();
+  }
+  void remove(vertex_index_t) override {
+    report_read_only();
+  }
+  void remove(point_index_t) override {
+    report_read_only();
+  }
+
+  bool retract(edge_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool retract(face_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool retract(vertex_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool retract(point_index_t) override {
+    report_read_only();
+    return false;
+  }
+
+  bool restore(edge_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool restore(face_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool restore(vertex_index_t) override {
+    report_read_only();
+    return false;
+  }
+  bool restore(point_index_t) override {
+    report_read_only();
+    return false;
+  }
+
+  size_t point_count() const override {
+    return _points.count;
+  }
+  size_t vertex_count() const override {
+    return _vertices.count;
+  }
+  size_t face_count() const override {
+    return _faces.count;
+  }
+  size_t edge_count() const override {
+    return _edges.count;
+  }
+
+  void reserve(size_t, size_t, size_t, size_t) override {}
+
+  remap_table_t compact() override {
+    report_read_only();
+    return remap_table_t();
+  }
+  remap_table_t reorder(const element_order_t&) override {
+    report_read_only();
+    return remap_table_t();
+  }
+
+  void resolve(edge_index_t* index, edge_t** edge) const override {
+    resolve_index(_edges, index, edge);
+  }
+  void resolve(face_index_t* index, face_t** face) const override {
+    resolve_index(_faces, index, face);
+  }
+  void resolve(point_index_t* index, point_t** point) const override {
+    resolve_index(_points, index, point);
+  }
+  void resolve(vertex_index_t* index, vertex_t** vert) const override {
+    resolve_index(_vertices, index, vert);
+  }
+
+  edge_table_t edge_table() override {
+    return edge_columns(paged_table<edge_table_t, edge_t>(_edges.pages, _edges.size, _validator, nullptr),
+                        _edges.pages, nullptr);
+  }
+  face_table_t face_table() override {
+    return face_columns(paged_table<face_table_t, face_t>(_faces.pages, _faces.size, _validator, nullptr),
+                        _faces.pages, nullptr);
+  }
+  vertex_table_t vertex_table() override {
+    return vertex_columns(paged_table<vertex_table_t, vertex_t>(_vertices.pages, _vertices.size, _validator,
+                                                                nullptr),
+                          _vertices.pages, nullptr);
+  }
+  point_table_t point_table() override {
+    return point_columns(paged_table<point_table_t, point_t>(_points.pages, _points.size, _validator, nullptr),
+                         _points.pages, nullptr);
+  }
+
+  validation_t validation() const override {
+    return _validator.validation;
+  }
+  const validation_counters_t& validation_counters() const override {
+    return _counters;
+  }
+
+  /**
+     Another view of the same epoch, it only copies the page tables.
+   */
+  kernel_t::ptr_t snapshot() override {
+    return kernel_t::ptr_t(new snapshot_kernel_t(_registry, _epoch, _edges, _faces, _vertices, _points,
+                                                 _validator.validation),
+                           [](kernel_t* k) { delete k; });
+  }
+};
+
+/**
+   Kernel that keeps its elements in pages shared with the snapshots taken
+   from it. Taking a snapshot copies the page tables and moves the writer on
+   to the next epoch; the first write to a page after that copies the page.
+   The tables are the writer of their columns, so only the pages written
+   through them get copied. get() and resolve() can't tell a read from a
+   write and copy the page they hand out.
+ */
+class versioned_kernel_t final : public kernel_t {
+  version_clock_t _clock;
+  validation_counters_t _counters;
+  validator_t _validator;
+  // Mutable since copying a shared page doesn't change what the kernel
+  // holds and resolve() is const.
+  mutable paged_store_t<edge_t, edge_index_t> _edges;
+  mutable paged_store_t<face_t, face_index_t> _faces;
+  mutable paged_store_t<vertex_t, vertex_index_t> _vertices;
+  mutable paged_store_t<point_t, point_index_t> _points;
+
+public:
+  explicit versioned_kernel_t(validation_t validation)
+    : _validator(validation, &_counters)
+    , _edges(&_clock, _validator)
+    , _faces(&_clock, _validator)
+    , _vertices(&_clock, _validator)
+    , _points(&_clock, _validator)
+  {}
+
+  edge_t* get(edge_index_t index) override {
+    return _edges.get(index);
+  }
+  face_t* get(face_index_t index) override {
+    return _faces.get(index);
+  }
+  vertex_t* get(vertex_index_t index) override {
+    return _vertices.get(index);
+  }
+  point_t* get(point_index_t index) override {
+    return _points.get(index);
+  }
+
+  edge_index_t emplace(edge_t&& edge) override {
+    return created(_edges.emplace(std::move(edge)));
+  }
+  face_index_t emplace(face_t&& face) override {
+    return created(_faces.emplace(std::move(face)));
+  }
+  vertex_index_t emplace(vertex_t&& vertex) override {
+    return created(_vertices.emplace(std::move(vertex)));
+  }
+  point_index_t emplace(point_t&& point) override {
+    return created(_points.emplace(std::move(point)));
+  }
+
+  void remove(edge_index_t index) override {
+    _edges.remove(index);
+  }
+  void remove(face_index_t index) override {
+    _faces.remove(index);
+  }
+  void remove(vertex_index_t index) override {
+    _vertices.remove(index);
+  }
+  void remove(point_index_t index) override {
+    _points.remove(index);
+  }
+
+  bool retract(edge_index_t index) override {
+    return _edges.retract(index);
+  }
+  bool retract(face_index_t index) override {
+    return _faces.retract(index);
+  }
+  bool retract(vertex_index_t index) override {
+    return _vertices.retract(index);
+  }
+  bool retract(point_index_t index) override {
+    return _points.retract(index);
+  }
+
+  bool restore(edge_index_t index) override {
+    return _edges.restore(index);
+  }
+  bool restore(face_index_t index) override {
+    return _faces.restore(index);
+  }
+  bool restore(vertex_index_t index) override {
+    return _vertices.restore(index);
+  }
+  bool restore(point_index_t index) override {
+    return _points.restore(index);
+  }
+
+  size_t point_count() const override {
+    return _points.count();
+  }
+  size_t vertex_count() const override {
+    return _vertices.count();
+  }
+  size_t face_count() const override {
+    return _faces.count();
+  }
+  size_t edge_count() const override {
+    return _edges.count();
+  }
+
+  void reserve(size_t point_count, size_t vertex_count, size_t face_count, size_t edge_count) override {
+    _points.reserve(_points.size() + point_count);
+    _vertices.reserve(_vertices.size() + vertex_count);
+    _faces.reserve(_faces.size() + face_count);
+    _edges.reserve(_edges.size() + edge_count);
+  }
+
+  remap_table_t compact() override {
+    return reorder(element_order_t());
+  }
+
+  remap_table_t reorder(const element_order_t& order) override {
+    remap_table_t remap;
+    remap.edges = _edges.reorder(order.edges);
+    remap.faces = _faces.reorder(order.faces);
+    remap.vertices = _vertices.reorder(order.vertices);
+    remap.points = _points.reorder(order.points);
+    remap_references(*this, remap);
+    return remapped(std::move(remap));
+  }
+
+  void resolve(edge_index_t* index, edge_t** edge) const override {
+    _edges.resolve(index, edge);
+  }
+  void resolve(face_index_t* index, face_t** face) const override {
+    _faces.resolve(index, face);
+  }
+  void resolve(point_index_t* index, point_t** point) const override {
+    _points.resolve(index, point);
+  }
+  void resolve(vertex_index_t* index, vertex_t** vert) const override {
+    _vertices.resolve(index, vert);
+  }
+
+  edge_table_t edge_table() override {
+    return edge_columns(paged_table<edge_table_t, edge_t>(_edges.pages(), _edges.size(), _validator, &_edges),
+                        _edges.pages(), &_edges);
+  }
+  face_table_t face_table() override {
+    return face_columns(paged_table<face_table_t, face_t>(_faces.pages(), _faces.size(), _validator, &_faces),
+                        _faces.pages(), &_faces);
+  }
+  vertex_table_t vertex_table() override {
+    return vertex_columns(paged_table<vertex_table_t, vertex_t>(_vertices.pages(), _vertices.size(), _validator,
+                                                                &_vertices),
+                          _vertices.pages(), &_vertices);
+  }
+  point_table_t point_table() override {
+    return point_columns(paged_table<point_table_t, point_t>(_points.pages(), _points.size(), _validator,
+                                                             &_points),
+                         _points.pages(), &_points);
+  }
+
+  validation_t validation() const override {
+    return _validator.validation;
+  }
+  const validation_counters_t& validation_counters() const override {
+    return _counters;
+  }
+
+  kernel_t::ptr_t snapshot() override {
+    kernel_t::ptr_t snapshot(new snapshot_kernel_t(_clock.registry, _clock.current, _edges.view(), _faces.view(),
+                                                   _vertices.view(), _points.view(), _validator.validation),
+                             [](kernel_t* k) { delete k; });
+    ++_clock.current;
+    return snapshot;
+  }
+};
+
+} // namespace
+
+kernel_t::ptr_t make_versioned_kernel(validation_t validation) {
+  return kernel_t::ptr_t(new versioned_kernel_t(validation), [](kernel_t* k) { delete k; });
+}
+
+} // namespace hedge
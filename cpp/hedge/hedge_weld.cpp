@@ -0,0 +1,402 @@
+#include "hedge.hpp"
+#include "hedge_parallel.hpp"
+
+#include <easylogging++.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace hedge {
+
+namespace {
+
+/**
+   Grid cells stay well inside of int32 so that their neighbours do too.
+ */
+const float cell_limit = 1073741824.f;
+
+struct cell_t {
+  int32_t x;
+  int32_t y;
+  int32_t z;
+
+  bool operator==(const cell_t& other) const {
+    return x == other.x && y == other.y && z == other.z;
+  }
+
+  bool operator<(const cell_t& other) const {
+    return x != other.x ? x < other.x : (y != other.y ? y < other.y : z < other.z);
+  }
+};
+
+struct record_t {
+  cell_t cell;
+  uint32_t point;
+};
+
+/**
+   Buckets the points, partitions the buckets by hash and merges every group
+   of points through a union-find whose roots only ever link to a lower
+   offset. The root of every group is its lowest offset whichever thread got
+   there first, so the outcome doesn't depend on the thread count.
+ */
+class welder_t {
+  point_table_t _points;
+  float _tolerance;
+  size_t _thread_count;
+  size_t _partition_bits;
+  std::vector<record_t> _records;
+  std::vector<size_t> _partition_begin;
+  std::vector<std::atomic<uint32_t>> _parents;
+
+  cell_t cell_of(const position_t& position) const {
+    cell_t cell;
+    int32_t* axes[] = { &cell.x, &cell.y, &cell.z };
+    for (int axis = 0; axis < 3; ++axis) {
+      if (_tolerance > 0.f) {
+        const float slot = std::floor(position[axis] / _tolerance);
+        *axes[axis] = int32_t(std::max(-cell_limit, std::min(cell_limit, slot)));
+      } else {
+        // Adding zero folds -0 into 0.
+        const float value = position[axis] + 0.f;
+        std::memcpy(axes[axis], &value, sizeof(float));
+      }
+    }
+    return cell;
+  }
+
+  size_t partition_of(const cell_t& cell) const {
+    uint64_t key = uint64_t(uint32_t(cell.x)) * 0x9E3779B1ull;
+    key ^= uint64_t(uint32_t(cell.y)) * 0x85EBCA77ull;
+    key ^= uint64_t(uint32_t(cell.z)) * 0xC2B2AE3Dull;
+    key *= 0x9E3779B97F4A7C15ull;
+    return _partition_bits ? size_t(key >> (64 - _partition_bits)) : 0;
+  }
+
+  bool is_point(size_t offset) const {
+    return _points.element[offset].status == element_status_t::ACTIVE;
+  }
+
+  bool is_close(uint32_t a, uint32_t b) const {
+    const position_t offset = _points.position[a] - _points.position[b];
+    return position_t::DotProduct(offset, offset) <= _tolerance * _tolerance;
+  }
+
+  uint32_t find(uint32_t point) {
+    for (;;) {
+      uint32_t parent = _parents[point].load();
+      if (parent == point) {
+        return point;
+      }
+      const uint32_t grandparent = _parents[parent].load();
+      if (grandparent != parent) {
+        _parents[point].compare_exchange_weak(parent, grandparent);
+      }
+      point = grandparent;
+    }
+  }
+
+  void unite(uint32_t a, uint32_t b) {
+    for (;;) {
+      a = find(a);
+      b = find(b);
+      if (a == b) {
+        return;
+      }
+      if (a > b) {
+        std::swap(a, b);
+      }
+      uint32_t expected = b;
+      if (_parents[b].compare_exchange_strong(expected, a)) {
+        return;
+      }
+    }
+  }
+
+  /**
+     Gathers the records of every chunk of points with a histogram of their
+     partitions, then lays the partitions out one after the other.
+   */
+  void bucket() {
+    const size_t partition_count = size_t(1) << _partition_bits;
+    std::vector<std::vector<record_t>> local(_thread_count);
+    std::vector<std::vector<size_t>> histograms(_thread_count, std::vector<size_t>(partition_count, 0));
+    parallel_for(_points.size, _thread_count, [&](size_t begin, size_t end, size_t chunk) {
+      for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+        if (!is_point(offset)) {
+          continue;
+        }
+        record_t record { cell_of(_points.position[offset]), uint32_t(offset) };
+        histograms[chunk][partition_of(record.cell)]++;
+        local[chunk].push_back(record);
+      }
+    });
+
+    std::vector<std::vector<size_t>> cursors(_thread_count, std::vector<size_t>(partition_count, 0));
+    _partition_begin.assign(partition_count + 1, 0);
+    size_t total = 0;
+    for (size_t partition = 0; partition < partition_count; ++partition) {
+      _partition_begin[partition] = total;
+      for (size_t chunk = 0; chunk < _thread_count; ++chunk) {
+        cursors[chunk][partition] = total;
+        total += histograms[chunk][partition];
+      }
+    }
+    _partition_begin[partition_count] = total;
+
+    _records.resize(total);
+    parallel_for(_thread_count, _thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t chunk = begin; chunk < end; ++chunk) {
+        auto& cursor = cursors[chunk];
+        for (auto& record : local[chunk]) {
+          _records[cursor[partition_of(record.cell)]++] = record;
+        }
+        local[chunk] = std::vector<record_t>();
+      }
+    });
+    parallel_for(partition_count, _thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t partition = begin; partition < end; ++partition) {
+        std::sort(_records.begin() + _partition_begin[partition], _records.begin() + _partition_begin[partition + 1],
+                  [](const record_t& a, const record_t& b) {
+                    return a.cell < b.cell || (a.cell == b.cell && a.point < b.point);
+                  });
+      }
+    });
+  }
+
+  /**
+     Unites a point with the later points of its own cell that are close
+     enough, and with those of the neighbouring cells that sort after its own
+     and come within the tolerance of it, so every pair is looked at once.
+   */
+  void match(std::vector<record_t>::const_iterator record, std::vector<record_t>::const_iterator run_end) {
+    for (auto other = record + 1; other != run_end; ++other) {
+      if (is_close(record->point, other->point)) {
+        unite(record->point, other->point);
+      }
+    }
+
+    const position_t& position = _points.position[record->point];
+    const int32_t corner[] = { record->cell.x, record->cell.y, record->cell.z };
+    for (int dx = -1; dx <= 1; ++dx) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dz = -1; dz <= 1; ++dz) {
+          const cell_t cell = { corner[0] + dx, corner[1] + dy, corner[2] + dz };
+          if (!(record->cell < cell)) {
+            continue;
+          }
+          const int steps[] = { dx, dy, dz };
+          float gap = 0.f;
+          for (int axis = 0; axis < 3; ++axis) {
+            const float lo = float(corner[axis]) * _tolerance;
+            const float d = steps[axis] < 0 ? position[axis] - lo
+                          : steps[axis] > 0 ? lo + _tolerance - position[axis] : 0.f;
+            gap += d * d;
+          }
+          if (gap > _tolerance * _tolerance) {
+            continue;
+          }
+          const size_t partition = partition_of(cell);
+          auto range = std::equal_range(_records.cbegin() + _partition_begin[partition],
+                                        _records.cbegin() + _partition_begin[partition + 1],
+                                        record_t { cell, 0 }, [](const record_t& a, const record_t& b) {
+                                          return a.cell < b.cell;
+                                        });
+          for (auto other = range.first; other != range.second; ++other) {
+            if (is_close(record->point, other->point)) {
+              unite(record->point, other->point);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  void merge() {
+    const size_t partition_count = _partition_begin.size() - 1;
+    parallel_for(partition_count, _thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t partition = begin; partition < end; ++partition) {
+        auto first = _records.cbegin() + _partition_begin[partition];
+        auto last = _records.cbegin() + _partition_begin[partition + 1];
+        for (auto run = first; run != last;) {
+          auto run_end = run + 1;
+          while (run_end != last && run_end->cell == run->cell) {
+            ++run_end;
+          }
+          if (_tolerance > 0.f) {
+            for (auto record = run; record != run_end; ++record) {
+              match(record, run_end);
+            }
+          } else {
+            // Exact cells are the positions themselves, the run is the group.
+            for (auto record = run + 1; record != run_end; ++record) {
+              _parents[record->point].store(run->point);
+            }
+          }
+          run = run_end;
+        }
+      }
+    });
+  }
+public:
+  welder_t(mesh_t& mesh, const weld_options_t& options)
+    : _points(mesh.kernel->point_table())
+    , _tolerance(options.tolerance)
+    , _thread_count(resolve_thread_count(options.thread_count))
+    , _partition_bits(0)
+    , _parents(_points.size)
+  {
+    while ((size_t(1) << _partition_bits) < _thread_count * 4) {
+      ++_partition_bits;
+    }
+  }
+
+  /**
+     The offset every point ends up merged into, itself for the ones that
+     stay.
+   */
+  std::vector<uint32_t> run() {
+    for (size_t offset = 0; offset < _points.size; ++offset) {
+      _parents[offset].store(uint32_t(offset));
+    }
+    bucket();
+    merge();
+    std::vector<uint32_t> roots(_points.size);
+    parallel_for(_points.size, _thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t offset = begin; offset < end; ++offset) {
+        roots[offset] = find(uint32_t(offset));
+      }
+    });
+    return roots;
+  }
+};
+
+} // namespace
+
+weld_report_t weld_points(mesh_t& mesh, const weld_options_t& options) {
+  weld_report_t report;
+  auto points = mesh.kernel->point_table();
+  if (points.size > UINT32_MAX) {
+    LOG(ERROR) << "Too many points to weld: " << points.size;
+    return report;
+  }
+  if (!(options.tolerance >= 0.f)) {
+    LOG(ERROR) << "Welding needs a tolerance of zero or more, got " << options.tolerance;
+    return report;
+  }
+
+  const auto roots = welder_t(mesh, options).run();
+  const size_t thread_count = resolve_thread_count(options.thread_count);
+  auto edges = mesh.kernel->edge_table();
+  auto vertices = mesh.kernel->vertex_table();
+  auto* transaction = mesh.transaction();
+
+  // The vertices of a merged group fold into the one with the lowest offset,
+  // the same single vertex per point building from indices ends up with.
+  std::vector<uint8_t> merged(points.size, 0);
+  for (size_t offset = 1; offset < points.size; ++offset) {
+    if (roots[offset] != offset) {
+      merged[roots[offset]] = 1;
+    }
+  }
+  auto root_of = [&](size_t vertex) -> uint32_t {
+    if (vertices.element[vertex].status != element_status_t::ACTIVE) {
+      return 0;
+    }
+    auto pindex = vertices.point_index[vertex];
+    return points.contains(pindex) && merged[roots[pindex.offset]] ? roots[pindex.offset] : 0;
+  };
+  std::vector<std::atomic<uint32_t>> owners(points.size);
+  for (auto& owner : owners) {
+    owner.store(UINT32_MAX);
+  }
+  parallel_for(vertices.size, thread_count, [&](size_t begin, size_t end, size_t) {
+    for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+      if (auto root = root_of(offset)) {
+        uint32_t owner = owners[root].load();
+        while (offset < owner && !owners[root].compare_exchange_weak(owner, uint32_t(offset))) {}
+      }
+    }
+  });
+  auto owner_of = [&](offset_t vertex) -> offset_t {
+    auto root = root_of(vertex);
+    return root ? offset_t(owners[root].load()) : vertex;
+  };
+
+  // Edges move over to the owners first, then the owners over to the root
+  // points, so no write depends on another.
+  auto rewrite_edge = [&](offset_t offset) {
+    if (edges.element[offset].status != element_status_t::ACTIVE) {
+      return;
+    }
+    auto vindex = edges.vertex_index[offset];
+    if (!vertices.contains(vindex)) {
+      return;
+    }
+    const offset_t owner = owner_of(vindex.offset);
+    if (owner != vindex.offset) {
+      if (transaction != nullptr) {
+        transaction->touch(edge_index_t(offset, edges.element[offset].generation));
+      }
+      edges.vertex_index.writable(offset) = vertex_index_t(owner, vertices.element[owner].generation);
+    }
+  };
+  auto rewrite_vertex = [&](offset_t offset) {
+    auto root = root_of(offset);
+    if (!root || owners[root].load() != offset || vertices.point_index[offset].offset == root) {
+      return;
+    }
+    if (transaction != nullptr) {
+      transaction->touch(vertex_index_t(offset, vertices.element[offset].generation));
+    }
+    vertices.point_index.writable(offset) = point_index_t(root, points.element[root].generation);
+  };
+  if (transaction != nullptr) {
+    for (offset_t offset = 1; offset < edges.size; ++offset) {
+      rewrite_edge(offset);
+    }
+    for (offset_t offset = 1; offset < vertices.size; ++offset) {
+      rewrite_vertex(offset);
+    }
+  } else {
+    // Threads must not race to copy the same shared page.
+    edges.make_writable();
+    vertices.make_writable();
+    parallel_for(edges.size, thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+        rewrite_edge(offset_t(offset));
+      }
+    });
+    parallel_for(vertices.size, thread_count, [&](size_t begin, size_t end, size_t) {
+      for (size_t offset = std::max<size_t>(begin, 1); offset < end; ++offset) {
+        rewrite_vertex(offset_t(offset));
+      }
+    });
+  }
+
+  auto remove = [&](auto index) {
+    if (transaction != nullptr) {
+      transaction->remove(index);
+    } else {
+      mesh.kernel->remove(index);
+    }
+  };
+  for (offset_t offset = 1; offset < vertices.size; ++offset) {
+    if (owner_of(offset) != offset) {
+      remove(vertex_index_t(offset, vertices.element[offset].generation));
+      ++report.merged_vertices;
+    }
+  }
+  for (offset_t offset = 1; offset < roots.size(); ++offset) {
+    if (roots[offset] != offset && points.element[offset].status == element_status_t::ACTIVE) {
+      remove(point_index_t(offset, points.element[offset].generation));
+      ++report.merged_points;
+    }
+  }
+  return report;
+}
+
+} // namespace hedge